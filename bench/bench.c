@@ -0,0 +1,379 @@
+#include "bench.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __OPTIMIZE__
+#define BENCH_OPTIMIZED true
+#else
+#define BENCH_OPTIMIZED false
+#endif
+
+double bench_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int compare_seconds(const void *a, const void *b)
+{
+  double lhs = *(const double *)a;
+  double rhs = *(const double *)b;
+  return (lhs > rhs) - (lhs < rhs);
+}
+
+bool bench_measure(const bench_settings *settings, bench_fn fn, void *context,
+                   bench_result *result)
+{
+  uint32_t iterations = settings->iterations ? settings->iterations : 1;
+  double *samples = (double *)malloc(iterations * sizeof(double));
+  if (samples == NULL)
+    return false;
+
+  uint64_t work = 0;
+  double warmup_start = bench_now();
+  for (uint32_t run = 0; run < settings->warmup; run++)
+  {
+    work = fn(context);
+    if (work == 0)
+      goto failed;
+
+    // A single slow warm-up run is enough to fault everything in.
+    if (settings->max_seconds > 0.0 &&
+        bench_now() - warmup_start > settings->max_seconds / 4)
+      break;
+  }
+
+  uint32_t count = 0;
+  double total = 0.0;
+  while (count < iterations)
+  {
+    double start = bench_now();
+    uint64_t done = fn(context);
+    double elapsed = bench_now() - start;
+
+    if (done == 0 || (work != 0 && done != work))
+      goto failed;
+
+    work = done;
+    samples[count++] = elapsed;
+    total += elapsed;
+
+    if (settings->max_seconds > 0.0 && total > settings->max_seconds &&
+        count >= BENCH_MIN_ITERATIONS)
+      break;
+  }
+
+  qsort(samples, count, sizeof(double), compare_seconds);
+
+  result->work = work;
+  result->iterations = count;
+  result->min_seconds = samples[0];
+  result->mean_seconds = total / count;
+  result->median_seconds =
+      (count % 2) ? samples[count / 2]
+                  : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+
+  // Nearest rank: the smallest sample at or above 99% of the runs.
+  size_t rank = (size_t)ceil(0.99 * count);
+  result->p99_seconds = samples[rank - 1];
+
+  result->throughput = (result->median_seconds > 0.0)
+                           ? (double)work / result->median_seconds / 1e6
+                           : 0.0;
+
+  free(samples);
+  return true;
+
+failed:
+  free(samples);
+  return false;
+}
+
+bool bench_report_add(bench_report *report, const bench_result *result)
+{
+  if (report->count == report->capacity)
+  {
+    size_t capacity = report->capacity ? report->capacity * 2 : 64;
+    bench_result *results =
+        (bench_result *)realloc(report->results, capacity * sizeof(bench_result));
+    if (results == NULL)
+      return false;
+
+    report->results = results;
+    report->capacity = capacity;
+  }
+
+  report->results[report->count++] = *result;
+  return true;
+}
+
+void bench_report_free(bench_report *report)
+{
+  free(report->results);
+  report->results = NULL;
+  report->count = 0;
+  report->capacity = 0;
+}
+
+static const char *unit_name(bench_unit unit)
+{
+  return (unit == BENCH_UNIT_BYTES) ? "MB/s" : "Mpixels/s";
+}
+
+/**
+ * Encoded length as a percentage of the BMP length, 0 when the benchmark does not
+ * compress.
+ */
+static double compression_percent(const bench_result *result)
+{
+  return result->bmp_bytes ? 100.0 * (double)result->encoded_bytes / result->bmp_bytes
+                           : 0.0;
+}
+
+static void write_text(FILE *file, const bench_report *report,
+                       const bench_settings *settings)
+{
+  fprintf(file, "# matrix_bench: kernels %s, %u warm-up + %u runs%s\n",
+          convert_kernel_name(get_convert_kernel_level()), settings->warmup,
+          settings->iterations, BENCH_OPTIMIZED ? "" : ", UNOPTIMIZED BUILD");
+  fprintf(file, "%-30s %-22s %11s %6s %11s %11s %13s\n", "benchmark", "variant",
+          "resolution", "runs", "median ms", "p99 ms", "throughput");
+
+  for (size_t index = 0; index < report->count; index++)
+  {
+    const bench_result *result = &report->results[index];
+    char resolution[16];
+    snprintf(resolution, sizeof(resolution), "%ux%u", result->horizontal,
+             result->vertical);
+
+    fprintf(file, "%-30s %-22s %11s %6u %11.3f %11.3f %13.1f %s", result->name,
+            result->variant, resolution, result->iterations,
+            result->median_seconds * 1e3, result->p99_seconds * 1e3, result->throughput,
+            unit_name(result->unit));
+    if (result->bmp_bytes)
+      fprintf(file, "  %llu of %llu BMP bytes (%.1f%%)",
+              (unsigned long long)result->encoded_bytes,
+              (unsigned long long)result->bmp_bytes, compression_percent(result));
+    fputc('\n', file);
+  }
+}
+
+static void write_csv(FILE *file, const bench_report *report)
+{
+  fprintf(file, "benchmark,variant,width,height,unit,work,runs,median_ms,p99_ms,"
+                "min_ms,mean_ms,throughput,encoded_bytes,bmp_bytes\n");
+
+  for (size_t index = 0; index < report->count; index++)
+  {
+    const bench_result *result = &report->results[index];
+    fprintf(file, "%s,%s,%u,%u,%s,%llu,%u,%.6f,%.6f,%.6f,%.6f,%.3f,%llu,%llu\n",
+            result->name, result->variant, result->horizontal, result->vertical,
+            unit_name(result->unit), (unsigned long long)result->work,
+            result->iterations, result->median_seconds * 1e3,
+            result->p99_seconds * 1e3, result->min_seconds * 1e3,
+            result->mean_seconds * 1e3, result->throughput,
+            (unsigned long long)result->encoded_bytes,
+            (unsigned long long)result->bmp_bytes);
+  }
+}
+
+static void write_json(FILE *file, const bench_report *report,
+                       const bench_settings *settings)
+{
+  fprintf(file, "{\n");
+  fprintf(file, "  \"kernels\": \"%s\",\n",
+          convert_kernel_name(get_convert_kernel_level()));
+  fprintf(file, "  \"optimized\": %s,\n", BENCH_OPTIMIZED ? "true" : "false");
+  fprintf(file, "  \"warmup\": %u,\n", settings->warmup);
+  fprintf(file, "  \"iterations\": %u,\n", settings->iterations);
+  fprintf(file, "  \"results\": [");
+
+  for (size_t index = 0; index < report->count; index++)
+  {
+    const bench_result *result = &report->results[index];
+    fprintf(file,
+            "%s\n    {\"benchmark\": \"%s\", \"variant\": \"%s\", \"width\": %u, "
+            "\"height\": %u, \"unit\": \"%s\", \"work\": %llu, \"runs\": %u, "
+            "\"median_ms\": %.6f, \"p99_ms\": %.6f, \"min_ms\": %.6f, "
+            "\"mean_ms\": %.6f, \"throughput\": %.3f",
+            index ? "," : "", result->name, result->variant, result->horizontal,
+            result->vertical, unit_name(result->unit), (unsigned long long)result->work,
+            result->iterations, result->median_seconds * 1e3,
+            result->p99_seconds * 1e3, result->min_seconds * 1e3,
+            result->mean_seconds * 1e3, result->throughput);
+    if (result->bmp_bytes)
+      fprintf(file, ", \"encoded_bytes\": %llu, \"bmp_bytes\": %llu",
+              (unsigned long long)result->encoded_bytes,
+              (unsigned long long)result->bmp_bytes);
+    fputc('}', file);
+  }
+
+  fprintf(file, "%s]\n}\n", report->count ? "\n  " : "");
+}
+
+void bench_report_write(FILE *file, const bench_report *report,
+                        bench_output_format format, const bench_settings *settings)
+{
+  switch (format)
+  {
+  case BENCH_OUTPUT_CSV:
+    write_csv(file, report);
+    break;
+  case BENCH_OUTPUT_JSON:
+    write_json(file, report, settings);
+    break;
+  default:
+    write_text(file, report, settings);
+    break;
+  }
+}
+
+static uint32_t xorshift32(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+#define SYNTHETIC_BLOCKS 3
+
+void bench_synthesize_frame(matrix *mat, uint32_t seed, uint32_t frame_index)
+{
+  uint32_t width = mat->horizontal;
+  uint32_t height = mat->vertical;
+  uint32_t span_x = (width > 1) ? width - 1 : 1;
+  uint32_t span_y = (height > 1) ? height - 1 : 1;
+
+  for (uint32_t row = 0; row < height; row++)
+  {
+    uint32_t state = (seed ^ (row * 0x9E3779B9u)) | 1u;
+    uint16_t *pixels = mat->mem + calculate_offset(mat, (uint16_t)row, 0);
+    uint32_t green = row * 63 / span_y;
+
+    for (uint32_t column = 0; column < width; column++)
+    {
+      uint32_t red = column * 31 / span_x;
+      uint32_t blue = (column + row) * 31 / (span_x + span_y);
+
+      // Sensor noise flips the lowest bit of every channel now and then.
+      uint32_t noise = xorshift32(&state);
+      uint16_t pixel = (uint16_t)((red << 11) | (green << 5) | blue);
+      pixels[column] = pixel ^ (uint16_t)(noise & 0x0821u & (noise >> 16));
+    }
+  }
+
+  // Flat blocks drift right and down by 1/64 of the frame per frame.
+  uint32_t block_w = width / 8 ? width / 8 : 1;
+  uint32_t block_h = height / 8 ? height / 8 : 1;
+  static const uint16_t colors[SYNTHETIC_BLOCKS] = {0xF800, 0x07E0, 0xFFE0};
+  for (uint32_t block = 0; block < SYNTHETIC_BLOCKS; block++)
+  {
+    uint32_t x0 = (block * width / SYNTHETIC_BLOCKS + frame_index * width / 64) % width;
+    uint32_t y0 =
+        (block * height / SYNTHETIC_BLOCKS + frame_index * height / 64) % height;
+    fill_clipped_rect(mat, colors[block], (int32_t)y0, (int32_t)(y0 + block_h - 1),
+                      (int32_t)x0, (int32_t)(x0 + block_w - 1));
+  }
+}
+
+static void expand_rgb565(uint16_t pixel, int32_t *red, int32_t *green, int32_t *blue)
+{
+  uint16_t r = pixel >> 11, g = (pixel >> 5) & 0x3F, b = pixel & 0x1F;
+  *red = (r << 3) | (r >> 2);
+  *green = (g << 2) | (g >> 4);
+  *blue = (b << 3) | (b >> 2);
+}
+
+static uint8_t clamp_byte(int32_t value)
+{
+  return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+/**
+ * Pack a pair of pixels as Y0 U Y1 V, BT.601 limited range, with the chroma of the
+ * pair averaged.
+ */
+static void pack_yuyv_pair(uint16_t first, uint16_t second, uint8_t *dst)
+{
+  int32_t r0, g0, b0, r1, g1, b1;
+  expand_rgb565(first, &r0, &g0, &b0);
+  expand_rgb565(second, &r1, &g1, &b1);
+
+  int32_t r = (r0 + r1) / 2, g = (g0 + g1) / 2, b = (b0 + b1) / 2;
+  dst[0] = clamp_byte(((66 * r0 + 129 * g0 + 25 * b0 + 128) >> 8) + 16);
+  dst[1] = clamp_byte(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+  dst[2] = clamp_byte(((66 * r1 + 129 * g1 + 25 * b1 + 128) >> 8) + 16);
+  dst[3] = clamp_byte(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+void bench_pack_raw_row(raw_pixel_format format, const uint16_t *src, uint16_t *dst,
+                        size_t count)
+{
+  if (format == RAW_FORMAT_YUYV)
+  {
+    for (size_t index = 0; index + 1 < count; index += 2)
+      pack_yuyv_pair(src[index], src[index + 1], (uint8_t *)&dst[index]);
+    return;
+  }
+
+  for (size_t index = 0; index < count; index++)
+  {
+    uint16_t pixel = src[index];
+    uint16_t red = pixel >> 11, green = (pixel >> 5) & 0x3F, blue = pixel & 0x1F;
+
+    switch (format)
+    {
+    case RAW_FORMAT_RGB565_SWAPPED:
+      dst[index] = (uint16_t)((pixel << 8) | (pixel >> 8));
+      break;
+    case RAW_FORMAT_BGR565:
+      dst[index] = (uint16_t)((blue << 11) | (green << 5) | red);
+      break;
+    case RAW_FORMAT_RGB555:
+      dst[index] = (uint16_t)((red << 10) | ((green >> 1) << 5) | blue);
+      break;
+    default:
+      dst[index] = pixel;
+      break;
+    }
+  }
+}
+
+bool bench_write_raw_file(const char *filepath, matrix *const *frames, size_t frame_count,
+                          raw_pixel_format format)
+{
+  FILE *file_ptr = fopen(filepath, "wb");
+  if (file_ptr == NULL)
+    return false;
+
+  bool success = true;
+  uint16_t *row = NULL;
+  if (frame_count > 0)
+  {
+    row = (uint16_t *)malloc((size_t)frames[0]->horizontal * sizeof(uint16_t));
+    success = (row != NULL);
+  }
+
+  for (size_t frame = 0; success && frame < frame_count; frame++)
+  {
+    matrix *mat = frames[frame];
+    for (uint32_t index = 0; success && index < mat->vertical; index++)
+    {
+      const uint16_t *pixels = mat->mem + calculate_offset(mat, (uint16_t)index, 0);
+      bench_pack_raw_row(format, pixels, row, mat->horizontal);
+      success =
+          fwrite(row, sizeof(uint16_t), mat->horizontal, file_ptr) == mat->horizontal;
+    }
+  }
+
+  free(row);
+  if (fclose(file_ptr) != 0)
+    success = false;
+  return success;
+}
@@ -0,0 +1,212 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "convert.h"
+#include "matrix.h"
+
+/**
+ * @brief What the work count returned by a benchmark body measures.
+ */
+typedef enum bench_unit
+{
+  /**
+   * @brief Bytes read or written. Reported in MB/s (10^6 bytes per second).
+   */
+  BENCH_UNIT_BYTES,
+
+  /**
+   * @brief Pixels processed. Reported in Mpixels/s (10^6 pixels per second).
+   */
+  BENCH_UNIT_PIXELS
+} bench_unit;
+
+/**
+ * @brief Layouts of a machine readable report.
+ */
+typedef enum bench_output_format
+{
+  BENCH_OUTPUT_TEXT,
+  BENCH_OUTPUT_CSV,
+  BENCH_OUTPUT_JSON
+} bench_output_format;
+
+/**
+ * @brief How often every benchmark body is run.
+ */
+typedef struct bench_settings
+{
+  /**
+   * @brief Untimed runs before measuring, to fault in pages and warm caches.
+   */
+  uint32_t warmup;
+
+  /**
+   * @brief Timed runs per benchmark.
+   */
+  uint32_t iterations;
+
+  /**
+   * @brief Stop measuring a benchmark once its timed runs add up to this many
+   * seconds, provided BENCH_MIN_ITERATIONS runs were made. 0 disables the limit.
+   */
+  double max_seconds;
+} bench_settings;
+
+/**
+ * @brief Fewest timed runs kept when max_seconds cuts a benchmark short.
+ */
+#define BENCH_MIN_ITERATIONS 3
+
+/**
+ * @brief Summary of the timed runs of one benchmark.
+ */
+typedef struct bench_result
+{
+  const char *name;
+  char variant[48];
+
+  uint16_t horizontal;
+  uint16_t vertical;
+
+  bench_unit unit;
+
+  /**
+   * @brief Bytes or pixels processed by a single run.
+   */
+  uint64_t work;
+
+  uint32_t iterations;
+
+  double median_seconds;
+  double p99_seconds;
+  double min_seconds;
+  double mean_seconds;
+
+  /**
+   * @brief Work per second at the median run time, in millions of units.
+   */
+  double throughput;
+
+  /**
+   * @brief For benchmarks that compress a frame, the encoded length of the last run
+   * and the length of the same frame as a 16-bit BMP file; both 0 otherwise. Reported
+   * as a compression ratio.
+   */
+  uint64_t encoded_bytes;
+  uint64_t bmp_bytes;
+} bench_result;
+
+/**
+ * @brief Growable list of results written out together once every benchmark ran.
+ */
+typedef struct bench_report
+{
+  bench_result *results;
+  size_t count;
+  size_t capacity;
+} bench_report;
+
+/**
+ * @brief Body of a benchmark. Returns the bytes or pixels it processed, 0 on failure.
+ */
+typedef uint64_t (*bench_fn)(void *context);
+
+/**
+ * @brief Monotonic clock, in seconds.
+ *
+ * @return double
+ */
+double bench_now(void);
+
+/**
+ * @brief Run fn settings->warmup times untimed, then time up to settings->iterations
+ * runs and summarize them into result. The name, variant and dimensions of result are
+ * left to the caller.
+ *
+ * Returns true on success, false if any run of fn failed or returned a different
+ * amount of work.
+ *
+ * @param settings Run counts.
+ * @param fn Benchmark body.
+ * @param context Passed to fn.
+ * @param result Receives the statistics.
+ * @return bool
+ */
+bool bench_measure(const bench_settings *settings, bench_fn fn, void *context,
+                   bench_result *result);
+
+/**
+ * @brief Append a copy of result to report.
+ *
+ * Returns true on success, false otherwise.
+ *
+ * @param report Pointer to a report, zero initialized before first use.
+ * @param result Result to append.
+ * @return bool
+ */
+bool bench_report_add(bench_report *report, const bench_result *result);
+
+/**
+ * @brief Release the storage of a report.
+ *
+ * @param report Pointer to a report.
+ */
+void bench_report_free(bench_report *report);
+
+/**
+ * @brief Write every result of a report as an aligned table, CSV with a header row,
+ * or a JSON document.
+ *
+ * @param file Destination stream.
+ * @param report Results to write.
+ * @param format Layout of the report.
+ * @param settings Settings the results were measured with.
+ */
+void bench_report_write(FILE *file, const bench_report *report,
+                        bench_output_format format, const bench_settings *settings);
+
+/**
+ * @brief Fill mat with a synthetic camera frame: smooth gradients with sensor noise in
+ * the low bits and a few flat blocks that move with frame_index, so consecutive frames
+ * differ the way a static scene with moving objects does.
+ *
+ * The same seed, dimensions and frame_index always produce the same frame.
+ *
+ * @param mat Matrix to fill.
+ * @param seed Seed of the noise.
+ * @param frame_index Position of the frame in a synthetic video.
+ */
+void bench_synthesize_frame(matrix *mat, uint32_t seed, uint32_t frame_index);
+
+/**
+ * @brief Pack RGB565 pixels into a RAW pixel layout, the inverse of
+ * raw_to_rgb565_row. count must be even for RAW_FORMAT_YUYV.
+ *
+ * @param format Layout to produce.
+ * @param src RGB565 pixels.
+ * @param dst Receives count two-byte pixels.
+ * @param count Number of pixels.
+ */
+void bench_pack_raw_row(raw_pixel_format format, const uint16_t *src, uint16_t *dst,
+                        size_t count);
+
+/**
+ * @brief Write frames back to back into a headerless RAW file of the given layout.
+ *
+ * Returns true on success, false otherwise.
+ *
+ * @param filepath File to create.
+ * @param frames Frames to write, all of the same dimensions.
+ * @param frame_count Number of frames.
+ * @param format Pixel layout of the file.
+ * @return bool
+ */
+bool bench_write_raw_file(const char *filepath, matrix *const *frames, size_t frame_count,
+                          raw_pixel_format format);
+
+#endif
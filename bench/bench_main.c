@@ -0,0 +1,1478 @@
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "async_writer.h"
+#include "batch.h"
+#include "bench.h"
+#include "bitmap.h"
+#include "convert.h"
+#include "matrix.h"
+#include "pool.h"
+#include "ppm.h"
+#include "qoi.h"
+#include "resample.h"
+#include "shapes.h"
+#include "stream.h"
+#include "transform.h"
+
+#define BENCH_SEED 0x5EED565u
+#define BENCH_VIDEO_FRAMES 4
+#define BENCH_MAX_LIST 16
+#define BENCH_STRIPE_SIZE (size_t)(1 << 20)
+#define BENCH_PATH_SIZE 512
+
+typedef struct bench_resolution
+{
+  const char *name;
+  uint16_t horizontal;
+  uint16_t vertical;
+} bench_resolution;
+
+static const bench_resolution resolutions[] = {
+    {"qvga", 320, 240},    {"vga", 640, 480},    {"720p", 1280, 720},
+    {"1080p", 1920, 1080}, {"4k", 3840, 2160},   {"8k", 7680, 4320},
+};
+
+#define RESOLUTION_COUNT (sizeof(resolutions) / sizeof(resolutions[0]))
+
+/**
+ * Everything the benchmarks of one resolution share: synthetic frames, the files
+ * generated from them and preallocated destinations, so the timed bodies only run
+ * the entry point they measure.
+ */
+typedef struct bench_fixture
+{
+  uint16_t horizontal;
+  uint16_t vertical;
+  uint64_t pixels;
+
+  char dir[BENCH_PATH_SIZE];
+  char raw_path[RAW_FORMAT_YUYV + 1][BENCH_PATH_SIZE];
+  char video_path[BENCH_PATH_SIZE];
+  char rgb888_path[BENCH_PATH_SIZE];
+  char ppm_path[BENCH_PATH_SIZE];
+  char bmp_path[BENCH_PATH_SIZE];
+  char update_path[BENCH_PATH_SIZE];
+  char qoi_path[BENCH_PATH_SIZE];
+  char archive_path[BENCH_PATH_SIZE];
+  char output_path[BENCH_PATH_SIZE];
+  char output_dir[BENCH_PATH_SIZE];
+
+  matrix *frames[BENCH_VIDEO_FRAMES];
+  matrix *scratch;
+  matrix *tracked;
+  matrix *rotated;
+  matrix *half;
+  matrix *downscaled[3];
+
+  /**
+   * The first frame stored in every matrix_layout, indexed by layout.
+   */
+  matrix *layouts[3];
+
+  uint8_t *rgb888;
+  uint8_t *bgra;
+  uint8_t *encoded;
+  size_t encoded_capacity;
+  uint8_t *stripe;
+  uint8_t *qoi;
+  size_t qoi_length;
+
+  /**
+   * Encoded length of the last run of a compressing benchmark, 0 for the others.
+   */
+  uint64_t encoded_bytes;
+
+  rgb565_pixel_code *pixel_list;
+  size_t pixel_capacity;
+
+  bmp_encoder *encoders[3];
+  matrix_pool *pool;
+  async_bmp_writer *writers[2];
+  batch_job_list jobs;
+} bench_fixture;
+
+/**
+ * Parameters of one variant of a benchmark.
+ */
+typedef struct bench_params
+{
+  uint32_t option;
+  uint16_t pt_size;
+  uint32_t density;
+} bench_params;
+
+#define BENCH_AXIS_PT_SIZE 0x01
+#define BENCH_AXIS_DENSITY 0x02
+
+typedef struct bench_case
+{
+  const char *name;
+  bench_unit unit;
+
+  /**
+   * Combination of BENCH_AXIS_* flags: the benchmark runs once per pt_size and/or
+   * draw density given on the command line.
+   */
+  uint32_t axes;
+
+  /**
+   * NULL terminated names of the options the benchmark runs once for each, or NULL.
+   */
+  const char *const *options;
+
+  uint64_t (*run)(bench_fixture *fixture, const bench_params *params);
+} bench_case;
+
+static const char *const raw_format_options[] = {"rgb565", "rgb565be", "bgr565", "rgb555",
+                                                 "yuyv", NULL};
+static const char *const bmp_format_options[] = {"rgb565", "bgr888", "bgra8888", NULL};
+static const char *const dither_options[] = {"none", "4x4", "8x8", NULL};
+static const char *const factor_options[] = {"1/2", "1/4", "1/8", NULL};
+static const char *const bilinear_options[] = {"down2", "up2", NULL};
+static const char *const transform_options[] = {"rotate90",       "rotate180",
+                                                "rotate270",      "flip_horizontal",
+                                                "flip_vertical",  "transpose",
+                                                NULL};
+static const char *const in_place_options[] = {"rotate180", "flip_horizontal",
+                                               "flip_vertical", NULL};
+static const matrix_transform in_place_transforms[] = {
+    TRANSFORM_ROTATE_180, TRANSFORM_FLIP_HORIZONTAL, TRANSFORM_FLIP_VERTICAL};
+static const char *const backend_options[] = {"io_uring", "threads", NULL};
+static const char *const layout_options[] = {"row_major", "tiled8x8", "tiled16x16", NULL};
+static const char *const layout_conversion_options[] = {
+    "to_tiled8x8", "to_tiled16x16", "from_tiled8x8", "from_tiled16x16", NULL};
+
+static uint32_t next_random(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static uint64_t frame_bytes(const bench_fixture *fixture)
+{
+  return fixture->pixels * sizeof(uint16_t);
+}
+
+static uint64_t mat_ok(mat_fn_status status, uint64_t work)
+{
+  return (status == VALID_OP) ? work : 0;
+}
+
+/* Reading and ingest */
+
+static uint64_t run_read_binary_file(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  return mat_ok(read_binary_file(f->scratch, f->raw_path[RAW_FORMAT_RGB565]),
+                frame_bytes(f));
+}
+
+static uint64_t run_read_binary_file_format(bench_fixture *f, const bench_params *p)
+{
+  return mat_ok(read_binary_file_format(f->scratch, f->raw_path[p->option],
+                                        (raw_pixel_format)p->option),
+                frame_bytes(f));
+}
+
+static uint64_t run_read_binary_frame(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  FILE *file_ptr = fopen(f->video_path, "rb");
+  if (file_ptr == NULL)
+    return 0;
+
+  uint64_t work = frame_bytes(f) * BENCH_VIDEO_FRAMES;
+  for (int frame = 0; frame < BENCH_VIDEO_FRAMES && work; frame++)
+    if (read_binary_frame(f->scratch, file_ptr) != VALID_OP)
+      work = 0;
+
+  fclose(file_ptr);
+  return work;
+}
+
+static uint64_t run_map_binary_file(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  matrix *mat = map_binary_file(f->raw_path[RAW_FORMAT_RGB565], f->horizontal,
+                                f->vertical, 0);
+  if (mat == NULL)
+    return 0;
+
+  // Touch every pixel so the pages are actually read in.
+  uint32_t sum = 0;
+  for (uint32_t index = 0; index < mat->size; index++)
+    sum += mat->mem[index];
+
+  static volatile uint32_t sink;
+  sink = sum;
+  (void)sink;
+
+  deallocate_matrix(mat);
+  return frame_bytes(f);
+}
+
+static uint64_t run_read_rgb888_file(bench_fixture *f, const bench_params *p)
+{
+  return mat_ok(read_rgb888_file(f->scratch, f->rgb888_path, (rgb565_dither)p->option),
+                f->pixels * 3);
+}
+
+static uint64_t run_read_ppm_file(bench_fixture *f, const bench_params *p)
+{
+  matrix *mat = read_ppm_file(f->ppm_path, (rgb565_dither)p->option);
+  if (mat == NULL)
+    return 0;
+
+  deallocate_matrix(mat);
+  return f->pixels * 3;
+}
+
+static uint64_t run_import_rgb888_frame(bench_fixture *f, const bench_params *p)
+{
+  return mat_ok(import_rgb888_frame(f->scratch, f->rgb888, (size_t)f->horizontal * 3,
+                                    (rgb565_dither)p->option),
+                f->pixels * 3);
+}
+
+static uint64_t run_read_rgb565_bmpfile(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  matrix *mat = read_rgb565_bmpfile(f->bmp_path);
+  if (mat == NULL)
+    return 0;
+
+  deallocate_matrix(mat);
+  return f->pixels;
+}
+
+static uint64_t run_read_qoi_file(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  matrix *mat = read_qoi_file(f->qoi_path);
+  if (mat == NULL)
+    return 0;
+
+  deallocate_matrix(mat);
+  return f->pixels;
+}
+
+static uint64_t run_decode_qoi(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  matrix *mat = decode_qoi(f->qoi, f->qoi_length);
+  if (mat == NULL)
+    return 0;
+
+  deallocate_matrix(mat);
+  return f->pixels;
+}
+
+static uint64_t run_frame_archive_read_frame(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  frame_archive_reader *reader = open_frame_archive(f->archive_path);
+  if (reader == NULL)
+    return 0;
+
+  uint64_t work = f->pixels * BENCH_VIDEO_FRAMES;
+  for (uint64_t frame = 0; frame < BENCH_VIDEO_FRAMES && work; frame++)
+    if (frame_archive_read_frame(reader, frame, f->scratch) != VALID_OP)
+      work = 0;
+
+  close_frame_archive_reader(reader);
+  return work;
+}
+
+/* Drawing */
+
+static uint64_t run_zero_matrix(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  return mat_ok(zero_matrix(f->scratch), frame_bytes(f));
+}
+
+static uint64_t run_fill_matrix(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  return mat_ok(fill_matrix(f->scratch, 0x7BEF), frame_bytes(f));
+}
+
+static uint64_t run_matrix_pool_acquire(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  matrix *mat = matrix_pool_acquire(f->pool, MATRIX_INIT_ZERO, 0);
+  if (mat == NULL)
+    return 0;
+
+  return mat_ok(matrix_pool_release(f->pool, mat), frame_bytes(f));
+}
+
+static size_t pixel_count(const bench_fixture *f, const bench_params *p)
+{
+  size_t count = (size_t)(f->pixels * p->density / 100);
+  return count ? count : 1;
+}
+
+static uint64_t run_write_rgb565_pixel_code(bench_fixture *f, const bench_params *p)
+{
+  size_t count = pixel_count(f, p);
+  for (size_t index = 0; index < count; index++)
+  {
+    const rgb565_pixel_code *pixel = &f->pixel_list[index];
+    if (write_rgb565_pixel_code(f->scratch, pixel->color, pixel->row, pixel->column) !=
+        VALID_OP)
+      return 0;
+  }
+
+  return count;
+}
+
+static uint64_t run_write_rgb565_pixel_rgb(bench_fixture *f, const bench_params *p)
+{
+  size_t count = pixel_count(f, p);
+  for (size_t index = 0; index < count; index++)
+  {
+    const rgb565_pixel_code *pixel = &f->pixel_list[index];
+    if (write_rgb565_pixel_rgb(f->scratch, pixel->color >> 11, (pixel->color >> 5) & 0x3F,
+                               pixel->color & 0x1F, pixel->row,
+                               pixel->column) != VALID_OP)
+      return 0;
+  }
+
+  return count;
+}
+
+static uint64_t run_write_rgb565_pixels_code(bench_fixture *f, const bench_params *p)
+{
+  size_t count = pixel_count(f, p);
+  return mat_ok(write_rgb565_pixels_code(f->scratch, f->pixel_list, count,
+                                         PIXEL_BATCH_VALIDATE),
+                count);
+}
+
+/**
+ * Distance between parallel strokes so that strokes of the given width cover about
+ * density percent of the frame.
+ */
+static uint32_t stroke_spacing(uint32_t band, uint32_t density)
+{
+  uint32_t spacing = band * 100 / density;
+  return (spacing > band) ? spacing : band + 1;
+}
+
+static uint64_t draw_horizontal_lines(matrix *target, const bench_fixture *f,
+                                      const bench_params *p)
+{
+  uint32_t reach = p->pt_size - 1u, band = 2 * reach + 1;
+  uint32_t spacing = stroke_spacing(band, p->density);
+
+  uint64_t work = 0;
+  for (uint32_t row = reach; row + reach < f->vertical; row += spacing)
+  {
+    if (draw_horizontal_line(target, 0xF81F, p->pt_size, (uint16_t)row, 0,
+                             f->horizontal - 1) != VALID_OP)
+      return 0;
+    work += (uint64_t)band * f->horizontal;
+  }
+
+  return work;
+}
+
+static uint64_t run_draw_horizontal_line(bench_fixture *f, const bench_params *p)
+{
+  return draw_horizontal_lines(f->scratch, f, p);
+}
+
+static uint64_t draw_vertical_lines(matrix *target, const bench_fixture *f,
+                                    const bench_params *p)
+{
+  uint32_t reach = p->pt_size - 1u, band = 2 * reach + 1;
+  uint32_t spacing = stroke_spacing(band, p->density);
+
+  uint64_t work = 0;
+  for (uint32_t column = reach; column + reach < f->horizontal; column += spacing)
+  {
+    if (draw_vertical_line(target, 0x07FF, p->pt_size, (uint16_t)column, 0,
+                           f->vertical - 1) != VALID_OP)
+      return 0;
+    work += (uint64_t)band * f->vertical;
+  }
+
+  return work;
+}
+
+static uint64_t run_draw_vertical_line(bench_fixture *f, const bench_params *p)
+{
+  return draw_vertical_lines(f->scratch, f, p);
+}
+
+static uint64_t draw_rectangles(matrix *target, const bench_fixture *f,
+                                const bench_params *p)
+{
+  int64_t reach = p->pt_size - 1, band = 2 * reach + 1;
+  int64_t spacing = stroke_spacing((uint32_t)band, p->density);
+
+  // Concentric outlines, each inset by spacing from the previous one.
+  uint64_t work = 0;
+  for (int64_t inset = reach;; inset += spacing)
+  {
+    int64_t x0 = inset, y0 = inset;
+    int64_t x1 = f->horizontal - 1 - inset, y1 = f->vertical - 1 - inset;
+    if (x1 - x0 <= 2 * band || y1 - y0 <= 2 * band)
+      break;
+
+    if (draw_rectangle(target, 0xFFE0, p->pt_size, (uint16_t)x0, (uint16_t)y0,
+                       (uint16_t)x1, (uint16_t)y1) != VALID_OP)
+      return 0;
+
+    int64_t outer = (x1 - x0 + 1 + 2 * reach) * (y1 - y0 + 1 + 2 * reach);
+    int64_t inner_w = x1 - x0 - 2 * reach - 1, inner_h = y1 - y0 - 2 * reach - 1;
+    work += (uint64_t)(outer - ((inner_w > 0 && inner_h > 0) ? inner_w * inner_h : 0));
+  }
+
+  return work;
+}
+
+static uint64_t run_draw_rectangle(bench_fixture *f, const bench_params *p)
+{
+  return draw_rectangles(f->scratch, f, p);
+}
+
+#define SHAPE_SIZE 32
+
+/**
+ * Number of SHAPE_SIZE sized shapes covering about density percent of the frame.
+ */
+static uint32_t shape_count(const bench_fixture *f, const bench_params *p)
+{
+  uint64_t count = f->pixels * p->density / 100 / (SHAPE_SIZE * SHAPE_SIZE);
+  return count ? (uint32_t)count : 1;
+}
+
+static uint64_t run_fill_rectangle(bench_fixture *f, const bench_params *p)
+{
+  uint32_t state = BENCH_SEED, count = shape_count(f, p);
+  for (uint32_t shape = 0; shape < count; shape++)
+  {
+    int32_t x = (int32_t)(next_random(&state) % (f->horizontal - SHAPE_SIZE + 1));
+    int32_t y = (int32_t)(next_random(&state) % (f->vertical - SHAPE_SIZE + 1));
+    if (fill_rectangle(f->scratch, 0x001F, x, y, x + SHAPE_SIZE - 1,
+                       y + SHAPE_SIZE - 1) != VALID_OP)
+      return 0;
+  }
+
+  return (uint64_t)count * SHAPE_SIZE * SHAPE_SIZE;
+}
+
+static uint64_t run_fill_circle(bench_fixture *f, const bench_params *p)
+{
+  const int32_t radius = SHAPE_SIZE / 2;
+  uint64_t area = 0;
+  for (int32_t dy = -radius; dy <= radius; dy++)
+    for (int32_t dx = -radius; dx <= radius; dx++)
+      area += (dx * dx + dy * dy <= radius * radius);
+
+  uint32_t state = BENCH_SEED, count = shape_count(f, p);
+  for (uint32_t shape = 0; shape < count; shape++)
+  {
+    int32_t x = radius + (int32_t)(next_random(&state) % (f->horizontal - 2 * radius));
+    int32_t y = radius + (int32_t)(next_random(&state) % (f->vertical - 2 * radius));
+    if (fill_circle(f->scratch, 0xF800, x, y, (uint16_t)radius) != VALID_OP)
+      return 0;
+  }
+
+  return area * count;
+}
+
+static uint64_t run_fill_polygon(bench_fixture *f, const bench_params *p)
+{
+  // A five pointed star: concave, so it exercises the active edge table.
+  static const matrix_point star[] = {{16, 0},  {20, 11}, {31, 12}, {22, 19}, {26, 31},
+                                      {16, 24}, {6, 31},  {10, 19}, {1, 12},  {12, 11}};
+  const size_t vertices = sizeof(star) / sizeof(star[0]);
+
+  int64_t twice_area = 0;
+  for (size_t index = 0; index < vertices; index++)
+  {
+    const matrix_point *a = &star[index], *b = &star[(index + 1) % vertices];
+    twice_area += (int64_t)a->x * b->y - (int64_t)b->x * a->y;
+  }
+  uint64_t area = (uint64_t)(twice_area < 0 ? -twice_area : twice_area) / 2;
+
+  matrix_point points[sizeof(star) / sizeof(star[0])];
+  uint32_t state = BENCH_SEED, count = shape_count(f, p);
+  for (uint32_t shape = 0; shape < count; shape++)
+  {
+    int32_t x = (int32_t)(next_random(&state) % (f->horizontal - SHAPE_SIZE + 1));
+    int32_t y = (int32_t)(next_random(&state) % (f->vertical - SHAPE_SIZE + 1));
+    for (size_t index = 0; index < vertices; index++)
+    {
+      points[index].x = star[index].x + x;
+      points[index].y = star[index].y + y;
+    }
+
+    if (fill_polygon(f->scratch, 0x07E0, points, vertices) != VALID_OP)
+      return 0;
+  }
+
+  return area * count;
+}
+
+/* Pixel conversion */
+
+static uint64_t run_raw_to_rgb565_row(bench_fixture *f, const bench_params *p)
+{
+  // The kernels do not branch on pixel values, so any frame serves as input.
+  raw_to_rgb565_row((raw_pixel_format)p->option, f->frames[0]->mem, f->scratch->mem,
+                    f->pixels);
+  return f->pixels;
+}
+
+static uint64_t run_rgb888_to_rgb565_row(bench_fixture *f, const bench_params *p)
+{
+  size_t stride = (size_t)f->horizontal * 3;
+  for (uint32_t row = 0; row < f->vertical; row++)
+    rgb888_to_rgb565_row(f->rgb888 + row * stride,
+                         f->scratch->mem + (size_t)row * f->horizontal, f->horizontal,
+                         (rgb565_dither)p->option, row);
+  return f->pixels;
+}
+
+static uint64_t run_rgb565_to_bgr888_row(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  rgb565_to_bgr888_row(f->frames[0]->mem, f->encoded, f->pixels);
+  return f->pixels;
+}
+
+static uint64_t run_rgb565_to_bgra8888_row(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  rgb565_to_bgra8888_row(f->frames[0]->mem, f->encoded, f->pixels);
+  return f->pixels;
+}
+
+static uint64_t run_bgr888_to_rgb565_row(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  bgr888_to_rgb565_row(f->rgb888, f->scratch->mem, f->pixels);
+  return f->pixels;
+}
+
+static uint64_t run_bgra8888_to_rgb565_row(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  bgra8888_to_rgb565_row(f->bgra, f->scratch->mem, f->pixels);
+  return f->pixels;
+}
+
+static uint64_t run_reverse_rgb565_row(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  for (uint32_t row = 0; row < f->vertical; row++)
+    reverse_rgb565_row(f->frames[0]->mem + (size_t)row * f->horizontal,
+                       f->scratch->mem + (size_t)row * f->horizontal, f->horizontal);
+  return f->pixels;
+}
+
+/* Encoding and writing */
+
+static uint64_t encoded_size(const bench_fixture *f, uint32_t format)
+{
+  return bmp_encoder_encoded_size(f->encoders[format]);
+}
+
+static uint64_t run_write_rgb565_bmpfile(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  if (write_rgb565_bmpfile(f->output_path, f->frames[0]) != 0)
+    return 0;
+  return encoded_size(f, BMP_FORMAT_RGB565);
+}
+
+static uint64_t run_write_rgb565_bmpfile_buffered(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  if (write_rgb565_bmpfile_buffered(f->output_path, f->frames[0], f->stripe,
+                                    BENCH_STRIPE_SIZE) != 0)
+    return 0;
+  return encoded_size(f, BMP_FORMAT_RGB565);
+}
+
+static uint64_t run_write_bmpfile(bench_fixture *f, const bench_params *p)
+{
+  if (write_bmpfile(f->output_path, f->frames[0], (bmp_pixel_format)p->option) != 0)
+    return 0;
+  return encoded_size(f, p->option);
+}
+
+static uint64_t run_write_bmpfile_buffered(bench_fixture *f, const bench_params *p)
+{
+  if (write_bmpfile_buffered(f->output_path, f->frames[0], (bmp_pixel_format)p->option,
+                             f->stripe, BENCH_STRIPE_SIZE) != 0)
+    return 0;
+  return encoded_size(f, p->option);
+}
+
+static uint64_t run_bmp_encoder_write_file(bench_fixture *f, const bench_params *p)
+{
+  if (bmp_encoder_write_file(f->encoders[p->option], f->output_path, f->frames[0]) != 0)
+    return 0;
+  return encoded_size(f, p->option);
+}
+
+static uint64_t run_bmp_encoder_encode(bench_fixture *f, const bench_params *p)
+{
+  bmp_sink sink = bmp_memory_sink(f->encoded, f->encoded_capacity);
+  if (bmp_encoder_encode(f->encoders[p->option], &sink, f->frames[0]) != 0)
+    return 0;
+  return sink.written;
+}
+
+static uint64_t run_bmp_stripe_writer_append(bench_fixture *f, const bench_params *p)
+{
+  // The frame is appended as a single band, the way a mosaic builder hands over tiles.
+  bmp_stripe_writer *writer = create_bmp_stripe_writer(
+      f->output_path, f->horizontal, f->vertical, (bmp_pixel_format)p->option);
+  if (writer == NULL)
+    return 0;
+
+  uint8_t status = bmp_stripe_writer_append(writer, f->frames[0]);
+  if (close_bmp_stripe_writer(writer) != 0 || status != 0)
+    return 0;
+  return encoded_size(f, p->option);
+}
+
+static uint64_t run_update_rgb565_bmpfile(bench_fixture *f, const bench_params *p)
+{
+  // Dirty density percent of the rows, spread evenly over the frame.
+  uint32_t step = 100 / p->density ? 100 / p->density : 1;
+  uint64_t rows = 0;
+  for (uint32_t row = 0; row < f->vertical; row += step, rows++)
+    mark_dirty_rows(f->tracked, (uint16_t)row, (uint16_t)row);
+
+  if (update_rgb565_bmpfile(f->update_path, f->tracked) != 0)
+    return 0;
+  return rows * f->horizontal * sizeof(uint16_t);
+}
+
+static uint64_t run_encode_qoi(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  f->encoded_bytes = encode_qoi(f->frames[0], f->encoded, f->encoded_capacity);
+  return f->encoded_bytes ? f->pixels : 0;
+}
+
+static uint64_t run_write_qoi_file(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  return write_qoi_file(f->output_path, f->frames[0]) == 0 ? f->pixels : 0;
+}
+
+static uint64_t run_async_bmp_writer(bench_fixture *f, const bench_params *p)
+{
+  async_bmp_writer *writer = f->writers[p->option];
+  if (writer == NULL)
+    return 0;
+
+  char path[BENCH_PATH_SIZE + 32];
+  for (int frame = 0; frame < BENCH_VIDEO_FRAMES; frame++)
+  {
+    snprintf(path, sizeof(path), "%s/async_%d.bmp", f->output_dir, frame);
+    if (async_bmp_writer_submit(writer, path, f->frames[frame], BMP_FORMAT_RGB565, NULL,
+                                NULL) != VALID_OP)
+      return 0;
+  }
+
+  if (async_bmp_writer_wait_all(writer) != VALID_OP)
+    return 0;
+  return encoded_size(f, BMP_FORMAT_RGB565) * BENCH_VIDEO_FRAMES;
+}
+
+/* Resampling and transforms */
+
+static uint64_t run_downscale_box(bench_fixture *f, const bench_params *p)
+{
+  return mat_ok(downscale_box(f->frames[0], f->downscaled[p->option],
+                              (uint8_t)(2u << p->option)),
+                f->pixels);
+}
+
+static uint64_t run_create_thumbnail(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  matrix *thumbnail = create_thumbnail(f->frames[0], 4);
+  if (thumbnail == NULL)
+    return 0;
+
+  deallocate_matrix(thumbnail);
+  return f->pixels;
+}
+
+static uint64_t run_resize_bilinear(bench_fixture *f, const bench_params *p)
+{
+  // Throughput counts destination pixels.
+  if (p->option == 0)
+    return mat_ok(resize_bilinear(f->frames[0], f->half), f->half->size);
+  return mat_ok(resize_bilinear(f->half, f->scratch), f->pixels);
+}
+
+static uint64_t run_transform_matrix(bench_fixture *f, const bench_params *p)
+{
+  matrix_transform transform = (matrix_transform)(p->option + 1);
+  matrix *dst = transform_swaps_dimensions(transform) ? f->rotated : f->scratch;
+  return mat_ok(transform_matrix(f->frames[0], dst, transform), f->pixels);
+}
+
+static uint64_t run_transform_matrix_in_place(bench_fixture *f, const bench_params *p)
+{
+  return mat_ok(transform_matrix_in_place(f->scratch, in_place_transforms[p->option]),
+                f->pixels);
+}
+
+/* Whole pipelines over a short synthetic video */
+
+static uint64_t run_stream_convert_raw_file(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  return mat_ok(stream_convert_raw_file(f->video_path, f->output_dir, f->horizontal,
+                                        f->vertical, NULL),
+                frame_bytes(f) * BENCH_VIDEO_FRAMES);
+}
+
+static uint64_t run_batch_run(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  return mat_ok(batch_run(&f->jobs, 0, NULL), frame_bytes(f) * f->jobs.count);
+}
+
+static uint64_t run_archive_raw_file(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  return mat_ok(archive_raw_file(f->video_path, f->output_path, f->horizontal,
+                                 f->vertical, 0, NULL),
+                frame_bytes(f) * BENCH_VIDEO_FRAMES);
+}
+
+static uint64_t run_frame_archive_append(bench_fixture *f, const bench_params *p)
+{
+  (void)p;
+  frame_archive_writer *writer =
+      create_frame_archive(f->output_path, f->horizontal, f->vertical, 0);
+  if (writer == NULL)
+    return 0;
+
+  uint64_t work = frame_bytes(f) * BENCH_VIDEO_FRAMES;
+  for (int frame = 0; frame < BENCH_VIDEO_FRAMES && work; frame++)
+    if (frame_archive_append(writer, f->frames[frame]) != VALID_OP)
+      work = 0;
+
+  if (close_frame_archive(writer) != VALID_OP)
+    work = 0;
+  return work;
+}
+
+/* Matrix memory layouts */
+
+static uint64_t run_layout_draw_horizontal_line(bench_fixture *f, const bench_params *p)
+{
+  return draw_horizontal_lines(f->layouts[p->option], f, p);
+}
+
+static uint64_t run_layout_draw_vertical_line(bench_fixture *f, const bench_params *p)
+{
+  return draw_vertical_lines(f->layouts[p->option], f, p);
+}
+
+static uint64_t run_layout_draw_rectangle(bench_fixture *f, const bench_params *p)
+{
+  return draw_rectangles(f->layouts[p->option], f, p);
+}
+
+static uint64_t run_layout_bmp_encoder_encode(bench_fixture *f, const bench_params *p)
+{
+  // Tiled rows are put back in order inside the encoder.
+  bmp_sink sink = bmp_memory_sink(f->encoded, f->encoded_capacity);
+  matrix *mat = f->layouts[p->option];
+  if (bmp_encoder_encode(f->encoders[BMP_FORMAT_RGB565], &sink, mat) != 0)
+    return 0;
+  return sink.written;
+}
+
+static uint64_t run_convert_matrix_layout(bench_fixture *f, const bench_params *p)
+{
+  matrix *tiled = f->layouts[MATRIX_LAYOUT_TILED_8X8 + p->option % 2];
+  if (p->option < 2)
+    return mat_ok(convert_matrix_layout(f->frames[0], tiled), frame_bytes(f));
+  return mat_ok(convert_matrix_layout(tiled, f->scratch), frame_bytes(f));
+}
+
+static const bench_case cases[] = {
+    {"read_binary_file", BENCH_UNIT_BYTES, 0, NULL, run_read_binary_file},
+    {"read_binary_file_format", BENCH_UNIT_BYTES, 0, raw_format_options,
+     run_read_binary_file_format},
+    {"read_binary_frame", BENCH_UNIT_BYTES, 0, NULL, run_read_binary_frame},
+    {"map_binary_file", BENCH_UNIT_BYTES, 0, NULL, run_map_binary_file},
+    {"read_rgb888_file", BENCH_UNIT_BYTES, 0, dither_options, run_read_rgb888_file},
+    {"read_ppm_file", BENCH_UNIT_BYTES, 0, dither_options, run_read_ppm_file},
+    {"import_rgb888_frame", BENCH_UNIT_BYTES, 0, dither_options, run_import_rgb888_frame},
+    {"read_rgb565_bmpfile", BENCH_UNIT_PIXELS, 0, NULL, run_read_rgb565_bmpfile},
+    {"read_qoi_file", BENCH_UNIT_PIXELS, 0, NULL, run_read_qoi_file},
+    {"decode_qoi", BENCH_UNIT_PIXELS, 0, NULL, run_decode_qoi},
+    {"frame_archive_read_frame", BENCH_UNIT_PIXELS, 0, NULL,
+     run_frame_archive_read_frame},
+
+    {"zero_matrix", BENCH_UNIT_BYTES, 0, NULL, run_zero_matrix},
+    {"fill_matrix", BENCH_UNIT_BYTES, 0, NULL, run_fill_matrix},
+    {"matrix_pool_acquire", BENCH_UNIT_BYTES, 0, NULL, run_matrix_pool_acquire},
+    {"write_rgb565_pixel_code", BENCH_UNIT_PIXELS, BENCH_AXIS_DENSITY, NULL,
+     run_write_rgb565_pixel_code},
+    {"write_rgb565_pixel_rgb", BENCH_UNIT_PIXELS, BENCH_AXIS_DENSITY, NULL,
+     run_write_rgb565_pixel_rgb},
+    {"write_rgb565_pixels_code", BENCH_UNIT_PIXELS, BENCH_AXIS_DENSITY, NULL,
+     run_write_rgb565_pixels_code},
+    {"draw_horizontal_line", BENCH_UNIT_PIXELS, BENCH_AXIS_PT_SIZE | BENCH_AXIS_DENSITY,
+     NULL, run_draw_horizontal_line},
+    {"draw_vertical_line", BENCH_UNIT_PIXELS, BENCH_AXIS_PT_SIZE | BENCH_AXIS_DENSITY,
+     NULL, run_draw_vertical_line},
+    {"draw_rectangle", BENCH_UNIT_PIXELS, BENCH_AXIS_PT_SIZE | BENCH_AXIS_DENSITY, NULL,
+     run_draw_rectangle},
+    {"fill_rectangle", BENCH_UNIT_PIXELS, BENCH_AXIS_DENSITY, NULL, run_fill_rectangle},
+    {"fill_circle", BENCH_UNIT_PIXELS, BENCH_AXIS_DENSITY, NULL, run_fill_circle},
+    {"fill_polygon", BENCH_UNIT_PIXELS, BENCH_AXIS_DENSITY, NULL, run_fill_polygon},
+
+    {"raw_to_rgb565_row", BENCH_UNIT_PIXELS, 0, raw_format_options,
+     run_raw_to_rgb565_row},
+    {"rgb888_to_rgb565_row", BENCH_UNIT_PIXELS, 0, dither_options,
+     run_rgb888_to_rgb565_row},
+    {"rgb565_to_bgr888_row", BENCH_UNIT_PIXELS, 0, NULL, run_rgb565_to_bgr888_row},
+    {"rgb565_to_bgra8888_row", BENCH_UNIT_PIXELS, 0, NULL, run_rgb565_to_bgra8888_row},
+    {"bgr888_to_rgb565_row", BENCH_UNIT_PIXELS, 0, NULL, run_bgr888_to_rgb565_row},
+    {"bgra8888_to_rgb565_row", BENCH_UNIT_PIXELS, 0, NULL, run_bgra8888_to_rgb565_row},
+    {"reverse_rgb565_row", BENCH_UNIT_PIXELS, 0, NULL, run_reverse_rgb565_row},
+
+    {"write_rgb565_bmpfile", BENCH_UNIT_BYTES, 0, NULL, run_write_rgb565_bmpfile},
+    {"write_rgb565_bmpfile_buffered", BENCH_UNIT_BYTES, 0, NULL,
+     run_write_rgb565_bmpfile_buffered},
+    {"write_bmpfile", BENCH_UNIT_BYTES, 0, bmp_format_options, run_write_bmpfile},
+    {"write_bmpfile_buffered", BENCH_UNIT_BYTES, 0, bmp_format_options,
+     run_write_bmpfile_buffered},
+    {"bmp_encoder_write_file", BENCH_UNIT_BYTES, 0, bmp_format_options,
+     run_bmp_encoder_write_file},
+    {"bmp_encoder_encode", BENCH_UNIT_BYTES, 0, bmp_format_options,
+     run_bmp_encoder_encode},
+    {"bmp_stripe_writer_append", BENCH_UNIT_BYTES, 0, bmp_format_options,
+     run_bmp_stripe_writer_append},
+    {"update_rgb565_bmpfile", BENCH_UNIT_BYTES, BENCH_AXIS_DENSITY, NULL,
+     run_update_rgb565_bmpfile},
+    {"encode_qoi", BENCH_UNIT_PIXELS, 0, NULL, run_encode_qoi},
+    {"write_qoi_file", BENCH_UNIT_PIXELS, 0, NULL, run_write_qoi_file},
+    {"async_bmp_writer_submit", BENCH_UNIT_BYTES, 0, backend_options,
+     run_async_bmp_writer},
+
+    {"downscale_box", BENCH_UNIT_PIXELS, 0, factor_options, run_downscale_box},
+    {"create_thumbnail", BENCH_UNIT_PIXELS, 0, NULL, run_create_thumbnail},
+    {"resize_bilinear", BENCH_UNIT_PIXELS, 0, bilinear_options, run_resize_bilinear},
+    {"transform_matrix", BENCH_UNIT_PIXELS, 0, transform_options, run_transform_matrix},
+    {"transform_matrix_in_place", BENCH_UNIT_PIXELS, 0, in_place_options,
+     run_transform_matrix_in_place},
+
+    {"stream_convert_raw_file", BENCH_UNIT_BYTES, 0, NULL, run_stream_convert_raw_file},
+    {"batch_run", BENCH_UNIT_BYTES, 0, NULL, run_batch_run},
+    {"archive_raw_file", BENCH_UNIT_BYTES, 0, NULL, run_archive_raw_file},
+    {"frame_archive_append", BENCH_UNIT_BYTES, 0, NULL, run_frame_archive_append},
+
+    {"layout_draw_horizontal_line", BENCH_UNIT_PIXELS,
+     BENCH_AXIS_PT_SIZE | BENCH_AXIS_DENSITY, layout_options,
+     run_layout_draw_horizontal_line},
+    {"layout_draw_vertical_line", BENCH_UNIT_PIXELS,
+     BENCH_AXIS_PT_SIZE | BENCH_AXIS_DENSITY, layout_options,
+     run_layout_draw_vertical_line},
+    {"layout_draw_rectangle", BENCH_UNIT_PIXELS, BENCH_AXIS_PT_SIZE | BENCH_AXIS_DENSITY,
+     layout_options, run_layout_draw_rectangle},
+    {"layout_bmp_encoder_encode", BENCH_UNIT_BYTES, 0, layout_options,
+     run_layout_bmp_encoder_encode},
+    {"convert_matrix_layout", BENCH_UNIT_BYTES, 0, layout_conversion_options,
+     run_convert_matrix_layout},
+};
+
+#define CASE_COUNT (sizeof(cases) / sizeof(cases[0]))
+
+/* Fixture setup */
+
+/**
+ * Remove every file in dir, descending into subdirectories, then dir itself.
+ */
+static void remove_tree(const char *dir)
+{
+  DIR *handle = opendir(dir);
+  if (handle != NULL)
+  {
+    struct dirent *entry;
+    char path[BENCH_PATH_SIZE + 256];
+    while ((entry = readdir(handle)) != NULL)
+    {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        continue;
+
+      snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+      struct stat info;
+      if (lstat(path, &info) == 0 && S_ISDIR(info.st_mode))
+        remove_tree(path);
+      else
+        unlink(path);
+    }
+    closedir(handle);
+  }
+
+  rmdir(dir);
+}
+
+static bool fixture_path(const bench_fixture *f, char *path, const char *name)
+{
+  return snprintf(path, BENCH_PATH_SIZE, "%s/%s", f->dir, name) < BENCH_PATH_SIZE;
+}
+
+static void destroy_fixture(bench_fixture *f)
+{
+  for (int index = 0; index < 2; index++)
+    destroy_async_bmp_writer(f->writers[index]);
+  for (int index = 0; index < 3; index++)
+  {
+    destroy_bmp_encoder(f->encoders[index]);
+    deallocate_matrix(f->downscaled[index]);
+    deallocate_matrix(f->layouts[index]);
+  }
+  for (int index = 0; index < BENCH_VIDEO_FRAMES; index++)
+    deallocate_matrix(f->frames[index]);
+
+  if (f->pool != NULL)
+    destroy_matrix_pool(f->pool);
+  batch_free_jobs(&f->jobs);
+
+  deallocate_matrix(f->scratch);
+  deallocate_matrix(f->tracked);
+  deallocate_matrix(f->rotated);
+  deallocate_matrix(f->half);
+
+  free(f->rgb888);
+  free(f->bgra);
+  free(f->encoded);
+  free(f->stripe);
+  free(f->qoi);
+  free(f->pixel_list);
+
+  if (f->dir[0] != '\0')
+    remove_tree(f->dir);
+  memset(f, 0, sizeof(*f));
+}
+
+static bool write_file(const char *filepath, const char *header, const uint8_t *data,
+                       size_t length)
+{
+  FILE *file_ptr = fopen(filepath, "wb");
+  if (file_ptr == NULL)
+    return false;
+
+  bool success = (header == NULL || fputs(header, file_ptr) >= 0) &&
+                 fwrite(data, 1, length, file_ptr) == length;
+  return (fclose(file_ptr) == 0) && success;
+}
+
+/**
+ * Generate the synthetic video and every input file of one resolution under a new
+ * directory of tmpdir.
+ */
+static bool create_fixture(bench_fixture *f, const bench_resolution *resolution,
+                           const char *tmpdir, uint32_t max_density)
+{
+  memset(f, 0, sizeof(*f));
+  f->horizontal = resolution->horizontal;
+  f->vertical = resolution->vertical;
+  f->pixels = (uint64_t)f->horizontal * f->vertical;
+
+  snprintf(f->dir, sizeof(f->dir), "%s/matrix_bench_%s.XXXXXX", tmpdir, resolution->name);
+  if (mkdtemp(f->dir) == NULL)
+  {
+    fprintf(stderr, "matrix_bench: unable to create a directory in %s.\n", tmpdir);
+    f->dir[0] = '\0';
+    return false;
+  }
+
+  bool paths = true;
+  for (int format = RAW_FORMAT_RGB565; format <= RAW_FORMAT_YUYV; format++)
+  {
+    char name[32];
+    snprintf(name, sizeof(name), "frame_%s.raw", raw_format_options[format]);
+    paths = paths && fixture_path(f, f->raw_path[format], name);
+  }
+  paths = paths && fixture_path(f, f->video_path, "video.raw") &&
+          fixture_path(f, f->rgb888_path, "frame.rgb") &&
+          fixture_path(f, f->ppm_path, "frame.ppm") &&
+          fixture_path(f, f->bmp_path, "frame.bmp") &&
+          fixture_path(f, f->update_path, "update.bmp") &&
+          fixture_path(f, f->qoi_path, "frame.qoi") &&
+          fixture_path(f, f->archive_path, "video.arc") &&
+          fixture_path(f, f->output_path, "output") &&
+          fixture_path(f, f->output_dir, "out");
+  if (!paths || mkdir(f->output_dir, 0700) != 0)
+    goto failed;
+
+  for (int frame = 0; frame < BENCH_VIDEO_FRAMES; frame++)
+  {
+    f->frames[frame] = allocate_matrix(f->horizontal, f->vertical);
+    if (f->frames[frame] == NULL)
+      goto failed;
+    bench_synthesize_frame(f->frames[frame], BENCH_SEED, (uint32_t)frame);
+  }
+
+  f->scratch = allocate_matrix(f->horizontal, f->vertical);
+  f->tracked = allocate_matrix(f->horizontal, f->vertical);
+  f->rotated = allocate_matrix(f->vertical, f->horizontal);
+  f->half = allocate_matrix(f->horizontal / 2, f->vertical / 2);
+  for (int index = 0; index < 3; index++)
+    f->downscaled[index] =
+        allocate_matrix(f->horizontal >> (index + 1), f->vertical >> (index + 1));
+  f->pool = create_matrix_pool(f->horizontal, f->vertical, 1);
+  if (f->scratch == NULL || f->tracked == NULL || f->rotated == NULL || f->half == NULL ||
+      f->downscaled[0] == NULL || f->downscaled[1] == NULL || f->downscaled[2] == NULL ||
+      f->pool == NULL)
+    goto failed;
+
+  for (int layout = 0; layout < 3; layout++)
+  {
+    f->layouts[layout] =
+        allocate_matrix_layout(f->horizontal, f->vertical, (matrix_layout)layout);
+    if (f->layouts[layout] == NULL ||
+        convert_matrix_layout(f->frames[0], f->layouts[layout]) != VALID_OP)
+      goto failed;
+  }
+
+  for (int format = BMP_FORMAT_RGB565; format <= BMP_FORMAT_BGRA8888; format++)
+  {
+    f->encoders[format] =
+        create_bmp_encoder(f->horizontal, f->vertical, (bmp_pixel_format)format, NULL);
+    if (f->encoders[format] == NULL)
+      goto failed;
+  }
+
+  f->encoded_capacity = bmp_encoder_encoded_size(f->encoders[BMP_FORMAT_BGRA8888]);
+  if (calculate_qoi_max_size(f->frames[0]) > f->encoded_capacity)
+    f->encoded_capacity = calculate_qoi_max_size(f->frames[0]);
+
+  f->rgb888 = (uint8_t *)malloc(f->pixels * 3);
+  f->bgra = (uint8_t *)malloc(f->pixels * 4);
+  f->encoded = (uint8_t *)malloc(f->encoded_capacity);
+  f->stripe = (uint8_t *)malloc(BENCH_STRIPE_SIZE);
+  f->qoi = (uint8_t *)malloc(calculate_qoi_max_size(f->frames[0]));
+  f->pixel_capacity = (size_t)(f->pixels * max_density / 100) + 1;
+  f->pixel_list =
+      (rgb565_pixel_code *)malloc(f->pixel_capacity * sizeof(rgb565_pixel_code));
+  if (f->rgb888 == NULL || f->bgra == NULL || f->encoded == NULL || f->stripe == NULL ||
+      f->qoi == NULL || f->pixel_list == NULL)
+    goto failed;
+
+  rgb565_to_bgr888_row(f->frames[0]->mem, f->rgb888, f->pixels);
+  rgb565_to_bgra8888_row(f->frames[0]->mem, f->bgra, f->pixels);
+  f->qoi_length = encode_qoi(f->frames[0], f->qoi, calculate_qoi_max_size(f->frames[0]));
+
+  uint32_t state = BENCH_SEED;
+  for (size_t index = 0; index < f->pixel_capacity; index++)
+  {
+    f->pixel_list[index].row = (uint16_t)(next_random(&state) % f->vertical);
+    f->pixel_list[index].column = (uint16_t)(next_random(&state) % f->horizontal);
+    f->pixel_list[index].color = (uint16_t)next_random(&state);
+  }
+
+  // PPM and RGB888 files carry the same (channel swapped) 24-bit frame.
+  char header[64];
+  snprintf(header, sizeof(header), "P6\n%u %u\n255\n", f->horizontal, f->vertical);
+
+  bool written = f->qoi_length != 0 &&
+                 write_file(f->rgb888_path, NULL, f->rgb888, f->pixels * 3) &&
+                 write_file(f->ppm_path, header, f->rgb888, f->pixels * 3) &&
+                 write_file(f->qoi_path, NULL, f->qoi, f->qoi_length) &&
+                 bench_write_raw_file(f->video_path, f->frames, BENCH_VIDEO_FRAMES,
+                                      RAW_FORMAT_RGB565) &&
+                 write_rgb565_bmpfile(f->bmp_path, f->frames[0]) == 0 &&
+                 archive_raw_file(f->video_path, f->archive_path, f->horizontal,
+                                  f->vertical, 0, NULL) == VALID_OP;
+
+  for (int format = RAW_FORMAT_RGB565; written && format <= RAW_FORMAT_YUYV; format++)
+    written = bench_write_raw_file(f->raw_path[format], f->frames, 1,
+                                   (raw_pixel_format)format);
+  if (!written)
+    goto failed;
+
+  // The tracked matrix starts out in sync with the file it updates.
+  memcpy(f->tracked->mem, f->frames[0]->mem, frame_bytes(f));
+  if (write_rgb565_bmpfile(f->update_path, f->tracked) != 0 ||
+      enable_dirty_tracking(f->tracked) != VALID_OP)
+    goto failed;
+  clear_dirty_rows(f->tracked);
+
+  char job_output[BENCH_PATH_SIZE + 32];
+  for (int job = 0; job < BENCH_VIDEO_FRAMES; job++)
+  {
+    snprintf(job_output, sizeof(job_output), "%s/batch_%d.bmp", f->output_dir, job);
+    if (batch_add_job(&f->jobs, f->raw_path[RAW_FORMAT_RGB565], job_output, f->horizontal,
+                      f->vertical) != VALID_OP)
+      goto failed;
+  }
+
+  // A backend the machine lacks leaves its writer NULL; its benchmark is skipped.
+  async_writer_settings settings = {0};
+  settings.backend = ASYNC_WRITER_IO_URING;
+  f->writers[0] = create_async_bmp_writer(&settings);
+  settings.backend = ASYNC_WRITER_THREADS;
+  f->writers[1] = create_async_bmp_writer(&settings);
+
+  return true;
+
+failed:
+  fprintf(stderr, "matrix_bench: unable to set up %s inputs.\n", resolution->name);
+  destroy_fixture(f);
+  return false;
+}
+
+/* Driver */
+
+typedef struct bench_options
+{
+  bench_settings settings;
+  bench_output_format format;
+  const char *output;
+  const char *filter;
+  const char *tmpdir;
+
+  bool sizes[RESOLUTION_COUNT];
+  uint32_t pt_sizes[BENCH_MAX_LIST];
+  size_t pt_size_count;
+  uint32_t densities[BENCH_MAX_LIST];
+  size_t density_count;
+} bench_options;
+
+typedef struct bench_invocation
+{
+  const bench_case *bench;
+  bench_fixture *fixture;
+  bench_params params;
+} bench_invocation;
+
+static uint64_t invoke(void *context)
+{
+  bench_invocation *invocation = (bench_invocation *)context;
+  return invocation->bench->run(invocation->fixture, &invocation->params);
+}
+
+static bool case_selected(const bench_options *options, const bench_case *bench)
+{
+  return options->filter == NULL || strstr(bench->name, options->filter) != NULL;
+}
+
+static void run_variant(const bench_options *options, bench_report *report,
+                        bench_invocation *invocation)
+{
+  const bench_case *bench = invocation->bench;
+  const bench_params *params = &invocation->params;
+
+  bench_result result;
+  memset(&result, 0, sizeof(result));
+  result.name = bench->name;
+  result.unit = bench->unit;
+  result.horizontal = invocation->fixture->horizontal;
+  result.vertical = invocation->fixture->vertical;
+
+  int length = 0;
+  size_t size = sizeof(result.variant);
+  if (bench->options != NULL)
+    length += snprintf(result.variant + length, size - length, "%s",
+                       bench->options[params->option]);
+  if (bench->axes & BENCH_AXIS_PT_SIZE)
+    length += snprintf(result.variant + length, size - length, "%spt=%u",
+                       length ? " " : "", params->pt_size);
+  if (bench->axes & BENCH_AXIS_DENSITY)
+    length += snprintf(result.variant + length, size - length, "%sdensity=%u%%",
+                       length ? " " : "", params->density);
+  if (length == 0)
+    snprintf(result.variant, size, "-");
+
+  fprintf(stderr, "  %-30s %-22s", bench->name, result.variant);
+  invocation->fixture->encoded_bytes = 0;
+  if (!bench_measure(&options->settings, invoke, invocation, &result))
+  {
+    fprintf(stderr, " skipped (failed or unsupported)\n");
+    return;
+  }
+
+  fprintf(stderr, " %10.3f ms %12.1f %s", result.median_seconds * 1e3, result.throughput,
+          bench->unit == BENCH_UNIT_BYTES ? "MB/s" : "Mpixels/s");
+  if (invocation->fixture->encoded_bytes)
+  {
+    // Compression is measured against the 16-bit BMP of the same frame.
+    result.encoded_bytes = invocation->fixture->encoded_bytes;
+    result.bmp_bytes = encoded_size(invocation->fixture, BMP_FORMAT_RGB565);
+    fprintf(stderr, "  %.1f%% of BMP", 100.0 * result.encoded_bytes / result.bmp_bytes);
+  }
+  fputc('\n', stderr);
+  if (!bench_report_add(report, &result))
+    fprintf(stderr, "matrix_bench: out of memory, result dropped.\n");
+}
+
+static void run_case(const bench_options *options, bench_report *report,
+                     bench_fixture *fixture, const bench_case *bench)
+{
+  bench_invocation invocation;
+  invocation.bench = bench;
+  invocation.fixture = fixture;
+
+  size_t option_count = 1;
+  if (bench->options != NULL)
+    for (option_count = 0; bench->options[option_count] != NULL; option_count++)
+      ;
+
+  size_t pt_count = (bench->axes & BENCH_AXIS_PT_SIZE) ? options->pt_size_count : 1;
+  size_t density_count = (bench->axes & BENCH_AXIS_DENSITY) ? options->density_count : 1;
+
+  for (size_t option = 0; option < option_count; option++)
+    for (size_t pt = 0; pt < pt_count; pt++)
+      for (size_t density = 0; density < density_count; density++)
+      {
+        invocation.params.option = (uint32_t)option;
+        invocation.params.pt_size = (uint16_t)options->pt_sizes[pt];
+        invocation.params.density = options->densities[density];
+        run_variant(options, report, &invocation);
+      }
+}
+
+static void print_usage(const char *program)
+{
+  printf("Usage: %s [options]\n", program);
+  printf("  --sizes LIST       Resolutions to run: "
+         "qvga, vga, 720p, 1080p, 4k, 8k or all\n");
+  printf("                     (default: all).\n");
+  printf("  --pt-sizes LIST    Point sizes of the line and rectangle benchmarks "
+         "(default: 1,4,16).\n");
+  printf("  --densities LIST   Percent of the frame drawn by the draw benchmarks, "
+         "1-100\n");
+  printf("                     (default: 1,10).\n");
+  printf("  --warmup N         Untimed runs before measuring (default: 2).\n");
+  printf("  --iterations N     Timed runs per benchmark (default: 15).\n");
+  printf("  --max-seconds S    Stop after S seconds of timed runs, keeping at least %d\n",
+         BENCH_MIN_ITERATIONS);
+  printf("                     (default: 2, 0 for no limit).\n");
+  printf("  --filter TEXT      Only run benchmarks whose name contains TEXT.\n");
+  printf("  --format FORMAT    Report as text, csv or json (default: text).\n");
+  printf("  --output FILE      Write the report to FILE instead of stdout.\n");
+  printf("  --tmpdir DIR       Directory for generated files "
+         "(default: $TMPDIR or /tmp).\n");
+  printf("  --list             List the benchmarks and exit.\n");
+}
+
+static bool parse_count(const char *text, uint32_t minimum, uint32_t maximum,
+                        uint32_t *value)
+{
+  char *end = NULL;
+  unsigned long parsed = strtoul(text, &end, 10);
+  if (end == text || *end != '\0' || parsed < minimum || parsed > maximum)
+    return false;
+
+  *value = (uint32_t)parsed;
+  return true;
+}
+
+static bool parse_list(const char *text, uint32_t minimum, uint32_t maximum,
+                       uint32_t *values, size_t *count)
+{
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer), "%s", text);
+
+  *count = 0;
+  for (char *token = strtok(buffer, ","); token != NULL; token = strtok(NULL, ","))
+  {
+    if (*count == BENCH_MAX_LIST ||
+        !parse_count(token, minimum, maximum, &values[*count]))
+      return false;
+    (*count)++;
+  }
+
+  return *count > 0;
+}
+
+static bool parse_sizes(const char *text, bool *sizes)
+{
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer), "%s", text);
+  memset(sizes, 0, RESOLUTION_COUNT * sizeof(bool));
+
+  for (char *token = strtok(buffer, ","); token != NULL; token = strtok(NULL, ","))
+  {
+    bool known = false;
+    for (size_t index = 0; index < RESOLUTION_COUNT; index++)
+      if (strcmp(token, "all") == 0 || strcmp(token, resolutions[index].name) == 0)
+      {
+        sizes[index] = true;
+        known = true;
+      }
+
+    if (!known)
+      return false;
+  }
+
+  return true;
+}
+
+static bool parse_options(int argc, char **argv, bench_options *options)
+{
+  options->settings.warmup = 2;
+  options->settings.iterations = 15;
+  options->settings.max_seconds = 2.0;
+  options->format = BENCH_OUTPUT_TEXT;
+  options->tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+  for (size_t index = 0; index < RESOLUTION_COUNT; index++)
+    options->sizes[index] = true;
+
+  static const uint32_t default_pt_sizes[] = {1, 4, 16};
+  static const uint32_t default_densities[] = {1, 10};
+  memcpy(options->pt_sizes, default_pt_sizes, sizeof(default_pt_sizes));
+  options->pt_size_count = 3;
+  memcpy(options->densities, default_densities, sizeof(default_densities));
+  options->density_count = 2;
+
+  for (int index = 1; index < argc; index++)
+  {
+    const char *arg = argv[index];
+    const char *value = (index + 1 < argc) ? argv[index + 1] : NULL;
+    bool valid = (value != NULL);
+
+    if (strcmp(arg, "--list") == 0)
+    {
+      for (size_t bench = 0; bench < CASE_COUNT; bench++)
+        printf("%s\n", cases[bench].name);
+      exit(0);
+    }
+    else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0)
+    {
+      print_usage(argv[0]);
+      exit(0);
+    }
+    else if (strcmp(arg, "--sizes") == 0)
+      valid = valid && parse_sizes(value, options->sizes);
+    else if (strcmp(arg, "--pt-sizes") == 0)
+      valid = valid &&
+              parse_list(value, 1, 256, options->pt_sizes, &options->pt_size_count);
+    else if (strcmp(arg, "--densities") == 0)
+      valid = valid &&
+              parse_list(value, 1, 100, options->densities, &options->density_count);
+    else if (strcmp(arg, "--warmup") == 0)
+      valid = valid && parse_count(value, 0, 1000, &options->settings.warmup);
+    else if (strcmp(arg, "--iterations") == 0)
+      valid = valid && parse_count(value, 1, 100000, &options->settings.iterations);
+    else if (strcmp(arg, "--max-seconds") == 0)
+    {
+      char *end = NULL;
+      options->settings.max_seconds = valid ? strtod(value, &end) : 0.0;
+      valid = valid && end != value && *end == '\0' &&
+              options->settings.max_seconds >= 0.0;
+    }
+    else if (strcmp(arg, "--filter") == 0)
+      options->filter = value;
+    else if (strcmp(arg, "--output") == 0)
+      options->output = value;
+    else if (strcmp(arg, "--tmpdir") == 0)
+      options->tmpdir = value;
+    else if (strcmp(arg, "--format") == 0)
+    {
+      if (valid && strcmp(value, "text") == 0)
+        options->format = BENCH_OUTPUT_TEXT;
+      else if (valid && strcmp(value, "csv") == 0)
+        options->format = BENCH_OUTPUT_CSV;
+      else if (valid && strcmp(value, "json") == 0)
+        options->format = BENCH_OUTPUT_JSON;
+      else
+        valid = false;
+    }
+    else
+    {
+      fprintf(stderr, "Unknown option: %s\n", arg);
+      return false;
+    }
+
+    if (!valid)
+    {
+      fprintf(stderr, "Invalid value for %s\n", arg);
+      return false;
+    }
+    index++;
+  }
+
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  bench_options options;
+  memset(&options, 0, sizeof(options));
+  if (!parse_options(argc, argv, &options))
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  uint32_t max_density = 0;
+  for (size_t index = 0; index < options.density_count; index++)
+    if (options.densities[index] > max_density)
+      max_density = options.densities[index];
+
+  bench_report report = {0};
+  int status = 0;
+
+  for (size_t size = 0; size < RESOLUTION_COUNT; size++)
+  {
+    if (!options.sizes[size])
+      continue;
+
+    const bench_resolution *resolution = &resolutions[size];
+    fprintf(stderr, "%s (%ux%u)\n", resolution->name, resolution->horizontal,
+            resolution->vertical);
+
+    bench_fixture fixture;
+    if (!create_fixture(&fixture, resolution, options.tmpdir, max_density))
+    {
+      status = 1;
+      continue;
+    }
+
+    for (size_t bench = 0; bench < CASE_COUNT; bench++)
+      if (case_selected(&options, &cases[bench]))
+        run_case(&options, &report, &fixture, &cases[bench]);
+
+    destroy_fixture(&fixture);
+  }
+
+  FILE *output = stdout;
+  if (options.output != NULL && (output = fopen(options.output, "w")) == NULL)
+  {
+    fprintf(stderr, "matrix_bench: unable to open %s for writing.\n", options.output);
+    bench_report_free(&report);
+    return 1;
+  }
+
+  bench_report_write(output, &report, options.format, &options.settings);
+  if (output != stdout)
+    fclose(output);
+
+  bench_report_free(&report);
+  return status;
+}
@@ -0,0 +1,152 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+
+#include "matrix.h"
+
+/**
+ * @brief Keyframe interval used when none is given.
+ */
+#define ARCHIVE_DEFAULT_KEYFRAME_INTERVAL 30
+
+/**
+ * @brief Writer of a frame archive. Opaque, see create_frame_archive.
+ *
+ * An archive stores a sequence of same-shape RGB565 frames. Every keyframe_interval-th
+ * frame is a keyframe holding its own pixels; the frames in between hold the XOR of
+ * their pixels against the previous frame. Both are run-length encoded as 16-bit
+ * words, so unchanged areas of a delta collapse into a few bytes. An index of every
+ * frame's position is appended when the archive is closed.
+ */
+typedef struct frame_archive_writer frame_archive_writer;
+
+/**
+ * @brief Reader of a frame archive. Opaque, see open_frame_archive.
+ */
+typedef struct frame_archive_reader frame_archive_reader;
+
+/**
+ * @brief Summary of a RAW file archived by archive_raw_file.
+ */
+typedef struct archive_stats
+{
+  uint64_t frames;
+  uint64_t keyframes;
+
+  uint64_t raw_bytes;
+  uint64_t archive_bytes;
+
+  /**
+   * @brief Wall clock time spent archiving, in seconds.
+   */
+  double seconds;
+} archive_stats;
+
+/**
+ * @brief Create a new archive file for frames of the given dimensions.
+ *
+ * Pointer to a new writer, NULL otherwise. The index records payload lengths in 32 bits,
+ * so frames whose uncompressed payload could exceed 4 GiB (about 2^31 pixels) are
+ * rejected.
+ *
+ * @param filepath Destination archive file.
+ * @param horizontal Horizontal dimension of every frame.
+ * @param vertical Vertical dimension of every frame.
+ * @param keyframe_interval Distance between keyframes, 0 for the default.
+ * @return struct frame_archive_writer*
+ */
+frame_archive_writer *create_frame_archive(const char *filepath, uint16_t horizontal,
+                                           uint16_t vertical, uint32_t keyframe_interval);
+
+/**
+ * @brief Append a frame to the archive.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param writer Pointer to an archive writer.
+ * @param frame Frame with the dimensions of the archive.
+ * @return enum mat_fn_status
+ */
+mat_fn_status frame_archive_append(frame_archive_writer *writer, const matrix *frame);
+
+/**
+ * @brief Write the frame index, finalize the header and release the writer.
+ *
+ * Return VALID_OP on success, not otherwise. The writer is released either way.
+ *
+ * @param writer Pointer to an archive writer.
+ * @return enum mat_fn_status
+ */
+mat_fn_status close_frame_archive(frame_archive_writer *writer);
+
+/**
+ * @brief Archive every frame of a RAW RGB565 video file.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param raw_path RAW file holding back to back frames.
+ * @param archive_path Destination archive file.
+ * @param horizontal Horizontal dimension of a frame.
+ * @param vertical Vertical dimension of a frame.
+ * @param keyframe_interval Distance between keyframes, 0 for the default.
+ * @param stats Filled with a summary of the run, may be NULL.
+ * @return enum mat_fn_status
+ */
+mat_fn_status archive_raw_file(const char *raw_path, const char *archive_path,
+                               uint16_t horizontal, uint16_t vertical,
+                               uint32_t keyframe_interval, archive_stats *stats);
+
+/**
+ * @brief Open an archive for reading.
+ *
+ * Pointer to a new reader, NULL otherwise.
+ *
+ * @param filepath Archive file written by close_frame_archive.
+ * @return struct frame_archive_reader*
+ */
+frame_archive_reader *open_frame_archive(const char *filepath);
+
+/**
+ * @brief Release a reader.
+ *
+ * @param reader Pointer to an archive reader, may be NULL.
+ */
+void close_frame_archive_reader(frame_archive_reader *reader);
+
+/**
+ * @brief Number of frames in the archive.
+ *
+ * @param reader Pointer to an archive reader.
+ * @return uint64_t
+ */
+uint64_t frame_archive_frame_count(const frame_archive_reader *reader);
+
+/**
+ * @brief Horizontal and vertical dimension of the archived frames.
+ *
+ * @param reader Pointer to an archive reader.
+ * @param horizontal Receives the horizontal dimension.
+ * @param vertical Receives the vertical dimension.
+ */
+void frame_archive_dimensions(const frame_archive_reader *reader, uint16_t *horizontal,
+                              uint16_t *vertical);
+
+/**
+ * @brief Reconstruct a frame into mat.
+ *
+ * Frames are rebuilt from the nearest keyframe at or before frame_index. The reader
+ * remembers the last frame it rebuilt, so reading frames in order decodes a single
+ * delta per frame.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param reader Pointer to an archive reader.
+ * @param frame_index Zero based index of the frame.
+ * @param mat Matrix with the dimensions of the archive.
+ * @return enum mat_fn_status
+ */
+mat_fn_status frame_archive_read_frame(frame_archive_reader *reader,
+                                       uint64_t frame_index, matrix *mat);
+
+#endif
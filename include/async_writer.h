@@ -0,0 +1,157 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bitmap.h"
+#include "matrix.h"
+
+/**
+ * @brief Files in flight when no queue depth is given.
+ */
+#define ASYNC_WRITER_DEFAULT_QUEUE_DEPTH 32
+
+/**
+ * @brief Worker threads of the thread pool backend when no count is given.
+ */
+#define ASYNC_WRITER_DEFAULT_THREADS 4
+
+/**
+ * @brief How an async writer performs file I/O.
+ */
+typedef enum async_writer_backend
+{
+  /**
+   * @brief io_uring when the kernel supports it, the thread pool otherwise.
+   */
+  ASYNC_WRITER_AUTO,
+
+  /**
+   * @brief Every file is a linked open, write, (fsync,) close chain submitted to an
+   * io_uring. Creating the writer fails if the kernel cannot run such chains. Should
+   * waiting for completions fail later on, the files in flight fail and later files
+   * are written with blocking calls on the submitting thread.
+   */
+  ASYNC_WRITER_IO_URING,
+
+  /**
+   * @brief A pool of threads performing blocking open, write, (fsync,) close.
+   */
+  ASYNC_WRITER_THREADS
+} async_writer_backend;
+
+/**
+ * @brief Settings of an async writer. Zero initialized settings select the defaults.
+ */
+typedef struct async_writer_settings
+{
+  /**
+   * @brief Maximum number of files encoded or in flight at once, 0 for the default.
+   * Every file in flight owns an encode buffer of its own.
+   */
+  uint32_t queue_depth;
+
+  /**
+   * @brief Worker threads of the thread pool backend, 0 for the default.
+   */
+  uint32_t thread_count;
+
+  /**
+   * @brief Flush every file to stable storage before closing it. With io_uring the
+   * fsync is part of the file's chain, so it costs the submitting thread nothing.
+   */
+  bool sync_each_file;
+
+  async_writer_backend backend;
+} async_writer_settings;
+
+/**
+ * @brief Called once per submitted file when it has been written, or has failed.
+ *
+ * Runs on a thread owned by the writer and holds up the completion of other files
+ * while it runs. It must not submit files, wait for the writer or destroy it.
+ *
+ * @param context Value given to async_bmp_writer_submit.
+ * @param filepath Path of the file.
+ * @param error 0 on success, an errno value otherwise.
+ */
+typedef void (*async_write_callback)(void *context, const char *filepath, int error);
+
+/**
+ * @brief Writer that encodes matrices as BMP files and writes them out in the
+ * background. Opaque, see create_async_bmp_writer.
+ */
+typedef struct async_bmp_writer async_bmp_writer;
+
+/**
+ * @brief Create an async writer.
+ *
+ * Encode buffers are allocated as files are submitted and kept for reuse, so a
+ * steady stream of same-shape frames performs no allocation after the first
+ * queue_depth files.
+ *
+ * Pointer to a new writer, NULL otherwise.
+ *
+ * @param settings Writer settings, NULL for the defaults.
+ * @return struct async_bmp_writer*
+ */
+async_bmp_writer *create_async_bmp_writer(const async_writer_settings *settings);
+
+/**
+ * @brief Wait for every outstanding file, then release the writer.
+ *
+ * @param writer Pointer to an async writer, may be NULL.
+ */
+void destroy_async_bmp_writer(async_bmp_writer *writer);
+
+/**
+ * @brief Backend actually used by the writer (never ASYNC_WRITER_AUTO).
+ *
+ * @param writer Pointer to an async writer.
+ * @return enum async_writer_backend
+ */
+async_writer_backend async_bmp_writer_backend(const async_bmp_writer *writer);
+
+/**
+ * @brief Human readable name of a backend ("auto", "io_uring", "threads").
+ *
+ * @param backend Backend.
+ * @return const char*
+ */
+const char *async_writer_backend_name(async_writer_backend backend);
+
+/**
+ * @brief Encode mat as a BMP file and queue it to be written to filepath.
+ *
+ * mat is encoded before this returns, so the caller may reuse it immediately. The
+ * calling thread only blocks when queue_depth files are already in flight; it never
+ * waits on the filesystem itself.
+ *
+ * Return VALID_OP when the file was queued, not otherwise. Failures while writing are
+ * reported through callback and async_bmp_writer_wait_all.
+ *
+ * @param writer Pointer to an async writer.
+ * @param filepath Destination file.
+ * @param mat Matrix to encode.
+ * @param format BMP pixel format.
+ * @param callback Completion callback, may be NULL.
+ * @param context Passed to callback.
+ * @return enum mat_fn_status
+ */
+mat_fn_status async_bmp_writer_submit(async_bmp_writer *writer, const char *filepath,
+                                      matrix *mat, bmp_pixel_format format,
+                                      async_write_callback callback, void *context);
+
+/**
+ * @brief Block until every submitted file has completed.
+ *
+ * Return VALID_OP if every file completed since the previous call succeeded,
+ * FAILED_BMP_FILE_WRITE otherwise.
+ *
+ * @param writer Pointer to an async writer.
+ * @return enum mat_fn_status
+ */
+mat_fn_status async_bmp_writer_wait_all(async_bmp_writer *writer);
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+/**
+ * @brief A single RAW to BMP conversion.
+ */
+typedef struct batch_job
+{
+  /**
+   * @brief Filepath of the RAW file to read.
+   */
+  char *input;
+
+  /**
+   * @brief Filepath of the BMP file to write.
+   */
+  char *output;
+
+  /**
+   * @brief Horizontal dimension of the RAW frame.
+   */
+  uint16_t horizontal;
+
+  /**
+   * @brief Vertical dimension of the RAW frame.
+   */
+  uint16_t vertical;
+} batch_job;
+
+/**
+ * @brief Growable list of conversion jobs.
+ */
+typedef struct batch_job_list
+{
+  batch_job *jobs;
+  size_t count;
+  size_t capacity;
+} batch_job_list;
+
+/**
+ * @brief Summary of a completed batch run.
+ */
+typedef struct batch_stats
+{
+  size_t jobs_completed;
+  size_t jobs_failed;
+
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+
+  /**
+   * @brief Wall clock time of the whole run, in seconds.
+   */
+  double seconds;
+
+  /**
+   * @brief Index of the slowest job in the job list and its duration in seconds.
+   */
+  size_t slowest_job;
+  double slowest_seconds;
+} batch_stats;
+
+/**
+ * @brief Append a job to the list. The paths are copied.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param list Pointer to a job list, zero initialized before first use.
+ * @param input Filepath of the RAW file to read.
+ * @param output Filepath of the BMP file to write.
+ * @param horizontal Horizontal dimension of the RAW frame.
+ * @param vertical Vertical dimension of the RAW frame.
+ * @return enum mat_fn_status
+ */
+mat_fn_status batch_add_job(batch_job_list *list, const char *input,
+                            const char *output, uint16_t horizontal,
+                            uint16_t vertical);
+
+/**
+ * @brief Append the jobs described by a manifest file.
+ *
+ * Each non-empty line of the manifest holds "input output width height"
+ * separated by whitespace. Lines starting with '#' are ignored.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param list Pointer to a job list.
+ * @param manifest_path Filepath of the manifest.
+ * @return enum mat_fn_status
+ */
+mat_fn_status batch_load_manifest(batch_job_list *list, const char *manifest_path);
+
+/**
+ * @brief Append one job for every .raw file found in input_dir. Each output is
+ * written to output_dir with the .raw extension replaced by .bmp.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param list Pointer to a job list.
+ * @param input_dir Directory to scan for RAW files.
+ * @param output_dir Existing directory to write BMP files into.
+ * @param horizontal Horizontal dimension shared by every RAW file.
+ * @param vertical Vertical dimension shared by every RAW file.
+ * @return enum mat_fn_status
+ */
+mat_fn_status batch_load_directory(batch_job_list *list, const char *input_dir,
+                                   const char *output_dir, uint16_t horizontal,
+                                   uint16_t vertical);
+
+/**
+ * @brief Release every job in the list along with the list storage.
+ *
+ * @param list Pointer to a job list.
+ */
+void batch_free_jobs(batch_job_list *list);
+
+/**
+ * @brief Run every job in the list on a pool of worker threads.
+ *
+ * Jobs are split into one contiguous range per worker. A worker that runs out
+ * of jobs steals the back half of another worker's remaining range. Each worker
+ * keeps its own matrix and stripe buffer for the whole run.
+ *
+ * Return VALID_OP if every job succeeded, not otherwise.
+ *
+ * @param list Pointer to the job list to run.
+ * @param thread_count Number of worker threads. 0 uses every online core.
+ * @param stats Optional pointer filled in with a summary of the run.
+ * @return enum mat_fn_status
+ */
+mat_fn_status batch_run(const batch_job_list *list, unsigned thread_count,
+                        batch_stats *stats);
+
+#endif
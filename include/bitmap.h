@@ -3,6 +3,25 @@
 
 #include "matrix.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Combined length of the file, info and color headers (14 + 40 + 84).
+ */
+#define BMP_HEADER_BLOCK_SIZE 138
+
+/**
+ * @brief Pixel layouts that can be written out to a BMP file. Matrices are always
+ * RGB565; the 24 and 32-bit formats are expanded to 8 bits per channel on write.
+ */
+typedef enum bmp_pixel_format
+{
+  BMP_FORMAT_RGB565,
+  BMP_FORMAT_BGR888,
+  BMP_FORMAT_BGRA8888
+} bmp_pixel_format;
+
 /**
  * @brief General information for the image processor to help it understand how to 
  * begin reading our BMP file.
@@ -128,4 +147,430 @@ void deallocate_bmpcolorheader(BMPColorHeader *bmpColorHeaderPtr);
  */
 uint8_t write_rgb565_bmpfile(const char *filepath, struct matrix *mat);
 
+/**
+ * @brief Calculate the length in bytes of a single BMP pixel row, including the
+ * padding required to align each row to 4 bytes.
+ * 
+ * @param mat Pointer to existing matrix structure
+ * @return uint32_t 
+ */
+uint32_t calculate_bmp_row_stride(const struct matrix *mat);
+
+/**
+ * @brief Serialize the file, info and color headers describing mat into a
+ * little-endian byte buffer, ready to be written at the start of a BMP file.
+ * 
+ * @param mat Pointer to existing matrix structure
+ * @param header_block Destination buffer of at least BMP_HEADER_BLOCK_SIZE bytes.
+ */
+void serialize_rgb565_bmp_headers(const struct matrix *mat, uint8_t *header_block);
+
+/**
+ * @brief Number of bits used by a single pixel of the given format.
+ * 
+ * @param format BMP pixel format
+ * @return uint8_t 
+ */
+uint8_t bmp_bits_per_pixel(bmp_pixel_format format);
+
+/**
+ * @brief Calculate the length in bytes of a single BMP pixel row of the given
+ * format, including the padding required to align each row to 4 bytes.
+ * 
+ * @param mat Pointer to existing matrix structure
+ * @param format BMP pixel format
+ * @return uint32_t 
+ */
+uint32_t calculate_bmp_format_row_stride(const struct matrix *mat,
+                                         bmp_pixel_format format);
+
+/**
+ * @brief Serialize the file, info and color headers describing mat stored in the
+ * given pixel format into a little-endian byte buffer.
+ * 
+ * 16 and 32-bit formats are written as BI_BITFIELDS with their channel masks,
+ * 24-bit as BI_RGB.
+ * 
+ * @param mat Pointer to existing matrix structure
+ * @param format BMP pixel format
+ * @param header_block Destination buffer of at least BMP_HEADER_BLOCK_SIZE bytes.
+ */
+void serialize_bmp_headers(const struct matrix *mat, bmp_pixel_format format,
+                           uint8_t *header_block);
+
+/**
+ * @brief Write mat out to a BMP file using the given pixel format. RGB565 pixels
+ * are expanded to 8 bits per channel (with bit replication) for the 24 and 32-bit
+ * formats. Tiled matrices are accepted by every BMP writer and encoder; their rows
+ * are put back in order while they are packed.
+ * 
+ * @param filepath Destination file to write BMP data to.
+ * @param mat Matrix used as source data to write out.
+ * @param format BMP pixel format
+ * 
+ * Returns 0 on success. Non-zero otherwize.
+ * 
+ * @return uint8_t 
+ */
+uint8_t write_bmpfile(const char *filepath, struct matrix *mat,
+                      bmp_pixel_format format);
+
+/**
+ * @brief Same as write_bmpfile, but rows are converted into the caller provided
+ * scratch buffer and written out one stripe of rows at a time.
+ * 
+ * If scratch is NULL or too small to hold a single row, a stripe buffer is
+ * allocated for the duration of the call.
+ * 
+ * @param filepath Destination file to write BMP data to.
+ * @param mat Matrix used as source data to write out.
+ * @param format BMP pixel format
+ * @param scratch Reusable buffer used to build stripes of rows.
+ * @param scratch_size Length of scratch in bytes.
+ * 
+ * Returns 0 on success. Non-zero otherwize.
+ * 
+ * @return uint8_t 
+ */
+uint8_t write_bmpfile_buffered(const char *filepath, struct matrix *mat,
+                               bmp_pixel_format format, uint8_t *scratch,
+                               size_t scratch_size);
+
+/**
+ * @brief Same as write_rgb565_bmpfile, but rows are packed into the caller
+ * provided scratch buffer and written out one stripe of rows at a time.
+ * 
+ * If scratch is NULL or too small to hold a single row, a stripe buffer is
+ * allocated for the duration of the call.
+ * 
+ * @param filepath Destination file to write BMP data to.
+ * @param mat Matrix used as source data to write out.
+ * @param scratch Reusable buffer used to build stripes of rows.
+ * @param scratch_size Length of scratch in bytes.
+ * 
+ * Returns 0 on success. Non-zero otherwize.
+ * 
+ * @return uint8_t 
+ */
+uint8_t write_rgb565_bmpfile_buffered(const char *filepath, struct matrix *mat,
+                                      uint8_t *scratch, size_t scratch_size);
+
+/**
+ * @brief Rewrite, in place, only the rows of an existing 16-bit BMP file that changed
+ * in mat since its dirty rows were last cleared, then clear them.
+ * 
+ * The file must have been written from a matrix of the same dimensions (for example
+ * by write_rgb565_bmpfile): a 16-bit BI_BITFIELDS BMP with the RGB565 masks, long
+ * enough to hold every row. Any other file, 16-bit BI_RGB (555) included, is rejected
+ * before anything is written. Each run of consecutive dirty rows is written with
+ * positioned writes; untouched rows cost nothing. If dirty tracking is disabled on
+ * mat, every row is rewritten.
+ * 
+ * @param filepath Existing BMP file to update.
+ * @param mat Matrix used as source data to write out.
+ * 
+ * Returns 0 on success. Non-zero otherwize.
+ * 
+ * @return uint8_t 
+ */
+uint8_t update_rgb565_bmpfile(const char *filepath, struct matrix *mat);
+
+/**
+ * @brief Output settings of a BMP encoder.
+ */
+typedef struct bmp_encoder_settings
+{
+  /**
+   * @brief Bytes of pixel rows staged per write. Rounded to whole rows; 0 selects the
+   * default of 1 MiB.
+   */
+  size_t stripe_size;
+
+  /**
+   * @brief Flush every encoded file to stable storage before closing it.
+   */
+  bool sync_on_close;
+
+  /**
+   * @brief Emit the rows of every frame top to bottom instead, storing the image
+   * upside down. Costs nothing: only the order rows are packed in changes.
+   */
+  bool flip_vertical;
+
+  /**
+   * @brief Mirror every row left to right while packing it. Combined with
+   * flip_vertical this writes the frame rotated by 180 degrees.
+   */
+  bool mirror_horizontal;
+} bmp_encoder_settings;
+
+/**
+ * @brief Reusable BMP encoder for frames of one shape and pixel format. Opaque, see
+ * create_bmp_encoder.
+ */
+typedef struct bmp_encoder bmp_encoder;
+
+/**
+ * @brief Create an encoder for matrices of the given dimensions.
+ * 
+ * The 138-byte header block is serialized once here, and the stripe buffer used to
+ * pack rows is allocated once here. Encoding a frame afterwards performs no heap
+ * allocation.
+ * 
+ * Pointer to a newly created encoder, NULL otherwise.
+ * 
+ * @param horizontal_dim Horizontal dimension of the frames to encode.
+ * @param vertical_dim Vertical dimension of the frames to encode.
+ * @param format BMP pixel format
+ * @param settings Output settings, NULL for the defaults.
+ * @return struct bmp_encoder*
+ */
+bmp_encoder *create_bmp_encoder(uint16_t horizontal_dim, uint16_t vertical_dim,
+                                bmp_pixel_format format,
+                                const bmp_encoder_settings *settings);
+
+/**
+ * @brief Release an encoder and its buffers.
+ * 
+ * @param encoder Pointer to an existing encoder, may be NULL.
+ */
+void destroy_bmp_encoder(bmp_encoder *encoder);
+
+/**
+ * @brief Check whether an encoder was created for the dimensions of mat.
+ * 
+ * @param encoder Pointer to an existing encoder
+ * @param mat Pointer to existing matrix structure
+ * @return bool
+ */
+bool bmp_encoder_matches(const bmp_encoder *encoder, const struct matrix *mat);
+
+/**
+ * @brief Encode mat into a BMP file using the encoder's cached header and buffers.
+ * 
+ * The headers go out together with the first stripe of rows in a single write.
+ * 
+ * @param encoder Encoder created for the dimensions of mat.
+ * @param filepath Destination file to write BMP data to.
+ * @param mat Matrix used as source data to write out.
+ * 
+ * Returns 0 on success, 3 if mat does not match the encoder. Non-zero otherwize.
+ * 
+ * @return uint8_t 
+ */
+uint8_t bmp_encoder_write_file(bmp_encoder *encoder, const char *filepath,
+                               struct matrix *mat);
+
+/**
+ * @brief Destinations a bmp_encoder can encode into.
+ */
+typedef enum bmp_sink_type
+{
+  /**
+   * @brief Caller provided memory buffer, see bmp_encoder_encoded_size.
+   */
+  BMP_SINK_MEMORY,
+
+  /**
+   * @brief Already open file descriptor (file, pipe or socket), written sequentially.
+   */
+  BMP_SINK_FD,
+
+  /**
+   * @brief File created at its final size and encoded straight into a mapping of it.
+   */
+  BMP_SINK_MAPPED_FILE,
+
+  /**
+   * @brief Caller supplied function receiving the encoded bytes in order.
+   */
+  BMP_SINK_CALLBACK
+} bmp_sink_type;
+
+/**
+ * @brief Callback of a BMP_SINK_CALLBACK sink. Receives consecutive chunks of the
+ * encoded file and returns false to abort encoding.
+ */
+typedef bool (*bmp_sink_write_fn)(void *context, const uint8_t *data, size_t length);
+
+/**
+ * @brief Where an encoder writes its output. Build one with bmp_memory_sink,
+ * bmp_fd_sink, bmp_mapped_file_sink or bmp_callback_sink.
+ */
+typedef struct bmp_sink
+{
+  bmp_sink_type type;
+
+  uint8_t *buffer;
+  size_t capacity;
+
+  int fd;
+
+  const char *filepath;
+
+  bmp_sink_write_fn write;
+  void *context;
+
+  /**
+   * @brief Number of bytes produced by the last successful encode.
+   */
+  size_t written;
+} bmp_sink;
+
+/**
+ * @brief Sink encoding into buffer, which must hold bmp_encoder_encoded_size bytes.
+ * 
+ * @param buffer Destination memory.
+ * @param capacity Length of buffer in bytes.
+ * @return struct bmp_sink
+ */
+bmp_sink bmp_memory_sink(uint8_t *buffer, size_t capacity);
+
+/**
+ * @brief Sink writing to an open file descriptor. The descriptor stays open.
+ * 
+ * @param fd File descriptor opened for writing.
+ * @return struct bmp_sink
+ */
+bmp_sink bmp_fd_sink(int fd);
+
+/**
+ * @brief Sink creating filepath, sizing it with ftruncate and encoding straight into
+ * a shared mapping of it.
+ * 
+ * @param filepath Destination file to write BMP data to.
+ * @return struct bmp_sink
+ */
+bmp_sink bmp_mapped_file_sink(const char *filepath);
+
+/**
+ * @brief Sink handing the encoded bytes, one stripe at a time, to write_fn.
+ * 
+ * @param write_fn Function receiving the encoded bytes.
+ * @param context Passed through to write_fn.
+ * @return struct bmp_sink
+ */
+bmp_sink bmp_callback_sink(bmp_sink_write_fn write_fn, void *context);
+
+/**
+ * @brief Exact length in bytes of a BMP file produced by the encoder.
+ * 
+ * @param encoder Pointer to an existing encoder
+ * @return size_t
+ */
+size_t bmp_encoder_encoded_size(const bmp_encoder *encoder);
+
+/**
+ * @brief Encode mat into sink. On success sink->written holds the encoded length.
+ * 
+ * Memory and mapped file sinks receive the image directly, without staging rows
+ * through the stripe buffer.
+ * 
+ * @param encoder Encoder created for the dimensions of mat.
+ * @param sink Destination of the encoded bytes.
+ * @param mat Matrix used as source data to write out.
+ * 
+ * Returns 0 on success, 3 if mat does not match the encoder, 8 if a memory sink is
+ * too small. Non-zero otherwize.
+ * 
+ * @return uint8_t 
+ */
+uint8_t bmp_encoder_encode(bmp_encoder *encoder, bmp_sink *sink, struct matrix *mat);
+
+/**
+ * @brief Writer of one BMP file delivered a band of rows at a time. Opaque, see
+ * create_bmp_stripe_writer.
+ */
+typedef struct bmp_stripe_writer bmp_stripe_writer;
+
+/**
+ * @brief Create filepath and write the headers of a horizontal_dim x vertical_dim
+ * image whose rows are appended afterwards, top row first.
+ * 
+ * The file is a top-down BMP (negative height), so rows reach the file in the order
+ * they are appended and the image never has to be held in memory: the writer only
+ * keeps a stripe of about 1 MiB of packed rows, or a single row when rows are wider.
+ * Dimensions are not limited to those of a matrix, which makes the writer suited to
+ * mosaics stitched from several frames. Files of 4 GiB or more store 0 in the 32-bit
+ * size fields of the header.
+ * 
+ * Pointer to a newly created writer, NULL otherwise.
+ * 
+ * @param filepath Destination file to write BMP data to.
+ * @param horizontal_dim Width of the image, 1 to 2^31 - 1 pixels.
+ * @param vertical_dim Height of the image, 1 to 2^31 - 1 pixels.
+ * @param format BMP pixel format
+ * @return struct bmp_stripe_writer*
+ */
+bmp_stripe_writer *create_bmp_stripe_writer(const char *filepath,
+                                            uint32_t horizontal_dim,
+                                            uint32_t vertical_dim,
+                                            bmp_pixel_format format);
+
+/**
+ * @brief Append rows of RGB565 pixels below the rows appended so far.
+ * 
+ * Returns 0 on success, 3 if more rows are appended than the image holds. Non-zero
+ * otherwize.
+ * 
+ * @param writer Pointer to an existing writer.
+ * @param pixels First pixel of the first row.
+ * @param pitch Distance in pixels between the starts of consecutive rows, at least
+ * the width of the image.
+ * @param rows Number of rows.
+ * @return uint8_t 
+ */
+uint8_t bmp_stripe_writer_append_rows(bmp_stripe_writer *writer, const uint16_t *pixels,
+                                      size_t pitch, uint32_t rows);
+
+/**
+ * @brief Append every row of band below the rows appended so far. band must be as
+ * wide as the image, and may use any layout.
+ * 
+ * Returns 0 on success, 3 if band has the wrong width or more rows are appended than
+ * the image holds. Non-zero otherwize.
+ * 
+ * @param writer Pointer to an existing writer.
+ * @param band Matrix holding the next rows of the image.
+ * @return uint8_t 
+ */
+uint8_t bmp_stripe_writer_append(bmp_stripe_writer *writer, struct matrix *band);
+
+/**
+ * @brief Number of rows still to be appended before the image is complete.
+ * 
+ * @param writer Pointer to an existing writer.
+ * @return uint64_t
+ */
+uint64_t bmp_stripe_writer_rows_remaining(const bmp_stripe_writer *writer);
+
+/**
+ * @brief Write out the buffered rows, close the file and release the writer.
+ * 
+ * The writer is released even when this fails. A file closed before every row was
+ * appended is left truncated.
+ * 
+ * Returns 0 on success, 3 if rows are missing. Non-zero otherwize.
+ * 
+ * @param writer Pointer to an existing writer.
+ * @return uint8_t 
+ */
+uint8_t close_bmp_stripe_writer(bmp_stripe_writer *writer);
+
+/**
+ * @brief Read a BMP file into a newly allocated matrix.
+ * 
+ * Files in the layout written by write_rgb565_bmpfile (16-bit BI_BITFIELDS with
+ * 565 masks) are read with a single bulk read and flipped into top-down row order
+ * in place, so they round-trip byte for byte. Uncompressed 24-bit and 32-bit files
+ * are quantized to RGB565 by dropping the low bits of every channel. Bottom-up and
+ * top-down (negative height) files are both accepted.
+ * 
+ * Pointer to a new matrix, NULL otherwise.
+ * 
+ * @param filepath BMP file to read.
+ * @return struct matrix*
+ */
+struct matrix *read_rgb565_bmpfile(const char *filepath);
+
 #endif
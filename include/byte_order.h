@@ -0,0 +1,44 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <stdint.h>
+
+/**
+ * @brief Little-endian field accessors for the BMP and archive file formats. They work
+ * byte by byte, so dst and src need no alignment and the host byte order does not
+ * matter.
+ */
+static inline void put_le16(uint8_t *dst, uint16_t value)
+{
+  dst[0] = (uint8_t)(value & 0xFF);
+  dst[1] = (uint8_t)(value >> 8);
+}
+
+static inline void put_le32(uint8_t *dst, uint32_t value)
+{
+  put_le16(dst, (uint16_t)(value & 0xFFFF));
+  put_le16(dst + 2, (uint16_t)(value >> 16));
+}
+
+static inline void put_le64(uint8_t *dst, uint64_t value)
+{
+  put_le32(dst, (uint32_t)(value & 0xFFFFFFFF));
+  put_le32(dst + 4, (uint32_t)(value >> 32));
+}
+
+static inline uint16_t get_le16(const uint8_t *src)
+{
+  return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *src)
+{
+  return (uint32_t)get_le16(src) | ((uint32_t)get_le16(src + 2) << 16);
+}
+
+static inline uint64_t get_le64(const uint8_t *src)
+{
+  return (uint64_t)get_le32(src) | ((uint64_t)get_le32(src + 4) << 32);
+}
+
+#endif
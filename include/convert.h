@@ -0,0 +1,222 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Instruction set used by the pixel conversion kernels.
+ */
+typedef enum convert_kernel_level
+{
+  CONVERT_KERNEL_SCALAR,
+  CONVERT_KERNEL_SSE2,
+  CONVERT_KERNEL_AVX2
+} convert_kernel_level;
+
+/**
+ * @brief Pixel layouts accepted when ingesting RAW frames. Every layout stores two
+ * bytes per pixel, so frames can be converted to RGB565 in place.
+ */
+typedef enum raw_pixel_format
+{
+  /**
+   * @brief Host order RGB565, the layout of matrix memory. Read verbatim.
+   */
+  RAW_FORMAT_RGB565,
+
+  /**
+   * @brief RGB565 with the two bytes of every pixel swapped (big-endian sensors on a
+   * little-endian host).
+   */
+  RAW_FORMAT_RGB565_SWAPPED,
+
+  /**
+   * @brief Host order 565 with blue in the top five bits and red in the bottom five.
+   */
+  RAW_FORMAT_BGR565,
+
+  /**
+   * @brief Host order X1R5G5B5. The top bit is ignored, green is widened to six bits.
+   */
+  RAW_FORMAT_RGB555,
+
+  /**
+   * @brief Packed YUV 4:2:2 as bytes Y0 U Y1 V, BT.601 limited range. Every pair of
+   * pixels shares one U and one V sample.
+   */
+  RAW_FORMAT_YUYV
+} raw_pixel_format;
+
+/**
+ * @brief Ordered dithering applied when quantizing 8-bit channels to RGB565.
+ */
+typedef enum rgb565_dither
+{
+  /**
+   * @brief Truncate every channel.
+   */
+  RGB565_DITHER_NONE,
+
+  /**
+   * @brief Add a 4x4 Bayer threshold before truncating.
+   */
+  RGB565_DITHER_ORDERED_4X4,
+
+  /**
+   * @brief Add an 8x8 Bayer threshold before truncating.
+   */
+  RGB565_DITHER_ORDERED_8X8
+} rgb565_dither;
+
+/**
+ * @brief Return the kernel level currently used by the dispatched conversion functions.
+ *
+ * On first use this is the best level supported by the running CPU.
+ *
+ * @return enum convert_kernel_level
+ */
+convert_kernel_level get_convert_kernel_level(void);
+
+/**
+ * @brief Force the dispatched conversion functions to a given kernel level. Levels the
+ * running CPU does not support are lowered to the best supported one.
+ *
+ * Returns the level actually selected.
+ *
+ * @param level Requested kernel level.
+ * @return enum convert_kernel_level
+ */
+convert_kernel_level set_convert_kernel_level(convert_kernel_level level);
+
+/**
+ * @brief Human readable name of a kernel level ("scalar", "sse2", "avx2").
+ *
+ * @param level Kernel level.
+ * @return const char*
+ */
+const char *convert_kernel_name(convert_kernel_level level);
+
+/**
+ * @brief Quantize 24-bit R, G, B byte triplets to RGB565, optionally with ordered
+ * dithering.
+ *
+ * With dithering, each channel gets a threshold from the Bayer matrix cell at (row,
+ * column) added before its low bits are dropped, scaled so that the thresholds
+ * average out to rounding to nearest. Column 0 of the matrix lines up with src[0].
+ *
+ * @param src Source pixels, 3 * count bytes.
+ * @param dst Destination buffer of at least count pixels.
+ * @param count Number of pixels to convert.
+ * @param dither Dithering to apply.
+ * @param row Image row of the pixels, selects the row of the Bayer matrix.
+ */
+void rgb888_to_rgb565_row(const uint8_t *src, uint16_t *dst, size_t count,
+                          rgb565_dither dither, uint32_t row);
+
+/**
+ * @brief Scalar reference implementation of rgb888_to_rgb565_row.
+ */
+void rgb888_to_rgb565_row_scalar(const uint8_t *src, uint16_t *dst, size_t count,
+                                 rgb565_dither dither, uint32_t row);
+
+/**
+ * @brief Name of a RAW pixel format ("rgb565", "rgb565be", "bgr565", "rgb555", "yuyv").
+ *
+ * @param format RAW pixel format.
+ * @return const char*
+ */
+const char *raw_pixel_format_name(raw_pixel_format format);
+
+/**
+ * @brief Look up a RAW pixel format by the name raw_pixel_format_name gives it.
+ *
+ * Returns 0 on success. Non-zero otherwize.
+ *
+ * @param name Format name.
+ * @param format Receives the format.
+ * @return uint8_t
+ */
+uint8_t parse_raw_pixel_format(const char *name, raw_pixel_format *format);
+
+/**
+ * @brief Convert count pixels of a RAW layout to RGB565.
+ *
+ * src and dst may be the same buffer, which converts a frame in place. For
+ * RAW_FORMAT_YUYV count must be even; a trailing odd pixel is left untouched.
+ *
+ * @param format Layout of the source pixels.
+ * @param src Source pixels, 2 * count bytes.
+ * @param dst Destination buffer of at least count pixels.
+ * @param count Number of pixels to convert.
+ */
+void raw_to_rgb565_row(raw_pixel_format format, const void *src, uint16_t *dst,
+                       size_t count);
+
+/**
+ * @brief Scalar reference implementation of raw_to_rgb565_row.
+ */
+void raw_to_rgb565_row_scalar(raw_pixel_format format, const void *src, uint16_t *dst,
+                              size_t count);
+
+/**
+ * @brief Expand RGB565 pixels to 24-bit B, G, R byte triplets.
+ *
+ * Each channel is widened to 8 bits by replicating its top bits into the new low bits,
+ * so 0x1F maps to 0xFF and 0x00 to 0x00.
+ *
+ * @param src Source RGB565 pixels.
+ * @param dst Destination buffer of at least 3 * count bytes.
+ * @param count Number of pixels to convert.
+ */
+void rgb565_to_bgr888_row(const uint16_t *src, uint8_t *dst, size_t count);
+
+/**
+ * @brief Expand RGB565 pixels to 32-bit B, G, R, A byte quadruplets with opaque alpha.
+ *
+ * @param src Source RGB565 pixels.
+ * @param dst Destination buffer of at least 4 * count bytes.
+ * @param count Number of pixels to convert.
+ */
+void rgb565_to_bgra8888_row(const uint16_t *src, uint8_t *dst, size_t count);
+
+/**
+ * @brief Scalar reference implementation of rgb565_to_bgr888_row.
+ */
+void rgb565_to_bgr888_row_scalar(const uint16_t *src, uint8_t *dst, size_t count);
+
+/**
+ * @brief Scalar reference implementation of rgb565_to_bgra8888_row.
+ */
+void rgb565_to_bgra8888_row_scalar(const uint16_t *src, uint8_t *dst, size_t count);
+
+/**
+ * @brief Quantize 24-bit B, G, R byte triplets to RGB565 by dropping the low bits of
+ * each channel. Exactly undoes rgb565_to_bgr888_row.
+ *
+ * @param src Source pixels, 3 * count bytes.
+ * @param dst Destination buffer of at least count pixels.
+ * @param count Number of pixels to convert.
+ */
+void bgr888_to_rgb565_row(const uint8_t *src, uint16_t *dst, size_t count);
+
+/**
+ * @brief Quantize 32-bit B, G, R, A byte quadruplets to RGB565, ignoring alpha.
+ *
+ * @param src Source pixels, 4 * count bytes.
+ * @param dst Destination buffer of at least count pixels.
+ * @param count Number of pixels to convert.
+ */
+void bgra8888_to_rgb565_row(const uint8_t *src, uint16_t *dst, size_t count);
+
+/**
+ * @brief Scalar reference implementation of bgr888_to_rgb565_row.
+ */
+void bgr888_to_rgb565_row_scalar(const uint8_t *src, uint16_t *dst, size_t count);
+
+/**
+ * @brief Scalar reference implementation of bgra8888_to_rgb565_row.
+ */
+void bgra8888_to_rgb565_row_scalar(const uint8_t *src, uint16_t *dst, size_t count);
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef ERRORS_H
+#define ERRORS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+/**
+ * @brief Longest message kept in an error record, terminating NUL included. Longer
+ * messages are truncated.
+ */
+#define MAT_ERROR_MESSAGE_SIZE 160
+
+/**
+ * @brief Where the library sends the details of a failure.
+ */
+typedef enum mat_error_output
+{
+  /**
+   * @brief Print every error to stdout as well as recording it. The default, and the
+   * behaviour of the library before error records existed.
+   */
+  MAT_ERRORS_PRINT,
+
+  /**
+   * @brief Only record errors: in the last error of the failing thread and, when
+   * enabled, in the error ring. Nothing is printed, so a caller feeding bad input
+   * in a loop does not turn stdout into a bottleneck.
+   */
+  MAT_ERRORS_QUIET
+} mat_error_output;
+
+/**
+ * @brief Details of one failure.
+ */
+typedef struct mat_error
+{
+  /**
+   * @brief Status returned by the failing function. Functions returning pointers or
+   * numeric codes report the closest status.
+   */
+  mat_fn_status status;
+
+  /**
+   * @brief Name of the reporting function, a string literal.
+   */
+  const char *function;
+
+  /**
+   * @brief Per-process sequence number, so records from the ring and from the last
+   * error of several threads can be ordered.
+   */
+  uint64_t sequence;
+
+  char message[MAT_ERROR_MESSAGE_SIZE];
+} mat_error;
+
+/**
+ * @brief Choose whether errors are printed. May be called at any time from any
+ * thread.
+ *
+ * @param output MAT_ERRORS_PRINT or MAT_ERRORS_QUIET.
+ */
+void mat_set_error_output(mat_error_output output);
+
+/**
+ * @brief Current error output, see mat_set_error_output.
+ *
+ * @return mat_error_output
+ */
+mat_error_output mat_get_error_output(void);
+
+/**
+ * @brief Record a failure of the calling function. Use through mat_report_error.
+ *
+ * @param status Status the caller is about to return.
+ * @param function Name of the caller.
+ * @param format printf style message, without a trailing newline.
+ */
+void mat_record_error(mat_fn_status status, const char *function, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Record a failure of the enclosing function with a printf style message.
+ */
+#define mat_report_error(status, ...) mat_record_error((status), __func__, __VA_ARGS__)
+
+/**
+ * @brief Copy the most recent error reported by the calling thread.
+ *
+ * Returns true if the thread reported an error since it started or since
+ * mat_clear_last_error, false otherwise.
+ *
+ * @param error Receives the record.
+ * @return bool
+ */
+bool mat_get_last_error(mat_error *error);
+
+/**
+ * @brief Forget the last error of the calling thread.
+ */
+void mat_clear_last_error(void);
+
+/**
+ * @brief Also queue every error into a bounded ring that mat_drain_errors empties.
+ *
+ * The ring is lock-free: any number of threads report into it and drain it at the
+ * same time. When it is full new errors are dropped and counted instead of blocking
+ * the reporting thread, see mat_dropped_errors. Enabling an already enabled ring
+ * replaces it, discarding its contents. Enabling and disabling may happen while other
+ * threads report or drain: the old ring is freed only after every thread still using
+ * it has finished with it.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param capacity Number of records kept, rounded up to a power of two, at least 2.
+ * @return enum mat_fn_status
+ */
+mat_fn_status mat_enable_error_ring(size_t capacity);
+
+/**
+ * @brief Release the error ring. Errors are only kept as the last error of each
+ * thread afterwards.
+ *
+ * Waits for threads reporting into or draining the ring to finish with it.
+ */
+void mat_disable_error_ring(void);
+
+/**
+ * @brief Move up to capacity queued errors, oldest first, into errors.
+ *
+ * Returns the number of records copied, 0 when the ring is empty or disabled.
+ *
+ * @param errors Receives the records.
+ * @param capacity Size of errors.
+ * @return size_t
+ */
+size_t mat_drain_errors(mat_error *errors, size_t capacity);
+
+/**
+ * @brief Errors that could not be queued because the ring was full, since it was
+ * enabled.
+ *
+ * @return uint64_t
+ */
+uint64_t mat_dropped_errors(void);
+
+#endif
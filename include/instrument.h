@@ -0,0 +1,278 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "matrix.h"
+
+/**
+ * @brief Stages of a conversion that keep a monotonic timer. Every timed section adds
+ * its duration to the stage's total.
+ */
+typedef enum instrument_stage
+{
+  /**
+   * @brief Reading RAW, PPM, BMP, QOI or archive data from a file.
+   */
+  INSTRUMENT_STAGE_READ,
+
+  /**
+   * @brief Converting ingested pixels (RAW layouts, RGB888, 24/32-bit BMP rows) to
+   * RGB565.
+   */
+  INSTRUMENT_STAGE_CONVERT,
+
+  /**
+   * @brief Drawing lines, rectangles and filled shapes into a matrix.
+   */
+  INSTRUMENT_STAGE_DRAW,
+
+  /**
+   * @brief Building and serializing BMP headers.
+   */
+  INSTRUMENT_STAGE_HEADER,
+
+  /**
+   * @brief Packing matrix rows into BMP pixel data.
+   */
+  INSTRUMENT_STAGE_ENCODE,
+
+  /**
+   * @brief Opening, writing, syncing and closing output files.
+   */
+  INSTRUMENT_STAGE_WRITE,
+
+  INSTRUMENT_STAGE_COUNT
+} instrument_stage;
+
+/**
+ * @brief Running totals kept by the library.
+ */
+typedef enum instrument_counter
+{
+  INSTRUMENT_BYTES_READ,
+  INSTRUMENT_BYTES_WRITTEN,
+
+  /**
+   * @brief File system calls issued: open, read, write, fsync, close and
+   * io_uring_enter, with every stdio call that maps onto one counted as one.
+   */
+  INSTRUMENT_SYSCALLS,
+
+  /**
+   * @brief Pixels written by the drawing and pixel writing functions.
+   */
+  INSTRUMENT_PIXELS_DRAWN,
+
+  /**
+   * @brief Frames written out as BMP files, QOI images or archive entries.
+   */
+  INSTRUMENT_FRAMES_PROCESSED,
+
+  INSTRUMENT_COUNTER_COUNT
+} instrument_counter;
+
+/**
+ * @brief Per-frame latencies collected into histograms.
+ */
+typedef enum instrument_histogram
+{
+  /**
+   * @brief Reading one frame into a matrix, conversion included.
+   */
+  INSTRUMENT_LATENCY_FRAME_READ,
+
+  /**
+   * @brief Encoding one frame and writing it out. For the async writer this runs from
+   * submission to completion.
+   */
+  INSTRUMENT_LATENCY_FRAME_WRITE,
+
+  /**
+   * @brief One frame end to end through the stream and batch pipelines.
+   */
+  INSTRUMENT_LATENCY_FRAME_TOTAL,
+
+  INSTRUMENT_HISTOGRAM_COUNT
+} instrument_histogram;
+
+/**
+ * @brief Histogram buckets. Bucket i counts latencies in [2^i, 2^(i+1)) nanoseconds.
+ */
+#define INSTRUMENT_HISTOGRAM_BUCKETS 40
+
+typedef struct instrument_stage_stats
+{
+  uint64_t calls;
+  uint64_t total_ns;
+  uint64_t max_ns;
+} instrument_stage_stats;
+
+typedef struct instrument_histogram_stats
+{
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t buckets[INSTRUMENT_HISTOGRAM_BUCKETS];
+} instrument_histogram_stats;
+
+/**
+ * @brief Copy of every timer, counter and histogram, see instrument_get_snapshot.
+ */
+typedef struct instrument_snapshot
+{
+  /**
+   * @brief False when the library was built without MATRIX_INSTRUMENTATION, in
+   * which case everything else is zero.
+   */
+  bool enabled;
+
+  instrument_stage_stats stages[INSTRUMENT_STAGE_COUNT];
+  uint64_t counters[INSTRUMENT_COUNTER_COUNT];
+  instrument_histogram_stats histograms[INSTRUMENT_HISTOGRAM_COUNT];
+} instrument_snapshot;
+
+/**
+ * @brief Whether the library records anything, i.e. was built with
+ * MATRIX_INSTRUMENTATION.
+ *
+ * @return bool
+ */
+bool instrument_enabled(void);
+
+/**
+ * @brief Monotonic clock in nanoseconds.
+ *
+ * @return uint64_t
+ */
+uint64_t instrument_now_ns(void);
+
+/**
+ * @brief Same clock as instrument_now_ns in seconds, for the wall clock totals of the
+ * stream, batch and archive statistics.
+ *
+ * @return double
+ */
+double instrument_now_seconds(void);
+
+/**
+ * @brief Add the time elapsed since start_ns to a stage.
+ *
+ * Returns the current time, so consecutive stages can be timed from one variable.
+ *
+ * @param stage Stage to charge.
+ * @param start_ns Value of instrument_now_ns when the section began.
+ * @return uint64_t
+ */
+uint64_t instrument_record_stage(instrument_stage stage, uint64_t start_ns);
+
+/**
+ * @brief Add the time elapsed since start_ns to a latency histogram.
+ *
+ * @param histogram Histogram to update.
+ * @param start_ns Value of instrument_now_ns when the frame began.
+ */
+void instrument_record_latency(instrument_histogram histogram, uint64_t start_ns);
+
+/**
+ * @brief Add amount to a counter.
+ *
+ * @param counter Counter to update.
+ * @param amount Value to add.
+ */
+void instrument_count(instrument_counter counter, uint64_t amount);
+
+/**
+ * @brief Copy the current values of every timer, counter and histogram.
+ *
+ * Each value is read atomically, but values updated by other threads during the copy
+ * may be from slightly different moments.
+ *
+ * @param snapshot Receives the values.
+ */
+void instrument_get_snapshot(instrument_snapshot *snapshot);
+
+/**
+ * @brief Zero every timer, counter and histogram.
+ */
+void instrument_reset(void);
+
+/**
+ * @brief Upper bound, in nanoseconds, of the bucket holding the given quantile of a
+ * histogram, 0 when it is empty.
+ *
+ * @param histogram Histogram of a snapshot.
+ * @param quantile Quantile between 0 and 1, e.g. 0.99.
+ * @return uint64_t
+ */
+uint64_t instrument_histogram_quantile(const instrument_histogram_stats *histogram,
+                                       double quantile);
+
+/**
+ * @brief Name of a stage as used in JSON output ("read", "convert", ...).
+ *
+ * @param stage Stage.
+ * @return const char*
+ */
+const char *instrument_stage_name(instrument_stage stage);
+
+/**
+ * @brief Name of a counter as used in JSON output ("bytes_read", ...).
+ *
+ * @param counter Counter.
+ * @return const char*
+ */
+const char *instrument_counter_name(instrument_counter counter);
+
+/**
+ * @brief Name of a histogram as used in JSON output ("frame_read", ...).
+ *
+ * @param histogram Histogram.
+ * @return const char*
+ */
+const char *instrument_histogram_name(instrument_histogram histogram);
+
+/**
+ * @brief Write a snapshot as a JSON document.
+ *
+ * @param file Destination stream.
+ * @param snapshot Values to write.
+ */
+void instrument_write_json(FILE *file, const instrument_snapshot *snapshot);
+
+/**
+ * @brief Dump a JSON snapshot to filepath when the process exits and every time it
+ * receives SIGUSR1.
+ *
+ * SIGUSR1 is blocked in the calling thread and collected by a dedicated thread with
+ * sigwait, so call this from main before any other thread is started; threads started
+ * afterwards inherit the blocked signal. Each dump replaces the file. Calling this
+ * again only changes the destination.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param filepath Destination file, NULL for stderr.
+ * @return enum mat_fn_status
+ */
+mat_fn_status instrument_install_dump(const char *filepath);
+
+#ifdef MATRIX_INSTRUMENTATION
+
+#define INSTRUMENT_TIMER(name) uint64_t name = instrument_now_ns()
+#define INSTRUMENT_LAP(stage, name) ((name) = instrument_record_stage((stage), (name)))
+#define INSTRUMENT_LATENCY(histogram, name) instrument_record_latency((histogram), (name))
+#define INSTRUMENT_COUNT(counter, amount) instrument_count((counter), (uint64_t)(amount))
+
+#else
+
+// Without MATRIX_INSTRUMENTATION the hooks compile to nothing and their arguments are
+// never evaluated.
+#define INSTRUMENT_TIMER(name) ((void)0)
+#define INSTRUMENT_LAP(stage, name) ((void)0)
+#define INSTRUMENT_LATENCY(histogram, name) ((void)0)
+#define INSTRUMENT_COUNT(counter, amount) ((void)0)
+
+#endif
+
+#endif
@@ -1,7 +1,12 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+
+#include "convert.h"
 
 /**
  * @brief Enumeration of possible function status messages.
@@ -13,9 +18,48 @@ typedef enum mat_fn_status
   INVALID_PARAM,
   FAILED_MAT_ALLOCATION,
   FAILED_BINARY_FILE_READ,
-  FAILED_DRAW_OP
+  FAILED_DRAW_OP,
+  FAILED_BMP_FILE_WRITE
 } mat_fn_status;
 
+/**
+ * @brief Enumeration of where the memory backing a matrix comes from.
+ */
+typedef enum matrix_storage
+{
+  MATRIX_STORAGE_HEAP,
+  MATRIX_STORAGE_MAPPED,
+  MATRIX_STORAGE_POOLED
+} matrix_storage;
+
+/**
+ * @brief Enumeration of how the pixels of a matrix are ordered in memory.
+ */
+typedef enum matrix_layout
+{
+  /**
+   * @brief One row after the other. The default, and the only layout the file readers,
+   * QOI, archive, resample and transform functions accept.
+   */
+  MATRIX_LAYOUT_ROW_MAJOR,
+
+  /**
+   * @brief Square tiles of 8x8 pixels (two cache lines), stored one after the other in
+   * row-major order, each holding its pixels in row-major order. A column then moves
+   * 16 bytes per row inside a tile instead of a whole matrix row, which keeps vertical
+   * lines and other column-oriented work in cache on wide matrices.
+   */
+  MATRIX_LAYOUT_TILED_8X8,
+
+  /**
+   * @brief Same as MATRIX_LAYOUT_TILED_8X8 with 16x16 tiles (eight cache lines), which
+   * keeps longer runs of a row contiguous.
+   */
+  MATRIX_LAYOUT_TILED_16X16
+} matrix_layout;
+
+struct matrix_pool;
+
 /**
  * @brief Data structure for representing a traditional matrix structure
  * in similar libraries and package.
@@ -25,9 +69,12 @@ typedef struct matrix
 {
 
   /**
-   * @brief Absolute size of the underlying memory pointed by *mem
+   * @brief Absolute size of the underlying memory pointed by *mem, in pixels. 64 bits
+   * wide so that sizes derived from it (bytes, BMP payloads) never wrap. Tiled matrices
+   * round both dimensions up to whole tiles, so their size may exceed
+   * horizontal * vertical.
    */
-  uint32_t size;
+  uint64_t size;
 
   /**
    * @brief Horizontal dimension of the matrix.
@@ -43,6 +90,37 @@ typedef struct matrix
    * @brief Pointer to the underlying memory representing the matrix.
    */
   uint16_t *mem;
+
+  /**
+   * @brief Order of the pixels in *mem. Use calculate_offset rather than assuming rows.
+   */
+  matrix_layout layout;
+
+  /**
+   * @brief Where the memory pointed by *mem comes from.
+   */
+  matrix_storage storage;
+
+  /**
+   * @brief Start of the mapping containing *mem when storage is MATRIX_STORAGE_MAPPED.
+   */
+  void *map_base;
+
+  /**
+   * @brief Length of the mapping starting at map_base.
+   */
+  size_t map_length;
+
+  /**
+   * @brief Pool the matrix is returned to when storage is MATRIX_STORAGE_POOLED.
+   */
+  struct matrix_pool *pool;
+
+  /**
+   * @brief One flag per row set whenever the row is modified, or NULL when dirty
+   * tracking is disabled. See enable_dirty_tracking.
+   */
+  uint8_t *dirty_rows;
 } matrix;
 
 /**
@@ -55,6 +133,17 @@ typedef struct matrix
  */
 mat_fn_status zero_matrix(matrix *mat);
 
+/**
+ * @brief Set every pixel of the matrix to the same color.
+ *
+ * VALID_OP on success, not otherwise.
+ *
+ * @param mat Pointer to an existing matrix structure
+ * @param color Color code to fill the matrix with
+ * @return enum mat_fn_status
+ */
+mat_fn_status fill_matrix(matrix *mat, uint16_t color);
+
 /**
  * @brief Allocate a new matrix given a horizontal and vertical dimension.
  *
@@ -67,7 +156,57 @@ mat_fn_status zero_matrix(matrix *mat);
 struct matrix *allocate_matrix(uint16_t horizontal_dim, uint16_t vertical_dim);
 
 /**
- * @brief Deallocate existing matrix structure.
+ * @brief Allocate a new matrix whose pixels are stored in the given layout.
+ *
+ * Pointer to a newly allocated matrix, NULL otherwise.
+ *
+ * @param horizontal_dim Indicate the horizontal dimension for matrix
+ * @param vertical_dim Indicate the vertical dimension for the matrix structure
+ * @param layout Order of the pixels in memory.
+ * @return struct matrix*
+ */
+struct matrix *allocate_matrix_layout(uint16_t horizontal_dim, uint16_t vertical_dim,
+                                      matrix_layout layout);
+
+/**
+ * @brief Copy every pixel of src into dst, converting between their layouts.
+ *
+ * Both matrices must have the same dimensions. The copy moves whole runs of a row at
+ * a time, i.e. one tile row when either side is tiled.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param src Pointer to the matrix to copy.
+ * @param dst Pointer to a distinct matrix receiving the pixels.
+ * @return enum mat_fn_status
+ */
+mat_fn_status convert_matrix_layout(matrix *src, matrix *dst);
+
+/**
+ * @brief Whether the pixels of mat are stored row after row, as required by every
+ * function that hands rows of mat->mem to other code.
+ *
+ * @param mat Pointer to a matrix struct.
+ * @return bool
+ */
+bool matrix_is_row_major(const matrix *mat);
+
+/**
+ * @brief Copy count pixels of a row, starting at start_col, into dst whatever the layout
+ * of the matrix. The span must lie inside the matrix.
+ *
+ * @param mat Pointer to a matrix struct.
+ * @param row Row to read.
+ * @param start_col First column to read.
+ * @param count Number of pixels to copy.
+ * @param dst Destination of count pixels.
+ */
+void copy_matrix_row(const matrix *mat, uint16_t row, uint16_t start_col, uint32_t count,
+                     uint16_t *dst);
+
+/**
+ * @brief Deallocate existing matrix structure. Pooled matrices are handed back to
+ * their pool instead.
  *
  * Return VALID_OP on success, not otherwise.
  *
@@ -76,6 +215,45 @@ struct matrix *allocate_matrix(uint16_t horizontal_dim, uint16_t vertical_dim);
  */
 mat_fn_status deallocate_matrix(matrix *mat);
 
+/**
+ * @brief Start recording which rows of the matrix get modified. Every row starts clean.
+ *
+ * Once enabled, the pixel writers, draw and fill functions and the binary file readers
+ * flag each row they touch in mat->dirty_rows. Code writing to mat->mem directly should
+ * call mark_dirty_rows.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param mat Pointer to a matrix struct.
+ * @return enum mat_fn_status
+ */
+mat_fn_status enable_dirty_tracking(matrix *mat);
+
+/**
+ * @brief Stop recording modified rows and release the dirty row flags.
+ *
+ * @param mat Pointer to a matrix struct.
+ */
+void disable_dirty_tracking(matrix *mat);
+
+/**
+ * @brief Flag every row as clean again, typically after the changes have been written
+ * out.
+ *
+ * @param mat Pointer to a matrix struct.
+ */
+void clear_dirty_rows(matrix *mat);
+
+/**
+ * @brief Flag rows [first_row, last_row] as modified. Does nothing when dirty tracking
+ * is disabled.
+ *
+ * @param mat Pointer to a matrix struct.
+ * @param first_row First modified row.
+ * @param last_row Last modified row.
+ */
+void mark_dirty_rows(matrix *mat, uint16_t first_row, uint16_t last_row);
+
 /**
  * @brief Print out to console the entire matrix structure. Used for debugging.
  *
@@ -88,16 +266,16 @@ mat_fn_status print_matrix(matrix *mat);
 
 /**
  * @brief Given a matrix and position (row, column), calculate the position in the underlying
- * matrix memory to retrieve the correct pixel.
+ * matrix memory to retrieve the correct pixel, following the layout of the matrix.
  *
  * Returns calculated index position.
  *
  * @param mat existing pointer to a matrix structure.
  * @param row Row position in the matrix.
  * @param column Column position in the matrix.
- * @return uint32_t
+ * @return uint64_t
  */
-uint32_t calculate_offset(matrix *mat, uint16_t row, uint16_t column);
+uint64_t calculate_offset(matrix *mat, uint16_t row, uint16_t column);
 
 /**
  * @brief Given individually specified color values, write data at position (column, row).
@@ -130,9 +308,129 @@ mat_fn_status write_rgb565_pixel_rgb(matrix *mat, uint8_t red,
 mat_fn_status write_rgb565_pixel_code(matrix *mat, uint16_t color,
                                       uint16_t row, uint16_t column);
 
+/**
+ * @brief A single pixel of a batch written with write_rgb565_pixels_code.
+ */
+typedef struct rgb565_pixel_code
+{
+  uint16_t row;
+  uint16_t column;
+  uint16_t color;
+} rgb565_pixel_code;
+
+/**
+ * @brief A single pixel of a batch written with write_rgb565_pixels_rgb. Channels use
+ * the same 5/6/5 bit ranges as write_rgb565_pixel_rgb.
+ */
+typedef struct rgb565_pixel_rgb
+{
+  uint16_t row;
+  uint16_t column;
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+} rgb565_pixel_rgb;
+
+/**
+ * @brief Options for the batched pixel writers. Combine with bitwise or.
+ */
+typedef enum pixel_batch_flags
+{
+  /**
+   * @brief Reject the whole batch, writing nothing, if any pixel is out of bounds.
+   */
+  PIXEL_BATCH_VALIDATE = 0x00,
+
+  /**
+   * @brief Skip out of bounds pixels and write the rest.
+   */
+  PIXEL_BATCH_CLIP = 0x01,
+
+  /**
+   * @brief Sort the batch in place by row before writing, so the writes walk the
+   * matrix memory one row at a time. The sort is stable, so when several pixels share
+   * a position the last one in the batch still wins. A rejected batch is left in its
+   * original order.
+   *
+   * This is a locality option, not a speed-up for a single call: the sort costs more
+   * than it saves on one write (1e6 random pixels on 1080p, -O2: 4.3 ms unsorted,
+   * 6.8 ms sorted and written). It pays off when the caller keeps the sorted batch,
+   * whose later writes take 1.6 ms, or walks it row by row afterwards.
+   */
+  PIXEL_BATCH_SORT_ROWS = 0x02
+} pixel_batch_flags;
+
+/**
+ * @brief Write a batch of (row, column, color) pixels.
+ *
+ * The batch is checked against the matrix bounds once up front. When every pixel is in
+ * bounds they are written without any per pixel checks.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param mat Pointer to a matrix struct.
+ * @param pixels Array of pixels to write. Only reordered when PIXEL_BATCH_SORT_ROWS is
+ * set.
+ * @param count Number of pixels in the array.
+ * @param flags Combination of pixel_batch_flags.
+ * @return enum mat_fn_status
+ */
+mat_fn_status write_rgb565_pixels_code(matrix *mat, rgb565_pixel_code *pixels,
+                                       size_t count, uint8_t flags);
+
+/**
+ * @brief Write a batch of (row, column, red, green, blue) pixels.
+ *
+ * Behaves like write_rgb565_pixels_code.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param mat Pointer to a matrix struct.
+ * @param pixels Array of pixels to write. Only reordered when PIXEL_BATCH_SORT_ROWS is
+ * set.
+ * @param count Number of pixels in the array.
+ * @param flags Combination of pixel_batch_flags.
+ * @return enum mat_fn_status
+ */
+mat_fn_status write_rgb565_pixels_rgb(matrix *mat, rgb565_pixel_rgb *pixels,
+                                      size_t count, uint8_t flags);
+
+/**
+ * @brief Fill the pixels of a single row between start_col and end_col (inclusive).
+ *
+ * Coordinates are signed and may lie outside of the matrix; the span is clipped
+ * to the matrix once before being filled.
+ *
+ * @param mat Pointer to matrix structure.
+ * @param color Color to fill with.
+ * @param row Row position of the span.
+ * @param start_col First column of the span.
+ * @param end_col Last column of the span.
+ */
+void fill_clipped_span(matrix *mat, uint16_t color, int32_t row,
+                       int32_t start_col, int32_t end_col);
+
+/**
+ * @brief Fill every pixel of the rectangle [start_row, end_row] x [start_col, end_col].
+ *
+ * Coordinates are signed and may lie outside of the matrix; the rectangle is clipped
+ * to the matrix once before its rows are filled.
+ *
+ * @param mat Pointer to matrix structure.
+ * @param color Color to fill with.
+ * @param start_row First row of the rectangle.
+ * @param end_row Last row of the rectangle.
+ * @param start_col First column of the rectangle.
+ * @param end_col Last column of the rectangle.
+ */
+void fill_clipped_rect(matrix *mat, uint16_t color, int32_t start_row,
+                       int32_t end_row, int32_t start_col, int32_t end_col);
+
 /**
  * @brief Given a x position (column), draw a straight line from start_y to end_y.
  *
+ * A pt_size of 0 draws nothing.
+ *
  * @param mat Pointer to matrix structure.
  * @param color Color of the line.
  * @param pt_size Size of the line.
@@ -147,6 +445,8 @@ mat_fn_status draw_vertical_line(matrix *mat, uint16_t color, uint16_t pt_size,
 /**
  * @brief Given a y position (row), draw a straight line from start_x to end_x.
  *
+ * A pt_size of 0 draws nothing.
+ *
  * @param mat Pointer to matrix structure.
  * @param color Color of the line.
  * @param pt_size Size of the line.
@@ -161,6 +461,10 @@ mat_fn_status draw_horizontal_line(matrix *mat, uint16_t color, uint16_t pt_size
 /**
  * @brief Draw rectangle starting from one corner (start_x, start_y) to opposite corner (end_x, end_y)
  *
+ * (start_x, start_y) must be strictly above and left of (end_x, end_y); flat or
+ * inverted rectangles are rejected with INVALID_PARAM before any pixel is written. A
+ * pt_size of 0 draws nothing.
+ *
  * @param mat Pointer to matrix structure.
  * @param color Color of the rectangle.
  * @param pt_size Size of the lines.
@@ -184,4 +488,63 @@ mat_fn_status draw_rectangle(matrix *mat, uint16_t color, uint16_t pt_size,
  */
 mat_fn_status read_binary_file(matrix *mat, const char *filepath);
 
+/**
+ * @brief Read the next frame from an already opened RAW file into a pre-allocated matrix.
+ *
+ * Exactly mat->size pixels are consumed from file_ptr. A short read (including end of
+ * file) is reported as FAILED_BINARY_FILE_READ; use feof to tell the two apart.
+ *
+ * @param mat Pointer to matrix structure with the dimensions of a single frame.
+ * @param file_ptr File opened for binary reading, positioned at the start of a frame.
+ * @return enum mat_fn_status
+ */
+mat_fn_status read_binary_frame(matrix *mat, FILE *file_ptr);
+
+/**
+ * @brief Same as read_binary_file for a RAW file holding pixels of the given layout.
+ *
+ * The file is read in 64 KiB chunks straight into matrix memory, and every chunk is
+ * converted to RGB565 in place while it is still in cache. No second frame buffer is
+ * involved.
+ *
+ * @param mat Pointer to matrix structure.
+ * @param filepath Filepath to an existing file containing raw data.
+ * @param format Pixel layout of the file.
+ * @return enum mat_fn_status
+ */
+mat_fn_status read_binary_file_format(matrix *mat, const char *filepath,
+                                      raw_pixel_format format);
+
+/**
+ * @brief Same as read_binary_frame for a RAW file holding pixels of the given layout.
+ *
+ * Converts chunk by chunk in place, see read_binary_file_format.
+ *
+ * @param mat Pointer to matrix structure with the dimensions of a single frame.
+ * @param file_ptr File opened for binary reading, positioned at the start of a frame.
+ * @param format Pixel layout of the file.
+ * @return enum mat_fn_status
+ */
+mat_fn_status read_binary_frame_format(matrix *mat, FILE *file_ptr,
+                                       raw_pixel_format format);
+
+/**
+ * @brief Map a single frame of a RAW file into a new matrix without copying it.
+ *
+ * The returned matrix points directly into a private mapping of the file, so pages are
+ * only read in as they are touched. The file itself is never modified: draw operations
+ * on the matrix land in copy-on-write pages owned by this process. Release the matrix
+ * with deallocate_matrix.
+ *
+ * Pointer to a newly mapped matrix, NULL otherwise.
+ *
+ * @param filepath Filepath to an existing file containing raw data.
+ * @param horizontal_dim Horizontal dimension of a single frame.
+ * @param vertical_dim Vertical dimension of a single frame.
+ * @param frame_index Index of the frame to map, counted from the start of the file.
+ * @return struct matrix*
+ */
+struct matrix *map_binary_file(const char *filepath, uint16_t horizontal_dim,
+                               uint16_t vertical_dim, uint64_t frame_index);
+
 #endif
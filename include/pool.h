@@ -0,0 +1,98 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+/**
+ * @brief Alignment of every pooled matrix allocation and of its pixel memory.
+ */
+#define MATRIX_POOL_ALIGNMENT 64
+
+/**
+ * @brief How the pixels of a matrix handed out by a pool are initialized.
+ */
+typedef enum matrix_init
+{
+  /**
+   * @brief Every pixel is 0x0000.
+   */
+  MATRIX_INIT_ZERO,
+
+  /**
+   * @brief Pixels hold whatever the previous user left behind. Use when the matrix is
+   * about to be overwritten anyway, e.g. by read_binary_file.
+   */
+  MATRIX_INIT_UNINITIALIZED,
+
+  /**
+   * @brief Every pixel is set to the requested color.
+   */
+  MATRIX_INIT_FILL
+} matrix_init;
+
+/**
+ * @brief Recycler of same-shape matrices. Opaque, see create_matrix_pool.
+ */
+typedef struct matrix_pool matrix_pool;
+
+/**
+ * @brief Create a pool handing out matrices of the given shape.
+ *
+ * Each pooled matrix is a single MATRIX_POOL_ALIGNMENT aligned allocation holding both
+ * the matrix structure and its pixels. Released matrices are kept for reuse, up to
+ * max_cached of them, instead of going back to the allocator. The pool is safe to
+ * share between threads.
+ *
+ * Pointer to a newly created pool, NULL otherwise.
+ *
+ * @param horizontal_dim Horizontal dimension of every matrix in the pool.
+ * @param vertical_dim Vertical dimension of every matrix in the pool.
+ * @param max_cached Number of released matrices kept around for reuse.
+ * @return struct matrix_pool*
+ */
+matrix_pool *create_matrix_pool(uint16_t horizontal_dim, uint16_t vertical_dim,
+                                size_t max_cached);
+
+/**
+ * @brief Destroy a pool and every matrix it holds for reuse.
+ *
+ * Every matrix acquired from the pool must have been released first.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param pool Pointer to a matrix pool.
+ * @return enum mat_fn_status
+ */
+mat_fn_status destroy_matrix_pool(matrix_pool *pool);
+
+/**
+ * @brief Take a matrix from the pool, allocating a new one only if none is cached.
+ *
+ * Fresh zeroed matrices large enough to be mapped straight from the kernel rely on
+ * its zero filled pages instead of being cleared by hand.
+ *
+ * Pointer to a matrix, NULL otherwise.
+ *
+ * @param pool Pointer to a matrix pool.
+ * @param init How the pixels should be initialized.
+ * @param color Fill color, only used with MATRIX_INIT_FILL.
+ * @return struct matrix*
+ */
+matrix *matrix_pool_acquire(matrix_pool *pool, matrix_init init, uint16_t color);
+
+/**
+ * @brief Hand a matrix back to the pool it was acquired from. deallocate_matrix does
+ * the same for pooled matrices.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param pool Pointer to a matrix pool.
+ * @param mat Matrix previously acquired from pool.
+ * @return enum mat_fn_status
+ */
+mat_fn_status matrix_pool_release(matrix_pool *pool, matrix *mat);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef PPM_H
+#define PPM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "convert.h"
+#include "matrix.h"
+
+/**
+ * @brief Quantize a 24-bit R, G, B frame held in memory into mat.
+ *
+ * Rows are converted with rgb888_to_rgb565_row, so the dither pattern is anchored at
+ * the top left pixel of the frame.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param mat Destination matrix, its dimensions are those of the frame.
+ * @param pixels First byte of the top row.
+ * @param stride Distance in bytes between the starts of two rows, at least 3 * width.
+ * @param dither Dithering to apply.
+ * @return enum mat_fn_status
+ */
+mat_fn_status import_rgb888_frame(matrix *mat, const uint8_t *pixels, size_t stride,
+                                  rgb565_dither dither);
+
+/**
+ * @brief Read a headerless RAW RGB888 frame with the dimensions of mat.
+ *
+ * The file is read in stripes of about 1 MiB and every stripe is quantized straight
+ * into matrix memory, so the 24-bit frame is never held in full.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param mat Pointer to matrix structure.
+ * @param filepath File holding at least 3 * width * height bytes.
+ * @param dither Dithering to apply.
+ * @return enum mat_fn_status
+ */
+mat_fn_status read_rgb888_file(matrix *mat, const char *filepath, rgb565_dither dither);
+
+/**
+ * @brief Read a binary PPM (P6, maximum value 255) into a newly allocated matrix.
+ *
+ * Rows are quantized stripe by stripe like read_rgb888_file.
+ *
+ * Pointer to a new matrix, NULL otherwise.
+ *
+ * @param filepath PPM file to read.
+ * @param dither Dithering to apply.
+ * @return struct matrix*
+ */
+matrix *read_ppm_file(const char *filepath, rgb565_dither dither);
+
+#endif
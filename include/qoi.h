@@ -0,0 +1,79 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+/**
+ * @brief Length of the QOI header (magic, width, height, channels, colorspace).
+ */
+#define QOI_HEADER_SIZE 14
+
+/**
+ * @brief Length of the QOI end marker (seven 0x00 bytes followed by 0x01).
+ */
+#define QOI_END_MARKER_SIZE 8
+
+/**
+ * @brief Upper bound of the encoded length of mat, used to size encode buffers.
+ *
+ * @param mat Pointer to existing matrix structure
+ * @return size_t
+ */
+size_t calculate_qoi_max_size(const struct matrix *mat);
+
+/**
+ * @brief Losslessly encode mat as a 3-channel sRGB QOI image.
+ *
+ * RGB565 pixels are expanded to 8 bits per channel (with bit replication, as for 24-bit
+ * BMP output) inside the encode loop; decoding the result and dropping the low bits
+ * restores the matrix exactly.
+ *
+ * Returns the encoded length, 0 if mat is NULL or dst holds less than
+ * calculate_qoi_max_size bytes.
+ *
+ * @param mat Matrix used as source data to encode.
+ * @param dst Destination buffer.
+ * @param capacity Length of dst in bytes.
+ * @return size_t
+ */
+size_t encode_qoi(struct matrix *mat, uint8_t *dst, size_t capacity);
+
+/**
+ * @brief Decode a QOI image (3 or 4 channels) into a newly allocated matrix. Channels
+ * are truncated to RGB565 and alpha is ignored.
+ *
+ * Pointer to a new matrix, NULL if the data is not a valid QOI image, including
+ * streams that run out of chunks before the last pixel or lack the end marker.
+ *
+ * @param data Encoded QOI image.
+ * @param length Length of data in bytes.
+ * @return struct matrix*
+ */
+matrix *decode_qoi(const uint8_t *data, size_t length);
+
+/**
+ * @brief Encode mat as QOI and write it out to a to-be created file.
+ *
+ * @param filepath Destination file to write QOI data to.
+ * @param mat Matrix used as source data to write out.
+ *
+ * Returns 0 on success. Non-zero otherwize.
+ *
+ * @return uint8_t
+ */
+uint8_t write_qoi_file(const char *filepath, struct matrix *mat);
+
+/**
+ * @brief Read and decode a QOI file into a newly allocated matrix.
+ *
+ * Pointer to a new matrix, NULL otherwise.
+ *
+ * @param filepath QOI file to read.
+ * @return struct matrix*
+ */
+matrix *read_qoi_file(const char *filepath);
+
+#endif
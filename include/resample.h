@@ -0,0 +1,81 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+
+#include "matrix.h"
+
+/**
+ * @brief Shrink src by a power of two (2, 4 or 8) into dst with a box filter.
+ *
+ * Every destination pixel is the rounded mean of the factor x factor source block it
+ * covers, averaged per RGB565 channel. dst must be src / factor in both dimensions
+ * (rounded down); source rows and columns past the last whole block are ignored.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param src Source matrix.
+ * @param dst Destination matrix.
+ * @param factor Reduction factor, 2, 4 or 8.
+ * @return enum mat_fn_status
+ */
+mat_fn_status downscale_box(matrix *src, matrix *dst, uint8_t factor);
+
+/**
+ * @brief Same as downscale_box, restricted to destination rows [first_row, last_row].
+ *
+ * Bands never share a destination row, so disjoint bands of the same image can be
+ * produced concurrently from different threads.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param src Source matrix.
+ * @param dst Destination matrix.
+ * @param factor Reduction factor, 2, 4 or 8.
+ * @param first_row First destination row of the band.
+ * @param last_row Last destination row of the band (inclusive).
+ * @return enum mat_fn_status
+ */
+mat_fn_status downscale_box_rows(matrix *src, matrix *dst, uint8_t factor,
+                                 uint16_t first_row, uint16_t last_row);
+
+/**
+ * @brief Resize src to the dimensions of dst with bilinear interpolation.
+ *
+ * Pixel centers are aligned (the corners of both images coincide). Reducing by more
+ * than 2x skips source pixels; use downscale_box first for large reductions.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param src Source matrix.
+ * @param dst Destination matrix of any non-zero size.
+ * @return enum mat_fn_status
+ */
+mat_fn_status resize_bilinear(matrix *src, matrix *dst);
+
+/**
+ * @brief Same as resize_bilinear, restricted to destination rows [first_row, last_row].
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param src Source matrix.
+ * @param dst Destination matrix of any non-zero size.
+ * @param first_row First destination row of the band.
+ * @param last_row Last destination row of the band (inclusive).
+ * @return enum mat_fn_status
+ */
+mat_fn_status resize_bilinear_rows(matrix *src, matrix *dst, uint16_t first_row,
+                                   uint16_t last_row);
+
+/**
+ * @brief Allocate a thumbnail of src reduced by factor and fill it with downscale_box.
+ *
+ * Pointer to a new matrix, NULL otherwise.
+ *
+ * @param src Source matrix.
+ * @param factor Reduction factor, 2, 4 or 8.
+ * @return struct matrix*
+ */
+matrix *create_thumbnail(matrix *src, uint8_t factor);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef SHAPES_H
+#define SHAPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+/**
+ * @brief A vertex of a polygon. Coordinates are signed so shapes may extend
+ * past the edges of the matrix; anything outside is clipped.
+ */
+typedef struct matrix_point
+{
+  /**
+   * @brief Column position.
+   */
+  int32_t x;
+
+  /**
+   * @brief Row position.
+   */
+  int32_t y;
+} matrix_point;
+
+/**
+ * @brief Fill every pixel of the rectangle between two opposite corners (inclusive).
+ *
+ * The corners may be given in any order. The rectangle is clipped to the matrix.
+ *
+ * @param mat Pointer to matrix structure.
+ * @param color Color of the rectangle.
+ * @param start_x X position of initial corner.
+ * @param start_y Y position of initial corner.
+ * @param end_x X position of opposite corner.
+ * @param end_y Y position of opposite corner.
+ * @return enum mat_fn_status
+ */
+mat_fn_status fill_rectangle(matrix *mat, uint16_t color, int32_t start_x,
+                             int32_t start_y, int32_t end_x, int32_t end_y);
+
+/**
+ * @brief Fill every pixel within radius of a center point.
+ *
+ * @param mat Pointer to matrix structure.
+ * @param color Color of the circle.
+ * @param center_x Column of the center.
+ * @param center_y Row of the center.
+ * @param radius Radius in pixels.
+ * @return enum mat_fn_status
+ */
+mat_fn_status fill_circle(matrix *mat, uint16_t color, int32_t center_x,
+                          int32_t center_y, uint16_t radius);
+
+/**
+ * @brief Fill an axis aligned ellipse.
+ *
+ * @param mat Pointer to matrix structure.
+ * @param color Color of the ellipse.
+ * @param center_x Column of the center.
+ * @param center_y Row of the center.
+ * @param radius_x Horizontal radius in pixels.
+ * @param radius_y Vertical radius in pixels.
+ * @return enum mat_fn_status
+ */
+mat_fn_status fill_ellipse(matrix *mat, uint16_t color, int32_t center_x,
+                           int32_t center_y, uint16_t radius_x, uint16_t radius_y);
+
+/**
+ * @brief Fill a convex or concave (possibly self intersecting) polygon.
+ *
+ * Pixels are filled when their center lies inside the polygon according to the
+ * even-odd rule. Rows are produced by an active edge table scanline filler and
+ * every row is written as contiguous spans.
+ *
+ * @param mat Pointer to matrix structure.
+ * @param color Color of the polygon.
+ * @param points Vertices of the polygon. The last vertex connects back to the first.
+ * @param count Number of vertices, at least 3.
+ * @return enum mat_fn_status
+ */
+mat_fn_status fill_polygon(matrix *mat, uint16_t color, const matrix_point *points,
+                           size_t count);
+
+#endif
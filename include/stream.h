@@ -0,0 +1,69 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+
+#include "matrix.h"
+
+/**
+ * @brief Number of matrices cycled between the reader thread and the encoder.
+ */
+#define STREAM_RING_SIZE 3
+
+/**
+ * @brief Summary of a completed streaming conversion.
+ */
+typedef struct stream_stats
+{
+  /**
+   * @brief Number of frames written out as BMP files.
+   */
+  uint64_t frames;
+
+  /**
+   * @brief Wall clock time spent converting, in seconds.
+   */
+  double seconds;
+} stream_stats;
+
+/**
+ * @brief Convert every frame of a RAW RGB565 video file into its own BMP file.
+ *
+ * Frames are written to output_dir as frame_000000.bmp, frame_000001.bmp, etc.
+ * A dedicated thread reads frame N+1 into a small ring of matrices while the
+ * calling thread encodes and writes frame N. A trailing partial frame is
+ * ignored.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param raw_path Filepath to a RAW file made of consecutive frames.
+ * @param output_dir Existing directory to write BMP files into.
+ * @param horizontal Horizontal dimension of a single frame.
+ * @param vertical Vertical dimension of a single frame.
+ * @param stats Optional pointer filled in with the frame count and elapsed time.
+ * @return enum mat_fn_status
+ */
+mat_fn_status stream_convert_raw_file(const char *raw_path, const char *output_dir,
+                                      uint16_t horizontal, uint16_t vertical,
+                                      stream_stats *stats);
+
+/**
+ * @brief Same as stream_convert_raw_file for a RAW file holding pixels of the given
+ * layout. The reader thread converts every frame to RGB565 in place as it reads it.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param raw_path Filepath to a RAW file made of consecutive frames.
+ * @param output_dir Existing directory to write BMP files into.
+ * @param horizontal Horizontal dimension of a single frame.
+ * @param vertical Vertical dimension of a single frame.
+ * @param format Pixel layout of the RAW file.
+ * @param stats Optional pointer filled in with the frame count and elapsed time.
+ * @return enum mat_fn_status
+ */
+mat_fn_status stream_convert_raw_file_format(const char *raw_path, const char *output_dir,
+                                             uint16_t horizontal, uint16_t vertical,
+                                             raw_pixel_format format,
+                                             stream_stats *stats);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stdbool.h>
+
+#include "matrix.h"
+
+/**
+ * @brief Orientation corrections that can be applied to a matrix.
+ */
+typedef enum matrix_transform
+{
+  TRANSFORM_NONE,
+
+  /**
+   * @brief Rotate clockwise by 90 degrees. Swaps the dimensions.
+   */
+  TRANSFORM_ROTATE_90,
+
+  TRANSFORM_ROTATE_180,
+
+  /**
+   * @brief Rotate clockwise by 270 degrees (90 counter-clockwise). Swaps the dimensions.
+   */
+  TRANSFORM_ROTATE_270,
+
+  /**
+   * @brief Mirror left to right.
+   */
+  TRANSFORM_FLIP_HORIZONTAL,
+
+  /**
+   * @brief Mirror top to bottom.
+   */
+  TRANSFORM_FLIP_VERTICAL,
+
+  /**
+   * @brief Swap rows and columns. Swaps the dimensions.
+   */
+  TRANSFORM_TRANSPOSE
+} matrix_transform;
+
+/**
+ * @brief Whether transform exchanges the horizontal and vertical dimensions.
+ *
+ * @param transform Transform to query.
+ * @return bool
+ */
+bool transform_swaps_dimensions(matrix_transform transform);
+
+/**
+ * @brief Write src, transformed, into dst.
+ *
+ * The 90 and 270 degree rotations and the transpose walk the image in cache sized
+ * tiles of 8x8 blocks, each transposed in SSE2 registers. Flips and the 180 degree
+ * rotation stream whole rows. src and dst must not overlap.
+ *
+ * Return VALID_OP on success, not otherwise.
+ *
+ * @param src Source matrix.
+ * @param dst Destination matrix with the dimensions of the transformed image.
+ * @param transform Transform to apply.
+ * @return enum mat_fn_status
+ */
+mat_fn_status transform_matrix(matrix *src, matrix *dst, matrix_transform transform);
+
+/**
+ * @brief Apply a transform that keeps the dimensions (flips, 180 degree rotation or
+ * none) to mat in place.
+ *
+ * Return VALID_OP on success, INVALID_PARAM for transforms that swap dimensions,
+ * FAILED_MAT_ALLOCATION if the row buffer cannot be allocated.
+ *
+ * @param mat Pointer to matrix structure.
+ * @param transform Transform to apply.
+ * @return enum mat_fn_status
+ */
+mat_fn_status transform_matrix_in_place(matrix *mat, matrix_transform transform);
+
+/**
+ * @brief Allocate a new matrix holding src transformed.
+ *
+ * Pointer to a new matrix, NULL otherwise.
+ *
+ * @param src Source matrix.
+ * @param transform Transform to apply.
+ * @return struct matrix*
+ */
+matrix *create_transformed_matrix(matrix *src, matrix_transform transform);
+
+/**
+ * @brief Write the count pixels of src into dst in reverse order.
+ *
+ * @param src Source row.
+ * @param dst Destination row, must not overlap src.
+ * @param count Number of pixels.
+ */
+void reverse_rgb565_row(const uint16_t *src, uint16_t *dst, size_t count);
+
+#endif
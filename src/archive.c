@@ -0,0 +1,742 @@
+#include "archive.h"
+#include "byte_order.h"
+#include "errors.h"
+#include "instrument.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * File layout, all fields little-endian:
+ *
+ *   header   ARCHIVE_HEADER_SIZE bytes, see serialize_archive_header
+ *   frames   frame_count run-length encoded payloads, back to back
+ *   index    frame_count entries of ARCHIVE_INDEX_ENTRY_SIZE bytes
+ *            (uint64 offset, uint32 length, uint32 flags)
+ *
+ * A payload is a sequence of packets, each starting with a 16-bit control
+ * word. With ARCHIVE_RUN_FLAG set, the next word is repeated
+ * (control & 0x7FFF) + 1 times; otherwise control + 1 literal words follow.
+ * Keyframe payloads encode pixels, delta payloads the XOR of the pixels with
+ * the previous frame. Pixel words are stored in the byte order of the RAW
+ * files they come from.
+ */
+#define ARCHIVE_MAGIC "R565ARCH"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 40
+#define ARCHIVE_INDEX_ENTRY_SIZE 16
+
+#define ARCHIVE_RUN_FLAG 0x8000
+#define ARCHIVE_MAX_PACKET 0x8000
+#define ARCHIVE_MIN_RUN 3
+
+#define ARCHIVE_FRAME_KEY 0x1
+
+#define ARCHIVE_NO_FRAME UINT64_MAX
+
+typedef struct archive_index_entry
+{
+  uint64_t offset;
+  uint32_t length;
+  uint32_t flags;
+} archive_index_entry;
+
+struct frame_archive_writer
+{
+  FILE *file_ptr;
+  uint16_t horizontal;
+  uint16_t vertical;
+  uint32_t keyframe_interval;
+  size_t pixel_count;
+
+  /**
+   * Copy of the last appended frame, XORed against by the next delta.
+   */
+  uint16_t *previous;
+  uint16_t *payload;
+
+  archive_index_entry *index;
+  uint64_t frame_count;
+  uint64_t index_capacity;
+  uint64_t offset;
+};
+
+struct frame_archive_reader
+{
+  int fd;
+  uint16_t horizontal;
+  uint16_t vertical;
+  size_t pixel_count;
+
+  archive_index_entry *index;
+  uint64_t frame_count;
+
+  /**
+   * Last frame rebuilt and its index, ARCHIVE_NO_FRAME before the first read.
+   */
+  uint16_t *current;
+  uint64_t current_index;
+
+  uint16_t *payload;
+  size_t payload_capacity;
+};
+
+static void serialize_archive_header(const frame_archive_writer *writer,
+                                     uint8_t *header)
+{
+  memset(header, 0, ARCHIVE_HEADER_SIZE);
+  memcpy(header, ARCHIVE_MAGIC, 8);
+  put_le16(header + 8, ARCHIVE_VERSION);
+  put_le16(header + 10, writer->horizontal);
+  put_le16(header + 12, writer->vertical);
+  put_le32(header + 16, writer->keyframe_interval);
+  put_le64(header + 24, writer->frame_count);
+  put_le64(header + 32, writer->offset);
+}
+
+/**
+ * Worst case payload length in words: all literals, one control word per
+ * ARCHIVE_MAX_PACKET of them.
+ */
+static size_t max_payload_words(size_t pixel_count)
+{
+  return pixel_count + pixel_count / ARCHIVE_MAX_PACKET + 1;
+}
+
+static inline uint16_t delta_word(const uint16_t *current, const uint16_t *previous,
+                                  size_t position)
+{
+  return previous ? (uint16_t)(current[position] ^ previous[position])
+                  : current[position];
+}
+
+static size_t emit_literals(const uint16_t *current, const uint16_t *previous,
+                            size_t start, size_t end, uint16_t *out)
+{
+  size_t written = 0;
+  while (start < end)
+  {
+    size_t count = end - start;
+    if (count > ARCHIVE_MAX_PACKET)
+      count = ARCHIVE_MAX_PACKET;
+
+    out[written++] = (uint16_t)(count - 1);
+    for (size_t position = start; position < start + count; position++)
+      out[written++] = delta_word(current, previous, position);
+    start += count;
+  }
+
+  return written;
+}
+
+/**
+ * Run-length encode current, or its XOR with previous when previous is not
+ * NULL, into out. Returns the number of words written.
+ */
+static size_t rle_encode(const uint16_t *current, const uint16_t *previous,
+                         size_t count, uint16_t *out)
+{
+  size_t written = 0;
+  size_t literal_start = 0;
+  size_t position = 0;
+
+  while (position < count)
+  {
+    uint16_t word = delta_word(current, previous, position);
+    size_t limit = (count - position > ARCHIVE_MAX_PACKET)
+                       ? position + ARCHIVE_MAX_PACKET
+                       : count;
+    size_t end = position + 1;
+
+    // Unchanged areas of a delta are the common case; compare them four
+    // pixels at a time.
+    if (previous && word == 0)
+    {
+      uint64_t lhs, rhs;
+      while (end + 4 <= limit)
+      {
+        memcpy(&lhs, current + end, sizeof(lhs));
+        memcpy(&rhs, previous + end, sizeof(rhs));
+        if (lhs != rhs)
+          break;
+        end += 4;
+      }
+    }
+
+    while (end < limit && delta_word(current, previous, end) == word)
+      end++;
+
+    if (end - position >= ARCHIVE_MIN_RUN)
+    {
+      written += emit_literals(current, previous, literal_start, position,
+                               out + written);
+      out[written++] = (uint16_t)(ARCHIVE_RUN_FLAG | (end - position - 1));
+      out[written++] = word;
+      literal_start = end;
+    }
+
+    position = end;
+  }
+
+  written += emit_literals(current, previous, literal_start, count, out + written);
+  return written;
+}
+
+/**
+ * Decode a payload of length words into frame. Delta payloads are XORed into
+ * the frame, keyframe payloads overwrite it. Returns false if the payload does
+ * not describe exactly count pixels.
+ */
+static bool rle_decode(const uint16_t *payload, size_t length, uint16_t *frame,
+                       size_t count, bool delta)
+{
+  const uint16_t *end = payload + length;
+  size_t position = 0;
+
+  while (payload < end)
+  {
+    uint16_t control = *payload++;
+    size_t run = (size_t)(control & ~ARCHIVE_RUN_FLAG) + 1;
+    if (run > count - position)
+      return false;
+
+    if (control & ARCHIVE_RUN_FLAG)
+    {
+      if (payload >= end)
+        return false;
+      uint16_t word = *payload++;
+
+      if (!delta)
+      {
+        for (size_t index = 0; index < run; index++)
+          frame[position + index] = word;
+      }
+      else if (word != 0)
+      {
+        for (size_t index = 0; index < run; index++)
+          frame[position + index] ^= word;
+      }
+    }
+    else
+    {
+      if ((size_t)(end - payload) < run)
+        return false;
+
+      if (!delta)
+      {
+        memcpy(frame + position, payload, run * sizeof(uint16_t));
+      }
+      else
+      {
+        for (size_t index = 0; index < run; index++)
+          frame[position + index] ^= payload[index];
+      }
+      payload += run;
+    }
+
+    position += run;
+  }
+
+  return position == count;
+}
+
+frame_archive_writer *create_frame_archive(const char *filepath, uint16_t horizontal,
+                                           uint16_t vertical, uint32_t keyframe_interval)
+{
+  if (filepath == NULL || horizontal == 0 || vertical == 0)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "create_frame_archive: invalid filepath or frame dimensions.");
+    return NULL;
+  }
+
+  // Index entries store payload lengths in 32 bits; a frame that does not compress
+  // could not be recorded.
+  size_t pixel_count = (size_t)horizontal * vertical;
+  if (max_payload_words(pixel_count) > UINT32_MAX / sizeof(uint16_t))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "create_frame_archive: %ux%u frames can exceed the 4 GiB payload "
+                     "limit.",
+                     horizontal, vertical);
+    return NULL;
+  }
+
+  frame_archive_writer *writer =
+      (frame_archive_writer *)calloc(1, sizeof(frame_archive_writer));
+  if (writer == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_frame_archive: failed to allocate writer.");
+    return NULL;
+  }
+
+  writer->horizontal = horizontal;
+  writer->vertical = vertical;
+  writer->keyframe_interval =
+      keyframe_interval ? keyframe_interval : ARCHIVE_DEFAULT_KEYFRAME_INTERVAL;
+  writer->pixel_count = pixel_count;
+  writer->previous = (uint16_t *)malloc(writer->pixel_count * sizeof(uint16_t));
+  writer->payload =
+      (uint16_t *)malloc(max_payload_words(writer->pixel_count) * sizeof(uint16_t));
+  if (writer->previous == NULL || writer->payload == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_frame_archive: failed to allocate frame buffers.");
+    goto fail;
+  }
+
+  writer->file_ptr = fopen(filepath, "wb");
+  if (writer->file_ptr == NULL)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE,
+                     "create_frame_archive: unable to open %s for writing.", filepath);
+    goto fail;
+  }
+
+  // The header is rewritten with the final frame count and index offset on
+  // close.
+  uint8_t header[ARCHIVE_HEADER_SIZE];
+  writer->offset = ARCHIVE_HEADER_SIZE;
+  serialize_archive_header(writer, header);
+  if (fwrite(header, sizeof(header), 1, writer->file_ptr) != 1)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE,
+                     "create_frame_archive: unable to write header to %s.", filepath);
+    fclose(writer->file_ptr);
+    goto fail;
+  }
+
+  return writer;
+
+fail:
+  free(writer->payload);
+  free(writer->previous);
+  free(writer);
+  return NULL;
+}
+
+mat_fn_status frame_archive_append(frame_archive_writer *writer, const matrix *frame)
+{
+  if (writer == NULL || frame == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "frame_archive_append: writer or frame is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(frame))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "frame_archive_append: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  if (frame->horizontal != writer->horizontal || frame->vertical != writer->vertical)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "frame_archive_append: frame dimensions do not match the archive.");
+    return INVALID_PARAM;
+  }
+
+  if (writer->frame_count == writer->index_capacity)
+  {
+    uint64_t capacity = writer->index_capacity ? writer->index_capacity * 2 : 256;
+    archive_index_entry *index = (archive_index_entry *)realloc(
+        writer->index, capacity * sizeof(archive_index_entry));
+    if (index == NULL)
+    {
+      mat_report_error(FAILED_MAT_ALLOCATION,
+                       "frame_archive_append: unable to grow frame index.");
+      return FAILED_MAT_ALLOCATION;
+    }
+    writer->index = index;
+    writer->index_capacity = capacity;
+  }
+
+  INSTRUMENT_TIMER(frame_start);
+  INSTRUMENT_TIMER(start);
+  bool keyframe = writer->frame_count % writer->keyframe_interval == 0;
+  size_t words = rle_encode(frame->mem, keyframe ? NULL : writer->previous,
+                            writer->pixel_count, writer->payload);
+  size_t length = words * sizeof(uint16_t);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_ENCODE, start);
+
+  if (fwrite(writer->payload, length, 1, writer->file_ptr) != 1)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE,
+                     "frame_archive_append: failed to write frame %llu.",
+                     (unsigned long long)writer->frame_count);
+    return FAILED_BMP_FILE_WRITE;
+  }
+  INSTRUMENT_COUNT(INSTRUMENT_BYTES_WRITTEN, length);
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+  INSTRUMENT_COUNT(INSTRUMENT_FRAMES_PROCESSED, 1);
+  INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_WRITE, frame_start);
+
+  archive_index_entry *entry = &writer->index[writer->frame_count++];
+  entry->offset = writer->offset;
+  entry->length = (uint32_t)length; // bounded by create_frame_archive
+  entry->flags = keyframe ? ARCHIVE_FRAME_KEY : 0;
+  writer->offset += length;
+
+  memcpy(writer->previous, frame->mem, writer->pixel_count * sizeof(uint16_t));
+  return VALID_OP;
+}
+
+mat_fn_status close_frame_archive(frame_archive_writer *writer)
+{
+  if (writer == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "close_frame_archive: writer is NULL.");
+    return INVALID_PARAM;
+  }
+
+  mat_fn_status status = VALID_OP;
+  uint8_t entry[ARCHIVE_INDEX_ENTRY_SIZE];
+  for (uint64_t frame = 0; frame < writer->frame_count && status == VALID_OP; frame++)
+  {
+    put_le64(entry, writer->index[frame].offset);
+    put_le32(entry + 8, writer->index[frame].length);
+    put_le32(entry + 12, writer->index[frame].flags);
+    if (fwrite(entry, sizeof(entry), 1, writer->file_ptr) != 1)
+      status = FAILED_BMP_FILE_WRITE;
+  }
+
+  uint8_t header[ARCHIVE_HEADER_SIZE];
+  serialize_archive_header(writer, header);
+  if (status == VALID_OP &&
+      (fseek(writer->file_ptr, 0, SEEK_SET) != 0 ||
+       fwrite(header, sizeof(header), 1, writer->file_ptr) != 1))
+    status = FAILED_BMP_FILE_WRITE;
+
+  if (fclose(writer->file_ptr) != 0)
+    status = FAILED_BMP_FILE_WRITE;
+
+  if (status != VALID_OP)
+    mat_report_error(status, "close_frame_archive: failed to finalize archive.");
+
+  free(writer->index);
+  free(writer->payload);
+  free(writer->previous);
+  free(writer);
+
+  return status;
+}
+
+mat_fn_status archive_raw_file(const char *raw_path, const char *archive_path,
+                               uint16_t horizontal, uint16_t vertical,
+                               uint32_t keyframe_interval, archive_stats *stats)
+{
+  if (raw_path == NULL || archive_path == NULL)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "archive_raw_file: raw_path or archive_path is NULL.");
+    return INVALID_PARAM;
+  }
+
+  double start = instrument_now_seconds();
+
+  FILE *file_ptr = fopen(raw_path, "rb");
+  if (file_ptr == NULL)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "archive_raw_file: unable to open %s for reading.", raw_path);
+    return FAILED_BINARY_FILE_READ;
+  }
+
+  mat_fn_status status = VALID_OP;
+  frame_archive_writer *writer = NULL;
+  matrix *frame = allocate_matrix(horizontal, vertical);
+  if (frame == NULL)
+  {
+    status = FAILED_MAT_ALLOCATION;
+    goto cleanup;
+  }
+
+  writer = create_frame_archive(archive_path, horizontal, vertical, keyframe_interval);
+  if (writer == NULL)
+  {
+    status = FAILED_BMP_FILE_WRITE;
+    goto cleanup;
+  }
+
+  while (read_binary_frame(frame, file_ptr) == VALID_OP)
+  {
+    status = frame_archive_append(writer, frame);
+    if (status != VALID_OP)
+      break;
+  }
+
+  if (status == VALID_OP && ferror(file_ptr))
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ, "archive_raw_file: failed to read %s.",
+                     raw_path);
+    status = FAILED_BINARY_FILE_READ;
+  }
+
+  if (stats != NULL)
+  {
+    stats->frames = writer->frame_count;
+    stats->keyframes =
+        (writer->frame_count + writer->keyframe_interval - 1) / writer->keyframe_interval;
+    stats->raw_bytes = writer->frame_count * writer->pixel_count * sizeof(uint16_t);
+    stats->archive_bytes =
+        writer->offset + writer->frame_count * ARCHIVE_INDEX_ENTRY_SIZE;
+  }
+
+  mat_fn_status close_status = close_frame_archive(writer);
+  if (status == VALID_OP)
+    status = close_status;
+
+cleanup:
+  if (frame)
+    deallocate_matrix(frame);
+  fclose(file_ptr);
+
+  if (stats != NULL)
+    stats->seconds = instrument_now_seconds() - start;
+
+  return status;
+}
+
+static bool pread_all(int fd, void *buffer, size_t length, uint64_t offset)
+{
+  uint8_t *dst = (uint8_t *)buffer;
+  while (length > 0)
+  {
+    ssize_t got = pread(fd, dst, length, (off_t)offset);
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      return false;
+    INSTRUMENT_COUNT(INSTRUMENT_BYTES_READ, got);
+    dst += got;
+    length -= (size_t)got;
+    offset += (uint64_t)got;
+  }
+
+  return true;
+}
+
+frame_archive_reader *open_frame_archive(const char *filepath)
+{
+  if (filepath == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "open_frame_archive: filepath is NULL.");
+    return NULL;
+  }
+
+  frame_archive_reader *reader =
+      (frame_archive_reader *)calloc(1, sizeof(frame_archive_reader));
+  if (reader == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "open_frame_archive: failed to allocate reader.");
+    return NULL;
+  }
+
+  reader->current_index = ARCHIVE_NO_FRAME;
+  reader->fd = open(filepath, O_RDONLY);
+  if (reader->fd < 0)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "open_frame_archive: unable to open %s for reading.", filepath);
+    free(reader);
+    return NULL;
+  }
+
+  uint8_t header[ARCHIVE_HEADER_SIZE];
+  if (!pread_all(reader->fd, header, sizeof(header), 0) ||
+      memcmp(header, ARCHIVE_MAGIC, 8) != 0 || get_le16(header + 8) != ARCHIVE_VERSION)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "open_frame_archive: %s is not a frame archive.", filepath);
+    goto fail;
+  }
+
+  reader->horizontal = get_le16(header + 10);
+  reader->vertical = get_le16(header + 12);
+  reader->frame_count = get_le64(header + 24);
+  reader->pixel_count = (size_t)reader->horizontal * reader->vertical;
+  uint64_t index_offset = get_le64(header + 32);
+
+  if (reader->pixel_count == 0 ||
+      reader->frame_count > SIZE_MAX / ARCHIVE_INDEX_ENTRY_SIZE)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "open_frame_archive: %s has an invalid header.", filepath);
+    goto fail;
+  }
+
+  size_t index_bytes = (size_t)reader->frame_count * ARCHIVE_INDEX_ENTRY_SIZE;
+  uint8_t *raw_index = (uint8_t *)malloc(index_bytes ? index_bytes : 1);
+  reader->index = (archive_index_entry *)calloc(
+      reader->frame_count ? reader->frame_count : 1, sizeof(archive_index_entry));
+  reader->current = (uint16_t *)malloc(reader->pixel_count * sizeof(uint16_t));
+  if (raw_index == NULL || reader->index == NULL || reader->current == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "open_frame_archive: failed to allocate frame index.");
+    free(raw_index);
+    goto fail;
+  }
+
+  if (!pread_all(reader->fd, raw_index, index_bytes, index_offset))
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "open_frame_archive: unable to read frame index of %s.", filepath);
+    free(raw_index);
+    goto fail;
+  }
+
+  for (uint64_t frame = 0; frame < reader->frame_count; frame++)
+  {
+    const uint8_t *entry = raw_index + frame * ARCHIVE_INDEX_ENTRY_SIZE;
+    reader->index[frame].offset = get_le64(entry);
+    reader->index[frame].length = get_le32(entry + 8);
+    reader->index[frame].flags = get_le32(entry + 12);
+  }
+  free(raw_index);
+
+  if (reader->frame_count > 0 && !(reader->index[0].flags & ARCHIVE_FRAME_KEY))
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "open_frame_archive: %s does not start with a keyframe.", filepath);
+    goto fail;
+  }
+
+  return reader;
+
+fail:
+  close_frame_archive_reader(reader);
+  return NULL;
+}
+
+void close_frame_archive_reader(frame_archive_reader *reader)
+{
+  if (reader == NULL)
+    return;
+
+  if (reader->fd >= 0)
+    close(reader->fd);
+  free(reader->payload);
+  free(reader->current);
+  free(reader->index);
+  free(reader);
+}
+
+uint64_t frame_archive_frame_count(const frame_archive_reader *reader)
+{
+  return reader ? reader->frame_count : 0;
+}
+
+void frame_archive_dimensions(const frame_archive_reader *reader, uint16_t *horizontal,
+                              uint16_t *vertical)
+{
+  if (horizontal)
+    *horizontal = reader ? reader->horizontal : 0;
+  if (vertical)
+    *vertical = reader ? reader->vertical : 0;
+}
+
+/**
+ * Read and apply the payload of one frame to reader->current.
+ */
+static bool apply_frame(frame_archive_reader *reader, uint64_t frame)
+{
+  const archive_index_entry *entry = &reader->index[frame];
+  if (entry->length % sizeof(uint16_t) != 0)
+    return false;
+
+  if (reader->payload_capacity < entry->length)
+  {
+    uint16_t *payload = (uint16_t *)realloc(reader->payload, entry->length);
+    if (payload == NULL)
+      return false;
+    reader->payload = payload;
+    reader->payload_capacity = entry->length;
+  }
+
+  INSTRUMENT_TIMER(start);
+  if (!pread_all(reader->fd, reader->payload, entry->length, entry->offset))
+    return false;
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_READ, start);
+
+  bool ok = rle_decode(reader->payload, entry->length / sizeof(uint16_t),
+                       reader->current, reader->pixel_count,
+                       !(entry->flags & ARCHIVE_FRAME_KEY));
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_CONVERT, start);
+  return ok;
+}
+
+mat_fn_status frame_archive_read_frame(frame_archive_reader *reader,
+                                       uint64_t frame_index, matrix *mat)
+{
+  if (reader == NULL || mat == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "frame_archive_read_frame: reader or mat is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "frame_archive_read_frame: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  if (frame_index >= reader->frame_count)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "frame_archive_read_frame: frame %llu is past the end of the "
+                     "archive.", (unsigned long long)frame_index);
+    return INVALID_PARAM;
+  }
+
+  if (mat->horizontal != reader->horizontal || mat->vertical != reader->vertical)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "frame_archive_read_frame: mat dimensions do not match the "
+                     "archive.");
+    return INVALID_PARAM;
+  }
+
+  INSTRUMENT_TIMER(frame_start);
+  uint64_t keyframe = frame_index;
+  while (!(reader->index[keyframe].flags & ARCHIVE_FRAME_KEY))
+    keyframe--;
+
+  // Continue from the last rebuilt frame when it lies between the keyframe
+  // and the requested frame.
+  uint64_t frame = keyframe;
+  if (reader->current_index != ARCHIVE_NO_FRAME && reader->current_index >= keyframe &&
+      reader->current_index <= frame_index)
+    frame = reader->current_index + 1;
+
+  for (; frame <= frame_index; frame++)
+  {
+    if (!apply_frame(reader, frame))
+    {
+      mat_report_error(FAILED_BINARY_FILE_READ,
+                       "frame_archive_read_frame: frame %llu of the archive is corrupt.",
+                       (unsigned long long)frame);
+      reader->current_index = ARCHIVE_NO_FRAME;
+      return FAILED_BINARY_FILE_READ;
+    }
+    reader->current_index = frame;
+  }
+
+  memcpy(mat->mem, reader->current, reader->pixel_count * sizeof(uint16_t));
+  mark_dirty_rows(mat, 0, mat->vertical - 1);
+  INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_READ, frame_start);
+
+  return VALID_OP;
+}
@@ -0,0 +1,1021 @@
+#include "async_writer.h"
+#include "errors.h"
+#include "instrument.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) &&                   \
+    defined(__NR_io_uring_register)
+#define ASYNC_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#endif
+#endif
+
+#define ASYNC_WRITER_MAX_QUEUE_DEPTH 1024
+
+/**
+ * Largest single write submitted to the ring; bigger files are written in
+ * several linked chunks.
+ */
+#define ASYNC_WRITE_CHUNK (size_t)(1u << 30)
+
+/**
+ * Submission queue entries. A file's chain is submitted in one go and the
+ * kernel consumes every entry during io_uring_enter, so this only has to hold
+ * the longest chain: open, up to 17 chunks of a 65535x65535 BGRA file, fsync
+ * and close.
+ */
+#define ASYNC_RING_ENTRIES 32
+
+/**
+ * user_data of the no-op that wakes the completion thread for shutdown.
+ */
+#define ASYNC_WAKE_USER_DATA UINT64_MAX
+
+enum write_op
+{
+  WRITE_OP_OPEN,
+  WRITE_OP_WRITE,
+  WRITE_OP_FSYNC,
+  WRITE_OP_CLOSE
+};
+
+/**
+ * One file in flight. The index doubles as the slot of the ring's registered
+ * file table the file is opened into.
+ */
+typedef struct write_slot
+{
+  uint32_t index;
+
+  bmp_encoder *encoder;
+  bmp_pixel_format format;
+  uint8_t *buffer;
+  size_t capacity;
+  size_t length;
+
+  char filepath[PATH_MAX];
+  async_write_callback callback;
+  void *context;
+
+  int error;
+  uint32_t pending;
+
+#ifdef MATRIX_INSTRUMENTATION
+  uint64_t submitted_ns;
+#endif
+
+  struct write_slot *next;
+} write_slot;
+
+#ifdef ASYNC_HAVE_IO_URING
+typedef struct uring
+{
+  int fd;
+
+  void *sq_map;
+  size_t sq_map_length;
+  void *cq_map;
+  size_t cq_map_length;
+  struct io_uring_sqe *sqes;
+  size_t sqes_length;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned *sq_array;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+} uring;
+#endif
+
+struct async_bmp_writer
+{
+  async_writer_backend backend;
+  bool sync_each_file;
+  uint32_t queue_depth;
+  write_slot *slots;
+
+  pthread_mutex_t lock;
+  pthread_cond_t slot_released;
+  write_slot *free_slots;
+  uint32_t in_flight;
+  uint32_t failures;
+  bool stopping;
+
+  /**
+   * Slots given up on while the kernel may still hold requests referring to
+   * them. They are never reused nor freed.
+   */
+  uint32_t retired_slots;
+
+  /*
+   * Thread pool backend.
+   */
+  pthread_t *threads;
+  uint32_t thread_count;
+  pthread_cond_t work_ready;
+  write_slot *queue_head;
+  write_slot *queue_tail;
+
+#ifdef ASYNC_HAVE_IO_URING
+  /*
+   * io_uring backend. ring_lock serializes submitters; only the completion
+   * thread touches the completion queue. Once it can no longer wait for
+   * completions it sets ring_failed under ring_lock, and later files take the
+   * blocking write path.
+   */
+  uring ring;
+  pthread_mutex_t ring_lock;
+  pthread_t reaper;
+  bool ring_ready;
+  bool reaper_started;
+  bool ring_failed;
+#endif
+};
+
+const char *async_writer_backend_name(async_writer_backend backend)
+{
+  switch (backend)
+  {
+  case ASYNC_WRITER_IO_URING:
+    return "io_uring";
+  case ASYNC_WRITER_THREADS:
+    return "threads";
+  default:
+    return "auto";
+  }
+}
+
+async_writer_backend async_bmp_writer_backend(const async_bmp_writer *writer)
+{
+  return writer ? writer->backend : ASYNC_WRITER_AUTO;
+}
+
+/**
+ * Hand a slot back and wake anyone waiting for one.
+ */
+static void release_slot(async_bmp_writer *writer, write_slot *slot, bool failed)
+{
+  pthread_mutex_lock(&writer->lock);
+  if (failed)
+    writer->failures++;
+  slot->next = writer->free_slots;
+  writer->free_slots = slot;
+  writer->in_flight--;
+  pthread_cond_broadcast(&writer->slot_released);
+  pthread_mutex_unlock(&writer->lock);
+}
+
+static void finish_slot(async_bmp_writer *writer, write_slot *slot)
+{
+  if (slot->error == 0)
+  {
+    INSTRUMENT_COUNT(INSTRUMENT_FRAMES_PROCESSED, 1);
+    INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_WRITE, slot->submitted_ns);
+  }
+  if (slot->callback)
+    slot->callback(slot->context, slot->filepath, slot->error);
+  release_slot(writer, slot, slot->error != 0);
+}
+
+/*
+ * Thread pool backend.
+ */
+
+static int write_file_blocking(const write_slot *slot, bool sync_each_file)
+{
+  INSTRUMENT_TIMER(start);
+  int fd = open(slot->filepath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+  if (fd < 0)
+    return errno;
+
+  int error = 0;
+  const uint8_t *data = slot->buffer;
+  size_t remaining = slot->length;
+  while (remaining > 0)
+  {
+    ssize_t written = write(fd, data, remaining);
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      error = errno;
+      break;
+    }
+    INSTRUMENT_COUNT(INSTRUMENT_BYTES_WRITTEN, written);
+    data += written;
+    remaining -= (size_t)written;
+  }
+
+  if (error == 0 && sync_each_file && fsync(fd) != 0)
+    error = errno;
+  if (close(fd) != 0 && error == 0)
+    error = errno;
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, sync_each_file ? 2 : 1);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+
+  return error;
+}
+
+static void *pool_worker(void *arg)
+{
+  async_bmp_writer *writer = (async_bmp_writer *)arg;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->queue_head == NULL && !writer->stopping)
+      pthread_cond_wait(&writer->work_ready, &writer->lock);
+
+    write_slot *slot = writer->queue_head;
+    if (slot == NULL)
+    {
+      pthread_mutex_unlock(&writer->lock);
+      break;
+    }
+
+    writer->queue_head = slot->next;
+    if (writer->queue_head == NULL)
+      writer->queue_tail = NULL;
+    pthread_mutex_unlock(&writer->lock);
+
+    slot->error = write_file_blocking(slot, writer->sync_each_file);
+    finish_slot(writer, slot);
+  }
+
+  return NULL;
+}
+
+static bool start_pool(async_bmp_writer *writer, uint32_t thread_count)
+{
+  writer->threads = (pthread_t *)calloc(thread_count, sizeof(pthread_t));
+  if (writer->threads == NULL)
+    return false;
+
+  for (; writer->thread_count < thread_count; writer->thread_count++)
+  {
+    if (pthread_create(&writer->threads[writer->thread_count], NULL, pool_worker,
+                       writer) != 0)
+      break;
+  }
+
+  return writer->thread_count > 0;
+}
+
+static void enqueue_slot(async_bmp_writer *writer, write_slot *slot)
+{
+  slot->next = NULL;
+
+  pthread_mutex_lock(&writer->lock);
+  if (writer->queue_tail)
+    writer->queue_tail->next = slot;
+  else
+    writer->queue_head = slot;
+  writer->queue_tail = slot;
+  pthread_cond_signal(&writer->work_ready);
+  pthread_mutex_unlock(&writer->lock);
+}
+
+/*
+ * io_uring backend. The ring is driven with raw system calls; every file is a
+ * chain of
+ *
+ *   openat (into registered file slot n) -> write... -> [fsync] -> close
+ *
+ * Everything after the open is hard linked, so the close still runs when a
+ * write fails, while a failed open cancels the rest of the chain. Each entry
+ * posts exactly one completion, cancelled ones included, so a slot is done when
+ * its pending count drops to zero.
+ */
+
+#ifdef ASYNC_HAVE_IO_URING
+
+static inline uint64_t encode_user_data(uint32_t slot, enum write_op op, uint32_t chunk)
+{
+  return ((uint64_t)slot << 32) | ((uint64_t)op << 24) | chunk;
+}
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void unmap_ring(uring *ring)
+{
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_length);
+  if (ring->cq_map && ring->cq_map != ring->sq_map)
+    munmap(ring->cq_map, ring->cq_map_length);
+  if (ring->sq_map)
+    munmap(ring->sq_map, ring->sq_map_length);
+  if (ring->fd >= 0)
+    close(ring->fd);
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+static bool map_ring(uring *ring, uint32_t file_slots)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  ring->fd = (int)syscall(__NR_io_uring_setup, ASYNC_RING_ENTRIES, &params);
+  if (ring->fd < 0)
+    return false;
+
+  // Completions beyond the queue size must be kept rather than dropped.
+  if (!(params.features & IORING_FEAT_NODROP))
+    return false;
+
+  ring->sq_map_length = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_map_length =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_map)
+  {
+    if (ring->cq_map_length > ring->sq_map_length)
+      ring->sq_map_length = ring->cq_map_length;
+    ring->cq_map_length = ring->sq_map_length;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_map_length, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED)
+  {
+    ring->sq_map = NULL;
+    return false;
+  }
+
+  if (single_map)
+    ring->cq_map = ring->sq_map;
+  else
+  {
+    ring->cq_map = mmap(NULL, ring->cq_map_length, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED)
+    {
+      ring->cq_map = NULL;
+      return false;
+    }
+  }
+
+  ring->sqes_length = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_length,
+                                           PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, ring->fd,
+                                           IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+  {
+    ring->sqes = NULL;
+    return false;
+  }
+
+  uint8_t *sq = (uint8_t *)ring->sq_map;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+  uint8_t *cq = (uint8_t *)ring->cq_map;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  // A sparse table of files for the chains to open into.
+  int *files = (int *)malloc(file_slots * sizeof(int));
+  if (files == NULL)
+    return false;
+  for (uint32_t index = 0; index < file_slots; index++)
+    files[index] = -1;
+
+  int registered = (int)syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES,
+                                files, file_slots);
+  free(files);
+
+  return registered == 0;
+}
+
+/**
+ * Claim the next submission entry. The caller holds ring_lock and has checked
+ * that the chain fits.
+ */
+static struct io_uring_sqe *next_sqe(uring *ring, unsigned *tail)
+{
+  unsigned index = *tail & ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[index] = index;
+  (*tail)++;
+  return sqe;
+}
+
+/**
+ * Queue the chain writing slot out. Returns the number of entries queued.
+ */
+static unsigned prepare_chain(uring *ring, const write_slot *slot, bool sync_each_file,
+                              unsigned *tail)
+{
+  unsigned count = 0;
+  struct io_uring_sqe *sqe = next_sqe(ring, tail);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t)(uintptr_t)slot->filepath;
+  sqe->len = 0644;
+  sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+  sqe->file_index = slot->index + 1;
+  sqe->flags = IOSQE_IO_LINK;
+  sqe->user_data = encode_user_data(slot->index, WRITE_OP_OPEN, 0);
+  count++;
+
+  uint32_t chunk = 0;
+  for (size_t offset = 0; offset < slot->length; offset += ASYNC_WRITE_CHUNK, chunk++)
+  {
+    size_t length = slot->length - offset;
+    if (length > ASYNC_WRITE_CHUNK)
+      length = ASYNC_WRITE_CHUNK;
+
+    sqe = next_sqe(ring, tail);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = (int)slot->index;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->addr = (uint64_t)(uintptr_t)(slot->buffer + offset);
+    sqe->len = (uint32_t)length;
+    sqe->off = offset;
+    sqe->user_data = encode_user_data(slot->index, WRITE_OP_WRITE, chunk);
+    count++;
+  }
+
+  if (sync_each_file)
+  {
+    sqe = next_sqe(ring, tail);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = (int)slot->index;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->user_data = encode_user_data(slot->index, WRITE_OP_FSYNC, 0);
+    count++;
+  }
+
+  sqe = next_sqe(ring, tail);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->file_index = slot->index + 1;
+  sqe->user_data = encode_user_data(slot->index, WRITE_OP_CLOSE, 0);
+  count++;
+
+  return count;
+}
+
+/**
+ * Publish count prepared entries and submit them. On failure the entries the
+ * kernel has not consumed are withdrawn; returns how many it did consume, or
+ * a negative errno when it consumed none.
+ */
+static int submit_entries(uring *ring, unsigned tail, unsigned count)
+{
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  unsigned submitted = 0;
+  while (submitted < count)
+  {
+    int ret = ring_enter(ring->fd, count - submitted, 0, 0);
+    if (ret >= 0)
+    {
+      submitted += (unsigned)ret;
+      continue;
+    }
+    if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+      continue;
+
+    int error = errno;
+    __atomic_store_n(ring->sq_tail, tail - (count - submitted), __ATOMIC_RELEASE);
+    return submitted ? (int)submitted : -error;
+  }
+
+  return (int)submitted;
+}
+
+static void complete_entry(async_bmp_writer *writer, uint64_t user_data, int32_t result)
+{
+  write_slot *slot = &writer->slots[user_data >> 32];
+  enum write_op op = (enum write_op)((user_data >> 24) & 0xFF);
+  uint32_t chunk = (uint32_t)(user_data & 0xFFFFFF);
+
+  // Pairs with the release store in submit_to_ring, which follows every write
+  // to the slot made by the submitting thread.
+  (void)__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE);
+
+  // Only the first failure of a chain is reported; the cancellations it
+  // causes further down are not.
+  if (slot->error == 0)
+  {
+    if (result < 0)
+      slot->error = -result;
+    else if (op == WRITE_OP_WRITE)
+    {
+      size_t expected = slot->length - (size_t)chunk * ASYNC_WRITE_CHUNK;
+      if (expected > ASYNC_WRITE_CHUNK)
+        expected = ASYNC_WRITE_CHUNK;
+      if ((size_t)result != expected)
+        slot->error = EIO;
+      INSTRUMENT_COUNT(INSTRUMENT_BYTES_WRITTEN, result);
+    }
+  }
+
+  if (__atomic_sub_fetch(&slot->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    finish_slot(writer, slot);
+}
+
+/**
+ * Fail every file whose chain is still in the kernel. Called by the completion
+ * thread once it can no longer wait for completions: their slots are retired,
+ * as the requests may still read the paths and buffers.
+ */
+static void fail_ring(async_bmp_writer *writer, int error)
+{
+  pthread_mutex_lock(&writer->ring_lock);
+  writer->ring_failed = true;
+  pthread_mutex_unlock(&writer->ring_lock);
+
+  // Submitters finish their chains under ring_lock, so pending no longer
+  // changes: only this thread reaps completions.
+  for (uint32_t index = 0; index < writer->queue_depth; index++)
+  {
+    write_slot *slot = &writer->slots[index];
+    if (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) == 0)
+      continue;
+
+    if (slot->error == 0)
+      slot->error = error;
+    if (slot->callback)
+      slot->callback(slot->context, slot->filepath, slot->error);
+
+    pthread_mutex_lock(&writer->lock);
+    writer->failures++;
+    writer->retired_slots++;
+    writer->in_flight--;
+    pthread_cond_broadcast(&writer->slot_released);
+    pthread_mutex_unlock(&writer->lock);
+  }
+}
+
+static void *ring_reaper(void *arg)
+{
+  async_bmp_writer *writer = (async_bmp_writer *)arg;
+  uring *ring = &writer->ring;
+  bool stop = false;
+
+  while (!stop)
+  {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+    {
+      if (ring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR &&
+          errno != EAGAIN && errno != EBUSY)
+      {
+        int error = errno;
+        mat_report_error(FAILED_BMP_FILE_WRITE,
+                         "async_bmp_writer: waiting for io_uring completions failed "
+                         "(%s), falling back to blocking writes.", strerror(error));
+        fail_ring(writer, error);
+        break;
+      }
+      continue;
+    }
+
+    for (; head != tail; head++)
+    {
+      const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+      uint64_t user_data = cqe->user_data;
+      int32_t result = cqe->res;
+
+      // Release the entry before running callbacks.
+      __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+      if (user_data == ASYNC_WAKE_USER_DATA)
+        stop = true;
+      else
+        complete_entry(writer, user_data, result);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Open /dev/null into the registered file table, write to it and close it.
+ * Kernels without direct descriptors (before 5.15) fail this, and the writer
+ * falls back to the thread pool.
+ */
+static bool probe_ring(uring *ring)
+{
+  static const char probe_path[] = "/dev/null";
+  static const uint8_t probe_byte = 0;
+
+  unsigned tail = *ring->sq_tail;
+  struct io_uring_sqe *sqe = next_sqe(ring, &tail);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t)(uintptr_t)probe_path;
+  sqe->open_flags = O_WRONLY;
+  sqe->file_index = 1;
+  sqe->flags = IOSQE_IO_LINK;
+
+  sqe = next_sqe(ring, &tail);
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = 0;
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+  sqe->addr = (uint64_t)(uintptr_t)&probe_byte;
+  sqe->len = 1;
+
+  sqe = next_sqe(ring, &tail);
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->file_index = 1;
+
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  int ret;
+  do
+    ret = ring_enter(ring->fd, 3, 3, IORING_ENTER_GETEVENTS);
+  while (ret < 0 && errno == EINTR);
+
+  unsigned head = *ring->cq_head;
+  unsigned seen = 0;
+  bool ok = ret == 3;
+  while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    if (ring->cqes[head & ring->cq_mask].res < 0)
+      ok = false;
+    head++;
+    seen++;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+  return ok && seen == 3;
+}
+
+static bool start_ring(async_bmp_writer *writer)
+{
+  writer->ring.fd = -1;
+  if (!map_ring(&writer->ring, writer->queue_depth) || !probe_ring(&writer->ring))
+  {
+    unmap_ring(&writer->ring);
+    return false;
+  }
+
+  pthread_mutex_init(&writer->ring_lock, NULL);
+  writer->ring_ready = true;
+
+  if (pthread_create(&writer->reaper, NULL, ring_reaper, writer) != 0)
+    return false;
+  writer->reaper_started = true;
+  return true;
+}
+
+static void submit_to_ring(async_bmp_writer *writer, write_slot *slot)
+{
+  uring *ring = &writer->ring;
+
+  pthread_mutex_lock(&writer->ring_lock);
+  if (writer->ring_failed)
+  {
+    pthread_mutex_unlock(&writer->ring_lock);
+    slot->error = write_file_blocking(slot, writer->sync_each_file);
+    finish_slot(writer, slot);
+    return;
+  }
+
+  // Completions can arrive as soon as the chain is submitted.
+  size_t chunks = (slot->length + ASYNC_WRITE_CHUNK - 1) / ASYNC_WRITE_CHUNK;
+  unsigned entries = 2 + (unsigned)chunks + (writer->sync_each_file ? 1 : 0);
+  __atomic_store_n(&slot->pending, entries, __ATOMIC_RELEASE);
+
+  unsigned tail = *ring->sq_tail;
+  unsigned count = prepare_chain(ring, slot, writer->sync_each_file, &tail);
+  int submitted = submit_entries(ring, tail, count);
+
+  // Part or all of the chain never reached the kernel. The entries are
+  // withdrawn under ring_lock, so fail_ring sees the chain as it is in the
+  // kernel.
+  bool finished = false;
+  if (submitted != (int)count)
+  {
+    if (slot->error == 0)
+      slot->error = submitted < 0 ? -submitted : EIO;
+    unsigned withdrawn = count - (submitted > 0 ? (unsigned)submitted : 0);
+    finished = __atomic_sub_fetch(&slot->pending, withdrawn, __ATOMIC_ACQ_REL) == 0;
+  }
+  pthread_mutex_unlock(&writer->ring_lock);
+
+  if (finished)
+    finish_slot(writer, slot);
+}
+
+static void stop_ring(async_bmp_writer *writer)
+{
+  if (writer->reaper_started)
+  {
+    pthread_mutex_lock(&writer->ring_lock);
+    uring *ring = &writer->ring;
+    unsigned tail = *ring->sq_tail;
+    struct io_uring_sqe *sqe = next_sqe(ring, &tail);
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = ASYNC_WAKE_USER_DATA;
+    int submitted = submit_entries(ring, tail, 1);
+    pthread_mutex_unlock(&writer->ring_lock);
+
+    if (submitted == 1)
+      pthread_join(writer->reaper, NULL);
+    else
+      pthread_cancel(writer->reaper);
+    writer->reaper_started = false;
+  }
+
+  // The AUTO fallback stops a ring that failed to start, and destroying the
+  // writer stops it again.
+  if (writer->ring_ready)
+  {
+    pthread_mutex_destroy(&writer->ring_lock);
+    unmap_ring(&writer->ring);
+    writer->ring_ready = false;
+  }
+}
+
+#endif
+
+/*
+ * Public interface.
+ */
+
+async_bmp_writer *create_async_bmp_writer(const async_writer_settings *settings)
+{
+  async_writer_settings defaults = {0};
+  if (settings == NULL)
+    settings = &defaults;
+
+  uint32_t queue_depth = settings->queue_depth ? settings->queue_depth
+                                               : ASYNC_WRITER_DEFAULT_QUEUE_DEPTH;
+  if (queue_depth > ASYNC_WRITER_MAX_QUEUE_DEPTH)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "create_async_bmp_writer: queue depth is limited to %u.",
+                     ASYNC_WRITER_MAX_QUEUE_DEPTH);
+    return NULL;
+  }
+
+  async_bmp_writer *writer = (async_bmp_writer *)calloc(1, sizeof(async_bmp_writer));
+  if (writer == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_async_bmp_writer: failed to allocate writer.");
+    return NULL;
+  }
+
+  writer->queue_depth = queue_depth;
+  writer->sync_each_file = settings->sync_each_file;
+  writer->slots = (write_slot *)calloc(queue_depth, sizeof(write_slot));
+  if (writer->slots == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_async_bmp_writer: failed to allocate slots.");
+    free(writer);
+    return NULL;
+  }
+
+  for (uint32_t index = queue_depth; index-- > 0;)
+  {
+    writer->slots[index].index = index;
+    writer->slots[index].next = writer->free_slots;
+    writer->free_slots = &writer->slots[index];
+  }
+
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->slot_released, NULL);
+  pthread_cond_init(&writer->work_ready, NULL);
+
+  async_writer_backend backend = settings->backend;
+
+#ifdef ASYNC_HAVE_IO_URING
+  if (backend != ASYNC_WRITER_THREADS)
+  {
+    if (start_ring(writer))
+      backend = ASYNC_WRITER_IO_URING;
+    else if (backend == ASYNC_WRITER_IO_URING)
+    {
+      mat_report_error(INVALID_PARAM,
+                       "create_async_bmp_writer: io_uring is not available.");
+      destroy_async_bmp_writer(writer);
+      return NULL;
+    }
+    else
+    {
+      stop_ring(writer);
+      backend = ASYNC_WRITER_THREADS;
+    }
+  }
+#else
+  if (backend == ASYNC_WRITER_IO_URING)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "create_async_bmp_writer: io_uring is not available.");
+    destroy_async_bmp_writer(writer);
+    return NULL;
+  }
+  backend = ASYNC_WRITER_THREADS;
+#endif
+
+  writer->backend = backend;
+  if (backend == ASYNC_WRITER_THREADS)
+  {
+    uint32_t threads = settings->thread_count ? settings->thread_count
+                                              : ASYNC_WRITER_DEFAULT_THREADS;
+    if (!start_pool(writer, threads))
+    {
+      mat_report_error(FAILED_BMP_FILE_WRITE,
+                       "create_async_bmp_writer: unable to start writer threads.");
+      destroy_async_bmp_writer(writer);
+      return NULL;
+    }
+  }
+
+  return writer;
+}
+
+void destroy_async_bmp_writer(async_bmp_writer *writer)
+{
+  if (writer == NULL)
+    return;
+
+  async_bmp_writer_wait_all(writer);
+
+  pthread_mutex_lock(&writer->lock);
+  writer->stopping = true;
+  pthread_cond_broadcast(&writer->work_ready);
+  pthread_mutex_unlock(&writer->lock);
+
+  for (uint32_t index = 0; index < writer->thread_count; index++)
+    pthread_join(writer->threads[index], NULL);
+  free(writer->threads);
+
+#ifdef ASYNC_HAVE_IO_URING
+  stop_ring(writer);
+#endif
+
+  // Requests of retired slots may outlive the ring, so their memory is leaked
+  // rather than freed under them.
+  for (uint32_t index = 0; index < writer->queue_depth; index++)
+  {
+    destroy_bmp_encoder(writer->slots[index].encoder);
+    if (writer->slots[index].pending == 0)
+      free(writer->slots[index].buffer);
+  }
+  if (writer->retired_slots == 0)
+    free(writer->slots);
+
+  pthread_cond_destroy(&writer->work_ready);
+  pthread_cond_destroy(&writer->slot_released);
+  pthread_mutex_destroy(&writer->lock);
+  free(writer);
+}
+
+/**
+ * Encode mat into the slot's buffer, (re)creating the encoder and growing the
+ * buffer only when the frame shape or format changes.
+ */
+static mat_fn_status encode_into_slot(write_slot *slot, matrix *mat,
+                                      bmp_pixel_format format)
+{
+  if (slot->encoder == NULL || slot->format != format ||
+      !bmp_encoder_matches(slot->encoder, mat))
+  {
+    destroy_bmp_encoder(slot->encoder);
+    slot->encoder = create_bmp_encoder(mat->horizontal, mat->vertical, format, NULL);
+    slot->format = format;
+    if (slot->encoder == NULL)
+      return FAILED_MAT_ALLOCATION;
+  }
+
+  size_t length = bmp_encoder_encoded_size(slot->encoder);
+  if (length > slot->capacity)
+  {
+    free(slot->buffer);
+    slot->capacity = 0;
+    slot->buffer = (uint8_t *)malloc(length);
+    if (slot->buffer == NULL)
+    {
+      mat_report_error(FAILED_MAT_ALLOCATION,
+                       "async_bmp_writer_submit: unable to allocate a %zu byte buffer.",
+                       length);
+      return FAILED_MAT_ALLOCATION;
+    }
+    slot->capacity = length;
+  }
+
+  bmp_sink sink = bmp_memory_sink(slot->buffer, slot->capacity);
+  if (bmp_encoder_encode(slot->encoder, &sink, mat) != 0)
+    return FAILED_BMP_FILE_WRITE;
+
+  slot->length = length;
+  return VALID_OP;
+}
+
+mat_fn_status async_bmp_writer_submit(async_bmp_writer *writer, const char *filepath,
+                                      matrix *mat, bmp_pixel_format format,
+                                      async_write_callback callback, void *context)
+{
+  if (writer == NULL || filepath == NULL || mat == NULL)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "async_bmp_writer_submit: writer, filepath or mat is NULL.");
+    return INVALID_PARAM;
+  }
+
+  size_t path_length = strlen(filepath);
+  if (path_length >= PATH_MAX)
+  {
+    mat_report_error(INVALID_PARAM, "async_bmp_writer_submit: filepath is too long.");
+    return INVALID_PARAM;
+  }
+
+  pthread_mutex_lock(&writer->lock);
+  while (writer->free_slots == NULL && writer->retired_slots < writer->queue_depth)
+    pthread_cond_wait(&writer->slot_released, &writer->lock);
+  write_slot *slot = writer->free_slots;
+  if (slot == NULL)
+  {
+    pthread_mutex_unlock(&writer->lock);
+    mat_report_error(FAILED_BMP_FILE_WRITE,
+                     "async_bmp_writer_submit: every slot was lost to a failed "
+                     "io_uring.");
+    return FAILED_BMP_FILE_WRITE;
+  }
+  writer->free_slots = slot->next;
+  writer->in_flight++;
+  pthread_mutex_unlock(&writer->lock);
+
+  // Encoding happens on the caller's thread, outside of any lock.
+  mat_fn_status status = encode_into_slot(slot, mat, format);
+  if (status != VALID_OP)
+  {
+    release_slot(writer, slot, false);
+    return status;
+  }
+
+#ifdef MATRIX_INSTRUMENTATION
+  slot->submitted_ns = instrument_now_ns();
+#endif
+  memcpy(slot->filepath, filepath, path_length + 1);
+  slot->callback = callback;
+  slot->context = context;
+  slot->error = 0;
+
+#ifdef ASYNC_HAVE_IO_URING
+  if (writer->backend == ASYNC_WRITER_IO_URING)
+  {
+    submit_to_ring(writer, slot);
+    return VALID_OP;
+  }
+#endif
+
+  enqueue_slot(writer, slot);
+  return VALID_OP;
+}
+
+mat_fn_status async_bmp_writer_wait_all(async_bmp_writer *writer)
+{
+  if (writer == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "async_bmp_writer_wait_all: writer is NULL.");
+    return INVALID_PARAM;
+  }
+
+  pthread_mutex_lock(&writer->lock);
+  while (writer->in_flight > 0)
+    pthread_cond_wait(&writer->slot_released, &writer->lock);
+  uint32_t failures = writer->failures;
+  writer->failures = 0;
+  pthread_mutex_unlock(&writer->lock);
+
+  return failures ? FAILED_BMP_FILE_WRITE : VALID_OP;
+}
@@ -0,0 +1,484 @@
+#include "batch.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "errors.h"
+#include "instrument.h"
+
+#define BATCH_PATH_LENGTH 4096
+#define BATCH_LINE_LENGTH (2 * BATCH_PATH_LENGTH + 64)
+
+/**
+ * Range of job indices [head, tail) owned by a worker. The owner takes jobs
+ * from the head, thieves take from the tail.
+ */
+typedef struct batch_deque
+{
+  pthread_mutex_t lock;
+  size_t head;
+  size_t tail;
+} batch_deque;
+
+typedef struct batch_pool batch_pool;
+
+/**
+ * Per-thread state. The matrix and BMP encoder are reused across jobs and
+ * only recreated when a job needs a different shape.
+ */
+typedef struct batch_worker
+{
+  batch_pool *pool;
+  unsigned id;
+  pthread_t thread;
+
+  matrix *mat;
+  bmp_encoder *encoder;
+
+  size_t jobs_completed;
+  size_t jobs_failed;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  size_t slowest_job;
+  double slowest_seconds;
+} batch_worker;
+
+struct batch_pool
+{
+  const batch_job_list *list;
+  unsigned worker_count;
+  batch_deque *deques;
+  batch_worker *workers;
+};
+
+static char *copy_string(const char *text)
+{
+  size_t length = strlen(text) + 1;
+  char *copy = (char *)malloc(length);
+  if (copy)
+    memcpy(copy, text, length);
+  return copy;
+}
+
+mat_fn_status batch_add_job(batch_job_list *list, const char *input,
+                            const char *output, uint16_t horizontal,
+                            uint16_t vertical)
+{
+  if (list == NULL || input == NULL || output == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "batch_add_job: list, input or output is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (horizontal == 0 || vertical == 0)
+  {
+    mat_report_error(INVALID_PARAM, "batch_add_job: frame dimensions must be non-zero.");
+    return INVALID_PARAM;
+  }
+
+  if (list->count == list->capacity)
+  {
+    size_t capacity = list->capacity ? list->capacity * 2 : 64;
+    batch_job *jobs = (batch_job *)realloc(list->jobs, capacity * sizeof(batch_job));
+    if (jobs == NULL)
+    {
+      mat_report_error(FAILED_MAT_ALLOCATION, "batch_add_job: unable to grow job list.");
+      return FAILED_MAT_ALLOCATION;
+    }
+    list->jobs = jobs;
+    list->capacity = capacity;
+  }
+
+  batch_job *job = &list->jobs[list->count];
+  job->input = copy_string(input);
+  job->output = copy_string(output);
+  if (job->input == NULL || job->output == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION, "batch_add_job: unable to copy job paths.");
+    free(job->input);
+    free(job->output);
+    return FAILED_MAT_ALLOCATION;
+  }
+  job->horizontal = horizontal;
+  job->vertical = vertical;
+
+  list->count++;
+  return VALID_OP;
+}
+
+mat_fn_status batch_load_manifest(batch_job_list *list, const char *manifest_path)
+{
+  if (list == NULL || manifest_path == NULL)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "batch_load_manifest: list or manifest_path is NULL.");
+    return INVALID_PARAM;
+  }
+
+  FILE *file_ptr = fopen(manifest_path, "r");
+  if (file_ptr == NULL)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "batch_load_manifest: unable to open %s for reading.",
+                     manifest_path);
+    return FAILED_BINARY_FILE_READ;
+  }
+
+  mat_fn_status status = VALID_OP;
+  char line[BATCH_LINE_LENGTH];
+  char input[BATCH_PATH_LENGTH];
+  char output[BATCH_PATH_LENGTH];
+  unsigned long line_number = 0;
+
+  while (fgets(line, sizeof(line), file_ptr) != NULL)
+  {
+    line_number++;
+
+    char *text = line;
+    while (isspace((unsigned char)*text))
+      text++;
+    if (*text == '\0' || *text == '#')
+      continue;
+
+    unsigned long horizontal, vertical;
+    if (sscanf(text, "%4095s %4095s %lu %lu", input, output, &horizontal,
+               &vertical) != 4 ||
+        horizontal == 0 || horizontal > UINT16_MAX || vertical == 0 ||
+        vertical > UINT16_MAX)
+    {
+      mat_report_error(INVALID_PARAM,
+                       "batch_load_manifest: %s:%lu is not \"input output width "
+                       "height\".", manifest_path, line_number);
+      status = INVALID_PARAM;
+      break;
+    }
+
+    status = batch_add_job(list, input, output, (uint16_t)horizontal,
+                           (uint16_t)vertical);
+    if (status != VALID_OP)
+      break;
+  }
+
+  fclose(file_ptr);
+  return status;
+}
+
+static int compare_jobs_by_input(const void *lhs, const void *rhs)
+{
+  return strcmp(((const batch_job *)lhs)->input, ((const batch_job *)rhs)->input);
+}
+
+mat_fn_status batch_load_directory(batch_job_list *list, const char *input_dir,
+                                   const char *output_dir, uint16_t horizontal,
+                                   uint16_t vertical)
+{
+  if (list == NULL || input_dir == NULL || output_dir == NULL)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "batch_load_directory: list, input_dir or output_dir is NULL.");
+    return INVALID_PARAM;
+  }
+
+  DIR *dir = opendir(input_dir);
+  if (dir == NULL)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "batch_load_directory: unable to open directory %s.", input_dir);
+    return FAILED_BINARY_FILE_READ;
+  }
+
+  mat_fn_status status = VALID_OP;
+  size_t first_job = list->count;
+  char input[BATCH_PATH_LENGTH];
+  char output[BATCH_PATH_LENGTH];
+  struct dirent *entry;
+
+  while ((entry = readdir(dir)) != NULL)
+  {
+    size_t length = strlen(entry->d_name);
+    if (length <= 4 || strcasecmp(entry->d_name + length - 4, ".raw") != 0)
+      continue;
+
+    snprintf(input, sizeof(input), "%s/%s", input_dir, entry->d_name);
+    snprintf(output, sizeof(output), "%s/%.*s.bmp", output_dir,
+             (int)(length - 4), entry->d_name);
+
+    status = batch_add_job(list, input, output, horizontal, vertical);
+    if (status != VALID_OP)
+      break;
+  }
+
+  closedir(dir);
+
+  // readdir order is arbitrary, keep runs reproducible.
+  qsort(list->jobs + first_job, list->count - first_job, sizeof(batch_job),
+        compare_jobs_by_input);
+
+  return status;
+}
+
+void batch_free_jobs(batch_job_list *list)
+{
+  if (list == NULL)
+    return;
+
+  for (size_t index = 0; index < list->count; index++)
+  {
+    free(list->jobs[index].input);
+    free(list->jobs[index].output);
+  }
+  free(list->jobs);
+
+  list->jobs = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+/**
+ * Take the next job from the worker's own range, or steal the back half of
+ * another worker's range. Returns false once every range is empty.
+ */
+static bool batch_next_job(batch_pool *pool, unsigned id, size_t *job_index)
+{
+  batch_deque *own = &pool->deques[id];
+
+  pthread_mutex_lock(&own->lock);
+  if (own->head < own->tail)
+  {
+    *job_index = own->head++;
+    pthread_mutex_unlock(&own->lock);
+    return true;
+  }
+  pthread_mutex_unlock(&own->lock);
+
+  for (unsigned offset = 1; offset < pool->worker_count; offset++)
+  {
+    batch_deque *victim = &pool->deques[(id + offset) % pool->worker_count];
+
+    pthread_mutex_lock(&victim->lock);
+    size_t remaining = victim->tail - victim->head;
+    if (remaining == 0)
+    {
+      pthread_mutex_unlock(&victim->lock);
+      continue;
+    }
+
+    size_t stolen = (remaining + 1) / 2;
+    size_t start = victim->tail - stolen;
+    victim->tail = start;
+    pthread_mutex_unlock(&victim->lock);
+
+    *job_index = start;
+
+    pthread_mutex_lock(&own->lock);
+    own->head = start + 1;
+    own->tail = start + stolen;
+    pthread_mutex_unlock(&own->lock);
+    return true;
+  }
+
+  return false;
+}
+
+static bool batch_prepare_worker(batch_worker *worker, const batch_job *job)
+{
+  if (worker->mat == NULL || worker->mat->horizontal != job->horizontal ||
+      worker->mat->vertical != job->vertical)
+  {
+    if (worker->mat)
+      deallocate_matrix(worker->mat);
+
+    worker->mat = allocate_matrix(job->horizontal, job->vertical);
+    if (worker->mat == NULL)
+      return false;
+  }
+
+  if (!bmp_encoder_matches(worker->encoder, worker->mat))
+  {
+    destroy_bmp_encoder(worker->encoder);
+
+    worker->encoder = create_bmp_encoder(job->horizontal, job->vertical,
+                                         BMP_FORMAT_RGB565, NULL);
+    if (worker->encoder == NULL)
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * Read exactly one frame of the RAW file at path into mat. Workers reuse their matrix
+ * between jobs, so a short file must fail the job rather than leave pixels of the
+ * previous input behind. The bytes actually read are added to bytes_read.
+ */
+static bool batch_read_input(matrix *mat, const char *path, uint64_t *bytes_read)
+{
+  FILE *file_ptr = fopen(path, "rb");
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+  if (file_ptr == NULL)
+    return false;
+
+  bool ok = read_binary_frame(mat, file_ptr) == VALID_OP;
+  long position = ftell(file_ptr);
+  if (position > 0)
+    *bytes_read += (uint64_t)position;
+
+  fclose(file_ptr);
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+  return ok;
+}
+
+static void *batch_worker_main(void *arg)
+{
+  batch_worker *worker = (batch_worker *)arg;
+  batch_pool *pool = worker->pool;
+  size_t job_index;
+
+  while (batch_next_job(pool, worker->id, &job_index))
+  {
+    const batch_job *job = &pool->list->jobs[job_index];
+    double start = instrument_now_seconds();
+    INSTRUMENT_TIMER(frame_start);
+
+    bool ok = batch_prepare_worker(worker, job);
+    if (!ok)
+      mat_report_error(FAILED_MAT_ALLOCATION,
+                       "batch_worker: unable to allocate buffers for %s.", job->input);
+
+    if (ok && !batch_read_input(worker->mat, job->input, &worker->bytes_read))
+    {
+      mat_report_error(FAILED_BINARY_FILE_READ,
+                       "batch_worker: failed to read a %ux%u frame from %s.",
+                       job->horizontal, job->vertical, job->input);
+      ok = false;
+    }
+
+    if (ok && bmp_encoder_write_file(worker->encoder, job->output, worker->mat) != 0)
+    {
+      mat_report_error(FAILED_BMP_FILE_WRITE, "batch_worker: failed to write %s.",
+                       job->output);
+      ok = false;
+    }
+
+    double elapsed = instrument_now_seconds() - start;
+    if (elapsed > worker->slowest_seconds)
+    {
+      worker->slowest_seconds = elapsed;
+      worker->slowest_job = job_index;
+    }
+
+    if (!ok)
+    {
+      worker->jobs_failed++;
+      continue;
+    }
+
+    INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_TOTAL, frame_start);
+    worker->jobs_completed++;
+    worker->bytes_written += BMP_HEADER_BLOCK_SIZE +
+                             (uint64_t)calculate_bmp_row_stride(worker->mat) *
+                                 worker->mat->vertical;
+  }
+
+  return NULL;
+}
+
+mat_fn_status batch_run(const batch_job_list *list, unsigned thread_count,
+                        batch_stats *stats)
+{
+  if (list == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "batch_run: list is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (thread_count == 0)
+  {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = (online > 0) ? (unsigned)online : 1;
+  }
+
+  batch_pool pool;
+  pool.list = list;
+  pool.worker_count = thread_count;
+  pool.deques = (batch_deque *)calloc(thread_count, sizeof(batch_deque));
+  pool.workers = (batch_worker *)calloc(thread_count, sizeof(batch_worker));
+  if (pool.deques == NULL || pool.workers == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION, "batch_run: unable to allocate worker pool.");
+    free(pool.deques);
+    free(pool.workers);
+    return FAILED_MAT_ALLOCATION;
+  }
+
+  // Hand each worker an even contiguous share of the job list up front.
+  for (unsigned id = 0; id < thread_count; id++)
+  {
+    pthread_mutex_init(&pool.deques[id].lock, NULL);
+    pool.deques[id].head = list->count * id / thread_count;
+    pool.deques[id].tail = list->count * (id + 1) / thread_count;
+
+    pool.workers[id].pool = &pool;
+    pool.workers[id].id = id;
+  }
+
+  double start = instrument_now_seconds();
+
+  unsigned started = 0;
+  for (; started < thread_count; started++)
+  {
+    if (pthread_create(&pool.workers[started].thread, NULL, batch_worker_main,
+                       &pool.workers[started]) != 0)
+    {
+      mat_report_error(FAILED_MAT_ALLOCATION,
+                       "batch_run: unable to start worker thread %u.", started);
+      break;
+    }
+  }
+
+  // Any worker that failed to start has its range stolen by the others.
+  if (started == 0)
+    batch_worker_main(&pool.workers[0]);
+
+  for (unsigned id = 0; id < started; id++)
+    pthread_join(pool.workers[id].thread, NULL);
+
+  batch_stats summary = {0};
+  summary.seconds = instrument_now_seconds() - start;
+
+  for (unsigned id = 0; id < thread_count; id++)
+  {
+    batch_worker *worker = &pool.workers[id];
+    summary.jobs_completed += worker->jobs_completed;
+    summary.jobs_failed += worker->jobs_failed;
+    summary.bytes_read += worker->bytes_read;
+    summary.bytes_written += worker->bytes_written;
+    if (worker->slowest_seconds > summary.slowest_seconds)
+    {
+      summary.slowest_seconds = worker->slowest_seconds;
+      summary.slowest_job = worker->slowest_job;
+    }
+
+    if (worker->mat)
+      deallocate_matrix(worker->mat);
+    destroy_bmp_encoder(worker->encoder);
+    pthread_mutex_destroy(&pool.deques[id].lock);
+  }
+
+  free(pool.deques);
+  free(pool.workers);
+
+  if (stats != NULL)
+    *stats = summary;
+
+  return (summary.jobs_failed == 0) ? VALID_OP : FAILED_BMP_FILE_WRITE;
+}
@@ -1,14 +1,51 @@
 #include "bitmap.h"
+#include "byte_order.h"
+#include "convert.h"
+#include "errors.h"
+#include "instrument.h"
+#include "transform.h"
 
+#include <errno.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define BMP_FILE_HEADER_SIZE (uint8_t)(14) // 14 bytes long
 #define BMP_INFO_HEADER_SIZE (uint8_t)(40) // 40 bytes long
 #define BMP_COLR_HEADER_SIZE (uint8_t)(84) // 84 bytes long
+#define BMP_STRIPE_SIZE (size_t)(1 << 20) // 1 MiB of pixel rows per write
+#define BMP_TILED_CHUNK_PIXELS 512u // Pixels of a tiled row gathered per pack call
+
+static uint64_t bmp_row_stride(uint32_t width, bmp_pixel_format format);
+
+/**
+ * Pixel payload of a matrix stored as 16-bit BMP rows, padding included.
+ */
+static uint64_t bmp_image_size(const matrix *mat)
+{
+  return bmp_row_stride(mat->horizontal, BMP_FORMAT_RGB565) * mat->vertical;
+}
+
+/**
+ * The 32-bit size fields of a BMP header cannot describe files of 4 GiB or more.
+ * Readers recompute the sizes from the dimensions when they are 0, so that is what
+ * is stored instead of a wrapped value.
+ */
+static uint32_t bmp_size_field(uint64_t bytes)
+{
+  return (bytes > UINT32_MAX) ? 0 : (uint32_t)bytes;
+}
 
 BMPFileHeader *allocate_bmpfileheader()
 {
@@ -17,7 +54,8 @@ BMPFileHeader *allocate_bmpfileheader()
 
   if (ptr == NULL)
   {
-    printf("allocate_bmpfileheader: Failed to allocate BMPFileHeader.\n");
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "allocate_bmpfileheader: Failed to allocate BMPFileHeader.");
     return NULL;
   }
 
@@ -51,19 +89,19 @@ void set_bmpfileheader_filesize(const matrix *mat,
 {
   if (mat == NULL)
   {
-    printf("set_bmpfilesize: mat passed in is NULL.\n");
+    mat_report_error(INVALID_PARAM, "set_bmpfilesize: mat passed in is NULL.");
     return;
   }
 
   if (bmpFileHeaderPtr == NULL)
   {
-    printf("set_bmpfilesize: bmpFileHeader passed in is NULL.\n");
+    mat_report_error(INVALID_PARAM, "set_bmpfilesize: bmpFileHeader passed in is NULL.");
     return;
   }
 
   uint32_t *file_size = (uint32_t *)bmpFileHeaderPtr->file_size;
-  *file_size = BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE +
-               BMP_COLR_HEADER_SIZE + (mat->horizontal * mat->vertical);
+  *file_size = bmp_size_field(BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE +
+                              BMP_COLR_HEADER_SIZE + bmp_image_size(mat));
 }
 
 BMPInfoHeader *allocate_bmpinfoheader()
@@ -73,7 +111,8 @@ BMPInfoHeader *allocate_bmpinfoheader()
 
   if (ptr == NULL)
   {
-    printf("allocate_bmpinfoheader: Failed to allocate BMPInfoHeader.\n");
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "allocate_bmpinfoheader: Failed to allocate BMPInfoHeader.");
     return NULL;
   }
 
@@ -125,13 +164,14 @@ void set_bmpinfoheader_dimensions(const matrix *mat,
 {
   if (mat == NULL)
   {
-    printf("set_bmp_width_height: mat passed in is NULL.\n");
+    mat_report_error(INVALID_PARAM, "set_bmp_width_height: mat passed in is NULL.");
     return;
   }
 
   if (bmpInfoHeaderPtr == NULL)
   {
-    printf("set_bmp_width_height: bmpInfoHeaderPtr passed in is NULL.\n");
+    mat_report_error(INVALID_PARAM,
+                     "set_bmp_width_height: bmpInfoHeaderPtr passed in is NULL.");
     return;
   }
 
@@ -142,7 +182,7 @@ void set_bmpinfoheader_dimensions(const matrix *mat,
   *height = mat->vertical;
 
   uint32_t *image_size = (uint32_t *)bmpInfoHeaderPtr->size_image;
-  *image_size = mat->horizontal * mat->vertical;
+  *image_size = bmp_size_field(bmp_image_size(mat));
 }
 
 BMPColorHeader *allocate_bmpcolorheader()
@@ -152,7 +192,7 @@ BMPColorHeader *allocate_bmpcolorheader()
 
   if (ptr == NULL)
   {
-    printf("Unable to allocate BMPColorHeader.\n");
+    mat_report_error(FAILED_MAT_ALLOCATION, "Unable to allocate BMPColorHeader.");
     return NULL;
   }
 
@@ -183,78 +223,1416 @@ void deallocate_bmpcolorheader(BMPColorHeader *bmpColorHeaderPtr)
   free(bmpColorHeaderPtr);
 }
 
+uint8_t bmp_bits_per_pixel(bmp_pixel_format format)
+{
+  switch (format)
+  {
+  case BMP_FORMAT_BGR888:
+    return 24;
+  case BMP_FORMAT_BGRA8888:
+    return 32;
+  default:
+    return 16;
+  }
+}
+
+static uint64_t bmp_row_stride(uint32_t width, bmp_pixel_format format)
+{
+  uint64_t bytes_per_pixel = bmp_bits_per_pixel(format) / 8;
+
+  // Every row is padded up to a multiple of 4 bytes.
+  return ((uint64_t)width * bytes_per_pixel + 3) & ~(uint64_t)3;
+}
+
+uint32_t calculate_bmp_format_row_stride(const matrix *mat, bmp_pixel_format format)
+{
+  // At most 65535 pixels of 4 bytes, so the stride always fits.
+  return (uint32_t)bmp_row_stride(mat->horizontal, format);
+}
+
+uint32_t calculate_bmp_row_stride(const matrix *mat)
+{
+  return calculate_bmp_format_row_stride(mat, BMP_FORMAT_RGB565);
+}
+
+/**
+ * A negative height in the info header marks a top-down BMP, whose first row in the
+ * file is the top of the image.
+ */
+static void serialize_headers(uint32_t width, uint32_t height, bool top_down,
+                              bmp_pixel_format format, uint8_t *header_block)
+{
+  uint64_t image_size = bmp_row_stride(width, format) * height;
+  uint8_t *file_header = header_block;
+  uint8_t *info_header = file_header + BMP_FILE_HEADER_SIZE;
+  uint8_t *color_header = info_header + BMP_INFO_HEADER_SIZE;
+
+  memset(header_block, 0, BMP_HEADER_BLOCK_SIZE);
+
+  // File header.
+  put_le16(file_header + 0, 0x4D42);
+  put_le32(file_header + 2, bmp_size_field(BMP_HEADER_BLOCK_SIZE + image_size));
+  put_le32(file_header + 10, BMP_HEADER_BLOCK_SIZE);
+
+  // Info header.
+  put_le32(info_header + 0, 0x0000007C);
+  put_le32(info_header + 4, width);
+  put_le32(info_header + 8, top_down ? (uint32_t)-(int64_t)height : height);
+  put_le16(info_header + 12, 0x0001);
+  put_le16(info_header + 14, bmp_bits_per_pixel(format));
+  put_le32(info_header + 20, bmp_size_field(image_size));
+
+  // Color header. The remaining 68 bytes stay zeroed.
+  switch (format)
+  {
+  case BMP_FORMAT_BGR888:
+    // BI_RGB, the masks are implied and left zeroed.
+    put_le32(info_header + 16, 0x00000000);
+    break;
+  case BMP_FORMAT_BGRA8888:
+    put_le32(info_header + 16, 0x00000003);
+    put_le32(color_header + 0, 0x00FF0000);
+    put_le32(color_header + 4, 0x0000FF00);
+    put_le32(color_header + 8, 0x000000FF);
+    put_le32(color_header + 12, 0xFF000000);
+    break;
+  default:
+    put_le32(info_header + 16, 0x00000003);
+    put_le32(color_header + 0, 0x0000F800);
+    put_le32(color_header + 4, 0x000007E0);
+    put_le32(color_header + 8, 0x0000001F);
+    break;
+  }
+}
+
+void serialize_bmp_headers(const matrix *mat, bmp_pixel_format format,
+                           uint8_t *header_block)
+{
+  serialize_headers(mat->horizontal, mat->vertical, false, format, header_block);
+}
+
+void serialize_rgb565_bmp_headers(const matrix *mat, uint8_t *header_block)
+{
+  serialize_bmp_headers(mat, BMP_FORMAT_RGB565, header_block);
+}
+
+/**
+ * Convert a single matrix row into its BMP representation (little-endian
+ * pixels of the requested format followed by zeroed padding up to the row
+ * stride).
+ */
+static void pack_bmp_row(const uint16_t *src, uint32_t width,
+                         bmp_pixel_format format, uint8_t *dst, uint32_t stride)
+{
+  size_t row_bytes = (size_t)width * (bmp_bits_per_pixel(format) / 8);
+
+  switch (format)
+  {
+  case BMP_FORMAT_BGR888:
+    rgb565_to_bgr888_row(src, dst, width);
+    break;
+  case BMP_FORMAT_BGRA8888:
+    rgb565_to_bgra8888_row(src, dst, width);
+    break;
+  default:
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (uint32_t col = 0; col < width; col++)
+      put_le16(dst + (size_t)col * sizeof(uint16_t), src[col]);
+#else
+    memcpy(dst, src, row_bytes);
+#endif
+    break;
+  }
+
+  if (stride > row_bytes)
+    memset(dst + row_bytes, 0, stride - row_bytes);
+}
+
+/**
+ * Pack a row of mat into dst, reversed through the one-row buffer mirrored unless it
+ * is NULL. Row-major rows are packed where they lie. A row of a tiled matrix is spread
+ * over one run per tile, so it is gathered into a small buffer chunk by chunk and
+ * every chunk packed while still in L1: the conversion to row-major happens on the
+ * way into the BMP row, without a row-major copy of the frame.
+ */
+static void pack_matrix_row(const matrix *mat, uint16_t row, uint16_t *mirrored,
+                            bmp_pixel_format format, uint8_t *dst, uint32_t stride)
+{
+  if (matrix_is_row_major(mat))
+  {
+    const uint16_t *src = mat->mem + calculate_offset((matrix *)mat, row, 0);
+    if (mirrored != NULL)
+    {
+      reverse_rgb565_row(src, mirrored, mat->horizontal);
+      src = mirrored;
+    }
+    pack_bmp_row(src, mat->horizontal, format, dst, stride);
+    return;
+  }
+
+  uint16_t gathered[BMP_TILED_CHUNK_PIXELS];
+  uint16_t reversed[BMP_TILED_CHUNK_PIXELS];
+  size_t pixel_bytes = bmp_bits_per_pixel(format) / 8;
+  uint32_t width = mat->horizontal;
+  uint32_t col = 0;
+
+#if !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  // Little endian 16-bit rows are the pixels themselves: gather them in place.
+  if (format == BMP_FORMAT_RGB565 && mirrored == NULL)
+  {
+    copy_matrix_row(mat, row, 0, width, (uint16_t *)dst);
+    col = width;
+  }
+#endif
+
+  for (; col < width; col += BMP_TILED_CHUNK_PIXELS)
+  {
+    uint32_t count = width - col;
+    if (count > BMP_TILED_CHUNK_PIXELS)
+      count = BMP_TILED_CHUNK_PIXELS;
+
+    const uint16_t *src = gathered;
+    if (mirrored != NULL)
+    {
+      copy_matrix_row(mat, row, (uint16_t)(width - col - count), count, gathered);
+      reverse_rgb565_row(gathered, reversed, count);
+      src = reversed;
+    }
+    else
+      copy_matrix_row(mat, row, (uint16_t)col, count, gathered);
+
+    pack_bmp_row(src, count, format, dst + col * pixel_bytes,
+                 (uint32_t)(count * pixel_bytes));
+  }
+
+  size_t row_bytes = width * pixel_bytes;
+  if (stride > row_bytes)
+    memset(dst + row_bytes, 0, stride - row_bytes);
+}
+
+uint8_t write_bmpfile_buffered(const char *filepath, matrix *mat,
+                               bmp_pixel_format format, uint8_t *scratch,
+                               size_t scratch_size)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT,
+                     "Unable to write BMP file, passed in mat parameter is NULL.");
+    return 1;
+  }
+
+  uint8_t ret = 0;
+  uint8_t header_block[BMP_HEADER_BLOCK_SIZE];
+  uint32_t stride = calculate_bmp_format_row_stride(mat, format);
+  uint8_t *owned_scratch = NULL;
+
+  // Fall back to an internal stripe buffer when the caller's is missing or
+  // cannot hold a single row.
+  if (scratch == NULL || scratch_size < stride)
+  {
+    size_t image_size = (size_t)stride * mat->vertical;
+    scratch_size = (image_size < BMP_STRIPE_SIZE) ? image_size : BMP_STRIPE_SIZE;
+    if (scratch_size < stride)
+      scratch_size = stride;
+
+    owned_scratch = (uint8_t *)malloc(scratch_size ? scratch_size : 1);
+    if (owned_scratch == NULL)
+    {
+      mat_report_error(FAILED_MAT_ALLOCATION, "Unable to allocate BMP stripe buffer.");
+      return 5;
+    }
+    scratch = owned_scratch;
+  }
+
+  INSTRUMENT_TIMER(frame_start);
+  INSTRUMENT_TIMER(start);
+  serialize_bmp_headers(mat, format, header_block);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_HEADER, start);
+
+  FILE *fileptr = fopen(filepath, "wb");
+  if (fileptr == NULL)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to open %s for binary writing.",
+                     filepath);
+    ret = 4;
+    goto cleanup;
+  }
+
+  // Every write below is a full stripe, so stdio buffering would only add a
+  // copy. Issue one write per stripe instead.
+  setvbuf(fileptr, NULL, _IONBF, 0);
+
+  if (fwrite(header_block, BMP_HEADER_BLOCK_SIZE, 1, fileptr) != 1)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to write BMP headers to %s.",
+                     filepath);
+    ret = 6;
+    goto close_file;
+  }
+  INSTRUMENT_COUNT(INSTRUMENT_BYTES_WRITTEN, BMP_HEADER_BLOCK_SIZE);
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 2);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+
+  uint32_t rows_per_stripe = (uint32_t)(scratch_size / stride);
+  int32_t row = (int32_t)mat->vertical - 1;
+  while (row >= 0)
+  {
+    uint32_t rows_in_stripe = 0;
+    uint8_t *dst = scratch;
+    while (row >= 0 && rows_in_stripe < rows_per_stripe)
+    {
+      pack_matrix_row(mat, (uint16_t)row, NULL, format, dst, stride);
+      dst += stride;
+      rows_in_stripe++;
+      row--;
+    }
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_ENCODE, start);
+
+    if (fwrite(scratch, (size_t)stride * rows_in_stripe, 1, fileptr) != 1)
+    {
+      mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to write BMP pixel data to %s.",
+                       filepath);
+      ret = 6;
+      goto close_file;
+    }
+    INSTRUMENT_COUNT(INSTRUMENT_BYTES_WRITTEN, (size_t)stride * rows_in_stripe);
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+  }
+
+close_file:
+  fclose(fileptr);
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+  if (ret == 0)
+    INSTRUMENT_COUNT(INSTRUMENT_FRAMES_PROCESSED, 1);
+  INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_WRITE, frame_start);
+
+cleanup:
+  free(owned_scratch);
+
+  return ret;
+}
+
+uint8_t write_bmpfile(const char *filepath, matrix *mat, bmp_pixel_format format)
+{
+  return write_bmpfile_buffered(filepath, mat, format, NULL, 0);
+}
+
+uint8_t write_rgb565_bmpfile_buffered(const char *filepath, matrix *mat,
+                                      uint8_t *scratch, size_t scratch_size)
+{
+  return write_bmpfile_buffered(filepath, mat, BMP_FORMAT_RGB565, scratch,
+                                scratch_size);
+}
+
 uint8_t write_rgb565_bmpfile(const char *filepath, matrix *mat)
+{
+  return write_bmpfile_buffered(filepath, mat, BMP_FORMAT_RGB565, NULL, 0);
+}
+
+/**
+ * Write rows [first_row, last_row] of mat into an already open BMP file,
+ * staging them through scratch.
+ */
+static uint8_t pwrite_rgb565_rows(int fd, const matrix *mat, bool top_down,
+                                  uint32_t data_offset, uint32_t stride,
+                                  int32_t first_row, int32_t last_row,
+                                  uint8_t *scratch, size_t scratch_size)
+{
+  int32_t rows_per_stripe = (int32_t)(scratch_size / stride);
+  INSTRUMENT_TIMER(start);
+
+  while (first_row <= last_row)
+  {
+    int32_t count = last_row - first_row + 1;
+    if (count > rows_per_stripe)
+      count = rows_per_stripe;
+
+    // Bottom-up files store matrix rows in reverse, so a run of matrix rows
+    // is still one contiguous run of file rows, just flipped.
+    int32_t stripe_first = top_down ? first_row : last_row - count + 1;
+    for (int32_t index = 0; index < count; index++)
+    {
+      int32_t row = top_down ? stripe_first + index : last_row - index;
+      pack_matrix_row(mat, (uint16_t)row, NULL, BMP_FORMAT_RGB565,
+                      scratch + index * stride, stride);
+    }
+
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_ENCODE, start);
+
+    int32_t file_row = top_down ? stripe_first : (int32_t)mat->vertical - 1 - last_row;
+    size_t length = (size_t)stride * count;
+    off_t offset = (off_t)data_offset + (off_t)file_row * stride;
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+    if (pwrite(fd, scratch, length, offset) != (ssize_t)length)
+      return 6;
+    INSTRUMENT_COUNT(INSTRUMENT_BYTES_WRITTEN, length);
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+
+    if (top_down)
+      first_row += count;
+    else
+      last_row -= count;
+  }
+
+  return 0;
+}
+
+uint8_t update_rgb565_bmpfile(const char *filepath, matrix *mat)
 {
   if (mat == NULL)
   {
-    printf("Unable to write BMP file, passed in mat parameter is NULL.\n");
+    mat_report_error(NULL_MAT,
+                     "Unable to update BMP file, passed in mat parameter is NULL.");
     return 1;
   }
 
+  int fd = open(filepath, O_RDWR);
+  if (fd < 0)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to open %s for updating.", filepath);
+    return 4;
+  }
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 4);
+
   uint8_t ret = 0;
-  BMPFileHeader *header_ptr = allocate_bmpfileheader();
-  BMPInfoHeader *info_ptr = allocate_bmpinfoheader();
-  BMPColorHeader *color_ptr = allocate_bmpcolorheader();
+  uint8_t *scratch = NULL;
+  struct stat file_stat;
+  uint8_t header_block[BMP_HEADER_BLOCK_SIZE] = {0};
 
-  if (header_ptr == NULL)
+  // The masks of a BI_BITFIELDS file directly follow the 40-byte info header,
+  // whichever header version is used.
+  const size_t minimum_header = BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + 12;
+  if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < minimum_header ||
+      pread(fd, header_block, minimum_header, 0) != (ssize_t)minimum_header)
   {
-    printf("Unable to allocate BMPFileHeader.\n");
-    ret = 1;
+    mat_report_error(FAILED_BINARY_FILE_READ, "Unable to read BMP headers from %s.",
+                     filepath);
+    ret = 7;
     goto cleanup;
   }
 
-  if (info_ptr == NULL)
+  const uint8_t *info_header = header_block + BMP_FILE_HEADER_SIZE;
+  const uint8_t *masks = info_header + BMP_INFO_HEADER_SIZE;
+  int32_t width = (int32_t)get_le32(info_header + 4);
+  int32_t height = (int32_t)get_le32(info_header + 8);
+  bool top_down = height < 0;
+
+  // Only files holding exactly the 565 layout may receive 565 rows: a 16-bit BI_RGB
+  // file is 555 and would be silently recolored.
+  if (get_le16(header_block) != 0x4D42 || get_le32(info_header) < BMP_INFO_HEADER_SIZE ||
+      get_le16(info_header + 14) != 16 || get_le32(info_header + 16) != 3 ||
+      get_le32(masks) != 0xF800 || get_le32(masks + 4) != 0x07E0 ||
+      get_le32(masks + 8) != 0x001F)
   {
-    printf("Unable to allocate BMPInfoHeader.\n");
-    ret = 2;
+    mat_report_error(INVALID_PARAM, "%s is not a 16-bit RGB565 BMP file.", filepath);
+    ret = 7;
     goto cleanup;
   }
 
-  if (color_ptr == NULL)
+  if (width != mat->horizontal ||
+      (top_down ? -(int64_t)height : height) != (int64_t)mat->vertical)
   {
-    printf("Unable to allocate BMPColorHeader.\n");
-    ret = 3;
+    mat_report_error(INVALID_PARAM, "%s does not have the dimensions of the matrix.",
+                     filepath);
+    ret = 7;
     goto cleanup;
   }
 
-  set_bmpfileheader_filesize(mat, header_ptr);
-  set_bmpinfoheader_dimensions(mat, info_ptr);
-  FILE *fileptr = fopen(filepath, "wb");
-  if (fileptr == NULL)
+  uint32_t data_offset = get_le32(header_block + 10);
+  uint32_t stride = calculate_bmp_row_stride(mat);
+  size_t image_size = (size_t)stride * mat->vertical;
+
+  // Rows are only ever rewritten, never appended: a short file is rejected rather
+  // than extended.
+  if (data_offset < minimum_header ||
+      (uint64_t)data_offset + image_size > (uint64_t)file_stat.st_size)
   {
-    printf("Unable to open %s for binary writing.\n", filepath);
-    ret = 4;
+    mat_report_error(INVALID_PARAM, "%s is truncated or its pixel data is misplaced.",
+                     filepath);
+    ret = 7;
     goto cleanup;
   }
 
-  fwrite(header_ptr, sizeof(BMPFileHeader), 1, fileptr);
-  fwrite(info_ptr, sizeof(BMPInfoHeader), 1, fileptr);
-  fwrite(color_ptr, sizeof(BMPColorHeader), 1, fileptr);
+  size_t scratch_size = (image_size < BMP_STRIPE_SIZE) ? image_size : BMP_STRIPE_SIZE;
+  if (scratch_size < stride)
+    scratch_size = stride;
+
+  scratch = (uint8_t *)malloc(scratch_size ? scratch_size : 1);
+  if (scratch == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION, "Unable to allocate BMP stripe buffer.");
+    ret = 5;
+    goto cleanup;
+  }
 
-  uint16_t padding = 0x0000;
-  bool toggle_padding = ((mat->horizontal % 2) == 0) ? false : true;
-  for (int32_t row = (mat->vertical - 1); row >= 0; row--)
+  // Without dirty tracking every row is considered modified.
+  int32_t row = 0;
+  while (row < mat->vertical)
   {
-    for (int32_t col = 0; col < mat->horizontal; col++)
+    if (mat->dirty_rows != NULL && !mat->dirty_rows[row])
     {
-      // uint32_t offset = calculate_offset(row, col, mat);
-      // printf("offset: %d.\n", offset);
-      fwrite((mat->mem + calculate_offset(mat, row, col)), sizeof(uint16_t), 1,
-             fileptr);
+      row++;
+      continue;
     }
-    if (toggle_padding)
-      fwrite(&padding, sizeof(uint16_t), 1, fileptr);
+
+    int32_t last_row = row;
+    while (last_row + 1 < mat->vertical &&
+           (mat->dirty_rows == NULL || mat->dirty_rows[last_row + 1]))
+      last_row++;
+
+    ret = pwrite_rgb565_rows(fd, mat, top_down, data_offset, stride, row, last_row,
+                             scratch, scratch_size);
+    if (ret != 0)
+    {
+      mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to write BMP pixel data to %s.",
+                       filepath);
+      goto cleanup;
+    }
+
+    row = last_row + 1;
   }
 
-  fclose(fileptr);
+  clear_dirty_rows(mat);
 
 cleanup:
-  if (color_ptr)
-    deallocate_bmpcolorheader(color_ptr);
-  if (info_ptr)
-    deallocate_bmpinfoheader(info_ptr);
-  if (header_ptr)
-    deallocate_bmpfileheader(header_ptr);
+  free(scratch);
+  close(fd);
 
   return ret;
-}
\ No newline at end of file
+}
+
+/**
+ * Offset of the pixel rows inside an encoder buffer. The header block sits
+ * right in front of them so the first stripe goes out together with it, while
+ * the rows themselves stay cache line aligned.
+ */
+#define BMP_ENCODER_ROWS_OFFSET (size_t)(192)
+
+struct bmp_encoder
+{
+  uint16_t horizontal;
+  uint16_t vertical;
+  bmp_pixel_format format;
+  uint32_t stride;
+  uint32_t rows_per_stripe;
+  bool sync_on_close;
+  bool flip_vertical;
+  bool mirror_horizontal;
+
+  /**
+   * Header block at rows - BMP_HEADER_BLOCK_SIZE followed by a stripe of rows.
+   */
+  uint8_t *buffer;
+  uint8_t *rows;
+
+  /**
+   * One matrix row, reversed, when mirror_horizontal is set.
+   */
+  uint16_t *mirrored;
+};
+
+bmp_encoder *create_bmp_encoder(uint16_t horizontal_dim, uint16_t vertical_dim,
+                                bmp_pixel_format format,
+                                const bmp_encoder_settings *settings)
+{
+  bmp_encoder *encoder = (bmp_encoder *)calloc(1, sizeof(bmp_encoder));
+  if (encoder == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_bmp_encoder: failed to allocate encoder.");
+    return NULL;
+  }
+
+  size_t stripe_size = (settings && settings->stripe_size) ? settings->stripe_size
+                                                           : BMP_STRIPE_SIZE;
+
+  encoder->horizontal = horizontal_dim;
+  encoder->vertical = vertical_dim;
+  encoder->format = format;
+  encoder->stride = (uint32_t)bmp_row_stride(horizontal_dim, format);
+  encoder->sync_on_close = settings ? settings->sync_on_close : false;
+  encoder->flip_vertical = settings ? settings->flip_vertical : false;
+  encoder->mirror_horizontal = settings ? settings->mirror_horizontal : false;
+
+  if (encoder->mirror_horizontal)
+  {
+    encoder->mirrored = (uint16_t *)malloc((size_t)horizontal_dim * sizeof(uint16_t));
+    if (encoder->mirrored == NULL && horizontal_dim != 0)
+    {
+      mat_report_error(FAILED_MAT_ALLOCATION,
+                       "create_bmp_encoder: failed to allocate mirror row.");
+      free(encoder);
+      return NULL;
+    }
+  }
+
+  // Never stage more rows than the image has, nor less than one.
+  uint32_t rows = encoder->stride ? (uint32_t)(stripe_size / encoder->stride) : 1;
+  if (rows > vertical_dim)
+    rows = vertical_dim;
+  if (rows == 0)
+    rows = 1;
+  encoder->rows_per_stripe = rows;
+
+  size_t buffer_size = BMP_ENCODER_ROWS_OFFSET + (size_t)encoder->stride * rows;
+  void *buffer = NULL;
+  if (posix_memalign(&buffer, 64, buffer_size) != 0)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_bmp_encoder: failed to allocate stripe buffer.");
+    free(encoder->mirrored);
+    free(encoder);
+    return NULL;
+  }
+
+  encoder->buffer = (uint8_t *)buffer;
+  encoder->rows = encoder->buffer + BMP_ENCODER_ROWS_OFFSET;
+  INSTRUMENT_TIMER(start);
+  serialize_headers(horizontal_dim, vertical_dim, false, format,
+                    encoder->rows - BMP_HEADER_BLOCK_SIZE);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_HEADER, start);
+
+  return encoder;
+}
+
+void destroy_bmp_encoder(bmp_encoder *encoder)
+{
+  if (encoder == NULL)
+    return;
+  free(encoder->buffer);
+  free(encoder->mirrored);
+  free(encoder);
+}
+
+bool bmp_encoder_matches(const bmp_encoder *encoder, const matrix *mat)
+{
+  return encoder != NULL && mat != NULL && encoder->horizontal == mat->horizontal &&
+         encoder->vertical == mat->vertical;
+}
+
+/**
+ * write(2) the whole buffer, resuming after short writes and interruptions.
+ */
+static bool write_all(int fd, const uint8_t *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t written = write(fd, data, length);
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    INSTRUMENT_COUNT(INSTRUMENT_BYTES_WRITTEN, written);
+    data += written;
+    length -= (size_t)written;
+  }
+
+  return true;
+}
+
+size_t bmp_encoder_encoded_size(const bmp_encoder *encoder)
+{
+  if (encoder == NULL)
+    return 0;
+  return BMP_HEADER_BLOCK_SIZE + (size_t)encoder->stride * encoder->vertical;
+}
+
+/**
+ * Pack the index-th row the file stores (counting from the start of the pixel
+ * array) into dst. BMP stores rows bottom up, so flip_vertical simply walks the
+ * matrix the other way; mirror_horizontal reverses the row into a one-row
+ * buffer on its way to pack_bmp_row.
+ */
+static void pack_encoded_row(const bmp_encoder *encoder, matrix *mat, uint32_t index,
+                             uint8_t *dst)
+{
+  uint32_t row = encoder->flip_vertical ? index : mat->vertical - 1u - index;
+  uint16_t *mirrored = encoder->mirror_horizontal ? encoder->mirrored : NULL;
+  pack_matrix_row(mat, (uint16_t)row, mirrored, encoder->format, dst, encoder->stride);
+}
+
+/**
+ * Encode the whole image straight into dst, which holds at least
+ * bmp_encoder_encoded_size bytes.
+ */
+static void encode_into(const bmp_encoder *encoder, matrix *mat, uint8_t *dst)
+{
+  INSTRUMENT_TIMER(start);
+  memcpy(dst, encoder->rows - BMP_HEADER_BLOCK_SIZE, BMP_HEADER_BLOCK_SIZE);
+  dst += BMP_HEADER_BLOCK_SIZE;
+
+  for (uint32_t index = 0; index < mat->vertical; index++)
+  {
+    pack_encoded_row(encoder, mat, index, dst);
+    dst += encoder->stride;
+  }
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_ENCODE, start);
+}
+
+/**
+ * Encode the image one stripe at a time through the encoder's buffer, handing
+ * every stripe to emit. The first stripe is preceded by the cached headers.
+ */
+static bool encode_stripes(bmp_encoder *encoder, matrix *mat,
+                           bool (*emit)(void *, const uint8_t *, size_t),
+                           void *context)
+{
+  uint8_t *start = encoder->rows - BMP_HEADER_BLOCK_SIZE;
+  uint32_t index = 0;
+  INSTRUMENT_TIMER(timer);
+  do
+  {
+    uint32_t rows_in_stripe = 0;
+    uint8_t *dst = encoder->rows;
+    while (index < mat->vertical && rows_in_stripe < encoder->rows_per_stripe)
+    {
+      pack_encoded_row(encoder, mat, index, dst);
+      dst += encoder->stride;
+      rows_in_stripe++;
+      index++;
+    }
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_ENCODE, timer);
+
+    if (!emit(context, start, (size_t)(dst - start)))
+      return false;
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, timer);
+    start = encoder->rows;
+  } while (index < mat->vertical);
+
+  return true;
+}
+
+static bool emit_to_fd(void *context, const uint8_t *data, size_t length)
+{
+  return write_all(*(int *)context, data, length);
+}
+
+/**
+ * Create filepath at its final size and encode straight into a shared mapping
+ * of it.
+ */
+static uint8_t encode_mapped_file(bmp_encoder *encoder, const char *filepath,
+                                  matrix *mat)
+{
+  size_t length = bmp_encoder_encoded_size(encoder);
+
+  int fd = open(filepath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to open %s for binary writing.",
+                     filepath);
+    return 4;
+  }
+
+  uint8_t ret = 0;
+  if (ftruncate(fd, (off_t)length) != 0)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to size %s to %zu bytes.", filepath,
+                     length);
+    ret = 6;
+    goto close_file;
+  }
+
+  uint8_t *map = (uint8_t *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                 fd, 0);
+  if (map == MAP_FAILED)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to map %s for writing.", filepath);
+    ret = 6;
+    goto close_file;
+  }
+
+  encode_into(encoder, mat, map);
+  INSTRUMENT_COUNT(INSTRUMENT_BYTES_WRITTEN, length);
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 2);
+
+  if (encoder->sync_on_close && msync(map, length, MS_SYNC) != 0)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to flush %s to storage.", filepath);
+    ret = 6;
+  }
+  munmap(map, length);
+
+close_file:
+  if (close(fd) != 0 && ret == 0)
+    ret = 6;
+
+  return ret;
+}
+
+bmp_sink bmp_memory_sink(uint8_t *buffer, size_t capacity)
+{
+  bmp_sink sink = {0};
+  sink.type = BMP_SINK_MEMORY;
+  sink.buffer = buffer;
+  sink.capacity = capacity;
+  sink.fd = -1;
+  return sink;
+}
+
+bmp_sink bmp_fd_sink(int fd)
+{
+  bmp_sink sink = {0};
+  sink.type = BMP_SINK_FD;
+  sink.fd = fd;
+  return sink;
+}
+
+bmp_sink bmp_mapped_file_sink(const char *filepath)
+{
+  bmp_sink sink = {0};
+  sink.type = BMP_SINK_MAPPED_FILE;
+  sink.filepath = filepath;
+  sink.fd = -1;
+  return sink;
+}
+
+bmp_sink bmp_callback_sink(bmp_sink_write_fn write_fn, void *context)
+{
+  bmp_sink sink = {0};
+  sink.type = BMP_SINK_CALLBACK;
+  sink.write = write_fn;
+  sink.context = context;
+  sink.fd = -1;
+  return sink;
+}
+
+uint8_t bmp_encoder_encode(bmp_encoder *encoder, bmp_sink *sink, matrix *mat)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT, "Unable to encode BMP, passed in mat parameter is NULL.");
+    return 1;
+  }
+
+  if (sink == NULL)
+  {
+    mat_report_error(NULL_MAT, "Unable to encode BMP, passed in sink parameter is NULL.");
+    return 1;
+  }
+
+  if (!bmp_encoder_matches(encoder, mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "Unable to encode BMP, encoder does not match the matrix.");
+    return 3;
+  }
+
+  size_t length = bmp_encoder_encoded_size(encoder);
+  uint8_t ret = 0;
+  sink->written = 0;
+
+  switch (sink->type)
+  {
+  case BMP_SINK_MEMORY:
+    if (sink->buffer == NULL || sink->capacity < length)
+    {
+      mat_report_error(FAILED_BMP_FILE_WRITE,
+                       "Unable to encode BMP, %zu bytes needed but the buffer holds "
+                       "%zu.", length, sink->capacity);
+      return 8;
+    }
+    encode_into(encoder, mat, sink->buffer);
+    break;
+  case BMP_SINK_FD:
+    if (!encode_stripes(encoder, mat, emit_to_fd, &sink->fd))
+    {
+      mat_report_error(FAILED_BMP_FILE_WRITE,
+                       "Unable to write BMP data to descriptor %d.", sink->fd);
+      return 6;
+    }
+    break;
+  case BMP_SINK_MAPPED_FILE:
+    ret = encode_mapped_file(encoder, sink->filepath, mat);
+    break;
+  case BMP_SINK_CALLBACK:
+    if (sink->write == NULL || !encode_stripes(encoder, mat, sink->write, sink->context))
+    {
+      mat_report_error(FAILED_BMP_FILE_WRITE,
+                       "Unable to hand BMP data to the sink callback.");
+      return 6;
+    }
+    break;
+  default:
+    mat_report_error(INVALID_PARAM, "Unable to encode BMP, unknown sink type.");
+    return 1;
+  }
+
+  if (ret == 0)
+    sink->written = length;
+
+  return ret;
+}
+
+uint8_t bmp_encoder_write_file(bmp_encoder *encoder, const char *filepath,
+                               matrix *mat)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT,
+                     "Unable to write BMP file, passed in mat parameter is NULL.");
+    return 1;
+  }
+
+  if (!bmp_encoder_matches(encoder, mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "Unable to write BMP file, encoder does not match the matrix.");
+    return 3;
+  }
+
+  INSTRUMENT_TIMER(frame_start);
+  int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to open %s for binary writing.",
+                     filepath);
+    return 4;
+  }
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, frame_start);
+
+  uint8_t ret = 0;
+  if (!encode_stripes(encoder, mat, emit_to_fd, &fd))
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to write BMP pixel data to %s.",
+                     filepath);
+    ret = 6;
+  }
+
+  INSTRUMENT_TIMER(start);
+  if (ret == 0 && encoder->sync_on_close && fsync(fd) != 0)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to flush %s to storage.", filepath);
+    ret = 6;
+  }
+
+  if (close(fd) != 0 && ret == 0)
+    ret = 6;
+
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, encoder->sync_on_close ? 3 : 2);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+  if (ret == 0)
+    INSTRUMENT_COUNT(INSTRUMENT_FRAMES_PROCESSED, 1);
+  INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_WRITE, frame_start);
+
+  return ret;
+}
+
+struct bmp_stripe_writer
+{
+  int fd;
+  char *filepath;
+  uint32_t horizontal;
+  uint32_t vertical;
+  bmp_pixel_format format;
+  uint32_t stride;
+  uint64_t rows_written;
+
+  /**
+   * Packed rows not written yet. Room for buffer_rows of them, buffered in use.
+   */
+  uint8_t *buffer;
+  uint32_t buffer_rows;
+  uint32_t buffered;
+  bool failed;
+};
+
+bmp_stripe_writer *create_bmp_stripe_writer(const char *filepath,
+                                            uint32_t horizontal_dim,
+                                            uint32_t vertical_dim,
+                                            bmp_pixel_format format)
+{
+  if (filepath == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "create_bmp_stripe_writer: filepath is NULL.");
+    return NULL;
+  }
+
+  uint64_t stride = bmp_row_stride(horizontal_dim, format);
+  if (horizontal_dim == 0 || vertical_dim == 0 || horizontal_dim > INT32_MAX ||
+      vertical_dim > INT32_MAX || stride > UINT32_MAX)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "create_bmp_stripe_writer: unsupported dimensions %ux%u.",
+                     horizontal_dim, vertical_dim);
+    return NULL;
+  }
+
+  bmp_stripe_writer *writer = (bmp_stripe_writer *)calloc(1, sizeof(bmp_stripe_writer));
+  if (writer == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_bmp_stripe_writer: failed to allocate writer.");
+    return NULL;
+  }
+
+  writer->horizontal = horizontal_dim;
+  writer->vertical = vertical_dim;
+  writer->format = format;
+  writer->stride = (uint32_t)stride;
+  writer->buffer_rows =
+      (stride < BMP_STRIPE_SIZE) ? (uint32_t)(BMP_STRIPE_SIZE / stride) : 1;
+  if (writer->buffer_rows > vertical_dim)
+    writer->buffer_rows = vertical_dim;
+
+  writer->filepath = strdup(filepath);
+  writer->buffer = (uint8_t *)malloc((size_t)writer->buffer_rows * writer->stride);
+  if (writer->filepath == NULL || writer->buffer == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_bmp_stripe_writer: failed to allocate stripe buffer.");
+    goto fail;
+  }
+
+  writer->fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (writer->fd < 0)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to open %s for binary writing.",
+                     filepath);
+    goto fail;
+  }
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+
+  uint8_t header_block[BMP_HEADER_BLOCK_SIZE];
+  INSTRUMENT_TIMER(start);
+  serialize_headers(horizontal_dim, vertical_dim, true, format, header_block);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_HEADER, start);
+  if (!write_all(writer->fd, header_block, sizeof(header_block)))
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to write BMP headers to %s.",
+                     filepath);
+    close(writer->fd);
+    goto fail;
+  }
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+
+  return writer;
+
+fail:
+  free(writer->buffer);
+  free(writer->filepath);
+  free(writer);
+  return NULL;
+}
+
+/**
+ * Write the buffered rows out and empty the buffer.
+ */
+static bool flush_stripe(bmp_stripe_writer *writer)
+{
+  if (writer->buffered == 0)
+    return true;
+
+  size_t length = (size_t)writer->buffered * writer->stride;
+  writer->buffered = 0;
+  if (!write_all(writer->fd, writer->buffer, length))
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to write BMP pixel data to %s.",
+                     writer->filepath);
+    writer->failed = true;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Pack rows into the stripe buffer, writing it out whenever it fills up. Rows are
+ * taken from pixels, or from band, whatever its layout, when pixels is NULL.
+ */
+static uint8_t append_stripe_rows(bmp_stripe_writer *writer, matrix *band,
+                                  const uint16_t *pixels, size_t pitch, uint32_t rows)
+{
+  if (rows > writer->vertical - writer->rows_written)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "bmp_stripe_writer: %u rows do not fit, %llu remain.", rows,
+                     (unsigned long long)(writer->vertical - writer->rows_written));
+    return 3;
+  }
+
+  if (writer->failed)
+    return 6;
+
+  INSTRUMENT_TIMER(start);
+  for (uint32_t row = 0; row < rows; row++)
+  {
+    uint8_t *dst = writer->buffer + (size_t)writer->buffered * writer->stride;
+    if (pixels != NULL)
+      pack_bmp_row(pixels + (size_t)row * pitch, writer->horizontal, writer->format, dst,
+                   writer->stride);
+    else
+      pack_matrix_row(band, (uint16_t)row, NULL, writer->format, dst, writer->stride);
+    writer->buffered++;
+
+    if (writer->buffered == writer->buffer_rows)
+    {
+      INSTRUMENT_LAP(INSTRUMENT_STAGE_ENCODE, start);
+      if (!flush_stripe(writer))
+        return 6;
+      INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+    }
+  }
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_ENCODE, start);
+
+  writer->rows_written += rows;
+  return 0;
+}
+
+uint8_t bmp_stripe_writer_append_rows(bmp_stripe_writer *writer, const uint16_t *pixels,
+                                      size_t pitch, uint32_t rows)
+{
+  if (writer == NULL || (pixels == NULL && rows != 0))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "bmp_stripe_writer_append_rows: writer or pixels is NULL.");
+    return 1;
+  }
+
+  if (pitch < writer->horizontal)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "bmp_stripe_writer_append_rows: pitch %zu is shorter than a row.",
+                     pitch);
+    return 3;
+  }
+
+  return append_stripe_rows(writer, NULL, pixels, pitch, rows);
+}
+
+uint8_t bmp_stripe_writer_append(bmp_stripe_writer *writer, matrix *band)
+{
+  if (writer == NULL || band == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "bmp_stripe_writer_append: writer or band is NULL.");
+    return 1;
+  }
+
+  if (band->horizontal != writer->horizontal)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "bmp_stripe_writer_append: band is %u pixels wide, the image %u.",
+                     band->horizontal, writer->horizontal);
+    return 3;
+  }
+
+  if (band->vertical == 0)
+    return 0;
+
+  return append_stripe_rows(writer, band, NULL, 0, band->vertical);
+}
+
+uint64_t bmp_stripe_writer_rows_remaining(const bmp_stripe_writer *writer)
+{
+  return (writer != NULL) ? writer->vertical - writer->rows_written : 0;
+}
+
+uint8_t close_bmp_stripe_writer(bmp_stripe_writer *writer)
+{
+  if (writer == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "close_bmp_stripe_writer: writer is NULL.");
+    return 1;
+  }
+
+  uint8_t ret = 0;
+  INSTRUMENT_TIMER(start);
+  if (writer->failed || !flush_stripe(writer))
+    ret = 6;
+  else if (writer->rows_written != writer->vertical)
+  {
+    mat_report_error(INVALID_PARAM, "close_bmp_stripe_writer: %s is missing %llu rows.",
+                     writer->filepath,
+                     (unsigned long long)(writer->vertical - writer->rows_written));
+    ret = 3;
+  }
+
+  if (close(writer->fd) != 0 && ret == 0)
+    ret = 6;
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+  if (ret == 0)
+    INSTRUMENT_COUNT(INSTRUMENT_FRAMES_PROCESSED, 1);
+
+  free(writer->buffer);
+  free(writer->filepath);
+  free(writer);
+  return ret;
+}
+
+/**
+ * pread(2) the whole range, resuming after short reads and interruptions.
+ */
+static bool read_all(int fd, uint8_t *data, size_t length, off_t offset)
+{
+  while (length > 0)
+  {
+    ssize_t got = pread(fd, data, length, offset);
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+    if (got < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (got == 0)
+      return false;
+    INSTRUMENT_COUNT(INSTRUMENT_BYTES_READ, got);
+    data += got;
+    length -= (size_t)got;
+    offset += got;
+  }
+
+  return true;
+}
+
+/**
+ * Exchange the contents of two non-overlapping rows.
+ */
+static void swap_rows(uint16_t *first, uint16_t *second, size_t count)
+{
+  size_t index = 0;
+
+#ifdef __SSE2__
+  for (; index + 8 <= count; index += 8)
+  {
+    __m128i lhs = _mm_loadu_si128((const __m128i *)(first + index));
+    __m128i rhs = _mm_loadu_si128((const __m128i *)(second + index));
+    _mm_storeu_si128((__m128i *)(first + index), rhs);
+    _mm_storeu_si128((__m128i *)(second + index), lhs);
+  }
+#endif
+
+  for (; index < count; index++)
+  {
+    uint16_t swap = first[index];
+    first[index] = second[index];
+    second[index] = swap;
+  }
+}
+
+/**
+ * Layouts of BMP pixel data read_rgb565_bmpfile understands.
+ */
+typedef enum bmp_source_format
+{
+  BMP_SOURCE_UNSUPPORTED,
+  BMP_SOURCE_RGB565,
+  BMP_SOURCE_BGR888,
+  BMP_SOURCE_BGRX8888
+} bmp_source_format;
+
+static bmp_source_format classify_bmp(uint16_t bits_per_pixel, uint32_t compression,
+                                      const uint8_t *masks)
+{
+  uint32_t red = get_le32(masks);
+  uint32_t green = get_le32(masks + 4);
+  uint32_t blue = get_le32(masks + 8);
+
+  if (bits_per_pixel == 16 && compression == 3 && red == 0xF800 && green == 0x07E0 &&
+      blue == 0x001F)
+    return BMP_SOURCE_RGB565;
+
+  if (bits_per_pixel == 24 && compression == 0)
+    return BMP_SOURCE_BGR888;
+
+  if (bits_per_pixel == 32 &&
+      (compression == 0 ||
+       (compression == 3 && red == 0x00FF0000 && green == 0x0000FF00 &&
+        blue == 0x000000FF)))
+    return BMP_SOURCE_BGRX8888;
+
+  return BMP_SOURCE_UNSUPPORTED;
+}
+
+/**
+ * Bulk read of a 565 image matching the matrix row layout, flipped in place.
+ */
+static bool read_rgb565_rows(int fd, matrix *mat, uint32_t data_offset,
+                             uint32_t stride, bool top_down)
+{
+  size_t row_bytes = (size_t)mat->horizontal * sizeof(uint16_t);
+  size_t image_size = (size_t)stride * mat->vertical;
+  INSTRUMENT_TIMER(start);
+
+  if (stride == row_bytes)
+  {
+    if (!read_all(fd, (uint8_t *)mat->mem, image_size, data_offset))
+      return false;
+
+    if (!top_down)
+    {
+      for (uint32_t row = 0; row < mat->vertical / 2u; row++)
+        swap_rows(mat->mem + calculate_offset(mat, row, 0),
+                  mat->mem + calculate_offset(mat, mat->vertical - 1 - row, 0),
+                  mat->horizontal);
+    }
+  }
+  else
+  {
+    // Odd widths carry 2 bytes of padding per row, so the rows have to be
+    // copied out of a staging buffer.
+    uint8_t *staging = (uint8_t *)malloc(image_size);
+    if (staging == NULL || !read_all(fd, staging, image_size, data_offset))
+    {
+      free(staging);
+      return false;
+    }
+
+    for (uint32_t row = 0; row < mat->vertical; row++)
+    {
+      uint32_t file_row = top_down ? row : mat->vertical - 1 - row;
+      memcpy(mat->mem + calculate_offset(mat, row, 0),
+             staging + (size_t)file_row * stride, row_bytes);
+    }
+    free(staging);
+  }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for (uint32_t index = 0; index < mat->size; index++)
+    mat->mem[index] = get_le16((const uint8_t *)(mat->mem + index));
+#endif
+
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_READ, start);
+  return true;
+}
+
+/**
+ * Read a 24 or 32-bit image one stripe at a time, quantizing every row.
+ */
+static bool read_quantized_rows(int fd, matrix *mat, bmp_source_format format,
+                                uint32_t data_offset, uint32_t stride, bool top_down)
+{
+  uint32_t rows_per_stripe = (uint32_t)(BMP_STRIPE_SIZE / stride);
+  if (rows_per_stripe == 0)
+    rows_per_stripe = 1;
+  if (rows_per_stripe > mat->vertical)
+    rows_per_stripe = mat->vertical;
+
+  uint8_t *stripe = (uint8_t *)malloc((size_t)stride * rows_per_stripe);
+  if (stripe == NULL)
+    return false;
+
+  bool ok = true;
+  INSTRUMENT_TIMER(start);
+  for (uint32_t file_row = 0; ok && file_row < mat->vertical; file_row += rows_per_stripe)
+  {
+    uint32_t rows = mat->vertical - file_row;
+    if (rows > rows_per_stripe)
+      rows = rows_per_stripe;
+
+    ok = read_all(fd, stripe, (size_t)stride * rows,
+                  (off_t)data_offset + (off_t)file_row * stride);
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_READ, start);
+
+    for (uint32_t index = 0; ok && index < rows; index++)
+    {
+      uint32_t row = top_down ? file_row + index : mat->vertical - 1 - file_row - index;
+      uint16_t *dst = mat->mem + calculate_offset(mat, row, 0);
+      const uint8_t *src = stripe + (size_t)index * stride;
+
+      if (format == BMP_SOURCE_BGR888)
+        bgr888_to_rgb565_row(src, dst, mat->horizontal);
+      else
+        bgra8888_to_rgb565_row(src, dst, mat->horizontal);
+    }
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_CONVERT, start);
+  }
+
+  free(stripe);
+  return ok;
+}
+
+matrix *read_rgb565_bmpfile(const char *filepath)
+{
+  if (filepath == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "read_rgb565_bmpfile: filepath is NULL.");
+    return NULL;
+  }
+
+  INSTRUMENT_TIMER(start);
+  int fd = open(filepath, O_RDONLY);
+  if (fd < 0)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ, "Unable to open %s for reading.", filepath);
+    return NULL;
+  }
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 2);
+
+  matrix *mat = NULL;
+  struct stat file_stat;
+  uint8_t header_block[BMP_HEADER_BLOCK_SIZE] = {0};
+
+  // The masks of a BI_BITFIELDS file directly follow the 40-byte info header,
+  // whichever header version is used.
+  const size_t minimum_header = BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + 12;
+  if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < minimum_header ||
+      !read_all(fd, header_block, minimum_header, 0))
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ, "Unable to read BMP headers from %s.",
+                     filepath);
+    goto cleanup;
+  }
+
+  const uint8_t *info_header = header_block + BMP_FILE_HEADER_SIZE;
+  uint32_t data_offset = get_le32(header_block + 10);
+  int32_t width = (int32_t)get_le32(info_header + 4);
+  int32_t height = (int32_t)get_le32(info_header + 8);
+  uint16_t bits_per_pixel = get_le16(info_header + 14);
+  uint32_t compression = get_le32(info_header + 16);
+  bool top_down = height < 0;
+  int64_t rows = top_down ? -(int64_t)height : height;
+
+  if (get_le16(header_block) != 0x4D42 || get_le32(info_header) < BMP_INFO_HEADER_SIZE ||
+      width <= 0 || width > UINT16_MAX || rows == 0 || rows > UINT16_MAX)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "%s is not a BMP file with supported dimensions.", filepath);
+    goto cleanup;
+  }
+
+  bmp_source_format format =
+      classify_bmp(bits_per_pixel, compression, info_header + BMP_INFO_HEADER_SIZE);
+  if (format == BMP_SOURCE_UNSUPPORTED)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "%s uses an unsupported pixel format (%u bits, compression %u).",
+                     filepath, bits_per_pixel, compression);
+    goto cleanup;
+  }
+
+  uint32_t stride = (((uint32_t)width * bits_per_pixel / 8) + 3) & ~(uint32_t)3;
+  if ((uint64_t)data_offset + (uint64_t)stride * rows > (uint64_t)file_stat.st_size)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ, "%s is truncated.", filepath);
+    goto cleanup;
+  }
+
+  mat = allocate_matrix((uint16_t)width, (uint16_t)rows);
+  if (mat == NULL)
+    goto cleanup;
+
+  bool ok = (format == BMP_SOURCE_RGB565)
+                ? read_rgb565_rows(fd, mat, data_offset, stride, top_down)
+                : read_quantized_rows(fd, mat, format, data_offset, stride, top_down);
+  if (!ok)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ, "Unable to read BMP pixel data from %s.",
+                     filepath);
+    deallocate_matrix(mat);
+    mat = NULL;
+  }
+
+cleanup:
+  close(fd);
+  if (mat != NULL)
+    INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_READ, start);
+
+  return mat;
+}
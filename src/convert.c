@@ -0,0 +1,1018 @@
+#include "convert.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define CONVERT_TARGET_AVX2 __attribute__((target("avx2")))
+#define CONVERT_TARGET_SSE2 __attribute__((target("sse2")))
+
+typedef void (*expand_row_fn)(const uint16_t *src, uint8_t *dst, size_t count);
+typedef void (*quantize_row_fn)(const uint8_t *src, uint16_t *dst, size_t count);
+typedef struct dither_pattern dither_pattern;
+typedef void (*dither_row_fn)(const uint8_t *src, uint16_t *dst, size_t count,
+                              const dither_pattern *pattern);
+typedef void (*raw_row_fn)(raw_pixel_format format, const void *src, uint16_t *dst,
+                           size_t count);
+
+/**
+ * Set of kernels for a single instruction set level.
+ */
+typedef struct convert_kernels
+{
+  expand_row_fn to_bgr888;
+  expand_row_fn to_bgra8888;
+  quantize_row_fn from_bgr888;
+  quantize_row_fn from_bgra8888;
+  dither_row_fn from_rgb888;
+  raw_row_fn from_raw;
+} convert_kernels;
+
+static convert_kernel_level supported_level = CONVERT_KERNEL_SCALAR;
+static convert_kernel_level active_level = CONVERT_KERNEL_SCALAR;
+static convert_kernels active_kernels;
+static pthread_once_t dispatch_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Scalar kernels
+ */
+
+static inline void expand_rgb565(uint16_t pixel, uint8_t *blue, uint8_t *green,
+                                 uint8_t *red)
+{
+  uint8_t r5 = (uint8_t)(pixel >> 11);
+  uint8_t g6 = (uint8_t)((pixel >> 5) & 0x3F);
+  uint8_t b5 = (uint8_t)(pixel & 0x1F);
+
+  *red = (uint8_t)((r5 << 3) | (r5 >> 2));
+  *green = (uint8_t)((g6 << 2) | (g6 >> 4));
+  *blue = (uint8_t)((b5 << 3) | (b5 >> 2));
+}
+
+void rgb565_to_bgr888_row_scalar(const uint16_t *src, uint8_t *dst, size_t count)
+{
+  for (size_t index = 0; index < count; index++, dst += 3)
+    expand_rgb565(src[index], &dst[0], &dst[1], &dst[2]);
+}
+
+void rgb565_to_bgra8888_row_scalar(const uint16_t *src, uint8_t *dst, size_t count)
+{
+  for (size_t index = 0; index < count; index++, dst += 4)
+  {
+    expand_rgb565(src[index], &dst[0], &dst[1], &dst[2]);
+    dst[3] = 0xFF;
+  }
+}
+
+/**
+ * Truncate 8-bit channels to RGB565. This exactly undoes expand_rgb565.
+ */
+static inline uint16_t quantize_rgb565(uint8_t blue, uint8_t green, uint8_t red)
+{
+  return (uint16_t)(((red & 0xF8) << 8) | ((green & 0xFC) << 3) | (blue >> 3));
+}
+
+void bgr888_to_rgb565_row_scalar(const uint8_t *src, uint16_t *dst, size_t count)
+{
+  for (size_t index = 0; index < count; index++, src += 3)
+    dst[index] = quantize_rgb565(src[0], src[1], src[2]);
+}
+
+void bgra8888_to_rgb565_row_scalar(const uint8_t *src, uint16_t *dst, size_t count)
+{
+  for (size_t index = 0; index < count; index++, src += 4)
+    dst[index] = quantize_rgb565(src[0], src[1], src[2]);
+}
+
+/*
+ * RGB888 ingest with ordered dithering. The thresholds of one image row repeat
+ * every 4 or 8 pixels, so they are laid out once per row as a bias byte for
+ * every byte of 16 interleaved R, G, B pixels (DITHER_PATTERN_BYTES), padded
+ * so that the SIMD gathers can read past it.
+ *
+ * A dithered channel v is first compressed to v - (v >> 5) (v - (v >> 6) for
+ * green), which maps 0..255 onto 0..248 (0..252), i.e. onto exactly 32 (64)
+ * steps, so that the bias, uniform over 0..7 (0..3), averages out to the
+ * value expand_rgb565 reconstructs. The sum never exceeds 255.
+ */
+
+#define DITHER_PATTERN_PIXELS 16
+#define DITHER_PATTERN_BYTES (3 * DITHER_PATTERN_PIXELS)
+
+struct dither_pattern
+{
+  uint8_t bias[DITHER_PATTERN_BYTES + 16];
+  bool enabled;
+};
+
+static const uint8_t bayer_8x8[8][8] = {
+    {0, 32, 8, 40, 2, 34, 10, 42},  {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44, 4, 36, 14, 46, 6, 38}, {60, 28, 52, 20, 62, 30, 54, 22},
+    {3, 35, 11, 43, 1, 33, 9, 41},  {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47, 7, 39, 13, 45, 5, 37}, {63, 31, 55, 23, 61, 29, 53, 21}};
+
+/**
+ * Fill pattern with the bias of every byte of a 16 pixel group on image row
+ * row. A cell holding rank t of n thresholds biases a channel quantized in
+ * steps of s by (2t + 1) * s / 2n, rounded down.
+ */
+static void build_dither_pattern(rgb565_dither dither, uint32_t row,
+                                 dither_pattern *pattern)
+{
+  memset(pattern, 0, sizeof(*pattern));
+  if (dither != RGB565_DITHER_ORDERED_4X4 && dither != RGB565_DITHER_ORDERED_8X8)
+    return;
+
+  // The 4x4 Bayer matrix is the top left quarter of the 8x8 one, ranks halved.
+  uint32_t size = (dither == RGB565_DITHER_ORDERED_4X4) ? 4 : 8;
+  uint32_t levels = size * size;
+
+  for (uint32_t col = 0; col < DITHER_PATTERN_PIXELS; col++)
+  {
+    uint32_t rank = bayer_8x8[row % size][col % size];
+    if (size == 4)
+      rank /= 4;
+
+    uint8_t bias_5 = (uint8_t)((2 * rank + 1) * 8 / (2 * levels));
+    uint8_t bias_6 = (uint8_t)((2 * rank + 1) * 4 / (2 * levels));
+    pattern->bias[3 * col] = bias_5;
+    pattern->bias[3 * col + 1] = bias_6;
+    pattern->bias[3 * col + 2] = bias_5;
+  }
+
+  pattern->enabled = true;
+}
+
+/**
+ * Quantization of a row that starts at the beginning of a pattern period.
+ */
+static void rgb888_row_scalar(const uint8_t *src, uint16_t *dst, size_t count,
+                              const dither_pattern *pattern)
+{
+  if (!pattern->enabled)
+  {
+    for (size_t index = 0; index < count; index++, src += 3)
+      dst[index] = quantize_rgb565(src[2], src[1], src[0]);
+    return;
+  }
+
+  for (size_t index = 0; index < count; index++, src += 3)
+  {
+    const uint8_t *cell = pattern->bias + 3 * (index % DITHER_PATTERN_PIXELS);
+    uint8_t red = (uint8_t)(src[0] - (src[0] >> 5) + cell[0]);
+    uint8_t green = (uint8_t)(src[1] - (src[1] >> 6) + cell[1]);
+    uint8_t blue = (uint8_t)(src[2] - (src[2] >> 5) + cell[2]);
+    dst[index] = quantize_rgb565(blue, green, red);
+  }
+}
+
+void rgb888_to_rgb565_row_scalar(const uint8_t *src, uint16_t *dst, size_t count,
+                                 rgb565_dither dither, uint32_t row)
+{
+  dither_pattern pattern;
+  build_dither_pattern(dither, row, &pattern);
+  rgb888_row_scalar(src, dst, count, &pattern);
+}
+
+/*
+ * RAW ingest. Every layout is two bytes per pixel; the kernels read a group
+ * of pixels before writing it, so src and dst may alias.
+ *
+ * YUYV uses BT.601 limited range with 6 fractional bits:
+ *   R = (74 (Y - 16) + 102 (V - 128) + 32) >> 6
+ *   G = (74 (Y - 16) - 25 (U - 128) - 52 (V - 128) + 32) >> 6
+ *   B = (74 (Y - 16) + 129 (U - 128) + 32) >> 6
+ * Only B can leave the 16-bit range, and only above 255, where the SIMD
+ * kernels saturate to the same clamped result.
+ */
+
+static inline uint16_t swap_rgb565(uint16_t pixel)
+{
+  return (uint16_t)((pixel >> 8) | (pixel << 8));
+}
+
+static inline uint16_t bgr565_to_rgb565(uint16_t pixel)
+{
+  return (uint16_t)((pixel >> 11) | (pixel & 0x07E0) | (pixel << 11));
+}
+
+static inline uint16_t rgb555_to_rgb565(uint16_t pixel)
+{
+  // Green gains a low bit copied from its top bit.
+  return (uint16_t)(((pixel & 0x7FE0) << 1) | ((pixel >> 4) & 0x20) | (pixel & 0x1F));
+}
+
+static inline int32_t clamp_channel(int32_t value)
+{
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline uint16_t yuv_to_rgb565(int32_t luma, int32_t u, int32_t v)
+{
+  int32_t base = 74 * (luma - 16) + 32;
+  int32_t red = clamp_channel((base + 102 * (v - 128)) >> 6);
+  int32_t green = clamp_channel((base - 25 * (u - 128) - 52 * (v - 128)) >> 6);
+  int32_t blue = clamp_channel((base + 129 * (u - 128)) >> 6);
+
+  return (uint16_t)(((red & 0xF8) << 8) | ((green & 0xFC) << 3) | (blue >> 3));
+}
+
+void raw_to_rgb565_row_scalar(raw_pixel_format format, const void *src, uint16_t *dst,
+                              size_t count)
+{
+  const uint16_t *pixels = (const uint16_t *)src;
+
+  switch (format)
+  {
+  case RAW_FORMAT_RGB565_SWAPPED:
+    for (size_t index = 0; index < count; index++)
+      dst[index] = swap_rgb565(pixels[index]);
+    break;
+  case RAW_FORMAT_BGR565:
+    for (size_t index = 0; index < count; index++)
+      dst[index] = bgr565_to_rgb565(pixels[index]);
+    break;
+  case RAW_FORMAT_RGB555:
+    for (size_t index = 0; index < count; index++)
+      dst[index] = rgb555_to_rgb565(pixels[index]);
+    break;
+  case RAW_FORMAT_YUYV:
+  {
+    const uint8_t *bytes = (const uint8_t *)src;
+    for (size_t index = 0; index + 2 <= count; index += 2, bytes += 4)
+    {
+      uint8_t y0 = bytes[0], u = bytes[1], y1 = bytes[2], v = bytes[3];
+      dst[index] = yuv_to_rgb565(y0, u, v);
+      dst[index + 1] = yuv_to_rgb565(y1, u, v);
+    }
+    break;
+  }
+  default:
+    if ((const void *)dst != src)
+      memmove(dst, src, count * sizeof(uint16_t));
+    break;
+  }
+}
+
+#ifdef CONVERT_HAVE_X86
+
+/*
+ * SSE2 kernels, 8 pixels per iteration.
+ */
+
+/**
+ * Expand 8 RGB565 pixels into two registers of 4 BGRA pixels each. alpha holds
+ * the value placed in the A byte of every pixel, shifted into the high byte.
+ */
+static inline CONVERT_TARGET_SSE2 void expand_8_sse2(__m128i pixels, __m128i alpha,
+                                                     __m128i *low, __m128i *high)
+{
+  const __m128i mask_6 = _mm_set1_epi16(0x3F);
+  const __m128i mask_5 = _mm_set1_epi16(0x1F);
+
+  __m128i r5 = _mm_srli_epi16(pixels, 11);
+  __m128i g6 = _mm_and_si128(_mm_srli_epi16(pixels, 5), mask_6);
+  __m128i b5 = _mm_and_si128(pixels, mask_5);
+
+  __m128i r8 = _mm_or_si128(_mm_slli_epi16(r5, 3), _mm_srli_epi16(r5, 2));
+  __m128i g8 = _mm_or_si128(_mm_slli_epi16(g6, 2), _mm_srli_epi16(g6, 4));
+  __m128i b8 = _mm_or_si128(_mm_slli_epi16(b5, 3), _mm_srli_epi16(b5, 2));
+
+  __m128i blue_green = _mm_or_si128(b8, _mm_slli_epi16(g8, 8));
+  __m128i red_alpha = _mm_or_si128(r8, alpha);
+
+  *low = _mm_unpacklo_epi16(blue_green, red_alpha);
+  *high = _mm_unpackhi_epi16(blue_green, red_alpha);
+}
+
+/**
+ * Squeeze 4 BGR0 pixels into 12 contiguous bytes at dst.
+ */
+static inline CONVERT_TARGET_SSE2 void store_4_bgr_sse2(__m128i bgr0, uint8_t *dst)
+{
+  const __m128i first_pixel = _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF);
+  const __m128i second_pixel =
+      _mm_set_epi32(0x0000FFFF, (int)0xFF000000, 0x0000FFFF, (int)0xFF000000);
+  const __m128i low_half = _mm_set_epi32(0, 0, -1, -1);
+  const __m128i high_half = _mm_set_epi32(-1, -1, 0, 0);
+
+  // Within each 64-bit half, slide the second pixel down over the empty
+  // alpha byte of the first one, leaving 6 valid bytes per half.
+  __m128i packed = _mm_or_si128(_mm_and_si128(bgr0, first_pixel),
+                                _mm_and_si128(_mm_srli_epi64(bgr0, 8), second_pixel));
+
+  // Close the 2 byte gap between the two halves.
+  __m128i bytes = _mm_or_si128(_mm_and_si128(packed, low_half),
+                               _mm_srli_si128(_mm_and_si128(packed, high_half), 2));
+
+  _mm_storel_epi64((__m128i *)dst, bytes);
+  uint32_t tail = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+  memcpy(dst + 8, &tail, sizeof(tail));
+}
+
+static CONVERT_TARGET_SSE2 void rgb565_to_bgr888_row_sse2(const uint16_t *src,
+                                                          uint8_t *dst, size_t count)
+{
+  const __m128i alpha = _mm_setzero_si128();
+  size_t index = 0;
+
+  for (; index + 8 <= count; index += 8, dst += 24)
+  {
+    __m128i low, high;
+    expand_8_sse2(_mm_loadu_si128((const __m128i *)(src + index)), alpha, &low, &high);
+    store_4_bgr_sse2(low, dst);
+    store_4_bgr_sse2(high, dst + 12);
+  }
+
+  rgb565_to_bgr888_row_scalar(src + index, dst, count - index);
+}
+
+static CONVERT_TARGET_SSE2 void rgb565_to_bgra8888_row_sse2(const uint16_t *src,
+                                                            uint8_t *dst, size_t count)
+{
+  const __m128i alpha = _mm_set1_epi16((short)0xFF00);
+  size_t index = 0;
+
+  for (; index + 8 <= count; index += 8, dst += 32)
+  {
+    __m128i low, high;
+    expand_8_sse2(_mm_loadu_si128((const __m128i *)(src + index)), alpha, &low, &high);
+    _mm_storeu_si128((__m128i *)dst, low);
+    _mm_storeu_si128((__m128i *)(dst + 16), high);
+  }
+
+  rgb565_to_bgra8888_row_scalar(src + index, dst, count - index);
+}
+
+/**
+ * Quantize 4 BGRx pixels, one per 32-bit lane, to RGB565 values sign extended
+ * to 32 bits, ready for a saturating pack that keeps them intact.
+ */
+static inline CONVERT_TARGET_SSE2 __m128i quantize_4_sse2(__m128i bgrx)
+{
+  __m128i red = _mm_and_si128(_mm_srli_epi32(bgrx, 8), _mm_set1_epi32(0xF800));
+  __m128i green = _mm_and_si128(_mm_srli_epi32(bgrx, 5), _mm_set1_epi32(0x07E0));
+  __m128i blue = _mm_and_si128(_mm_srli_epi32(bgrx, 3), _mm_set1_epi32(0x001F));
+  __m128i pixels = _mm_or_si128(_mm_or_si128(red, green), blue);
+
+  return _mm_srai_epi32(_mm_slli_epi32(pixels, 16), 16);
+}
+
+/**
+ * Gather 4 BGR pixels into the low 24 bits of each 32-bit lane. Reads one byte
+ * past the 12 bytes of pixels.
+ */
+static inline CONVERT_TARGET_SSE2 __m128i load_4_bgr_sse2(const uint8_t *src)
+{
+  int32_t lanes[4];
+  memcpy(&lanes[0], src, 4);
+  memcpy(&lanes[1], src + 3, 4);
+  memcpy(&lanes[2], src + 6, 4);
+  memcpy(&lanes[3], src + 9, 4);
+  return _mm_loadu_si128((const __m128i *)lanes);
+}
+
+static CONVERT_TARGET_SSE2 void bgr888_to_rgb565_row_sse2(const uint8_t *src,
+                                                          uint16_t *dst, size_t count)
+{
+  size_t index = 0;
+
+  // Keep one pixel in reserve for the scalar tail, so the gathers never read
+  // past the end of the row.
+  for (; index + 9 <= count; index += 8, src += 24)
+  {
+    __m128i low = quantize_4_sse2(load_4_bgr_sse2(src));
+    __m128i high = quantize_4_sse2(load_4_bgr_sse2(src + 12));
+    _mm_storeu_si128((__m128i *)(dst + index), _mm_packs_epi32(low, high));
+  }
+
+  bgr888_to_rgb565_row_scalar(src, dst + index, count - index);
+}
+
+static CONVERT_TARGET_SSE2 void bgra8888_to_rgb565_row_sse2(const uint8_t *src,
+                                                            uint16_t *dst, size_t count)
+{
+  size_t index = 0;
+
+  for (; index + 8 <= count; index += 8, src += 32)
+  {
+    __m128i low = quantize_4_sse2(_mm_loadu_si128((const __m128i *)src));
+    __m128i high = quantize_4_sse2(_mm_loadu_si128((const __m128i *)(src + 16)));
+    _mm_storeu_si128((__m128i *)(dst + index), _mm_packs_epi32(low, high));
+  }
+
+  bgra8888_to_rgb565_row_scalar(src, dst + index, count - index);
+}
+
+/**
+ * Quantize 4 RGBx pixels, one per 32-bit lane. Same output as quantize_4_sse2
+ * with red and blue swapped on input.
+ */
+static inline CONVERT_TARGET_SSE2 __m128i quantize_4_rgb_sse2(__m128i rgbx)
+{
+  __m128i red = _mm_and_si128(_mm_slli_epi32(rgbx, 8), _mm_set1_epi32(0xF800));
+  __m128i green = _mm_and_si128(_mm_srli_epi32(rgbx, 5), _mm_set1_epi32(0x07E0));
+  __m128i blue = _mm_and_si128(_mm_srli_epi32(rgbx, 19), _mm_set1_epi32(0x001F));
+  __m128i pixels = _mm_or_si128(_mm_or_si128(red, green), blue);
+
+  return _mm_srai_epi32(_mm_slli_epi32(pixels, 16), 16);
+}
+
+/**
+ * Compress the channels of 4 RGBx lanes for dithering (see above): subtract
+ * the top three bits of red and blue and the top two bits of green. scale is
+ * all ones when dithering and zero otherwise.
+ */
+static inline CONVERT_TARGET_SSE2 __m128i compress_4_rgb_sse2(__m128i rgbx, __m128i scale)
+{
+  __m128i top_5 = _mm_and_si128(_mm_srli_epi32(rgbx, 5), _mm_set1_epi32(0x00070007));
+  __m128i top_6 = _mm_and_si128(_mm_srli_epi32(rgbx, 6), _mm_set1_epi32(0x00000300));
+  return _mm_sub_epi32(rgbx, _mm_and_si128(_mm_or_si128(top_5, top_6), scale));
+}
+
+static CONVERT_TARGET_SSE2 void rgb888_row_sse2(const uint8_t *src, uint16_t *dst,
+                                                size_t count,
+                                                const dither_pattern *pattern)
+{
+  // Gathering the bias bytes like the pixels lines every bias up with its
+  // channel; the spare fourth byte of each lane is ignored by the quantizer.
+  const uint8_t *bias = pattern->bias;
+  __m128i bias_0 = load_4_bgr_sse2(bias);
+  __m128i bias_1 = load_4_bgr_sse2(bias + 12);
+  __m128i bias_2 = load_4_bgr_sse2(bias + 24);
+  __m128i bias_3 = load_4_bgr_sse2(bias + 36);
+  __m128i scale = pattern->enabled ? _mm_set1_epi32(-1) : _mm_setzero_si128();
+  size_t index = 0;
+
+#define DITHER_4_SSE2(offset, bias_lanes)                                               \
+  quantize_4_rgb_sse2(                                                                  \
+      _mm_adds_epu8(compress_4_rgb_sse2(load_4_bgr_sse2(src + (offset)), scale),        \
+                    bias_lanes))
+
+  for (; index + 17 <= count; index += 16, src += 48)
+  {
+    __m128i p0 = DITHER_4_SSE2(0, bias_0);
+    __m128i p1 = DITHER_4_SSE2(12, bias_1);
+    __m128i p2 = DITHER_4_SSE2(24, bias_2);
+    __m128i p3 = DITHER_4_SSE2(36, bias_3);
+    _mm_storeu_si128((__m128i *)(dst + index), _mm_packs_epi32(p0, p1));
+    _mm_storeu_si128((__m128i *)(dst + index + 8), _mm_packs_epi32(p2, p3));
+  }
+
+#undef DITHER_4_SSE2
+
+  rgb888_row_scalar(src, dst + index, count - index, pattern);
+}
+
+/**
+ * RAW ingest, 8 pixels at a time.
+ */
+static inline CONVERT_TARGET_SSE2 __m128i swap_8_sse2(__m128i pixels)
+{
+  return _mm_or_si128(_mm_slli_epi16(pixels, 8), _mm_srli_epi16(pixels, 8));
+}
+
+static inline CONVERT_TARGET_SSE2 __m128i bgr565_8_sse2(__m128i pixels)
+{
+  __m128i green = _mm_and_si128(pixels, _mm_set1_epi16(0x07E0));
+  return _mm_or_si128(_mm_or_si128(_mm_srli_epi16(pixels, 11), green),
+                      _mm_slli_epi16(pixels, 11));
+}
+
+static inline CONVERT_TARGET_SSE2 __m128i rgb555_8_sse2(__m128i pixels)
+{
+  __m128i red_green = _mm_slli_epi16(_mm_and_si128(pixels, _mm_set1_epi16(0x7FE0)), 1);
+  __m128i green_low = _mm_and_si128(_mm_srli_epi16(pixels, 4), _mm_set1_epi16(0x20));
+  __m128i blue = _mm_and_si128(pixels, _mm_set1_epi16(0x1F));
+  return _mm_or_si128(_mm_or_si128(red_green, green_low), blue);
+}
+
+static inline CONVERT_TARGET_SSE2 __m128i clamp_8_sse2(__m128i value)
+{
+  return _mm_min_epi16(_mm_max_epi16(value, _mm_setzero_si128()), _mm_set1_epi16(255));
+}
+
+/**
+ * Each 16-bit lane holds Y in its low byte and U (even lanes) or V (odd lanes)
+ * in its high byte; the chroma sample is copied to both pixels of its pair.
+ */
+static inline CONVERT_TARGET_SSE2 __m128i yuyv_8_sse2(__m128i words)
+{
+  const __m128i low_word = _mm_set1_epi32(0x0000FFFF);
+
+  __m128i luma = _mm_and_si128(words, _mm_set1_epi16(0x00FF));
+  __m128i chroma = _mm_srli_epi16(words, 8);
+  __m128i u = _mm_or_si128(_mm_and_si128(chroma, low_word), _mm_slli_epi32(chroma, 16));
+  __m128i v =
+      _mm_or_si128(_mm_srli_epi32(chroma, 16), _mm_andnot_si128(low_word, chroma));
+
+  __m128i c = _mm_sub_epi16(luma, _mm_set1_epi16(16));
+  __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+  __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+  __m128i base =
+      _mm_add_epi16(_mm_mullo_epi16(c, _mm_set1_epi16(74)), _mm_set1_epi16(32));
+
+  __m128i red = _mm_add_epi16(base, _mm_mullo_epi16(e, _mm_set1_epi16(102)));
+  __m128i green =
+      _mm_sub_epi16(_mm_sub_epi16(base, _mm_mullo_epi16(d, _mm_set1_epi16(25))),
+                    _mm_mullo_epi16(e, _mm_set1_epi16(52)));
+  __m128i blue = _mm_adds_epi16(base, _mm_mullo_epi16(d, _mm_set1_epi16(129)));
+
+  red = clamp_8_sse2(_mm_srai_epi16(red, 6));
+  green = clamp_8_sse2(_mm_srai_epi16(green, 6));
+  blue = clamp_8_sse2(_mm_srai_epi16(blue, 6));
+
+  red = _mm_and_si128(_mm_slli_epi16(red, 8), _mm_set1_epi16((short)0xF800));
+  green = _mm_and_si128(_mm_slli_epi16(green, 3), _mm_set1_epi16(0x07E0));
+  blue = _mm_srli_epi16(blue, 3);
+  return _mm_or_si128(_mm_or_si128(red, green), blue);
+}
+
+static CONVERT_TARGET_SSE2 void raw_to_rgb565_row_sse2(raw_pixel_format format,
+                                                       const void *src, uint16_t *dst,
+                                                       size_t count)
+{
+  const uint16_t *pixels = (const uint16_t *)src;
+  size_t index = 0;
+
+#define RAW_LOOP_SSE2(kernel)                                                           \
+  for (; index + 8 <= count; index += 8)                                               \
+    _mm_storeu_si128((__m128i *)(dst + index),                                          \
+                     kernel(_mm_loadu_si128((const __m128i *)(pixels + index))))
+
+  switch (format)
+  {
+  case RAW_FORMAT_RGB565_SWAPPED:
+    RAW_LOOP_SSE2(swap_8_sse2);
+    break;
+  case RAW_FORMAT_BGR565:
+    RAW_LOOP_SSE2(bgr565_8_sse2);
+    break;
+  case RAW_FORMAT_RGB555:
+    RAW_LOOP_SSE2(rgb555_8_sse2);
+    break;
+  case RAW_FORMAT_YUYV:
+    RAW_LOOP_SSE2(yuyv_8_sse2);
+    break;
+  default:
+    break;
+  }
+
+#undef RAW_LOOP_SSE2
+
+  raw_to_rgb565_row_scalar(format, pixels + index, dst + index, count - index);
+}
+
+/*
+ * AVX2 kernels, 16 pixels per iteration.
+ */
+
+/**
+ * Expand 16 RGB565 pixels into two registers of 8 BGRA pixels each, in order.
+ */
+static inline CONVERT_TARGET_AVX2 void expand_16_avx2(__m256i pixels, __m256i alpha,
+                                                      __m256i *low, __m256i *high)
+{
+  const __m256i mask_6 = _mm256_set1_epi16(0x3F);
+  const __m256i mask_5 = _mm256_set1_epi16(0x1F);
+
+  __m256i r5 = _mm256_srli_epi16(pixels, 11);
+  __m256i g6 = _mm256_and_si256(_mm256_srli_epi16(pixels, 5), mask_6);
+  __m256i b5 = _mm256_and_si256(pixels, mask_5);
+
+  __m256i r8 = _mm256_or_si256(_mm256_slli_epi16(r5, 3), _mm256_srli_epi16(r5, 2));
+  __m256i g8 = _mm256_or_si256(_mm256_slli_epi16(g6, 2), _mm256_srli_epi16(g6, 4));
+  __m256i b8 = _mm256_or_si256(_mm256_slli_epi16(b5, 3), _mm256_srli_epi16(b5, 2));
+
+  __m256i blue_green = _mm256_or_si256(b8, _mm256_slli_epi16(g8, 8));
+  __m256i red_alpha = _mm256_or_si256(r8, alpha);
+
+  // Unpacking works per 128-bit lane: pixels 0-3 and 8-11 end up in
+  // unpack_low, 4-7 and 12-15 in unpack_high.
+  __m256i unpack_low = _mm256_unpacklo_epi16(blue_green, red_alpha);
+  __m256i unpack_high = _mm256_unpackhi_epi16(blue_green, red_alpha);
+
+  *low = _mm256_permute2x128_si256(unpack_low, unpack_high, 0x20);
+  *high = _mm256_permute2x128_si256(unpack_low, unpack_high, 0x31);
+}
+
+/**
+ * Squeeze 8 BGR0 pixels into 24 contiguous bytes at dst.
+ */
+static inline CONVERT_TARGET_AVX2 void store_8_bgr_avx2(__m256i bgr0, uint8_t *dst)
+{
+  const __m256i drop_alpha = _mm256_setr_epi8(
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m256i join_lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+  __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(bgr0, drop_alpha),
+                                              join_lanes);
+
+  _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(bytes));
+  _mm_storel_epi64((__m128i *)(dst + 16), _mm256_extracti128_si256(bytes, 1));
+}
+
+static CONVERT_TARGET_AVX2 void rgb565_to_bgr888_row_avx2(const uint16_t *src,
+                                                          uint8_t *dst, size_t count)
+{
+  const __m256i alpha = _mm256_setzero_si256();
+  size_t index = 0;
+
+  for (; index + 16 <= count; index += 16, dst += 48)
+  {
+    __m256i low, high;
+    expand_16_avx2(_mm256_loadu_si256((const __m256i *)(src + index)), alpha, &low,
+                   &high);
+    store_8_bgr_avx2(low, dst);
+    store_8_bgr_avx2(high, dst + 24);
+  }
+
+  rgb565_to_bgr888_row_sse2(src + index, dst, count - index);
+}
+
+static CONVERT_TARGET_AVX2 void rgb565_to_bgra8888_row_avx2(const uint16_t *src,
+                                                            uint8_t *dst, size_t count)
+{
+  const __m256i alpha = _mm256_set1_epi16((short)0xFF00);
+  size_t index = 0;
+
+  for (; index + 16 <= count; index += 16, dst += 64)
+  {
+    __m256i low, high;
+    expand_16_avx2(_mm256_loadu_si256((const __m256i *)(src + index)), alpha, &low,
+                   &high);
+    _mm256_storeu_si256((__m256i *)dst, low);
+    _mm256_storeu_si256((__m256i *)(dst + 32), high);
+  }
+
+  rgb565_to_bgra8888_row_sse2(src + index, dst, count - index);
+}
+
+/**
+ * AVX2 counterpart of quantize_4_sse2, 8 pixels at a time.
+ */
+static inline CONVERT_TARGET_AVX2 __m256i quantize_8_avx2(__m256i bgrx)
+{
+  __m256i red = _mm256_and_si256(_mm256_srli_epi32(bgrx, 8), _mm256_set1_epi32(0xF800));
+  __m256i green =
+      _mm256_and_si256(_mm256_srli_epi32(bgrx, 5), _mm256_set1_epi32(0x07E0));
+  __m256i blue = _mm256_and_si256(_mm256_srli_epi32(bgrx, 3), _mm256_set1_epi32(0x001F));
+  __m256i pixels = _mm256_or_si256(_mm256_or_si256(red, green), blue);
+
+  return _mm256_srai_epi32(_mm256_slli_epi32(pixels, 16), 16);
+}
+
+/**
+ * Spread 8 BGR pixels (24 bytes) into the low 24 bits of each 32-bit lane.
+ * Reads 8 bytes past the pixels.
+ */
+static inline CONVERT_TARGET_AVX2 __m256i load_8_bgr_avx2(const uint8_t *src)
+{
+  const __m256i split_lanes = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+  const __m256i add_alpha = _mm256_setr_epi8(
+      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+  __m256i bytes = _mm256_loadu_si256((const __m256i *)src);
+  return _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(bytes, split_lanes), add_alpha);
+}
+
+static CONVERT_TARGET_AVX2 void bgr888_to_rgb565_row_avx2(const uint8_t *src,
+                                                          uint16_t *dst, size_t count)
+{
+  size_t index = 0;
+
+  // The last load of an iteration reads 8 bytes past its pixels; three spare
+  // pixels keep it inside the row.
+  for (; index + 19 <= count; index += 16, src += 48)
+  {
+    __m256i low = quantize_8_avx2(load_8_bgr_avx2(src));
+    __m256i high = quantize_8_avx2(load_8_bgr_avx2(src + 24));
+
+    // Packing works per 128-bit lane; restore pixel order afterwards.
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+    _mm256_storeu_si256((__m256i *)(dst + index), packed);
+  }
+
+  bgr888_to_rgb565_row_sse2(src, dst + index, count - index);
+}
+
+static CONVERT_TARGET_AVX2 void bgra8888_to_rgb565_row_avx2(const uint8_t *src,
+                                                            uint16_t *dst, size_t count)
+{
+  size_t index = 0;
+
+  for (; index + 16 <= count; index += 16, src += 64)
+  {
+    __m256i low = quantize_8_avx2(_mm256_loadu_si256((const __m256i *)src));
+    __m256i high = quantize_8_avx2(_mm256_loadu_si256((const __m256i *)(src + 32)));
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+    _mm256_storeu_si256((__m256i *)(dst + index), packed);
+  }
+
+  bgra8888_to_rgb565_row_sse2(src, dst + index, count - index);
+}
+
+/**
+ * AVX2 counterpart of quantize_4_rgb_sse2, 8 pixels at a time.
+ */
+static inline CONVERT_TARGET_AVX2 __m256i quantize_8_rgb_avx2(__m256i rgbx)
+{
+  __m256i red = _mm256_and_si256(_mm256_slli_epi32(rgbx, 8), _mm256_set1_epi32(0xF800));
+  __m256i green =
+      _mm256_and_si256(_mm256_srli_epi32(rgbx, 5), _mm256_set1_epi32(0x07E0));
+  __m256i blue =
+      _mm256_and_si256(_mm256_srli_epi32(rgbx, 19), _mm256_set1_epi32(0x001F));
+  __m256i pixels = _mm256_or_si256(_mm256_or_si256(red, green), blue);
+
+  return _mm256_srai_epi32(_mm256_slli_epi32(pixels, 16), 16);
+}
+
+static inline CONVERT_TARGET_AVX2 __m256i compress_8_rgb_avx2(__m256i rgbx,
+                                                              __m256i scale)
+{
+  __m256i top_5 =
+      _mm256_and_si256(_mm256_srli_epi32(rgbx, 5), _mm256_set1_epi32(0x00070007));
+  __m256i top_6 =
+      _mm256_and_si256(_mm256_srli_epi32(rgbx, 6), _mm256_set1_epi32(0x00000300));
+  return _mm256_sub_epi32(rgbx, _mm256_and_si256(_mm256_or_si256(top_5, top_6), scale));
+}
+
+static CONVERT_TARGET_AVX2 void rgb888_row_avx2(const uint8_t *src, uint16_t *dst,
+                                                size_t count,
+                                                const dither_pattern *pattern)
+{
+  __m256i bias_low = load_8_bgr_avx2(pattern->bias);
+  __m256i bias_high = load_8_bgr_avx2(pattern->bias + 24);
+  __m256i scale = _mm256_set1_epi32(pattern->enabled ? -1 : 0);
+  size_t index = 0;
+
+  for (; index + 19 <= count; index += 16, src += 48)
+  {
+    __m256i low = quantize_8_rgb_avx2(_mm256_adds_epu8(
+        compress_8_rgb_avx2(load_8_bgr_avx2(src), scale), bias_low));
+    __m256i high = quantize_8_rgb_avx2(_mm256_adds_epu8(
+        compress_8_rgb_avx2(load_8_bgr_avx2(src + 24), scale), bias_high));
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+    _mm256_storeu_si256((__m256i *)(dst + index), packed);
+  }
+
+  rgb888_row_sse2(src, dst + index, count - index, pattern);
+}
+
+/**
+ * AVX2 counterparts of the RAW ingest kernels, 16 pixels at a time. Every step
+ * stays within 128-bit lanes, so the SSE2 formulation carries over unchanged.
+ */
+static inline CONVERT_TARGET_AVX2 __m256i swap_16_avx2(__m256i pixels)
+{
+  return _mm256_or_si256(_mm256_slli_epi16(pixels, 8), _mm256_srli_epi16(pixels, 8));
+}
+
+static inline CONVERT_TARGET_AVX2 __m256i bgr565_16_avx2(__m256i pixels)
+{
+  __m256i green = _mm256_and_si256(pixels, _mm256_set1_epi16(0x07E0));
+  return _mm256_or_si256(_mm256_or_si256(_mm256_srli_epi16(pixels, 11), green),
+                         _mm256_slli_epi16(pixels, 11));
+}
+
+static inline CONVERT_TARGET_AVX2 __m256i rgb555_16_avx2(__m256i pixels)
+{
+  __m256i red_green =
+      _mm256_slli_epi16(_mm256_and_si256(pixels, _mm256_set1_epi16(0x7FE0)), 1);
+  __m256i green_low =
+      _mm256_and_si256(_mm256_srli_epi16(pixels, 4), _mm256_set1_epi16(0x20));
+  __m256i blue = _mm256_and_si256(pixels, _mm256_set1_epi16(0x1F));
+  return _mm256_or_si256(_mm256_or_si256(red_green, green_low), blue);
+}
+
+static inline CONVERT_TARGET_AVX2 __m256i clamp_16_avx2(__m256i value)
+{
+  return _mm256_min_epi16(_mm256_max_epi16(value, _mm256_setzero_si256()),
+                          _mm256_set1_epi16(255));
+}
+
+static inline CONVERT_TARGET_AVX2 __m256i yuyv_16_avx2(__m256i words)
+{
+  const __m256i low_word = _mm256_set1_epi32(0x0000FFFF);
+
+  __m256i luma = _mm256_and_si256(words, _mm256_set1_epi16(0x00FF));
+  __m256i chroma = _mm256_srli_epi16(words, 8);
+  __m256i u = _mm256_or_si256(_mm256_and_si256(chroma, low_word),
+                              _mm256_slli_epi32(chroma, 16));
+  __m256i v = _mm256_or_si256(_mm256_srli_epi32(chroma, 16),
+                              _mm256_andnot_si256(low_word, chroma));
+
+  __m256i c = _mm256_sub_epi16(luma, _mm256_set1_epi16(16));
+  __m256i d = _mm256_sub_epi16(u, _mm256_set1_epi16(128));
+  __m256i e = _mm256_sub_epi16(v, _mm256_set1_epi16(128));
+  __m256i base = _mm256_add_epi16(_mm256_mullo_epi16(c, _mm256_set1_epi16(74)),
+                                  _mm256_set1_epi16(32));
+
+  __m256i red = _mm256_add_epi16(base, _mm256_mullo_epi16(e, _mm256_set1_epi16(102)));
+  __m256i green = _mm256_sub_epi16(
+      _mm256_sub_epi16(base, _mm256_mullo_epi16(d, _mm256_set1_epi16(25))),
+      _mm256_mullo_epi16(e, _mm256_set1_epi16(52)));
+  __m256i blue = _mm256_adds_epi16(base, _mm256_mullo_epi16(d, _mm256_set1_epi16(129)));
+
+  red = clamp_16_avx2(_mm256_srai_epi16(red, 6));
+  green = clamp_16_avx2(_mm256_srai_epi16(green, 6));
+  blue = clamp_16_avx2(_mm256_srai_epi16(blue, 6));
+
+  red = _mm256_and_si256(_mm256_slli_epi16(red, 8), _mm256_set1_epi16((short)0xF800));
+  green = _mm256_and_si256(_mm256_slli_epi16(green, 3), _mm256_set1_epi16(0x07E0));
+  blue = _mm256_srli_epi16(blue, 3);
+  return _mm256_or_si256(_mm256_or_si256(red, green), blue);
+}
+
+static CONVERT_TARGET_AVX2 void raw_to_rgb565_row_avx2(raw_pixel_format format,
+                                                       const void *src, uint16_t *dst,
+                                                       size_t count)
+{
+  const uint16_t *pixels = (const uint16_t *)src;
+  size_t index = 0;
+
+#define RAW_LOOP_AVX2(kernel)                                                           \
+  for (; index + 16 <= count; index += 16)                                             \
+    _mm256_storeu_si256((__m256i *)(dst + index),                                       \
+                        kernel(_mm256_loadu_si256((const __m256i *)(pixels + index))))
+
+  switch (format)
+  {
+  case RAW_FORMAT_RGB565_SWAPPED:
+    RAW_LOOP_AVX2(swap_16_avx2);
+    break;
+  case RAW_FORMAT_BGR565:
+    RAW_LOOP_AVX2(bgr565_16_avx2);
+    break;
+  case RAW_FORMAT_RGB555:
+    RAW_LOOP_AVX2(rgb555_16_avx2);
+    break;
+  case RAW_FORMAT_YUYV:
+    RAW_LOOP_AVX2(yuyv_16_avx2);
+    break;
+  default:
+    break;
+  }
+
+#undef RAW_LOOP_AVX2
+
+  raw_to_rgb565_row_sse2(format, pixels + index, dst + index, count - index);
+}
+
+#endif
+
+/*
+ * Dispatch
+ */
+
+static void select_kernels(convert_kernel_level level)
+{
+  active_level = level;
+
+  switch (level)
+  {
+#ifdef CONVERT_HAVE_X86
+  case CONVERT_KERNEL_AVX2:
+    active_kernels.to_bgr888 = rgb565_to_bgr888_row_avx2;
+    active_kernels.to_bgra8888 = rgb565_to_bgra8888_row_avx2;
+    active_kernels.from_bgr888 = bgr888_to_rgb565_row_avx2;
+    active_kernels.from_bgra8888 = bgra8888_to_rgb565_row_avx2;
+    active_kernels.from_rgb888 = rgb888_row_avx2;
+    active_kernels.from_raw = raw_to_rgb565_row_avx2;
+    break;
+  case CONVERT_KERNEL_SSE2:
+    active_kernels.to_bgr888 = rgb565_to_bgr888_row_sse2;
+    active_kernels.to_bgra8888 = rgb565_to_bgra8888_row_sse2;
+    active_kernels.from_bgr888 = bgr888_to_rgb565_row_sse2;
+    active_kernels.from_bgra8888 = bgra8888_to_rgb565_row_sse2;
+    active_kernels.from_rgb888 = rgb888_row_sse2;
+    active_kernels.from_raw = raw_to_rgb565_row_sse2;
+    break;
+#endif
+  default:
+    active_level = CONVERT_KERNEL_SCALAR;
+    active_kernels.to_bgr888 = rgb565_to_bgr888_row_scalar;
+    active_kernels.to_bgra8888 = rgb565_to_bgra8888_row_scalar;
+    active_kernels.from_bgr888 = bgr888_to_rgb565_row_scalar;
+    active_kernels.from_bgra8888 = bgra8888_to_rgb565_row_scalar;
+    active_kernels.from_rgb888 = rgb888_row_scalar;
+    active_kernels.from_raw = raw_to_rgb565_row_scalar;
+    break;
+  }
+}
+
+static void detect_kernels(void)
+{
+#ifdef CONVERT_HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    supported_level = CONVERT_KERNEL_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    supported_level = CONVERT_KERNEL_SSE2;
+#endif
+
+  select_kernels(supported_level);
+}
+
+convert_kernel_level get_convert_kernel_level(void)
+{
+  pthread_once(&dispatch_once, detect_kernels);
+  return active_level;
+}
+
+convert_kernel_level set_convert_kernel_level(convert_kernel_level level)
+{
+  pthread_once(&dispatch_once, detect_kernels);
+  select_kernels((level > supported_level) ? supported_level : level);
+  return active_level;
+}
+
+const char *convert_kernel_name(convert_kernel_level level)
+{
+  switch (level)
+  {
+  case CONVERT_KERNEL_AVX2:
+    return "avx2";
+  case CONVERT_KERNEL_SSE2:
+    return "sse2";
+  default:
+    return "scalar";
+  }
+}
+
+static const char *const raw_format_names[] = {"rgb565", "rgb565be", "bgr565", "rgb555",
+                                              "yuyv"};
+
+const char *raw_pixel_format_name(raw_pixel_format format)
+{
+  if ((size_t)format >= sizeof(raw_format_names) / sizeof(raw_format_names[0]))
+    return "unknown";
+  return raw_format_names[format];
+}
+
+uint8_t parse_raw_pixel_format(const char *name, raw_pixel_format *format)
+{
+  if (name == NULL || format == NULL)
+    return 1;
+
+  for (size_t index = 0; index < sizeof(raw_format_names) / sizeof(raw_format_names[0]);
+       index++)
+  {
+    if (strcmp(name, raw_format_names[index]) == 0)
+    {
+      *format = (raw_pixel_format)index;
+      return 0;
+    }
+  }
+
+  return 2;
+}
+
+void rgb565_to_bgr888_row(const uint16_t *src, uint8_t *dst, size_t count)
+{
+  pthread_once(&dispatch_once, detect_kernels);
+  active_kernels.to_bgr888(src, dst, count);
+}
+
+void rgb565_to_bgra8888_row(const uint16_t *src, uint8_t *dst, size_t count)
+{
+  pthread_once(&dispatch_once, detect_kernels);
+  active_kernels.to_bgra8888(src, dst, count);
+}
+
+void bgr888_to_rgb565_row(const uint8_t *src, uint16_t *dst, size_t count)
+{
+  pthread_once(&dispatch_once, detect_kernels);
+  active_kernels.from_bgr888(src, dst, count);
+}
+
+void bgra8888_to_rgb565_row(const uint8_t *src, uint16_t *dst, size_t count)
+{
+  pthread_once(&dispatch_once, detect_kernels);
+  active_kernels.from_bgra8888(src, dst, count);
+}
+
+void rgb888_to_rgb565_row(const uint8_t *src, uint16_t *dst, size_t count,
+                          rgb565_dither dither, uint32_t row)
+{
+  dither_pattern pattern;
+  build_dither_pattern(dither, row, &pattern);
+
+  pthread_once(&dispatch_once, detect_kernels);
+  active_kernels.from_rgb888(src, dst, count, &pattern);
+}
+
+void raw_to_rgb565_row(raw_pixel_format format, const void *src, uint16_t *dst,
+                       size_t count)
+{
+  pthread_once(&dispatch_once, detect_kernels);
+  active_kernels.from_raw(format, src, dst, count);
+}
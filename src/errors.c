@@ -0,0 +1,258 @@
+#include "errors.h"
+
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Keeps the producer and consumer positions of the ring on separate cache lines.
+ */
+#define ERROR_RING_CACHE_LINE 64
+
+/**
+ * One slot of the ring. sequence tells producers and consumers whose turn it is,
+ * see mat_enable_error_ring.
+ */
+typedef struct error_cell
+{
+  uint64_t sequence;
+  mat_error error;
+} error_cell;
+
+/**
+ * Bounded multi-producer multi-consumer queue. A cell at position pos is free for the
+ * producer claiming pos when its sequence equals pos, and holds a record for the
+ * consumer claiming pos when its sequence equals pos + 1. Consuming it sets the
+ * sequence to pos + capacity, handing the cell to the producer one lap later.
+ */
+typedef struct error_ring
+{
+  error_cell *cells;
+  uint64_t mask;
+
+  _Alignas(ERROR_RING_CACHE_LINE) uint64_t enqueue_pos;
+  _Alignas(ERROR_RING_CACHE_LINE) uint64_t dequeue_pos;
+  _Alignas(ERROR_RING_CACHE_LINE) uint64_t dropped;
+} error_ring;
+
+static int error_output = MAT_ERRORS_PRINT;
+static uint64_t error_sequence = 0;
+static error_ring *ring = NULL;
+
+/**
+ * Threads between loading ring and their last access to it. A ring taken out of ring
+ * is only freed once this drops to zero, as those threads may still hold it.
+ */
+static uint64_t ring_users = 0;
+
+static _Thread_local mat_error last_error;
+static _Thread_local bool has_last_error = false;
+
+void mat_set_error_output(mat_error_output output)
+{
+  __atomic_store_n(&error_output, (int)output, __ATOMIC_RELAXED);
+}
+
+mat_error_output mat_get_error_output(void)
+{
+  return (mat_error_output)__atomic_load_n(&error_output, __ATOMIC_RELAXED);
+}
+
+/**
+ * Copy error into the ring, or count it as dropped when the ring is full.
+ */
+static void enqueue_error(error_ring *queue, const mat_error *error)
+{
+  uint64_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+  error_cell *cell;
+
+  for (;;)
+  {
+    cell = &queue->cells[pos & queue->mask];
+    uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    int64_t diff = (int64_t)(sequence - pos);
+
+    if (diff == 0)
+    {
+      if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (diff < 0)
+    {
+      __atomic_fetch_add(&queue->dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    else
+      pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+  }
+
+  cell->error = *error;
+  __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Move the oldest record of the ring into error. Returns false when it is empty.
+ */
+static bool dequeue_error(error_ring *queue, mat_error *error)
+{
+  uint64_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+  error_cell *cell;
+
+  for (;;)
+  {
+    cell = &queue->cells[pos & queue->mask];
+    uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    int64_t diff = (int64_t)(sequence - (pos + 1));
+
+    if (diff == 0)
+    {
+      if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (diff < 0)
+      return false;
+    else
+      pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+  }
+
+  *error = cell->error;
+  __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+ * Load ring and keep it from being freed until release_ring. The sequentially
+ * consistent order of the increment, this load and the exchange in retire_ring
+ * guarantees retire_ring sees every thread that can still see the old ring.
+ */
+static error_ring *acquire_ring(void)
+{
+  __atomic_add_fetch(&ring_users, 1, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&ring, __ATOMIC_SEQ_CST);
+}
+
+static void release_ring(void)
+{
+  __atomic_sub_fetch(&ring_users, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Free a ring already taken out of ring, once no thread can still be using it.
+ */
+static void retire_ring(error_ring *queue)
+{
+  if (queue == NULL)
+    return;
+
+  while (__atomic_load_n(&ring_users, __ATOMIC_SEQ_CST) != 0)
+    sched_yield();
+
+  free(queue->cells);
+  free(queue);
+}
+
+void mat_record_error(mat_fn_status status, const char *function, const char *format, ...)
+{
+  mat_error *error = &last_error;
+  error->status = status;
+  error->function = function;
+  error->sequence = __atomic_add_fetch(&error_sequence, 1, __ATOMIC_RELAXED);
+
+  va_list args;
+  va_start(args, format);
+  vsnprintf(error->message, sizeof(error->message), format, args);
+  va_end(args);
+  has_last_error = true;
+
+  error_ring *queue = acquire_ring();
+  if (queue != NULL)
+    enqueue_error(queue, error);
+  release_ring();
+
+  if (mat_get_error_output() == MAT_ERRORS_PRINT)
+    printf("%s\n", error->message);
+}
+
+bool mat_get_last_error(mat_error *error)
+{
+  if (!has_last_error)
+    return false;
+
+  if (error != NULL)
+    *error = last_error;
+  return true;
+}
+
+void mat_clear_last_error(void)
+{
+  has_last_error = false;
+}
+
+mat_fn_status mat_enable_error_ring(size_t capacity)
+{
+  size_t cell_count = 2;
+  while (cell_count < capacity)
+  {
+    if (cell_count > SIZE_MAX / 2 / sizeof(error_cell))
+    {
+      mat_report_error(INVALID_PARAM, "mat_enable_error_ring: capacity %zu is too large.",
+                       capacity);
+      return INVALID_PARAM;
+    }
+    cell_count *= 2;
+  }
+
+  error_ring *queue =
+      (error_ring *)aligned_alloc(ERROR_RING_CACHE_LINE, sizeof(error_ring));
+  error_cell *cells = (error_cell *)malloc(cell_count * sizeof(error_cell));
+  if (queue == NULL || cells == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "mat_enable_error_ring: unable to allocate %zu records.",
+                     cell_count);
+    free(queue);
+    free(cells);
+    return FAILED_MAT_ALLOCATION;
+  }
+
+  memset(queue, 0, sizeof(*queue));
+  queue->cells = cells;
+  queue->mask = cell_count - 1;
+  for (size_t index = 0; index < cell_count; index++)
+    cells[index].sequence = index;
+
+  retire_ring(__atomic_exchange_n(&ring, queue, __ATOMIC_SEQ_CST));
+  return VALID_OP;
+}
+
+void mat_disable_error_ring(void)
+{
+  retire_ring(__atomic_exchange_n(&ring, NULL, __ATOMIC_SEQ_CST));
+}
+
+size_t mat_drain_errors(mat_error *errors, size_t capacity)
+{
+  if (errors == NULL)
+    return 0;
+
+  error_ring *queue = acquire_ring();
+  size_t count = 0;
+  while (queue != NULL && count < capacity && dequeue_error(queue, &errors[count]))
+    count++;
+  release_ring();
+
+  return count;
+}
+
+uint64_t mat_dropped_errors(void)
+{
+  error_ring *queue = acquire_ring();
+  uint64_t dropped = (queue != NULL) ? __atomic_load_n(&queue->dropped, __ATOMIC_RELAXED)
+                                     : 0;
+  release_ring();
+  return dropped;
+}
@@ -0,0 +1,303 @@
+#include "instrument.h"
+#include "errors.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Every value below is only ever touched with relaxed atomics: they are independent
+ * statistics, so no ordering between them is needed.
+ */
+static instrument_stage_stats stages[INSTRUMENT_STAGE_COUNT];
+static uint64_t counters[INSTRUMENT_COUNTER_COUNT];
+static instrument_histogram_stats histograms[INSTRUMENT_HISTOGRAM_COUNT];
+
+static const char *const stage_names[INSTRUMENT_STAGE_COUNT] = {
+    "read", "convert", "draw", "header", "encode", "write"};
+
+static const char *const counter_names[INSTRUMENT_COUNTER_COUNT] = {
+    "bytes_read", "bytes_written", "syscalls", "pixels_drawn", "frames_processed"};
+
+static const char *const histogram_names[INSTRUMENT_HISTOGRAM_COUNT] = {
+    "frame_read", "frame_write", "frame_total"};
+
+bool instrument_enabled(void)
+{
+#ifdef MATRIX_INSTRUMENTATION
+  return true;
+#else
+  return false;
+#endif
+}
+
+uint64_t instrument_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+double instrument_now_seconds(void)
+{
+  return (double)instrument_now_ns() / 1e9;
+}
+
+static void store_max(uint64_t *target, uint64_t value)
+{
+  uint64_t current = __atomic_load_n(target, __ATOMIC_RELAXED);
+  while (value > current &&
+         !__atomic_compare_exchange_n(target, &current, value, true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+    ;
+}
+
+uint64_t instrument_record_stage(instrument_stage stage, uint64_t start_ns)
+{
+  uint64_t now = instrument_now_ns();
+  if ((unsigned)stage >= INSTRUMENT_STAGE_COUNT)
+    return now;
+
+  uint64_t elapsed = now - start_ns;
+  __atomic_fetch_add(&stages[stage].calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stages[stage].total_ns, elapsed, __ATOMIC_RELAXED);
+  store_max(&stages[stage].max_ns, elapsed);
+  return now;
+}
+
+void instrument_record_latency(instrument_histogram histogram, uint64_t start_ns)
+{
+  if ((unsigned)histogram >= INSTRUMENT_HISTOGRAM_COUNT)
+    return;
+
+  uint64_t elapsed = instrument_now_ns() - start_ns;
+  unsigned bucket = elapsed ? 63u - (unsigned)__builtin_clzll(elapsed) : 0;
+  if (bucket >= INSTRUMENT_HISTOGRAM_BUCKETS)
+    bucket = INSTRUMENT_HISTOGRAM_BUCKETS - 1;
+
+  instrument_histogram_stats *stats = &histograms[histogram];
+  __atomic_fetch_add(&stats->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->total_ns, elapsed, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void instrument_count(instrument_counter counter, uint64_t amount)
+{
+  if ((unsigned)counter < INSTRUMENT_COUNTER_COUNT)
+    __atomic_fetch_add(&counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+/**
+ * Copy or zero count consecutive 64-bit values one atomic access at a time.
+ */
+static void load_values(uint64_t *dst, uint64_t *src, size_t count)
+{
+  for (size_t index = 0; index < count; index++)
+    dst[index] = __atomic_load_n(&src[index], __ATOMIC_RELAXED);
+}
+
+static void clear_values(uint64_t *values, size_t count)
+{
+  for (size_t index = 0; index < count; index++)
+    __atomic_store_n(&values[index], 0, __ATOMIC_RELAXED);
+}
+
+#define VALUE_COUNT(object) (sizeof(object) / (sizeof(uint64_t)))
+
+void instrument_get_snapshot(instrument_snapshot *snapshot)
+{
+  if (snapshot == NULL)
+    return;
+
+  memset(snapshot, 0, sizeof(*snapshot));
+  snapshot->enabled = instrument_enabled();
+  load_values((uint64_t *)snapshot->stages, (uint64_t *)stages, VALUE_COUNT(stages));
+  load_values(snapshot->counters, counters, VALUE_COUNT(counters));
+  load_values((uint64_t *)snapshot->histograms, (uint64_t *)histograms,
+              VALUE_COUNT(histograms));
+}
+
+void instrument_reset(void)
+{
+  clear_values((uint64_t *)stages, VALUE_COUNT(stages));
+  clear_values(counters, VALUE_COUNT(counters));
+  clear_values((uint64_t *)histograms, VALUE_COUNT(histograms));
+}
+
+uint64_t instrument_histogram_quantile(const instrument_histogram_stats *histogram,
+                                       double quantile)
+{
+  if (histogram == NULL || histogram->count == 0)
+    return 0;
+
+  uint64_t rank = (uint64_t)(quantile * (double)histogram->count + 0.5);
+  if (rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (unsigned bucket = 0; bucket < INSTRUMENT_HISTOGRAM_BUCKETS; bucket++)
+  {
+    seen += histogram->buckets[bucket];
+    if (seen >= rank)
+      return (uint64_t)2 << bucket;
+  }
+
+  return (uint64_t)1 << INSTRUMENT_HISTOGRAM_BUCKETS;
+}
+
+const char *instrument_stage_name(instrument_stage stage)
+{
+  return ((unsigned)stage < INSTRUMENT_STAGE_COUNT) ? stage_names[stage] : "unknown";
+}
+
+const char *instrument_counter_name(instrument_counter counter)
+{
+  return ((unsigned)counter < INSTRUMENT_COUNTER_COUNT) ? counter_names[counter]
+                                                        : "unknown";
+}
+
+const char *instrument_histogram_name(instrument_histogram histogram)
+{
+  return ((unsigned)histogram < INSTRUMENT_HISTOGRAM_COUNT) ? histogram_names[histogram]
+                                                            : "unknown";
+}
+
+void instrument_write_json(FILE *file, const instrument_snapshot *snapshot)
+{
+  fprintf(file, "{\n  \"enabled\": %s,\n", snapshot->enabled ? "true" : "false");
+
+  fprintf(file, "  \"stages\": {");
+  for (int index = 0; index < INSTRUMENT_STAGE_COUNT; index++)
+  {
+    const instrument_stage_stats *stage = &snapshot->stages[index];
+    fprintf(file,
+            "%s\n    \"%s\": {\"calls\": %llu, \"total_ms\": %.3f, \"max_ms\": %.3f}",
+            index ? "," : "", stage_names[index], (unsigned long long)stage->calls,
+            stage->total_ns / 1e6, stage->max_ns / 1e6);
+  }
+  fprintf(file, "\n  },\n");
+
+  fprintf(file, "  \"counters\": {");
+  for (int index = 0; index < INSTRUMENT_COUNTER_COUNT; index++)
+    fprintf(file, "%s\n    \"%s\": %llu", index ? "," : "", counter_names[index],
+            (unsigned long long)snapshot->counters[index]);
+  fprintf(file, "\n  },\n");
+
+  fprintf(file, "  \"latency\": {");
+  for (int index = 0; index < INSTRUMENT_HISTOGRAM_COUNT; index++)
+  {
+    const instrument_histogram_stats *histogram = &snapshot->histograms[index];
+    double mean = histogram->count ? histogram->total_ns / 1e6 / histogram->count : 0.0;
+    fprintf(file,
+            "%s\n    \"%s\": {\"count\": %llu, \"mean_ms\": %.3f, \"p50_ms\": %.3f, "
+            "\"p90_ms\": %.3f, \"p99_ms\": %.3f, \"buckets\": [",
+            index ? "," : "", histogram_names[index],
+            (unsigned long long)histogram->count, mean,
+            instrument_histogram_quantile(histogram, 0.50) / 1e6,
+            instrument_histogram_quantile(histogram, 0.90) / 1e6,
+            instrument_histogram_quantile(histogram, 0.99) / 1e6);
+
+    // Only occupied buckets, each as its upper bound and count.
+    bool first = true;
+    for (unsigned bucket = 0; bucket < INSTRUMENT_HISTOGRAM_BUCKETS; bucket++)
+    {
+      if (histogram->buckets[bucket] == 0)
+        continue;
+      fprintf(file, "%s{\"le_us\": %.3f, \"count\": %llu}", first ? "" : ", ",
+              (double)((uint64_t)2 << bucket) / 1e3,
+              (unsigned long long)histogram->buckets[bucket]);
+      first = false;
+    }
+    fprintf(file, "]}");
+  }
+  fprintf(file, "\n  }\n}\n");
+}
+
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *dump_path = NULL;
+static bool dump_installed = false;
+
+/**
+ * Write a snapshot to the dump destination. Dumps from the signal thread and from
+ * exit are serialized so they never interleave in one file.
+ */
+static void dump_snapshot(void)
+{
+  instrument_snapshot snapshot;
+  instrument_get_snapshot(&snapshot);
+
+  pthread_mutex_lock(&dump_lock);
+  FILE *file = (dump_path != NULL) ? fopen(dump_path, "w") : stderr;
+  if (file != NULL)
+  {
+    instrument_write_json(file, &snapshot);
+    if (file != stderr)
+      fclose(file);
+    else
+      fflush(file);
+  }
+  else
+    mat_report_error(FAILED_BMP_FILE_WRITE, "instrument: unable to open %s for writing.",
+                     dump_path);
+  pthread_mutex_unlock(&dump_lock);
+}
+
+static void *signal_thread(void *context)
+{
+  sigset_t *set = (sigset_t *)context;
+  int signal_number;
+
+  for (;;)
+  {
+    if (sigwait(set, &signal_number) == 0 && signal_number == SIGUSR1)
+      dump_snapshot();
+  }
+
+  return NULL;
+}
+
+mat_fn_status instrument_install_dump(const char *filepath)
+{
+  char *path = NULL;
+  if (filepath != NULL && (path = strdup(filepath)) == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "instrument_install_dump: unable to copy the dump path.");
+    return FAILED_MAT_ALLOCATION;
+  }
+
+  pthread_mutex_lock(&dump_lock);
+  free(dump_path);
+  dump_path = path;
+  bool installed = dump_installed;
+  dump_installed = true;
+  pthread_mutex_unlock(&dump_lock);
+
+  if (installed)
+    return VALID_OP;
+
+  static sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+
+  pthread_t thread;
+  if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0 ||
+      pthread_create(&thread, NULL, signal_thread, &set) != 0)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "instrument_install_dump: unable to start the SIGUSR1 thread.");
+    return INVALID_PARAM;
+  }
+  pthread_detach(thread);
+
+  if (atexit(dump_snapshot) != 0)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "instrument_install_dump: unable to register the exit dump.");
+    return INVALID_PARAM;
+  }
+
+  return VALID_OP;
+}
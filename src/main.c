@@ -1,8 +1,261 @@
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "matrix.h"
 #include "bitmap.h"
+#include "stream.h"
+#include "batch.h"
+#include "archive.h"
+#include "ppm.h"
+#include "instrument.h"
 
-int main()
+static void print_usage(const char *program)
+{
+    printf("Usage:\n");
+    printf("  %s\n", program);
+    printf("      Convert the first frame of ../VIDEO001.RAW into application_13.bmp.\n");
+    printf("  %s stream <raw file> <width> <height> [output dir] [pixel format]\n",
+           program);
+    printf("      Convert every frame of a RAW video into frame_%%06d.bmp files.\n");
+    printf("      Pixel formats: rgb565 (default), rgb565be, bgr565, rgb555, yuyv.\n");
+    printf("  %s batch manifest <manifest file> [threads]\n", program);
+    printf("      Convert every \"input output width height\" line of a manifest.\n");
+    printf("  %s batch dir <input dir> <output dir> <width> <height> [threads]\n",
+           program);
+    printf("      Convert every .raw file of a directory.\n");
+    printf("  %s archive <raw file> <archive file> <width> <height> "
+           "[keyframe interval]\n", program);
+    printf("      Store a RAW video as keyframes and run-length encoded deltas.\n");
+    printf("  %s extract <archive file> <frame> <output bmp>\n", program);
+    printf("      Rebuild a single frame of an archive into a BMP file.\n");
+    printf("  %s ppm <ppm file> <output bmp> [none|4x4|8x8]\n", program);
+    printf("      Quantize a 24-bit PPM image to RGB565, with optional ordered "
+           "dithering.\n");
+}
+
+static bool parse_dimension(const char *text, uint16_t *dimension)
+{
+    char *end = NULL;
+    unsigned long value = strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || value == 0 || value > UINT16_MAX)
+    {
+        printf("Invalid dimension: %s\n", text);
+        return false;
+    }
+
+    *dimension = (uint16_t)value;
+    return true;
+}
+
+static int run_stream(int argc, char **argv)
+{
+    if (argc < 5 || argc > 7)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    uint16_t horizontal, vertical;
+    if (!parse_dimension(argv[3], &horizontal) || !parse_dimension(argv[4], &vertical))
+        return 1;
+
+    const char *output_dir = (argc >= 6) ? argv[5] : ".";
+
+    raw_pixel_format format = RAW_FORMAT_RGB565;
+    if (argc == 7 && parse_raw_pixel_format(argv[6], &format) != 0)
+    {
+        printf("Unknown pixel format: %s\n", argv[6]);
+        return 1;
+    }
+
+    stream_stats stats = {0};
+    mat_fn_status status = stream_convert_raw_file_format(argv[2], output_dir, horizontal,
+                                                          vertical, format, &stats);
+
+    double fps = (stats.seconds > 0.0) ? stats.frames / stats.seconds : 0.0;
+    printf("Converted %llu frames in %.3f s (%.1f frames/sec).\n",
+           (unsigned long long)stats.frames, stats.seconds, fps);
+
+    return (status == VALID_OP) ? 0 : 1;
+}
+
+static bool parse_thread_count(const char *text, unsigned *thread_count)
+{
+    char *end = NULL;
+    unsigned long value = strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || value > 4096)
+    {
+        printf("Invalid thread count: %s\n", text);
+        return false;
+    }
+
+    *thread_count = (unsigned)value;
+    return true;
+}
+
+static int run_batch(int argc, char **argv)
+{
+    batch_job_list list = {0};
+    unsigned thread_count = 0;
+    mat_fn_status status;
+
+    if (argc >= 4 && argc <= 5 && strcmp(argv[2], "manifest") == 0)
+    {
+        if (argc == 5 && !parse_thread_count(argv[4], &thread_count))
+            return 1;
+        status = batch_load_manifest(&list, argv[3]);
+    }
+    else if (argc >= 7 && argc <= 8 && strcmp(argv[2], "dir") == 0)
+    {
+        uint16_t horizontal, vertical;
+        if (!parse_dimension(argv[5], &horizontal) ||
+            !parse_dimension(argv[6], &vertical))
+            return 1;
+        if (argc == 8 && !parse_thread_count(argv[7], &thread_count))
+            return 1;
+        status = batch_load_directory(&list, argv[3], argv[4], horizontal, vertical);
+    }
+    else
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (status != VALID_OP)
+    {
+        batch_free_jobs(&list);
+        return 1;
+    }
+
+    batch_stats stats = {0};
+    status = batch_run(&list, thread_count, &stats);
+
+    double seconds = (stats.seconds > 0.0) ? stats.seconds : 1e-9;
+    printf("Converted %zu jobs (%zu failed) in %.3f s.\n", stats.jobs_completed,
+           stats.jobs_failed, stats.seconds);
+    printf("  %.1f jobs/sec, %.1f MB/s read, %.1f MB/s written.\n",
+           stats.jobs_completed / seconds, stats.bytes_read / seconds / 1e6,
+           stats.bytes_written / seconds / 1e6);
+    if (list.count > 0)
+        printf("  Slowest job: %s (%.3f ms).\n", list.jobs[stats.slowest_job].input,
+               stats.slowest_seconds * 1e3);
+
+    batch_free_jobs(&list);
+    return (status == VALID_OP) ? 0 : 1;
+}
+
+static bool parse_count(const char *text, uint64_t *count)
+{
+    char *end = NULL;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || *end != '\0')
+    {
+        printf("Invalid number: %s\n", text);
+        return false;
+    }
+
+    *count = (uint64_t)value;
+    return true;
+}
+
+static int run_archive(int argc, char **argv)
+{
+    if (argc < 6 || argc > 7)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    uint16_t horizontal, vertical;
+    if (!parse_dimension(argv[4], &horizontal) || !parse_dimension(argv[5], &vertical))
+        return 1;
+
+    uint64_t keyframe_interval = 0;
+    if (argc == 7 && (!parse_count(argv[6], &keyframe_interval) ||
+                      keyframe_interval > UINT32_MAX))
+        return 1;
+
+    archive_stats stats = {0};
+    mat_fn_status status = archive_raw_file(argv[2], argv[3], horizontal, vertical,
+                                            (uint32_t)keyframe_interval, &stats);
+
+    double ratio = (stats.archive_bytes > 0)
+                       ? (double)stats.raw_bytes / (double)stats.archive_bytes
+                       : 0.0;
+    printf("Archived %llu frames (%llu keyframes) in %.3f s.\n",
+           (unsigned long long)stats.frames, (unsigned long long)stats.keyframes,
+           stats.seconds);
+    printf("  %llu bytes of RAW data stored in %llu bytes (%.1fx).\n",
+           (unsigned long long)stats.raw_bytes, (unsigned long long)stats.archive_bytes,
+           ratio);
+
+    return (status == VALID_OP) ? 0 : 1;
+}
+
+static int run_extract(int argc, char **argv)
+{
+    if (argc != 5)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    uint64_t frame_index;
+    if (!parse_count(argv[3], &frame_index))
+        return 1;
+
+    frame_archive_reader *reader = open_frame_archive(argv[2]);
+    if (reader == NULL)
+        return 1;
+
+    uint16_t horizontal, vertical;
+    frame_archive_dimensions(reader, &horizontal, &vertical);
+
+    int ret = 1;
+    struct matrix *mat = allocate_matrix(horizontal, vertical);
+    if (mat != NULL && frame_archive_read_frame(reader, frame_index, mat) == VALID_OP &&
+        write_rgb565_bmpfile(argv[4], mat) == 0)
+        ret = 0;
+
+    if (mat != NULL)
+        deallocate_matrix(mat);
+    close_frame_archive_reader(reader);
+    return ret;
+}
+
+static int run_ppm(int argc, char **argv)
+{
+    if (argc < 4 || argc > 5)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    rgb565_dither dither = RGB565_DITHER_NONE;
+    if (argc == 5)
+    {
+        if (strcmp(argv[4], "4x4") == 0)
+            dither = RGB565_DITHER_ORDERED_4X4;
+        else if (strcmp(argv[4], "8x8") == 0)
+            dither = RGB565_DITHER_ORDERED_8X8;
+        else if (strcmp(argv[4], "none") != 0)
+        {
+            printf("Unknown dithering: %s\n", argv[4]);
+            return 1;
+        }
+    }
+
+    struct matrix *mat = read_ppm_file(argv[2], dither);
+    if (mat == NULL)
+        return 1;
+
+    int ret = (write_rgb565_bmpfile(argv[3], mat) == 0) ? 0 : 1;
+    deallocate_matrix(mat);
+    return ret;
+}
+
+static int run_default(void)
 {
     struct matrix *mat = allocate_matrix(320, 240);
     if (mat == NULL)
@@ -11,7 +264,7 @@ int main()
         return 0;
     }
 
-    bool success = read_binary_file(mat, "../VIDEO001.RAW");
+    bool success = read_binary_file(mat, "../VIDEO001.RAW") == VALID_OP;
     if (!success)
     {
         printf("Failed to read in binary file into matrix.\n\tGoing to cleanup.\n");
@@ -28,4 +281,33 @@ int main()
 
 cleanup:
     deallocate_matrix(mat);
-}
\ No newline at end of file
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    // Statistics go to $MATRIX_STATS_FILE (stderr when unset) at exit and on SIGUSR1.
+    if (instrument_enabled())
+        instrument_install_dump(getenv("MATRIX_STATS_FILE"));
+
+    if (argc == 1)
+        return run_default();
+
+    if (strcmp(argv[1], "stream") == 0)
+        return run_stream(argc, argv);
+
+    if (strcmp(argv[1], "batch") == 0)
+        return run_batch(argc, argv);
+
+    if (strcmp(argv[1], "archive") == 0)
+        return run_archive(argc, argv);
+
+    if (strcmp(argv[1], "extract") == 0)
+        return run_extract(argc, argv);
+
+    if (strcmp(argv[1], "ppm") == 0)
+        return run_ppm(argc, argv);
+
+    print_usage(argv[0]);
+    return 1;
+}
@@ -1,71 +1,166 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "errors.h"
+#include "instrument.h"
 #include "matrix.h"
+#include "pool.h"
 #include "stdio.h"
 
+/**
+ * Pixels read per chunk by the format converting readers (64 KiB).
+ */
+#define RAW_INGEST_CHUNK_PIXELS 32768u
+
+/**
+ * Pixels staged per step when converting between two tiled layouts (1 KiB).
+ */
+#define CONVERT_CHUNK_PIXELS 512u
+
 #define RED_PIXEL_MASK (uint8_t)(0x1F)
 #define GREEN_PIXEL_MASK (uint8_t)(0x3F)
 #define BLUE_PIXEL_MASK (uint8_t)(0x1F)
 
+/**
+ * Flag rows [first_row, last_row] as modified when dirty tracking is enabled.
+ * Callers pass rows that are already clipped to the matrix.
+ */
+static inline void mark_rows(matrix *mat, int32_t first_row, int32_t last_row)
+{
+  if (mat->dirty_rows != NULL && first_row <= last_row)
+    memset(mat->dirty_rows + first_row, 1, (size_t)(last_row - first_row + 1));
+}
+
+static inline void mark_all_rows_dirty(matrix *mat)
+{
+  mark_rows(mat, 0, (int32_t)mat->vertical - 1);
+}
+
+/**
+ * log2 of the tile edge of a layout, 0 for row-major.
+ */
+static inline uint32_t tile_shift(matrix_layout layout)
+{
+  switch (layout)
+  {
+  case MATRIX_LAYOUT_TILED_8X8:
+    return 3;
+  case MATRIX_LAYOUT_TILED_16X16:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+static inline uint64_t pixel_offset(const matrix *mat, uint32_t row, uint32_t column)
+{
+  uint32_t shift = tile_shift(mat->layout);
+  if (shift == 0)
+    return (uint64_t)row * mat->horizontal + column;
+
+  uint32_t mask = (1u << shift) - 1;
+  uint64_t tiles_per_row = ((uint32_t)mat->horizontal + mask) >> shift;
+  uint64_t tile = (uint64_t)(row >> shift) * tiles_per_row + (column >> shift);
+  return (tile << (2 * shift)) + ((row & mask) << shift) + (column & mask);
+}
+
 mat_fn_status zero_matrix(matrix *mat)
 {
   if (!mat)
   {
-    printf("zero_matrix: data_ptr is NULL.\n");
+    mat_report_error(INVALID_PARAM, "zero_matrix: data_ptr is NULL.");
     return INVALID_PARAM;
   }
 
   if (!(mat->mem))
   {
-    printf("zero_matrix: data_ptr underlying data is NULL.\n");
+    mat_report_error(INVALID_PARAM, "zero_matrix: data_ptr underlying data is NULL.");
     return INVALID_PARAM;
   }
 
-  uint16_t *mem = mat->mem;
-  for (uint32_t index = 0; index < mat->size; index++)
-  {
-    mem[index] = 0;
-  }
+  memset(mat->mem, 0, (size_t)mat->size * sizeof(uint16_t));
+
+  mark_all_rows_dirty(mat);
 
   return VALID_OP;
 }
 
 struct matrix *allocate_matrix(uint16_t horizontal_dim, uint16_t vertical_dim)
 {
+  return allocate_matrix_layout(horizontal_dim, vertical_dim, MATRIX_LAYOUT_ROW_MAJOR);
+}
+
+struct matrix *allocate_matrix_layout(uint16_t horizontal_dim, uint16_t vertical_dim,
+                                      matrix_layout layout)
+{
+  if (layout != MATRIX_LAYOUT_ROW_MAJOR && tile_shift(layout) == 0)
+  {
+    mat_report_error(INVALID_PARAM, "allocate_matrix: unknown layout %d.", (int)layout);
+    return NULL;
+  }
+
   struct matrix *mat = (struct matrix *)malloc(sizeof(struct matrix));
   if (!mat)
   {
-    printf("allocate_matrix: failed to allocate matrix_info struct.\n");
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "allocate_matrix: failed to allocate matrix_info struct.");
     return NULL;
   }
 
   mat->horizontal = horizontal_dim;
   mat->vertical = vertical_dim;
-
-  mat->size = mat->horizontal * mat->vertical;
-  mat->mem = (uint16_t *)malloc(sizeof(uint16_t) * (mat->size));
+  mat->layout = layout;
+
+  // Tiled layouts round both dimensions up to whole tiles.
+  uint32_t shift = tile_shift(layout);
+  uint32_t mask = (1u << shift) - 1;
+  mat->size = ((uint64_t)(((uint32_t)horizontal_dim + mask) >> shift) *
+               (((uint32_t)vertical_dim + mask) >> shift))
+              << (2 * shift);
+  // calloc hands large blocks back as fresh zero pages, so there is no need
+  // to sweep the buffer a second time.
+  mat->mem = (uint16_t *)calloc(mat->size ? mat->size : 1, sizeof(uint16_t));
+  mat->storage = MATRIX_STORAGE_HEAP;
+  mat->map_base = NULL;
+  mat->map_length = 0;
+  mat->pool = NULL;
+  mat->dirty_rows = NULL;
 
   if (mat->mem == NULL)
   {
-    printf("Unable to allocate underlying memory space for matrix.\n");
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "Unable to allocate underlying memory space for matrix.");
     free(mat);
     return NULL;
   }
 
-  zero_matrix(mat);
-
   return mat;
 }
 
 mat_fn_status deallocate_matrix(matrix *mat)
 {
+  if (mat != NULL && mat->storage == MATRIX_STORAGE_POOLED)
+    return matrix_pool_release(mat->pool, mat);
+
   if (mat != NULL && mat->mem)
   {
-    free(mat->mem);
+    if (mat->storage == MATRIX_STORAGE_MAPPED)
+      munmap(mat->map_base, mat->map_length);
+    else
+      free(mat->mem);
+    free(mat->dirty_rows);
     mat->horizontal = -1;
     mat->vertical = -1;
     mat->size = -1;
@@ -80,19 +175,18 @@ mat_fn_status print_matrix(matrix *mat)
 {
   if (mat == NULL)
   {
-    printf("print_matrix: mat passed is NULL.\n");
+    mat_report_error(INVALID_PARAM, "print_matrix: mat passed is NULL.");
     return INVALID_PARAM;
   }
 
-  uint16_t x_row, y_column, offset;
+  uint16_t x_row, y_column;
   printf("[\n");
   for (x_row = 0; x_row < mat->vertical; x_row++)
   {
-    offset = x_row * mat->horizontal;
     printf("[");
     for (y_column = 0; y_column < mat->horizontal; y_column++)
     {
-      printf("[ %6d ]", mat->mem[offset + y_column]);
+      printf("[ %6d ]", mat->mem[pixel_offset(mat, x_row, y_column)]);
     }
     printf("]\n");
   }
@@ -101,9 +195,117 @@ mat_fn_status print_matrix(matrix *mat)
   return VALID_OP;
 }
 
-uint32_t calculate_offset(matrix *mat, uint16_t row, uint16_t column)
+uint64_t calculate_offset(matrix *mat, uint16_t row, uint16_t column)
+{
+  return pixel_offset(mat, row, column);
+}
+
+bool matrix_is_row_major(const matrix *mat)
 {
-  return (uint32_t)(row * mat->horizontal + column);
+  return mat != NULL && mat->layout == MATRIX_LAYOUT_ROW_MAJOR;
+}
+
+/**
+ * Move count pixels between a row of a tiled matrix, starting at column, and the
+ * contiguous buffer pixels: gathered out of the tiles when gather is set, scattered
+ * into them otherwise. Called with a constant shift, so every whole tile row is a
+ * fixed size copy and the next tile is found by pointer arithmetic.
+ */
+static inline void move_tiled_row(const matrix *mat, uint32_t shift, uint32_t row,
+                                  uint32_t column, uint32_t count, uint16_t *pixels,
+                                  bool gather)
+{
+  uint32_t tile = 1u << shift;
+  uint16_t *tile_row = mat->mem + pixel_offset(mat, row, column);
+  uint32_t run = tile - (column & (tile - 1));
+
+  while (count > 0)
+  {
+    if (run >= count)
+      run = count;
+
+    size_t bytes = (run == tile) ? tile * sizeof(uint16_t) : run * sizeof(uint16_t);
+    if (gather)
+      memcpy(pixels, tile_row, bytes);
+    else
+      memcpy(tile_row, pixels, bytes);
+
+    // Same row of the next tile, which starts tile * tile pixels after this one.
+    tile_row += run - tile + (tile << shift);
+    pixels += run;
+    count -= run;
+    run = tile;
+  }
+}
+
+static void move_matrix_row(const matrix *mat, uint32_t row, uint32_t column,
+                            uint32_t count, uint16_t *pixels, bool gather)
+{
+  switch (mat->layout)
+  {
+  case MATRIX_LAYOUT_TILED_8X8:
+    move_tiled_row(mat, 3, row, column, count, pixels, gather);
+    break;
+  case MATRIX_LAYOUT_TILED_16X16:
+    move_tiled_row(mat, 4, row, column, count, pixels, gather);
+    break;
+  default:
+    if (gather)
+      memcpy(pixels, mat->mem + pixel_offset(mat, row, column), count * sizeof(uint16_t));
+    else
+      memcpy(mat->mem + pixel_offset(mat, row, column), pixels, count * sizeof(uint16_t));
+    break;
+  }
+}
+
+void copy_matrix_row(const matrix *mat, uint16_t row, uint16_t start_col, uint32_t count,
+                     uint16_t *dst)
+{
+  move_matrix_row(mat, row, start_col, count, dst, true);
+}
+
+mat_fn_status convert_matrix_layout(matrix *src, matrix *dst)
+{
+  if (src == NULL || dst == NULL || src == dst)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "convert_matrix_layout: src or dst passed is NULL or both are the "
+                     "same matrix.");
+    return INVALID_PARAM;
+  }
+
+  if (src->horizontal != dst->horizontal || src->vertical != dst->vertical)
+  {
+    mat_report_error(INVALID_PARAM, "convert_matrix_layout: dst must be %ux%u.",
+                     src->horizontal, src->vertical);
+    return INVALID_PARAM;
+  }
+
+  // Row by row: a row-major side is used in place, two tiled sides meet in a
+  // small buffer that stays in L1.
+  uint16_t chunk[CONVERT_CHUNK_PIXELS];
+  uint32_t width = src->horizontal;
+  for (uint32_t row = 0; row < src->vertical; row++)
+  {
+    if (matrix_is_row_major(dst))
+      move_matrix_row(src, row, 0, width, dst->mem + pixel_offset(dst, row, 0), true);
+    else if (matrix_is_row_major(src))
+      move_matrix_row(dst, row, 0, width, src->mem + pixel_offset(src, row, 0), false);
+    else
+    {
+      for (uint32_t col = 0; col < width; col += CONVERT_CHUNK_PIXELS)
+      {
+        uint32_t count = width - col;
+        if (count > CONVERT_CHUNK_PIXELS)
+          count = CONVERT_CHUNK_PIXELS;
+        move_matrix_row(src, row, col, count, chunk, true);
+        move_matrix_row(dst, row, col, count, chunk, false);
+      }
+    }
+  }
+
+  mark_all_rows_dirty(dst);
+  return VALID_OP;
 }
 
 mat_fn_status write_rgb565_pixel_rgb(matrix *mat, uint8_t red, uint8_t green, uint8_t blue,
@@ -111,19 +313,19 @@ mat_fn_status write_rgb565_pixel_rgb(matrix *mat, uint8_t red, uint8_t green, ui
 {
   if (mat == NULL)
   {
-    printf("write_rgb565_pixel: mat passed is NULL.\n");
+    mat_report_error(INVALID_PARAM, "write_rgb565_pixel: mat passed is NULL.");
     return INVALID_PARAM;
   }
 
   if (row < 0 || row >= mat->vertical)
   {
-    printf("write_rgb565_pixel: row parameters is invalid.\n");
+    mat_report_error(INVALID_PARAM, "write_rgb565_pixel: row parameters is invalid.");
     return INVALID_PARAM;
   }
 
   if (column < 0 || column >= mat->horizontal)
   {
-    printf("write_rgb565_pixel: column parameters is invalid.\n");
+    mat_report_error(INVALID_PARAM, "write_rgb565_pixel: column parameters is invalid.");
     return INVALID_PARAM;
   }
 
@@ -134,6 +336,9 @@ mat_fn_status write_rgb565_pixel_rgb(matrix *mat, uint8_t red, uint8_t green, ui
   *ptr |= (green & GREEN_PIXEL_MASK) << 5;
   *ptr |= (blue & BLUE_PIXEL_MASK);
 
+  mark_rows(mat, row, row);
+  INSTRUMENT_COUNT(INSTRUMENT_PIXELS_DRAWN, 1);
+
   return VALID_OP;
 }
 
@@ -142,24 +347,219 @@ mat_fn_status write_rgb565_pixel_code(matrix *mat, uint16_t color,
 {
   if (mat == NULL)
   {
-    printf("write_rgb565_pixel_code: mat passed is NULL.\n");
+    mat_report_error(NULL_MAT, "write_rgb565_pixel_code: mat passed is NULL.");
     return NULL_MAT;
   }
 
   if (row < 0 || row >= mat->vertical)
   {
-    printf("write_rgb565_pixel: row parameters is invalid.\n");
+    mat_report_error(INVALID_PARAM, "write_rgb565_pixel: row parameters is invalid.");
     return INVALID_PARAM;
   }
 
   if (column < 0 || column >= mat->horizontal)
   {
-    printf("write_rgb565_pixel: column parameters is invalid.\n");
+    mat_report_error(INVALID_PARAM, "write_rgb565_pixel: column parameters is invalid.");
     return INVALID_PARAM;
   }
 
   mat->mem[calculate_offset(mat, row, column)] = color;
 
+  mark_rows(mat, row, row);
+  INSTRUMENT_COUNT(INSTRUMENT_PIXELS_DRAWN, 1);
+
+  return VALID_OP;
+}
+
+static inline uint16_t pack_rgb565(uint8_t red, uint8_t green, uint8_t blue)
+{
+  return (uint16_t)(((red & RED_PIXEL_MASK) << 11) |
+                    ((green & GREEN_PIXEL_MASK) << 5) | (blue & BLUE_PIXEL_MASK));
+}
+
+/**
+ * Stable counting sort of a pixel batch by row. Every batch element type
+ * starts with its uint16_t row. Returns false if the temporary buffers could
+ * not be allocated, in which case the batch is left untouched.
+ */
+static inline bool sort_batch_by_row(void *pixels, size_t count,
+                                     size_t element_size, uint16_t max_row)
+{
+  size_t *starts = (size_t *)calloc((size_t)max_row + 2, sizeof(size_t));
+  uint8_t *sorted = (uint8_t *)malloc(count * element_size);
+  if (starts == NULL || sorted == NULL)
+  {
+    free(starts);
+    free(sorted);
+    return false;
+  }
+
+  uint8_t *elements = (uint8_t *)pixels;
+  uint16_t row;
+
+  for (size_t index = 0; index < count; index++)
+  {
+    memcpy(&row, elements + index * element_size, sizeof(row));
+    starts[row + 1]++;
+  }
+
+  for (size_t bucket = 1; bucket <= (size_t)max_row + 1; bucket++)
+    starts[bucket] += starts[bucket - 1];
+
+  for (size_t index = 0; index < count; index++)
+  {
+    memcpy(&row, elements + index * element_size, sizeof(row));
+    memcpy(sorted + starts[row]++ * element_size, elements + index * element_size,
+           element_size);
+  }
+
+  memcpy(pixels, sorted, count * element_size);
+  free(sorted);
+  free(starts);
+  return true;
+}
+
+mat_fn_status write_rgb565_pixels_code(matrix *mat, rgb565_pixel_code *pixels,
+                                       size_t count, uint8_t flags)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT, "write_rgb565_pixels_code: mat passed is NULL.");
+    return NULL_MAT;
+  }
+
+  if (pixels == NULL && count != 0)
+  {
+    mat_report_error(INVALID_PARAM, "write_rgb565_pixels_code: pixels passed is NULL.");
+    return INVALID_PARAM;
+  }
+
+  // Find the largest coordinates of the batch without branching per pixel.
+  uint16_t max_row = 0, max_column = 0;
+  for (size_t index = 0; index < count; index++)
+  {
+    max_row = (pixels[index].row > max_row) ? pixels[index].row : max_row;
+    max_column = (pixels[index].column > max_column) ? pixels[index].column : max_column;
+  }
+
+  bool in_bounds =
+      count == 0 || (max_row < mat->vertical && max_column < mat->horizontal);
+  if (!in_bounds && !(flags & PIXEL_BATCH_CLIP))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "write_rgb565_pixels_code: batch contains out of bounds pixels.");
+    return INVALID_PARAM;
+  }
+
+  // Only a batch that is going to be written is reordered.
+  if ((flags & PIXEL_BATCH_SORT_ROWS) &&
+      !sort_batch_by_row(pixels, count, sizeof(rgb565_pixel_code), max_row))
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "write_rgb565_pixels_code: unable to allocate sort buffers.");
+    return FAILED_MAT_ALLOCATION;
+  }
+
+  uint16_t *mem = mat->mem;
+
+  if (in_bounds)
+  {
+    if (mat->dirty_rows != NULL)
+    {
+      for (size_t index = 0; index < count; index++)
+        mat->dirty_rows[pixels[index].row] = 1;
+    }
+
+    for (size_t index = 0; index < count; index++)
+      mem[pixel_offset(mat, pixels[index].row, pixels[index].column)] =
+          pixels[index].color;
+    INSTRUMENT_COUNT(INSTRUMENT_PIXELS_DRAWN, count);
+    return VALID_OP;
+  }
+
+  for (size_t index = 0; index < count; index++)
+  {
+    if (pixels[index].row < mat->vertical && pixels[index].column < mat->horizontal)
+    {
+      mem[pixel_offset(mat, pixels[index].row, pixels[index].column)] =
+          pixels[index].color;
+      mark_rows(mat, pixels[index].row, pixels[index].row);
+      INSTRUMENT_COUNT(INSTRUMENT_PIXELS_DRAWN, 1);
+    }
+  }
+
+  return VALID_OP;
+}
+
+mat_fn_status write_rgb565_pixels_rgb(matrix *mat, rgb565_pixel_rgb *pixels,
+                                      size_t count, uint8_t flags)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT, "write_rgb565_pixels_rgb: mat passed is NULL.");
+    return NULL_MAT;
+  }
+
+  if (pixels == NULL && count != 0)
+  {
+    mat_report_error(INVALID_PARAM, "write_rgb565_pixels_rgb: pixels passed is NULL.");
+    return INVALID_PARAM;
+  }
+
+  // Find the largest coordinates of the batch without branching per pixel.
+  uint16_t max_row = 0, max_column = 0;
+  for (size_t index = 0; index < count; index++)
+  {
+    max_row = (pixels[index].row > max_row) ? pixels[index].row : max_row;
+    max_column = (pixels[index].column > max_column) ? pixels[index].column : max_column;
+  }
+
+  bool in_bounds =
+      count == 0 || (max_row < mat->vertical && max_column < mat->horizontal);
+  if (!in_bounds && !(flags & PIXEL_BATCH_CLIP))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "write_rgb565_pixels_rgb: batch contains out of bounds pixels.");
+    return INVALID_PARAM;
+  }
+
+  // Only a batch that is going to be written is reordered.
+  if ((flags & PIXEL_BATCH_SORT_ROWS) &&
+      !sort_batch_by_row(pixels, count, sizeof(rgb565_pixel_rgb), max_row))
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "write_rgb565_pixels_rgb: unable to allocate sort buffers.");
+    return FAILED_MAT_ALLOCATION;
+  }
+
+  uint16_t *mem = mat->mem;
+
+  if (in_bounds)
+  {
+    if (mat->dirty_rows != NULL)
+    {
+      for (size_t index = 0; index < count; index++)
+        mat->dirty_rows[pixels[index].row] = 1;
+    }
+
+    for (size_t index = 0; index < count; index++)
+      mem[pixel_offset(mat, pixels[index].row, pixels[index].column)] =
+          pack_rgb565(pixels[index].red, pixels[index].green, pixels[index].blue);
+    INSTRUMENT_COUNT(INSTRUMENT_PIXELS_DRAWN, count);
+    return VALID_OP;
+  }
+
+  for (size_t index = 0; index < count; index++)
+  {
+    if (pixels[index].row < mat->vertical && pixels[index].column < mat->horizontal)
+    {
+      mem[pixel_offset(mat, pixels[index].row, pixels[index].column)] =
+          pack_rgb565(pixels[index].red, pixels[index].green, pixels[index].blue);
+      mark_rows(mat, pixels[index].row, pixels[index].row);
+      INSTRUMENT_COUNT(INSTRUMENT_PIXELS_DRAWN, 1);
+    }
+  }
+
   return VALID_OP;
 }
 
@@ -168,13 +568,15 @@ bool static validate_horizontal_dimension(uint16_t horizontal_dim,
 {
   if (start_x >= horizontal_dim || start_x < 0)
   {
-    printf("validate_horizontal_dimension: start_x dimension is invalid");
+    mat_report_error(INVALID_PARAM,
+                     "validate_horizontal_dimension: start_x dimension is invalid");
     return false;
   }
 
   if (end_x >= horizontal_dim || end_x < 0)
   {
-    printf("validate_horizontal_dimension: end_x dimension is invalid");
+    mat_report_error(INVALID_PARAM,
+                     "validate_horizontal_dimension: end_x dimension is invalid");
     return false;
   }
 
@@ -186,13 +588,15 @@ bool static validate_vertical_dimension(uint16_t vertical_dim, uint16_t start_y,
 {
   if (start_y >= vertical_dim || start_y < 0)
   {
-    printf("validate_vertical_dimension: start_y dimension is invalid");
+    mat_report_error(INVALID_PARAM,
+                     "validate_vertical_dimension: start_y dimension is invalid");
     return false;
   }
 
   if (start_y >= vertical_dim || start_y < 0)
   {
-    printf("validate_vertical_dimension: end_y dimension is invalid");
+    mat_report_error(INVALID_PARAM,
+                     "validate_vertical_dimension: end_y dimension is invalid");
     return false;
   }
 
@@ -207,82 +611,154 @@ bool static validate_points_fall_in_bounds(uint16_t horizontal_dim,
 
   if (!validate_horizontal_dimension(horizontal_dim, start_x, end_x))
   {
-    printf("validate_points_fall_in_bounds: horizontal dimensions found to be "
-           "invalid.\n");
+    mat_report_error(INVALID_PARAM,
+                     "validate_points_fall_in_bounds: horizontal dimensions found to be "
+                     "invalid.");
     return false;
   }
 
   if (!validate_vertical_dimension(vertical_dim, start_y, end_y))
   {
-    printf("validate_points_fall_in_bounds: vertical dimensions found to be "
-           "invalid.\n");
+    mat_report_error(INVALID_PARAM,
+                     "validate_points_fall_in_bounds: vertical dimensions found to be "
+                     "invalid.");
     return false;
   }
 
   return true;
 }
 
-uint8_t static fill_pixel(matrix *mat, uint16_t color, uint16_t pt_size,
-                          uint16_t row, uint16_t column)
+/**
+ * Fill count consecutive pixels starting at dst with color.
+ */
+static inline void fill_words(uint16_t *dst, uint16_t color, size_t count)
 {
+  size_t index = 0;
 
-  if (pt_size == 0)
+#ifdef __SSE2__
+  const __m128i pattern = _mm_set1_epi16((short)color);
+  for (; index + 16 <= count; index += 16)
   {
-    printf("Invalid pixel size. returning.\n");
-    return 1;
+    _mm_storeu_si128((__m128i *)(dst + index), pattern);
+    _mm_storeu_si128((__m128i *)(dst + index + 8), pattern);
   }
-  else if (pt_size == 1)
+  if (index + 8 <= count)
   {
-    uint32_t offset = calculate_offset(mat, row, column);
-    // printf("Writing 0xFFFF to (%d, %d).\n", column, row);
-    // printf("%ul calculate_offset(row, column, mat)offset.\n", offset);
-    mat->mem[offset] = color;
-    return 0;
+    _mm_storeu_si128((__m128i *)(dst + index), pattern);
+    index += 8;
   }
+#endif
 
-  uint16_t position_offset = pt_size - 1;
-
-  int32_t start_position_row = row - position_offset;
-  int32_t start_position_column = column - position_offset;
+  for (; index < count; index++)
+    dst[index] = color;
+}
 
-  int32_t end_position_row = row + position_offset;
-  int32_t end_position_column = column + position_offset;
-  if (start_position_row < 0)
+mat_fn_status fill_matrix(matrix *mat, uint16_t color)
+{
+  if (mat == NULL || mat->mem == NULL)
   {
-    start_position_row = 0;
+    mat_report_error(INVALID_PARAM, "fill_matrix: mat passed is NULL.");
+    return INVALID_PARAM;
   }
 
-  if (start_position_column < 0)
-  {
-    start_position_column = 0;
-  }
+  fill_words(mat->mem, color, mat->size);
+  mark_all_rows_dirty(mat);
 
-  if (end_position_row >= mat->vertical)
-  {
-    end_position_row = mat->vertical - 1;
-  }
+  return VALID_OP;
+}
 
-  if (end_position_column >= mat->horizontal)
-  {
-    end_position_column = mat->horizontal - 1;
-  }
+/**
+ * Fill an already clipped rectangle of a tiled matrix one tile at a time, so the
+ * pixels written follow memory order: the rows of a tile are consecutive, as are the
+ * tiles of a tile row.
+ */
+static void fill_tiled_rect(matrix *mat, uint16_t color, int32_t start_row,
+                            int32_t end_row, int32_t start_col, int32_t end_col)
+{
+  uint32_t shift = tile_shift(mat->layout);
+  int32_t tile = 1 << shift, mask = tile - 1;
 
-  // printf("Starting (%d, %d) to Ending (%d, %d).\n", start_position_column,
-  //       start_position_row, end_position_column, end_position_row);
+  // Pixels per band of tiles, and the first pixel of the first band at start_col.
+  size_t band_pixels =
+      (size_t)(((uint32_t)mat->horizontal + mask) >> shift) << (2 * shift);
+  uint16_t *band_start = mat->mem + pixel_offset(mat, start_row & ~mask, start_col);
 
-  for (uint16_t row = start_position_row; row <= end_position_row; row++)
+  for (int32_t band = start_row; band <= end_row;
+       band = (band | mask) + 1, band_start += band_pixels)
   {
-    for (uint16_t col = start_position_column; col <= end_position_column;
-         col++)
+    int32_t band_end = (band | mask) < end_row ? (band | mask) : end_row;
+    uint16_t *tile_row = band_start + ((band & mask) << shift);
+    for (int32_t col = start_col; col <= end_col; col = (col | mask) + 1)
     {
-      uint32_t offset = calculate_offset(mat, row, col);
-      // printf("Writing 0xFFFF to (%d, %d).\n", col, row);
-      // printf("%ul offset.\n", offset);
-      mat->mem[offset] = color;
+      int32_t col_end = (col | mask) < end_col ? (col | mask) : end_col;
+      uint16_t *dst = tile_row;
+      for (int32_t row = band; row <= band_end; row++, dst += tile)
+        fill_words(dst, color, (size_t)(col_end - col + 1));
+
+      // Same row of the next tile.
+      tile_row += (col_end - col + 1) - tile + (tile << shift);
     }
   }
+}
+
+void fill_clipped_span(matrix *mat, uint16_t color, int32_t row,
+                       int32_t start_col, int32_t end_col)
+{
+  if (row < 0 || row >= mat->vertical)
+    return;
 
-  return 0;
+  if (start_col < 0)
+    start_col = 0;
+  if (end_col >= mat->horizontal)
+    end_col = mat->horizontal - 1;
+  if (start_col > end_col)
+    return;
+
+  if (mat->layout != MATRIX_LAYOUT_ROW_MAJOR)
+    fill_tiled_rect(mat, color, row, row, start_col, end_col);
+  else
+    fill_words(mat->mem + calculate_offset(mat, row, start_col), color,
+               (size_t)(end_col - start_col + 1));
+  mark_rows(mat, row, row);
+  INSTRUMENT_COUNT(INSTRUMENT_PIXELS_DRAWN, end_col - start_col + 1);
+}
+
+void fill_clipped_rect(matrix *mat, uint16_t color, int32_t start_row,
+                       int32_t end_row, int32_t start_col, int32_t end_col)
+{
+  if (start_row < 0)
+    start_row = 0;
+  if (end_row >= mat->vertical)
+    end_row = mat->vertical - 1;
+  if (start_col < 0)
+    start_col = 0;
+  if (end_col >= mat->horizontal)
+    end_col = mat->horizontal - 1;
+  if (start_row > end_row || start_col > end_col)
+    return;
+
+  size_t width = (size_t)(end_col - start_col + 1);
+  if (mat->layout != MATRIX_LAYOUT_ROW_MAJOR)
+    fill_tiled_rect(mat, color, start_row, end_row, start_col, end_col);
+  else
+  {
+    uint16_t *dst = mat->mem + calculate_offset(mat, start_row, start_col);
+    for (int32_t row = start_row; row <= end_row; row++, dst += mat->horizontal)
+      fill_words(dst, color, width);
+  }
+  mark_rows(mat, start_row, end_row);
+  INSTRUMENT_COUNT(INSTRUMENT_PIXELS_DRAWN, width * (size_t)(end_row - start_row + 1));
+}
+
+/**
+ * Fill the square a point of size pt_size covers around (row, column).
+ */
+static void fill_point(matrix *mat, uint16_t color, uint16_t pt_size,
+                       uint16_t row, uint16_t column)
+{
+  int32_t reach = pt_size - 1;
+  fill_clipped_rect(mat, color, row - reach, row + reach, column - reach,
+                    column + reach);
 }
 
 mat_fn_status draw_vertical_line(matrix *mat, uint16_t color, uint16_t pt_size,
@@ -291,19 +767,20 @@ mat_fn_status draw_vertical_line(matrix *mat, uint16_t color, uint16_t pt_size,
 {
   if (mat == NULL)
   {
-    printf("draw_vertical_line: mat passed is NULL.\n");
+    mat_report_error(INVALID_PARAM, "draw_vertical_line: mat passed is NULL.");
     return INVALID_PARAM;
   }
 
   if (start_row == end_row)
   {
-    fill_pixel(mat, color, pt_size, start_row, col_position);
+    fill_point(mat, color, pt_size, start_row, col_position);
     return INVALID_PARAM;
   }
 
   if (start_row > end_row)
   {
-    printf("draw_vertical_line: start_row is less than end_row.\n");
+    mat_report_error(INVALID_PARAM,
+                     "draw_vertical_line: start_row is less than end_row.");
     return INVALID_PARAM;
   }
 
@@ -311,14 +788,22 @@ mat_fn_status draw_vertical_line(matrix *mat, uint16_t color, uint16_t pt_size,
       validate_vertical_dimension(mat->vertical, start_row, end_row);
   if (col_position < 0 || col_position >= mat->horizontal || !valid_dims)
   {
-    printf("draw_vertical_line: Invalid dimensions detected.\n");
+    mat_report_error(INVALID_PARAM, "draw_vertical_line: Invalid dimensions detected.");
     return INVALID_PARAM;
   }
 
-  for (uint16_t row = start_row; row < end_row; row++)
-  {
-    fill_pixel(mat, color, pt_size, row, col_position);
-  }
+  // A zero point size covers no pixels, as it did when the line was drawn point
+  // by point.
+  if (pt_size == 0)
+    return VALID_OP;
+
+  // Points are placed on rows [start_row, end_row), each one covering a
+  // square of reach pixels around it. Their union is a single rectangle.
+  INSTRUMENT_TIMER(start);
+  int32_t reach = pt_size - 1;
+  fill_clipped_rect(mat, color, start_row - reach, end_row - 1 + reach,
+                    col_position - reach, col_position + reach);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_DRAW, start);
 
   return VALID_OP;
 }
@@ -328,26 +813,27 @@ mat_fn_status draw_horizontal_line(matrix *mat, uint16_t color, uint16_t pt_size
 {
   if (mat == NULL)
   {
-    printf("draw_horizontal_line: mat passed is NULL.\n");
+    mat_report_error(INVALID_PARAM, "draw_horizontal_line: mat passed is NULL.");
     return INVALID_PARAM;
   }
 
   if (start_col == end_col)
   {
-    fill_pixel(mat, color, pt_size, row, start_col);
+    fill_point(mat, color, pt_size, row, start_col);
     return INVALID_PARAM;
   }
 
   if (start_col > end_col)
   {
-    printf("draw_horizontal_line: Starting column is greater than ending "
-           "column. returning.\n");
+    mat_report_error(INVALID_PARAM,
+                     "draw_horizontal_line: Starting column is greater than ending "
+                     "column. returning.");
     return INVALID_PARAM;
   }
 
   if (row < 0 || row >= mat->vertical)
   {
-    printf("draw_horizontal_line: row dimension is invalid.\n");
+    mat_report_error(INVALID_PARAM, "draw_horizontal_line: row dimension is invalid.");
     return INVALID_PARAM;
   }
 
@@ -356,15 +842,22 @@ mat_fn_status draw_horizontal_line(matrix *mat, uint16_t color, uint16_t pt_size
 
   if (!valid_dims)
   {
-    printf(
-        "draw_perfect_horizontal_line: Invalid dimension found, returning.\n");
+    mat_report_error(INVALID_PARAM,
+                     "draw_perfect_horizontal_line: Invalid dimension found, returning.");
     return INVALID_PARAM;
   }
 
-  for (uint16_t x = start_col; x <= end_col; x++)
-  {
-    fill_pixel(mat, color, pt_size, row, x);
-  }
+  // A zero point size covers no pixels, as it did when the line was drawn point
+  // by point.
+  if (pt_size == 0)
+    return VALID_OP;
+
+  // Points are placed on columns [start_col, end_col].
+  INSTRUMENT_TIMER(start);
+  int32_t reach = pt_size - 1;
+  fill_clipped_rect(mat, color, row - reach, row + reach, start_col - reach,
+                    end_col + reach);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_DRAW, start);
 
   return VALID_OP;
 }
@@ -376,7 +869,7 @@ mat_fn_status draw_rectangle(matrix *mat, uint16_t color, uint16_t pt_size,
 
   if (mat == NULL)
   {
-    printf("draw_rectangle: mat passed is NULL.\n");
+    mat_report_error(INVALID_PARAM, "draw_rectangle: mat passed is NULL.");
     return INVALID_PARAM;
   }
 
@@ -386,30 +879,74 @@ mat_fn_status draw_rectangle(matrix *mat, uint16_t color, uint16_t pt_size,
 
   if (!valid_dims)
   {
-    printf("draw_rectangle: Invalid dimension found, returning.\n");
+    mat_report_error(INVALID_PARAM,
+                     "draw_rectangle: Invalid dimension found, returning.");
     return INVALID_PARAM;
   }
 
-  if(draw_horizontal_line(mat, color, pt_size, start_y, start_x, end_x) != VALID_OP) {
-    printf("draw_rectangle: failed to draw top horizontal line\n");
-    return FAILED_DRAW_OP;
-  }
+  // A zero point size covers no pixels, as it did when edges were drawn point by
+  // point.
+  if (pt_size == 0)
+    return VALID_OP;
 
-  if(draw_horizontal_line(mat, color, pt_size, end_y, start_x, end_x) != VALID_OP) {
-    printf("draw_rectangle: failed to draw bottom horizontal line\n");
-    return FAILED_DRAW_OP;
+  if (start_x >= end_x || start_y >= end_y)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "draw_rectangle: (%u, %u) is not the top left corner of (%u, %u).",
+                     start_x, start_y, end_x, end_y);
+    return INVALID_PARAM;
   }
 
-  if(draw_vertical_line(mat, color, pt_size, start_x, start_y, end_y) != VALID_OP) {
-    printf("draw_rectangle: failed to draw left vertical line\n");
-    return FAILED_DRAW_OP;
+  // The outline is the union of a top band, a bottom band and two side
+  // bands. Walk it row by row so every covered pixel is written exactly once.
+  INSTRUMENT_TIMER(start);
+  int32_t reach = pt_size - 1;
+  int32_t top_end = start_y + reach;
+  int32_t bottom_start = end_y - reach;
+  int32_t left_end = start_x + reach;
+  int32_t right_start = end_x - reach;
+
+  int32_t first_row = start_y - reach;
+  int32_t last_row = end_y + reach;
+  if (first_row < 0)
+    first_row = 0;
+  if (last_row >= mat->vertical)
+    last_row = mat->vertical - 1;
+
+  if (mat->layout != MATRIX_LAYOUT_ROW_MAJOR)
+  {
+    // Tiled matrices fill the bands as rectangles instead, so the side bands are
+    // written a tile at a time rather than a row at a time.
+    if (left_end + 1 >= right_start || top_end + 1 >= bottom_start)
+      fill_clipped_rect(mat, color, first_row, last_row, start_x - reach, end_x + reach);
+    else
+    {
+      fill_clipped_rect(mat, color, first_row, top_end, start_x - reach, end_x + reach);
+      fill_clipped_rect(mat, color, bottom_start, last_row, start_x - reach,
+                        end_x + reach);
+      fill_clipped_rect(mat, color, top_end + 1, bottom_start - 1, start_x - reach,
+                        left_end);
+      fill_clipped_rect(mat, color, top_end + 1, bottom_start - 1, right_start,
+                        end_x + reach);
+    }
+
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_DRAW, start);
+    return VALID_OP;
   }
 
-  if(draw_vertical_line(mat, color, pt_size, end_x, start_y, end_y) != VALID_OP) {
-    printf("draw_rectangle: failed to draw right vertical line\n");
-    return FAILED_DRAW_OP;
+  for (int32_t row = first_row; row <= last_row; row++)
+  {
+    if (row <= top_end || row >= bottom_start || left_end + 1 >= right_start)
+    {
+      fill_clipped_span(mat, color, row, start_x - reach, end_x + reach);
+      continue;
+    }
+
+    fill_clipped_span(mat, color, row, start_x - reach, left_end);
+    fill_clipped_span(mat, color, row, right_start, end_x + reach);
   }
 
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_DRAW, start);
   return VALID_OP;
 }
 
@@ -418,35 +955,326 @@ mat_fn_status read_binary_file(matrix *mat, const char *filepath)
 
   if (mat == NULL)
   {
-    printf("read_binary_file: mat structure pointer is NULL.\n");
+    mat_report_error(INVALID_PARAM, "read_binary_file: mat structure pointer is NULL.");
     return INVALID_PARAM;
   }
 
   if (filepath == NULL)
   {
-    printf("read_binary_file: filepath indicated is NULL.\n");
+    mat_report_error(INVALID_PARAM, "read_binary_file: filepath indicated is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "read_binary_file: tiled matrices are not supported.");
     return INVALID_PARAM;
   }
 
+  INSTRUMENT_TIMER(start);
   FILE *file_ptr = NULL;
   file_ptr = fopen(filepath, "rb");
   if (file_ptr == NULL)
   {
-    printf("read_binary_file: unable to open binary file for reading.\n");
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_binary_file: unable to open binary file for reading.");
     return FAILED_BINARY_FILE_READ;
   }
 
   size_t num_read = fread(mat->mem, sizeof(uint16_t), mat->size, file_ptr);
+  mark_all_rows_dirty(mat);
+  INSTRUMENT_COUNT(INSTRUMENT_BYTES_READ, num_read * sizeof(uint16_t));
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 3);
 
   mat_fn_status status = VALID_OP;
 
   if (!num_read)
   {
-    printf("read_binary_file: fread returned zero.\n");
+    mat_report_error(FAILED_BINARY_FILE_READ, "read_binary_file: fread returned zero.");
     status = FAILED_BINARY_FILE_READ;
   }
 
   fclose(file_ptr);
+  if (status == VALID_OP)
+    INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_READ, start);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_READ, start);
+
+  return status;
+}
+
+mat_fn_status read_binary_frame(matrix *mat, FILE *file_ptr)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "read_binary_frame: mat structure pointer is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (file_ptr == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "read_binary_frame: file_ptr is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "read_binary_frame: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  INSTRUMENT_TIMER(start);
+  size_t num_read = fread(mat->mem, sizeof(uint16_t), mat->size, file_ptr);
+  mark_all_rows_dirty(mat);
+  INSTRUMENT_COUNT(INSTRUMENT_BYTES_READ, num_read * sizeof(uint16_t));
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+  if (num_read != mat->size)
+  {
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_READ, start);
+    return FAILED_BINARY_FILE_READ;
+  }
+
+  INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_READ, start);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_READ, start);
+  return VALID_OP;
+}
+
+/**
+ * Read up to mat->size pixels from file_ptr chunk by chunk, converting every
+ * chunk to RGB565 right after it lands in matrix memory. Returns the number of
+ * pixels read.
+ */
+static size_t read_converted(matrix *mat, FILE *file_ptr, raw_pixel_format format)
+{
+  size_t done = 0;
+  INSTRUMENT_TIMER(frame_start);
+  INSTRUMENT_TIMER(start);
+
+  while (done < mat->size)
+  {
+    size_t wanted = mat->size - done;
+    if (wanted > RAW_INGEST_CHUNK_PIXELS)
+      wanted = RAW_INGEST_CHUNK_PIXELS;
+
+    size_t num_read = fread(mat->mem + done, sizeof(uint16_t), wanted, file_ptr);
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_READ, start);
+    INSTRUMENT_COUNT(INSTRUMENT_BYTES_READ, num_read * sizeof(uint16_t));
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+
+    raw_to_rgb565_row(format, mat->mem + done, mat->mem + done, num_read);
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_CONVERT, start);
+    done += num_read;
+
+    if (num_read != wanted)
+      break;
+  }
+
+  mark_all_rows_dirty(mat);
+  if (done == mat->size)
+    INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_READ, frame_start);
+  return done;
+}
+
+mat_fn_status read_binary_file_format(matrix *mat, const char *filepath,
+                                      raw_pixel_format format)
+{
+  if (format == RAW_FORMAT_RGB565)
+    return read_binary_file(mat, filepath);
+
+  if (mat == NULL || filepath == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "read_binary_file_format: mat or filepath is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "read_binary_file_format: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  FILE *file_ptr = fopen(filepath, "rb");
+  if (file_ptr == NULL)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_binary_file_format: unable to open binary file for reading.");
+    return FAILED_BINARY_FILE_READ;
+  }
+
+  mat_fn_status status = VALID_OP;
+  if (!read_converted(mat, file_ptr, format))
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_binary_file_format: fread returned zero.");
+    status = FAILED_BINARY_FILE_READ;
+  }
 
+  fclose(file_ptr);
   return status;
 }
+
+mat_fn_status read_binary_frame_format(matrix *mat, FILE *file_ptr,
+                                       raw_pixel_format format)
+{
+  if (format == RAW_FORMAT_RGB565)
+    return read_binary_frame(mat, file_ptr);
+
+  if (mat == NULL || file_ptr == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "read_binary_frame_format: mat or file_ptr is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "read_binary_frame_format: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  if (read_converted(mat, file_ptr, format) != mat->size)
+    return FAILED_BINARY_FILE_READ;
+
+  return VALID_OP;
+}
+
+struct matrix *map_binary_file(const char *filepath, uint16_t horizontal_dim,
+                               uint16_t vertical_dim, uint64_t frame_index)
+{
+  if (filepath == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "map_binary_file: filepath indicated is NULL.");
+    return NULL;
+  }
+
+  uint64_t frame_bytes = (uint64_t)horizontal_dim * vertical_dim * sizeof(uint16_t);
+  if (frame_bytes == 0)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "map_binary_file: frame dimensions must be non-zero.");
+    return NULL;
+  }
+
+  int fd = open(filepath, O_RDONLY);
+  if (fd < 0)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "map_binary_file: unable to open %s for reading.", filepath);
+    return NULL;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ, "map_binary_file: unable to stat %s.",
+                     filepath);
+    close(fd);
+    return NULL;
+  }
+
+  uint64_t frame_offset = frame_index * frame_bytes;
+  if (frame_index > UINT64_MAX / frame_bytes ||
+      frame_offset + frame_bytes > (uint64_t)file_stat.st_size)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "map_binary_file: frame %llu lies beyond the end of %s.",
+                     (unsigned long long)frame_index, filepath);
+    close(fd);
+    return NULL;
+  }
+
+  struct matrix *mat = (struct matrix *)malloc(sizeof(struct matrix));
+  if (!mat)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "map_binary_file: failed to allocate matrix_info struct.");
+    close(fd);
+    return NULL;
+  }
+
+  // mmap offsets have to be page aligned, so map from the page containing the
+  // start of the frame and point mem at the frame inside it.
+  uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+  uint64_t map_offset = frame_offset - (frame_offset % page_size);
+  size_t lead = (size_t)(frame_offset - map_offset);
+
+  mat->map_length = lead + (size_t)frame_bytes;
+  mat->map_base = mmap(NULL, mat->map_length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd, (off_t)map_offset);
+  close(fd);
+
+  if (mat->map_base == MAP_FAILED)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ, "map_binary_file: unable to map %s.",
+                     filepath);
+    free(mat);
+    return NULL;
+  }
+
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 2);
+  madvise(mat->map_base, mat->map_length, MADV_SEQUENTIAL);
+  madvise(mat->map_base, mat->map_length, MADV_WILLNEED);
+
+  mat->horizontal = horizontal_dim;
+  mat->vertical = vertical_dim;
+  mat->size = (uint64_t)horizontal_dim * vertical_dim;
+  mat->mem = (uint16_t *)((uint8_t *)mat->map_base + lead);
+  mat->layout = MATRIX_LAYOUT_ROW_MAJOR;
+  mat->storage = MATRIX_STORAGE_MAPPED;
+  mat->pool = NULL;
+  mat->dirty_rows = NULL;
+
+  return mat;
+}
+
+mat_fn_status enable_dirty_tracking(matrix *mat)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT, "enable_dirty_tracking: mat passed is NULL.");
+    return NULL_MAT;
+  }
+
+  if (mat->dirty_rows != NULL)
+    return VALID_OP;
+
+  mat->dirty_rows = (uint8_t *)calloc(mat->vertical ? mat->vertical : 1, sizeof(uint8_t));
+  if (mat->dirty_rows == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "enable_dirty_tracking: unable to allocate dirty row flags.");
+    return FAILED_MAT_ALLOCATION;
+  }
+
+  return VALID_OP;
+}
+
+void disable_dirty_tracking(matrix *mat)
+{
+  if (mat == NULL)
+    return;
+
+  free(mat->dirty_rows);
+  mat->dirty_rows = NULL;
+}
+
+void clear_dirty_rows(matrix *mat)
+{
+  if (mat == NULL || mat->dirty_rows == NULL)
+    return;
+
+  memset(mat->dirty_rows, 0, mat->vertical);
+}
+
+void mark_dirty_rows(matrix *mat, uint16_t first_row, uint16_t last_row)
+{
+  if (mat == NULL)
+    return;
+
+  if (last_row >= mat->vertical)
+    last_row = mat->vertical - 1;
+
+  mark_rows(mat, first_row, last_row);
+}
@@ -0,0 +1,233 @@
+#include "pool.h"
+#include "errors.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/**
+ * Blocks at least this large are mapped straight from the kernel, which hands
+ * them out already zeroed.
+ */
+#define MATRIX_POOL_MMAP_THRESHOLD ((size_t)256 * 1024)
+
+#define ALIGN_UP(value, alignment) (((value) + (alignment)-1) & ~((size_t)(alignment)-1))
+
+struct matrix_pool
+{
+  uint16_t horizontal;
+  uint16_t vertical;
+
+  /**
+   * Length of a whole block and offset of the pixels inside it.
+   */
+  size_t block_size;
+  size_t pixel_offset;
+
+  pthread_mutex_t lock;
+  matrix **cached;
+  size_t cached_count;
+  size_t max_cached;
+  size_t outstanding;
+};
+
+matrix_pool *create_matrix_pool(uint16_t horizontal_dim, uint16_t vertical_dim,
+                                size_t max_cached)
+{
+  matrix_pool *pool = (matrix_pool *)calloc(1, sizeof(matrix_pool));
+  if (pool == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_matrix_pool: failed to allocate pool.");
+    return NULL;
+  }
+
+  pool->cached = (matrix **)calloc(max_cached ? max_cached : 1, sizeof(matrix *));
+  if (pool->cached == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "create_matrix_pool: failed to allocate pool cache.");
+    free(pool);
+    return NULL;
+  }
+
+  size_t pixel_bytes = (size_t)horizontal_dim * vertical_dim * sizeof(uint16_t);
+
+  pool->horizontal = horizontal_dim;
+  pool->vertical = vertical_dim;
+  pool->pixel_offset = ALIGN_UP(sizeof(matrix), MATRIX_POOL_ALIGNMENT);
+  pool->block_size = pool->pixel_offset + ALIGN_UP(pixel_bytes, MATRIX_POOL_ALIGNMENT);
+  pool->max_cached = max_cached;
+  pthread_mutex_init(&pool->lock, NULL);
+
+  return pool;
+}
+
+/**
+ * Return a block to the system allocator it came from.
+ */
+static void release_block(matrix *mat)
+{
+  free(mat->dirty_rows);
+
+  if (mat->map_length != 0)
+    munmap(mat->map_base, mat->map_length);
+  else
+    free(mat->map_base);
+}
+
+/**
+ * Allocate a new block and lay a matrix out in it. zeroed reports whether the
+ * pixels are known to be zero.
+ */
+static matrix *allocate_block(matrix_pool *pool, bool *zeroed)
+{
+  void *block = NULL;
+  size_t map_length = 0;
+
+  if (pool->block_size >= MATRIX_POOL_MMAP_THRESHOLD)
+  {
+    block = mmap(NULL, pool->block_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED)
+      block = NULL;
+    map_length = pool->block_size;
+    *zeroed = true;
+  }
+  else
+  {
+    if (posix_memalign(&block, MATRIX_POOL_ALIGNMENT, pool->block_size) != 0)
+      block = NULL;
+    *zeroed = false;
+  }
+
+  if (block == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "matrix_pool_acquire: failed to allocate matrix block.");
+    return NULL;
+  }
+
+  matrix *mat = (matrix *)block;
+  mat->horizontal = pool->horizontal;
+  mat->vertical = pool->vertical;
+  mat->size = (uint64_t)pool->horizontal * pool->vertical;
+  mat->mem = (uint16_t *)((uint8_t *)block + pool->pixel_offset);
+  mat->layout = MATRIX_LAYOUT_ROW_MAJOR;
+  mat->storage = MATRIX_STORAGE_POOLED;
+  mat->map_base = block;
+  mat->map_length = map_length;
+  mat->pool = pool;
+  mat->dirty_rows = NULL;
+
+  return mat;
+}
+
+matrix *matrix_pool_acquire(matrix_pool *pool, matrix_init init, uint16_t color)
+{
+  if (pool == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "matrix_pool_acquire: pool passed is NULL.");
+    return NULL;
+  }
+
+  matrix *mat = NULL;
+  bool zeroed = false;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->cached_count > 0)
+    mat = pool->cached[--pool->cached_count];
+  pthread_mutex_unlock(&pool->lock);
+
+  if (mat == NULL)
+  {
+    mat = allocate_block(pool, &zeroed);
+    if (mat == NULL)
+      return NULL;
+  }
+
+  switch (init)
+  {
+  case MATRIX_INIT_ZERO:
+    if (!zeroed)
+      zero_matrix(mat);
+    break;
+  case MATRIX_INIT_FILL:
+    fill_matrix(mat, color);
+    break;
+  default:
+    break;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->outstanding++;
+  pthread_mutex_unlock(&pool->lock);
+
+  return mat;
+}
+
+mat_fn_status matrix_pool_release(matrix_pool *pool, matrix *mat)
+{
+  if (pool == NULL || mat == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "matrix_pool_release: pool or mat passed is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (mat->storage != MATRIX_STORAGE_POOLED || mat->pool != pool)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "matrix_pool_release: mat was not acquired from this pool.");
+    return INVALID_PARAM;
+  }
+
+  // Dirty tracking state belongs to the previous user.
+  disable_dirty_tracking(mat);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->outstanding--;
+  if (pool->cached_count < pool->max_cached)
+  {
+    pool->cached[pool->cached_count++] = mat;
+    mat = NULL;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (mat != NULL)
+    release_block(mat);
+
+  return VALID_OP;
+}
+
+mat_fn_status destroy_matrix_pool(matrix_pool *pool)
+{
+  if (pool == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "destroy_matrix_pool: pool passed is NULL.");
+    return INVALID_PARAM;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  size_t outstanding = pool->outstanding;
+  pthread_mutex_unlock(&pool->lock);
+
+  if (outstanding != 0)
+  {
+    mat_report_error(INVALID_PARAM, "destroy_matrix_pool: %zu matrices are still in use.",
+                     outstanding);
+    return INVALID_PARAM;
+  }
+
+  for (size_t index = 0; index < pool->cached_count; index++)
+    release_block(pool->cached[index]);
+
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->cached);
+  free(pool);
+
+  return VALID_OP;
+}
@@ -0,0 +1,233 @@
+#include "ppm.h"
+#include "errors.h"
+#include "instrument.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RGB888_STRIPE_SIZE (size_t)(1 << 20) // 1 MiB of 24-bit rows per read
+
+mat_fn_status import_rgb888_frame(matrix *mat, const uint8_t *pixels, size_t stride,
+                                  rgb565_dither dither)
+{
+  if (mat == NULL || pixels == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "import_rgb888_frame: mat or pixels is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "import_rgb888_frame: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  if (stride < (size_t)mat->horizontal * 3)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "import_rgb888_frame: stride %zu is shorter than a row.", stride);
+    return INVALID_PARAM;
+  }
+
+  if (mat->size == 0)
+    return VALID_OP;
+
+  for (uint32_t row = 0; row < mat->vertical; row++)
+    rgb888_to_rgb565_row(pixels + row * stride,
+                         mat->mem + calculate_offset(mat, (uint16_t)row, 0),
+                         mat->horizontal, dither, row);
+
+  mark_dirty_rows(mat, 0, mat->vertical - 1);
+  return VALID_OP;
+}
+
+/**
+ * Read the rows of mat from file_ptr in stripes and quantize each stripe into
+ * matrix memory.
+ */
+static mat_fn_status read_rgb888_rows(const char *caller, matrix *mat, FILE *file_ptr,
+                                      rgb565_dither dither)
+{
+  size_t row_bytes = (size_t)mat->horizontal * 3;
+  if (mat->size == 0)
+    return VALID_OP;
+
+  size_t rows_per_stripe = RGB888_STRIPE_SIZE / row_bytes;
+  if (rows_per_stripe == 0)
+    rows_per_stripe = 1;
+  if (rows_per_stripe > mat->vertical)
+    rows_per_stripe = mat->vertical;
+
+  uint8_t *stripe = (uint8_t *)malloc(rows_per_stripe * row_bytes);
+  if (stripe == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION, "%s: unable to allocate stripe buffer.",
+                     caller);
+    return FAILED_MAT_ALLOCATION;
+  }
+
+  mat_fn_status status = VALID_OP;
+  INSTRUMENT_TIMER(frame_start);
+  INSTRUMENT_TIMER(start);
+  for (uint32_t row = 0; row < mat->vertical; row += (uint32_t)rows_per_stripe)
+  {
+    size_t rows = mat->vertical - row;
+    if (rows > rows_per_stripe)
+      rows = rows_per_stripe;
+
+    if (fread(stripe, row_bytes, rows, file_ptr) != rows)
+    {
+      mat_report_error(FAILED_BINARY_FILE_READ, "%s: file ends before row %u.", caller,
+                       row + 1);
+      status = FAILED_BINARY_FILE_READ;
+      break;
+    }
+    INSTRUMENT_COUNT(INSTRUMENT_BYTES_READ, rows * row_bytes);
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_READ, start);
+
+    for (size_t index = 0; index < rows; index++)
+      rgb888_to_rgb565_row(stripe + index * row_bytes,
+                           mat->mem + calculate_offset(mat, (uint16_t)(row + index), 0),
+                           mat->horizontal, dither, (uint32_t)(row + index));
+    INSTRUMENT_LAP(INSTRUMENT_STAGE_CONVERT, start);
+  }
+  if (status == VALID_OP)
+    INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_READ, frame_start);
+
+  free(stripe);
+  mark_dirty_rows(mat, 0, mat->vertical - 1);
+  return status;
+}
+
+mat_fn_status read_rgb888_file(matrix *mat, const char *filepath, rgb565_dither dither)
+{
+  if (mat == NULL || filepath == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "read_rgb888_file: mat or filepath is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "read_rgb888_file: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  FILE *file_ptr = fopen(filepath, "rb");
+  if (file_ptr == NULL)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_rgb888_file: unable to open %s for reading.", filepath);
+    return FAILED_BINARY_FILE_READ;
+  }
+
+  mat_fn_status status = read_rgb888_rows("read_rgb888_file", mat, file_ptr, dither);
+  fclose(file_ptr);
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 2);
+  return status;
+}
+
+/**
+ * Read the next unsigned decimal field of a PPM header, skipping whitespace
+ * and comments before it.
+ */
+static bool read_ppm_field(FILE *file_ptr, uint32_t *value)
+{
+  int c = getc(file_ptr);
+  for (;;)
+  {
+    if (c == '#')
+    {
+      while (c != '\n' && c != EOF)
+        c = getc(file_ptr);
+    }
+    else if (c != EOF && isspace(c))
+      c = getc(file_ptr);
+    else
+      break;
+  }
+
+  if (c == EOF || !isdigit(c))
+    return false;
+
+  uint32_t result = 0;
+  while (c != EOF && isdigit(c))
+  {
+    if (result > 100000)
+      return false;
+    result = result * 10 + (uint32_t)(c - '0');
+    c = getc(file_ptr);
+  }
+
+  // A single whitespace byte ends the field; after the maximum value it is
+  // the last byte before the pixels.
+  if (c == EOF || !isspace(c))
+    return false;
+
+  *value = result;
+  return true;
+}
+
+matrix *read_ppm_file(const char *filepath, rgb565_dither dither)
+{
+  if (filepath == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "read_ppm_file: filepath is NULL.");
+    return NULL;
+  }
+
+  FILE *file_ptr = fopen(filepath, "rb");
+  if (file_ptr == NULL)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_ppm_file: unable to open %s for reading.", filepath);
+    return NULL;
+  }
+
+  matrix *mat = NULL;
+  uint32_t width, height, max_value;
+  if (getc(file_ptr) != 'P' || getc(file_ptr) != '6' ||
+      !read_ppm_field(file_ptr, &width) || !read_ppm_field(file_ptr, &height) ||
+      !read_ppm_field(file_ptr, &max_value))
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_ppm_file: %s is not a binary PPM (P6) file.", filepath);
+    goto cleanup;
+  }
+
+  if (max_value != 255)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_ppm_file: only 8-bit PPM files (maximum value 255) are "
+                     "supported.");
+    goto cleanup;
+  }
+
+  if (width == 0 || height == 0 || width > UINT16_MAX || height > UINT16_MAX)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_ppm_file: unsupported dimensions %ux%u.", width, height);
+    goto cleanup;
+  }
+
+  mat = allocate_matrix((uint16_t)width, (uint16_t)height);
+  if (mat == NULL)
+    goto cleanup;
+
+  if (read_rgb888_rows("read_ppm_file", mat, file_ptr, dither) != VALID_OP)
+  {
+    deallocate_matrix(mat);
+    mat = NULL;
+  }
+
+cleanup:
+  fclose(file_ptr);
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 2);
+  return mat;
+}
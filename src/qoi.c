@@ -0,0 +1,441 @@
+#include "qoi.h"
+#include "errors.h"
+#include "instrument.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+#define QOI_MASK_2 0xC0
+
+#define QOI_MAX_RUN 62
+
+/**
+ * Every pixel of a matrix is opaque, so the alpha term of the QOI hash is the
+ * constant 255 * 11.
+ */
+#define QOI_HASH(r, g, b, a) (((r)*3 + (g)*5 + (b)*7 + (a)*11) & 63)
+
+/**
+ * Slots of the encoder's index table hold RGB565 values. Unused slots hold a
+ * value no 16-bit pixel can match, standing in for the all-zero (transparent)
+ * pixels the format starts the table with.
+ */
+#define QOI_EMPTY_SLOT 0xFFFFFFFFu
+
+static void put_be32(uint8_t *dst, uint32_t value)
+{
+  dst[0] = (uint8_t)(value >> 24);
+  dst[1] = (uint8_t)((value >> 16) & 0xFF);
+  dst[2] = (uint8_t)((value >> 8) & 0xFF);
+  dst[3] = (uint8_t)(value & 0xFF);
+}
+
+static uint32_t get_be32(const uint8_t *src)
+{
+  return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) |
+         (uint32_t)src[3];
+}
+
+size_t calculate_qoi_max_size(const matrix *mat)
+{
+  if (mat == NULL)
+    return 0;
+
+  // Worst case every pixel is a 4-byte QOI_OP_RGB.
+  return QOI_HEADER_SIZE + (size_t)mat->size * 4 + QOI_END_MARKER_SIZE;
+}
+
+size_t encode_qoi(matrix *mat, uint8_t *dst, size_t capacity)
+{
+  if (mat == NULL || dst == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "encode_qoi: mat or dst passed is NULL.");
+    return 0;
+  }
+
+  if (!matrix_is_row_major(mat))
+  {
+    mat_report_error(INVALID_PARAM, "encode_qoi: tiled matrices are not supported.");
+    return 0;
+  }
+
+  if (capacity < calculate_qoi_max_size(mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "encode_qoi: destination holds %zu bytes, %zu needed.", capacity,
+                     calculate_qoi_max_size(mat));
+    return 0;
+  }
+
+  uint8_t *out = dst;
+  memcpy(out, "qoif", 4);
+  put_be32(out + 4, mat->horizontal);
+  put_be32(out + 8, mat->vertical);
+  out[12] = 3;
+  out[13] = 0;
+  out += QOI_HEADER_SIZE;
+
+  uint32_t index[64];
+  for (uint8_t slot = 0; slot < 64; slot++)
+    index[slot] = QOI_EMPTY_SLOT;
+
+  // The previous pixel starts as opaque black, which is RGB565 0x0000. Runs
+  // and index hits are detected on the 16-bit pixels; channels are only
+  // expanded for pixels that actually differ from their predecessor.
+  const uint16_t *src = mat->mem;
+  const uint16_t *end = src + mat->size;
+  uint16_t previous = 0x0000;
+  int32_t prev_r = 0, prev_g = 0, prev_b = 0;
+  uint32_t run = 0;
+
+  for (; src < end; src++)
+  {
+    uint16_t pixel = *src;
+
+    if (pixel == previous)
+    {
+      run++;
+      if (run == QOI_MAX_RUN)
+      {
+        *out++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+        run = 0;
+      }
+      continue;
+    }
+
+    if (run > 0)
+    {
+      *out++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+      run = 0;
+    }
+
+    int32_t r = (pixel >> 11) & 0x1F;
+    int32_t g = (pixel >> 5) & 0x3F;
+    int32_t b = pixel & 0x1F;
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+
+    uint32_t slot = QOI_HASH(r, g, b, 255);
+    if (index[slot] == pixel)
+    {
+      *out++ = (uint8_t)(QOI_OP_INDEX | slot);
+    }
+    else
+    {
+      index[slot] = pixel;
+
+      int8_t dr = (int8_t)(r - prev_r);
+      int8_t dg = (int8_t)(g - prev_g);
+      int8_t db = (int8_t)(b - prev_b);
+      int8_t dr_dg = (int8_t)(dr - dg);
+      int8_t db_dg = (int8_t)(db - dg);
+
+      if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+      {
+        *out++ = (uint8_t)(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+      }
+      else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 &&
+               db_dg < 8)
+      {
+        *out++ = (uint8_t)(QOI_OP_LUMA | (dg + 32));
+        *out++ = (uint8_t)((dr_dg + 8) << 4 | (db_dg + 8));
+      }
+      else
+      {
+        out[0] = QOI_OP_RGB;
+        out[1] = (uint8_t)r;
+        out[2] = (uint8_t)g;
+        out[3] = (uint8_t)b;
+        out += 4;
+      }
+    }
+
+    previous = pixel;
+    prev_r = r;
+    prev_g = g;
+    prev_b = b;
+  }
+
+  if (run > 0)
+    *out++ = (uint8_t)(QOI_OP_RUN | (run - 1));
+
+  memset(out, 0, QOI_END_MARKER_SIZE - 1);
+  out[QOI_END_MARKER_SIZE - 1] = 0x01;
+  out += QOI_END_MARKER_SIZE;
+
+  return (size_t)(out - dst);
+}
+
+matrix *decode_qoi(const uint8_t *data, size_t length)
+{
+  if (data == NULL || length < QOI_HEADER_SIZE + QOI_END_MARKER_SIZE ||
+      memcmp(data, "qoif", 4) != 0)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ, "decode_qoi: data is not a QOI image.");
+    return NULL;
+  }
+
+  uint32_t width = get_be32(data + 4);
+  uint32_t height = get_be32(data + 8);
+  uint8_t channels = data[12];
+  if (width == 0 || height == 0 || width > UINT16_MAX || height > UINT16_MAX ||
+      (channels != 3 && channels != 4))
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "decode_qoi: unsupported QOI image %ux%u with %u channels.", width,
+                     height, channels);
+    return NULL;
+  }
+
+  matrix *mat = allocate_matrix((uint16_t)width, (uint16_t)height);
+  if (mat == NULL)
+    return NULL;
+
+  uint8_t r = 0, g = 0, b = 0, a = 255;
+  uint8_t index[64][4] = {{0}};
+  uint16_t pixel = 0x0000;
+  uint32_t run = 0;
+  bool truncated = false;
+
+  const uint8_t *in = data + QOI_HEADER_SIZE;
+  const uint8_t *chunks_end = data + length - QOI_END_MARKER_SIZE;
+
+  for (uint32_t position = 0; position < mat->size; position++)
+  {
+    if (run > 0)
+    {
+      run--;
+    }
+    else if (in >= chunks_end)
+    {
+      truncated = true;
+      break;
+    }
+    else
+    {
+      uint8_t op = *in++;
+
+      if (op == QOI_OP_RGB)
+      {
+        if (chunks_end - in < 3)
+        {
+          truncated = true;
+          break;
+        }
+        r = in[0];
+        g = in[1];
+        b = in[2];
+        in += 3;
+      }
+      else if (op == QOI_OP_RGBA)
+      {
+        if (chunks_end - in < 4)
+        {
+          truncated = true;
+          break;
+        }
+        r = in[0];
+        g = in[1];
+        b = in[2];
+        a = in[3];
+        in += 4;
+      }
+      else if ((op & QOI_MASK_2) == QOI_OP_INDEX)
+      {
+        r = index[op][0];
+        g = index[op][1];
+        b = index[op][2];
+        a = index[op][3];
+      }
+      else if ((op & QOI_MASK_2) == QOI_OP_DIFF)
+      {
+        r += ((op >> 4) & 0x03) - 2;
+        g += ((op >> 2) & 0x03) - 2;
+        b += (op & 0x03) - 2;
+      }
+      else if ((op & QOI_MASK_2) == QOI_OP_LUMA)
+      {
+        if (in >= chunks_end)
+        {
+          truncated = true;
+          break;
+        }
+        uint8_t second = *in++;
+        int32_t dg = (op & 0x3F) - 32;
+        r += dg - 8 + ((second >> 4) & 0x0F);
+        g += dg;
+        b += dg - 8 + (second & 0x0F);
+      }
+      else
+      {
+        run = op & 0x3F;
+      }
+
+      uint8_t *slot = index[QOI_HASH(r, g, b, a)];
+      slot[0] = r;
+      slot[1] = g;
+      slot[2] = b;
+      slot[3] = a;
+
+      pixel = (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+    }
+
+    mat->mem[position] = pixel;
+  }
+
+  // The chunks must cover every pixel and be followed directly by the end marker;
+  // anything else is a cut or corrupted stream.
+  static const uint8_t end_marker[QOI_END_MARKER_SIZE] = {0, 0, 0, 0, 0, 0, 0, 1};
+  if (truncated || memcmp(in, end_marker, QOI_END_MARKER_SIZE) != 0)
+  {
+    deallocate_matrix(mat);
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "decode_qoi: chunk stream ends before the %ux%u image does or "
+                     "lacks its end marker.",
+                     width, height);
+    return NULL;
+  }
+
+  return mat;
+}
+
+uint8_t write_qoi_file(const char *filepath, matrix *mat)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT,
+                     "Unable to write QOI file, passed in mat parameter is NULL.");
+    return 1;
+  }
+
+  size_t capacity = calculate_qoi_max_size(mat);
+  uint8_t *buffer = (uint8_t *)malloc(capacity);
+  if (buffer == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION, "Unable to allocate QOI encode buffer.");
+    return 5;
+  }
+
+  uint8_t ret = 0;
+  INSTRUMENT_TIMER(frame_start);
+  INSTRUMENT_TIMER(start);
+  size_t length = encode_qoi(mat, buffer, capacity);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_ENCODE, start);
+
+  int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to open %s for binary writing.",
+                     filepath);
+    ret = 4;
+    goto cleanup;
+  }
+
+  const uint8_t *data = buffer;
+  while (length > 0)
+  {
+    ssize_t written = write(fd, data, length);
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0)
+    {
+      mat_report_error(FAILED_BMP_FILE_WRITE, "Unable to write QOI data to %s.",
+                       filepath);
+      ret = 6;
+      break;
+    }
+    INSTRUMENT_COUNT(INSTRUMENT_BYTES_WRITTEN, written);
+    data += written;
+    length -= (size_t)written;
+  }
+
+  if (close(fd) != 0 && ret == 0)
+    ret = 6;
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 2);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_WRITE, start);
+  if (ret == 0)
+    INSTRUMENT_COUNT(INSTRUMENT_FRAMES_PROCESSED, 1);
+  INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_WRITE, frame_start);
+
+cleanup:
+  free(buffer);
+
+  return ret;
+}
+
+matrix *read_qoi_file(const char *filepath)
+{
+  INSTRUMENT_TIMER(frame_start);
+  INSTRUMENT_TIMER(start);
+  int fd = open(filepath, O_RDONLY);
+  if (fd < 0)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_qoi_file: unable to open %s for reading.", filepath);
+    return NULL;
+  }
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 3);
+
+  matrix *mat = NULL;
+  struct stat file_stat;
+  uint8_t *buffer = NULL;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "read_qoi_file: unable to determine the size of %s.", filepath);
+    goto cleanup;
+  }
+
+  size_t length = (size_t)file_stat.st_size;
+  buffer = (uint8_t *)malloc(length);
+  if (buffer == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "read_qoi_file: unable to allocate read buffer.");
+    goto cleanup;
+  }
+
+  size_t total = 0;
+  while (total < length)
+  {
+    ssize_t got = read(fd, buffer + total, length - total);
+    INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 1);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+    {
+      mat_report_error(FAILED_BINARY_FILE_READ, "read_qoi_file: failed to read %s.",
+                       filepath);
+      goto cleanup;
+    }
+    total += (size_t)got;
+  }
+  INSTRUMENT_COUNT(INSTRUMENT_BYTES_READ, length);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_READ, start);
+
+  mat = decode_qoi(buffer, length);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_CONVERT, start);
+  if (mat != NULL)
+    INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_READ, frame_start);
+
+cleanup:
+  free(buffer);
+  close(fd);
+
+  return mat;
+}
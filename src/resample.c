@@ -0,0 +1,566 @@
+#include "resample.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convert.h"
+#include "errors.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESAMPLE_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define RESAMPLE_TARGET_AVX2 __attribute__((target("avx2")))
+#define RESAMPLE_TARGET_SSE2 __attribute__((target("sse2")))
+
+/**
+ * Bilinear weights use 8 fractional bits.
+ */
+#define BILINEAR_SHIFT 8
+#define BILINEAR_ONE (1 << BILINEAR_SHIFT)
+
+static inline uint16_t pack_channels(uint32_t red, uint32_t green, uint32_t blue)
+{
+  return (uint16_t)((red << 11) | (green << 5) | blue);
+}
+
+/*
+ * 2x box filter. Every output pixel averages a 2x2 block taken from two
+ * consecutive source rows.
+ */
+
+static void box2_row_scalar(const uint16_t *top, const uint16_t *bottom, uint16_t *dst,
+                            size_t count)
+{
+  for (size_t index = 0; index < count; index++)
+  {
+    uint16_t p0 = top[2 * index], p1 = top[2 * index + 1];
+    uint16_t p2 = bottom[2 * index], p3 = bottom[2 * index + 1];
+
+    uint32_t red = (p0 >> 11) + (p1 >> 11) + (p2 >> 11) + (p3 >> 11);
+    uint32_t green = ((p0 >> 5) & 0x3F) + ((p1 >> 5) & 0x3F) + ((p2 >> 5) & 0x3F) +
+                     ((p3 >> 5) & 0x3F);
+    uint32_t blue = (p0 & 0x1F) + (p1 & 0x1F) + (p2 & 0x1F) + (p3 & 0x1F);
+
+    dst[index] = pack_channels((red + 2) >> 2, (green + 2) >> 2, (blue + 2) >> 2);
+  }
+}
+
+#ifdef RESAMPLE_HAVE_X86
+
+/**
+ * Sum one channel of two vertically adjacent registers, then add horizontal
+ * neighbours together: 16 source pixels in, 8 block sums out.
+ */
+static inline RESAMPLE_TARGET_SSE2 __m128i box2_channel_sse2(__m128i top0, __m128i top1,
+                                                             __m128i bottom0,
+                                                             __m128i bottom1)
+{
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i low = _mm_madd_epi16(_mm_add_epi16(top0, bottom0), ones);
+  __m128i high = _mm_madd_epi16(_mm_add_epi16(top1, bottom1), ones);
+  return _mm_packs_epi32(low, high);
+}
+
+static RESAMPLE_TARGET_SSE2 void box2_row_sse2(const uint16_t *top,
+                                               const uint16_t *bottom, uint16_t *dst,
+                                               size_t count)
+{
+  const __m128i mask_6 = _mm_set1_epi16(0x3F);
+  const __m128i mask_5 = _mm_set1_epi16(0x1F);
+  const __m128i round = _mm_set1_epi16(2);
+  size_t index = 0;
+
+  for (; index + 8 <= count; index += 8)
+  {
+    __m128i t0 = _mm_loadu_si128((const __m128i *)(top + 2 * index));
+    __m128i t1 = _mm_loadu_si128((const __m128i *)(top + 2 * index + 8));
+    __m128i b0 = _mm_loadu_si128((const __m128i *)(bottom + 2 * index));
+    __m128i b1 = _mm_loadu_si128((const __m128i *)(bottom + 2 * index + 8));
+
+    __m128i red = box2_channel_sse2(_mm_srli_epi16(t0, 11), _mm_srli_epi16(t1, 11),
+                                    _mm_srli_epi16(b0, 11), _mm_srli_epi16(b1, 11));
+    __m128i green = box2_channel_sse2(
+        _mm_and_si128(_mm_srli_epi16(t0, 5), mask_6),
+        _mm_and_si128(_mm_srli_epi16(t1, 5), mask_6),
+        _mm_and_si128(_mm_srli_epi16(b0, 5), mask_6),
+        _mm_and_si128(_mm_srli_epi16(b1, 5), mask_6));
+    __m128i blue =
+        box2_channel_sse2(_mm_and_si128(t0, mask_5), _mm_and_si128(t1, mask_5),
+                          _mm_and_si128(b0, mask_5), _mm_and_si128(b1, mask_5));
+
+    red = _mm_srli_epi16(_mm_add_epi16(red, round), 2);
+    green = _mm_srli_epi16(_mm_add_epi16(green, round), 2);
+    blue = _mm_srli_epi16(_mm_add_epi16(blue, round), 2);
+
+    __m128i pixels = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(red, 11),
+                                               _mm_slli_epi16(green, 5)),
+                                  blue);
+    _mm_storeu_si128((__m128i *)(dst + index), pixels);
+  }
+
+  box2_row_scalar(top + 2 * index, bottom + 2 * index, dst + index, count - index);
+}
+
+static inline RESAMPLE_TARGET_AVX2 __m256i box2_channel_avx2(__m256i top0, __m256i top1,
+                                                             __m256i bottom0,
+                                                             __m256i bottom1)
+{
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i low = _mm256_madd_epi16(_mm256_add_epi16(top0, bottom0), ones);
+  __m256i high = _mm256_madd_epi16(_mm256_add_epi16(top1, bottom1), ones);
+
+  // Packing works per 128-bit lane; restore pixel order afterwards.
+  return _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+}
+
+static RESAMPLE_TARGET_AVX2 void box2_row_avx2(const uint16_t *top,
+                                               const uint16_t *bottom, uint16_t *dst,
+                                               size_t count)
+{
+  const __m256i mask_6 = _mm256_set1_epi16(0x3F);
+  const __m256i mask_5 = _mm256_set1_epi16(0x1F);
+  const __m256i round = _mm256_set1_epi16(2);
+  size_t index = 0;
+
+  for (; index + 16 <= count; index += 16)
+  {
+    __m256i t0 = _mm256_loadu_si256((const __m256i *)(top + 2 * index));
+    __m256i t1 = _mm256_loadu_si256((const __m256i *)(top + 2 * index + 16));
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)(bottom + 2 * index));
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(bottom + 2 * index + 16));
+
+    __m256i red =
+        box2_channel_avx2(_mm256_srli_epi16(t0, 11), _mm256_srli_epi16(t1, 11),
+                          _mm256_srli_epi16(b0, 11), _mm256_srli_epi16(b1, 11));
+    __m256i green = box2_channel_avx2(
+        _mm256_and_si256(_mm256_srli_epi16(t0, 5), mask_6),
+        _mm256_and_si256(_mm256_srli_epi16(t1, 5), mask_6),
+        _mm256_and_si256(_mm256_srli_epi16(b0, 5), mask_6),
+        _mm256_and_si256(_mm256_srli_epi16(b1, 5), mask_6));
+    __m256i blue = box2_channel_avx2(
+        _mm256_and_si256(t0, mask_5), _mm256_and_si256(t1, mask_5),
+        _mm256_and_si256(b0, mask_5), _mm256_and_si256(b1, mask_5));
+
+    red = _mm256_srli_epi16(_mm256_add_epi16(red, round), 2);
+    green = _mm256_srli_epi16(_mm256_add_epi16(green, round), 2);
+    blue = _mm256_srli_epi16(_mm256_add_epi16(blue, round), 2);
+
+    __m256i pixels = _mm256_or_si256(
+        _mm256_or_si256(_mm256_slli_epi16(red, 11), _mm256_slli_epi16(green, 5)), blue);
+    _mm256_storeu_si256((__m256i *)(dst + index), pixels);
+  }
+
+  box2_row_sse2(top + 2 * index, bottom + 2 * index, dst + index, count - index);
+}
+
+#endif
+
+typedef void (*box2_row_fn)(const uint16_t *top, const uint16_t *bottom, uint16_t *dst,
+                            size_t count);
+
+/**
+ * Pick the 2x kernel matching the level selected for the conversion kernels.
+ */
+static box2_row_fn select_box2_row(void)
+{
+  switch (get_convert_kernel_level())
+  {
+#ifdef RESAMPLE_HAVE_X86
+  case CONVERT_KERNEL_AVX2:
+    return box2_row_avx2;
+  case CONVERT_KERNEL_SSE2:
+    return box2_row_sse2;
+#endif
+  default:
+    return box2_row_scalar;
+  }
+}
+
+/*
+ * Channel planes. The bilinear path splits rows into separate 16-bit red,
+ * green and blue planes, which are then blended with plain vector multiplies
+ * and adds.
+ */
+
+typedef struct channel_planes
+{
+  uint16_t *red;
+  uint16_t *green;
+  uint16_t *blue;
+} channel_planes;
+
+static bool allocate_planes(channel_planes *planes, size_t count)
+{
+  planes->red = (uint16_t *)malloc(3 * count * sizeof(uint16_t));
+  planes->green = planes->red ? planes->red + count : NULL;
+  planes->blue = planes->red ? planes->green + count : NULL;
+  return planes->red != NULL;
+}
+
+/**
+ * Add the channels of count pixels of src, multiplied by weight, to the planes.
+ */
+static void accumulate_planes(const uint16_t *src, const channel_planes *planes,
+                              size_t count, uint16_t weight)
+{
+  size_t index = 0;
+
+#ifdef __SSE2__
+  const __m128i mask_6 = _mm_set1_epi16(0x3F);
+  const __m128i mask_5 = _mm_set1_epi16(0x1F);
+  const __m128i factor = _mm_set1_epi16((short)weight);
+
+  for (; index + 8 <= count; index += 8)
+  {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(src + index));
+    __m128i red = _mm_mullo_epi16(_mm_srli_epi16(pixels, 11), factor);
+    __m128i green = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(pixels, 5), mask_6),
+                                    factor);
+    __m128i blue = _mm_mullo_epi16(_mm_and_si128(pixels, mask_5), factor);
+
+    __m128i *red_plane = (__m128i *)(planes->red + index);
+    __m128i *green_plane = (__m128i *)(planes->green + index);
+    __m128i *blue_plane = (__m128i *)(planes->blue + index);
+    _mm_storeu_si128(red_plane, _mm_add_epi16(_mm_loadu_si128(red_plane), red));
+    _mm_storeu_si128(green_plane, _mm_add_epi16(_mm_loadu_si128(green_plane), green));
+    _mm_storeu_si128(blue_plane, _mm_add_epi16(_mm_loadu_si128(blue_plane), blue));
+  }
+#endif
+
+  for (; index < count; index++)
+  {
+    uint16_t pixel = src[index];
+    planes->red[index] += (uint16_t)((pixel >> 11) * weight);
+    planes->green[index] += (uint16_t)(((pixel >> 5) & 0x3F) * weight);
+    planes->blue[index] += (uint16_t)((pixel & 0x1F) * weight);
+  }
+}
+
+static void clear_planes(const channel_planes *planes, size_t count)
+{
+  memset(planes->red, 0, 3 * count * sizeof(uint16_t));
+}
+
+/**
+ * 4x and 8x box filter of one destination row. rows holds the factor source
+ * rows covered by it.
+ */
+static void box_block_row(const uint16_t *const *rows, uint8_t factor, uint16_t *dst,
+                          size_t count)
+{
+  // Sums of 16 or 64 channel values are divided by shifting.
+  uint32_t shift = (factor == 4) ? 4 : 6;
+  uint32_t round = 1u << (shift - 1);
+  size_t col = 0;
+
+#ifdef __SSE2__
+  // Eight source columns at a time: add the block rows together per channel,
+  // then fold neighbouring columns until each 32-bit lane 0 (and lane 2 for
+  // 4x) holds the sum of a whole block.
+  const __m128i mask_6 = _mm_set1_epi16(0x3F);
+  const __m128i mask_5 = _mm_set1_epi16(0x1F);
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i rounding = _mm_set1_epi32((int)round);
+  size_t per_chunk = 8 / factor;
+
+  for (; col + per_chunk <= count; col += per_chunk)
+  {
+    __m128i red = _mm_setzero_si128();
+    __m128i green = _mm_setzero_si128();
+    __m128i blue = _mm_setzero_si128();
+    for (uint8_t row = 0; row < factor; row++)
+    {
+      __m128i pixels = _mm_loadu_si128((const __m128i *)(rows[row] + col * factor));
+      red = _mm_add_epi16(red, _mm_srli_epi16(pixels, 11));
+      green = _mm_add_epi16(green, _mm_and_si128(_mm_srli_epi16(pixels, 5), mask_6));
+      blue = _mm_add_epi16(blue, _mm_and_si128(pixels, mask_5));
+    }
+
+    red = _mm_madd_epi16(red, ones);
+    green = _mm_madd_epi16(green, ones);
+    blue = _mm_madd_epi16(blue, ones);
+    red = _mm_add_epi32(red, _mm_srli_epi64(red, 32));
+    green = _mm_add_epi32(green, _mm_srli_epi64(green, 32));
+    blue = _mm_add_epi32(blue, _mm_srli_epi64(blue, 32));
+    if (factor == 8)
+    {
+      red = _mm_add_epi32(red, _mm_srli_si128(red, 8));
+      green = _mm_add_epi32(green, _mm_srli_si128(green, 8));
+      blue = _mm_add_epi32(blue, _mm_srli_si128(blue, 8));
+    }
+
+    red = _mm_srl_epi32(_mm_add_epi32(red, rounding), _mm_cvtsi32_si128((int)shift));
+    green = _mm_srl_epi32(_mm_add_epi32(green, rounding), _mm_cvtsi32_si128((int)shift));
+    blue = _mm_srl_epi32(_mm_add_epi32(blue, rounding), _mm_cvtsi32_si128((int)shift));
+    __m128i pixels = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(red, 11),
+                                               _mm_slli_epi32(green, 5)),
+                                  blue);
+
+    dst[col] = (uint16_t)_mm_cvtsi128_si32(pixels);
+    if (factor == 4)
+      dst[col + 1] = (uint16_t)_mm_cvtsi128_si32(_mm_srli_si128(pixels, 8));
+  }
+#endif
+
+  for (; col < count; col++)
+  {
+    uint32_t red = 0, green = 0, blue = 0;
+    for (uint8_t row = 0; row < factor; row++)
+    {
+      for (size_t index = col * factor; index < (col + 1) * factor; index++)
+      {
+        uint16_t pixel = rows[row][index];
+        red += pixel >> 11;
+        green += (pixel >> 5) & 0x3F;
+        blue += pixel & 0x1F;
+      }
+    }
+
+    dst[col] = pack_channels((red + round) >> shift, (green + round) >> shift,
+                             (blue + round) >> shift);
+  }
+}
+
+static bool check_box_params(const char *caller, matrix *src, matrix *dst,
+                             uint8_t factor)
+{
+  if (src == NULL || dst == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "%s: src or dst passed is NULL.", caller);
+    return false;
+  }
+
+  if (factor != 2 && factor != 4 && factor != 8)
+  {
+    mat_report_error(INVALID_PARAM, "%s: factor must be 2, 4 or 8.", caller);
+    return false;
+  }
+
+  if (!matrix_is_row_major(src) || !matrix_is_row_major(dst))
+  {
+    mat_report_error(INVALID_PARAM, "%s: tiled matrices are not supported.", caller);
+    return false;
+  }
+
+  if (dst->horizontal != src->horizontal / factor ||
+      dst->vertical != src->vertical / factor || dst->horizontal == 0 ||
+      dst->vertical == 0)
+  {
+    mat_report_error(INVALID_PARAM, "%s: dst must be %ux%u.", caller,
+                     src->horizontal / factor, src->vertical / factor);
+    return false;
+  }
+
+  return true;
+}
+
+mat_fn_status downscale_box_rows(matrix *src, matrix *dst, uint8_t factor,
+                                 uint16_t first_row, uint16_t last_row)
+{
+  if (!check_box_params("downscale_box_rows", src, dst, factor))
+    return INVALID_PARAM;
+
+  if (last_row >= dst->vertical)
+    last_row = dst->vertical - 1;
+  if (first_row > last_row)
+    return VALID_OP;
+
+  size_t out_count = dst->horizontal;
+
+  if (factor == 2)
+  {
+    box2_row_fn box2_row = select_box2_row();
+    for (uint32_t row = first_row; row <= last_row; row++)
+    {
+      box2_row(src->mem + calculate_offset(src, (uint16_t)(2 * row), 0),
+               src->mem + calculate_offset(src, (uint16_t)(2 * row + 1), 0),
+               dst->mem + calculate_offset(dst, (uint16_t)row, 0), out_count);
+    }
+
+    mark_dirty_rows(dst, first_row, last_row);
+    return VALID_OP;
+  }
+
+  const uint16_t *block_rows[8];
+  for (uint32_t row = first_row; row <= last_row; row++)
+  {
+    for (uint32_t block_row = 0; block_row < factor; block_row++)
+      block_rows[block_row] =
+          src->mem + calculate_offset(src, (uint16_t)(row * factor + block_row), 0);
+
+    box_block_row(block_rows, factor, dst->mem + calculate_offset(dst, (uint16_t)row, 0),
+                  out_count);
+  }
+
+  mark_dirty_rows(dst, first_row, last_row);
+  return VALID_OP;
+}
+
+mat_fn_status downscale_box(matrix *src, matrix *dst, uint8_t factor)
+{
+  if (dst == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "downscale_box: dst passed is NULL.");
+    return INVALID_PARAM;
+  }
+
+  return downscale_box_rows(src, dst, factor, 0, dst->vertical ? dst->vertical - 1 : 0);
+}
+
+matrix *create_thumbnail(matrix *src, uint8_t factor)
+{
+  if (src == NULL || (factor != 2 && factor != 4 && factor != 8))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "create_thumbnail: src is NULL or factor is not 2, 4 or 8.");
+    return NULL;
+  }
+
+  if (src->horizontal < factor || src->vertical < factor)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "create_thumbnail: matrix is smaller than the reduction factor.");
+    return NULL;
+  }
+
+  matrix *thumbnail = allocate_matrix(src->horizontal / factor, src->vertical / factor);
+  if (thumbnail == NULL)
+    return NULL;
+
+  if (downscale_box(src, thumbnail, factor) != VALID_OP)
+  {
+    deallocate_matrix(thumbnail);
+    return NULL;
+  }
+
+  return thumbnail;
+}
+
+/**
+ * Map destination coordinate position onto the source axis with aligned
+ * pixel centers: the lower source sample, the upper one and the weight of the
+ * upper one.
+ */
+static void bilinear_tap(uint32_t position, uint32_t src_length, uint32_t dst_length,
+                         uint16_t *lower, uint16_t *upper, uint16_t *weight)
+{
+  // Source coordinate (position + 0.5) * src_length / dst_length - 0.5, with
+  // BILINEAR_SHIFT fractional bits.
+  int64_t numerator = ((int64_t)2 * position + 1) * src_length - dst_length;
+  int64_t scaled = numerator * BILINEAR_ONE / (2 * (int64_t)dst_length);
+  if (scaled < 0)
+    scaled = 0;
+
+  int64_t base = scaled >> BILINEAR_SHIFT;
+  if (base >= (int64_t)src_length - 1)
+  {
+    *lower = *upper = (uint16_t)(src_length - 1);
+    *weight = 0;
+    return;
+  }
+
+  *lower = (uint16_t)base;
+  *upper = (uint16_t)(base + 1);
+  *weight = (uint16_t)(scaled & (BILINEAR_ONE - 1));
+}
+
+mat_fn_status resize_bilinear_rows(matrix *src, matrix *dst, uint16_t first_row,
+                                   uint16_t last_row)
+{
+  if (src == NULL || dst == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "resize_bilinear_rows: src or dst passed is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (src->size == 0 || dst->size == 0)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "resize_bilinear_rows: src and dst must not be empty.");
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(src) || !matrix_is_row_major(dst))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "resize_bilinear_rows: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  if (last_row >= dst->vertical)
+    last_row = dst->vertical - 1;
+  if (first_row > last_row)
+    return VALID_OP;
+
+  // Column taps are shared by every row: lower column, upper column, weight.
+  uint16_t *taps = (uint16_t *)malloc((size_t)dst->horizontal * 3 * sizeof(uint16_t));
+  channel_planes planes;
+  if (taps == NULL || !allocate_planes(&planes, src->horizontal))
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "resize_bilinear_rows: unable to allocate interpolation buffers.");
+    free(taps);
+    return FAILED_MAT_ALLOCATION;
+  }
+
+  for (uint32_t col = 0; col < dst->horizontal; col++)
+    bilinear_tap(col, src->horizontal, dst->horizontal, &taps[3 * col],
+                 &taps[3 * col + 1], &taps[3 * col + 2]);
+
+  for (uint32_t row = first_row; row <= last_row; row++)
+  {
+    uint16_t top, bottom, weight;
+    bilinear_tap(row, src->vertical, dst->vertical, &top, &bottom, &weight);
+
+    // Blend the two source rows into the channel planes with vector
+    // multiplies. 63 * 256 still fits 16 bits.
+    clear_planes(&planes, src->horizontal);
+    accumulate_planes(src->mem + calculate_offset(src, top, 0), &planes,
+                      src->horizontal, (uint16_t)(BILINEAR_ONE - weight));
+    if (weight != 0)
+      accumulate_planes(src->mem + calculate_offset(src, bottom, 0), &planes,
+                        src->horizontal, weight);
+
+    uint16_t *dst_row = dst->mem + calculate_offset(dst, (uint16_t)row, 0);
+    for (uint32_t col = 0; col < dst->horizontal; col++)
+    {
+      uint32_t left = taps[3 * col];
+      uint32_t right = taps[3 * col + 1];
+      uint32_t right_weight = taps[3 * col + 2];
+      uint32_t left_weight = BILINEAR_ONE - right_weight;
+      const uint32_t round = 1u << (2 * BILINEAR_SHIFT - 1);
+
+      uint32_t red = (planes.red[left] * left_weight + planes.red[right] * right_weight +
+                      round) >> (2 * BILINEAR_SHIFT);
+      uint32_t green = (planes.green[left] * left_weight +
+                        planes.green[right] * right_weight + round) >>
+                       (2 * BILINEAR_SHIFT);
+      uint32_t blue = (planes.blue[left] * left_weight +
+                       planes.blue[right] * right_weight + round) >>
+                      (2 * BILINEAR_SHIFT);
+
+      dst_row[col] = pack_channels(red, green, blue);
+    }
+  }
+
+  free(planes.red);
+  free(taps);
+  mark_dirty_rows(dst, first_row, last_row);
+  return VALID_OP;
+}
+
+mat_fn_status resize_bilinear(matrix *src, matrix *dst)
+{
+  if (dst == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "resize_bilinear: dst passed is NULL.");
+    return INVALID_PARAM;
+  }
+
+  return resize_bilinear_rows(src, dst, 0, dst->vertical ? dst->vertical - 1 : 0);
+}
@@ -0,0 +1,298 @@
+#include "shapes.h"
+#include "errors.h"
+#include "instrument.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * A polygon edge, oriented top to bottom. The intersection of the edge with
+ * the center line of the current row is kept as the exact mixed number
+ * x_whole + x_fraction / denominator, 0 <= x_fraction < denominator, so pixel
+ * centers lying on an edge are classified the same way on every row. Moving
+ * down a row adds step_whole + step_fraction / denominator.
+ */
+typedef struct polygon_edge
+{
+  int32_t first_row;
+  int32_t last_row;
+  int32_t top_x;
+  int64_t run;
+  int64_t x_whole;
+  int64_t x_fraction;
+  int64_t step_whole;
+  int64_t step_fraction;
+  int64_t denominator;
+  int32_t column;
+} polygon_edge;
+
+mat_fn_status fill_rectangle(matrix *mat, uint16_t color, int32_t start_x,
+                             int32_t start_y, int32_t end_x, int32_t end_y)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT, "fill_rectangle: mat passed is NULL.");
+    return NULL_MAT;
+  }
+
+  if (start_x > end_x)
+  {
+    int32_t swap = start_x;
+    start_x = end_x;
+    end_x = swap;
+  }
+
+  if (start_y > end_y)
+  {
+    int32_t swap = start_y;
+    start_y = end_y;
+    end_y = swap;
+  }
+
+  INSTRUMENT_TIMER(start);
+  fill_clipped_rect(mat, color, start_y, end_y, start_x, end_x);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_DRAW, start);
+  return VALID_OP;
+}
+
+mat_fn_status fill_ellipse(matrix *mat, uint16_t color, int32_t center_x,
+                           int32_t center_y, uint16_t radius_x, uint16_t radius_y)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT, "fill_ellipse: mat passed is NULL.");
+    return NULL_MAT;
+  }
+
+  // A pixel at offset (dx, dy) is inside when
+  // dx^2 * ry^2 <= rx^2 * ry^2 - dy^2 * rx^2. Every term is at most 65535^4,
+  // which fits in 64 unsigned bits, and the right hand side cannot go negative
+  // as dy <= ry. Walking dy outwards from the center, the half width of the
+  // row only ever shrinks.
+  INSTRUMENT_TIMER(start);
+  uint64_t rx2 = (uint64_t)radius_x * radius_x;
+  uint64_t ry2 = (uint64_t)radius_y * radius_y;
+  uint64_t limit = rx2 * ry2;
+  int32_t half_width = radius_x;
+
+  for (int32_t dy = 0; dy <= radius_y; dy++)
+  {
+    uint64_t row_limit = limit - (uint64_t)dy * (uint64_t)dy * rx2;
+    while (half_width > 0 &&
+           (uint64_t)half_width * (uint64_t)half_width * ry2 > row_limit)
+      half_width--;
+
+    fill_clipped_span(mat, color, center_y + dy, center_x - half_width,
+                      center_x + half_width);
+    if (dy != 0)
+      fill_clipped_span(mat, color, center_y - dy, center_x - half_width,
+                        center_x + half_width);
+  }
+
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_DRAW, start);
+  return VALID_OP;
+}
+
+mat_fn_status fill_circle(matrix *mat, uint16_t color, int32_t center_x,
+                          int32_t center_y, uint16_t radius)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT, "fill_circle: mat passed is NULL.");
+    return NULL_MAT;
+  }
+
+  return fill_ellipse(mat, color, center_x, center_y, radius, radius);
+}
+
+static int compare_edges_by_first_row(const void *lhs, const void *rhs)
+{
+  const polygon_edge *a = (const polygon_edge *)lhs;
+  const polygon_edge *b = (const polygon_edge *)rhs;
+  return (a->first_row > b->first_row) - (a->first_row < b->first_row);
+}
+
+static inline int64_t floor_div(int64_t value, int64_t divisor)
+{
+  int64_t quotient = value / divisor;
+  return (value % divisor != 0 && value < 0) ? quotient - 1 : quotient;
+}
+
+__extension__ typedef __int128 wide_int;
+
+/**
+ * Place the edge on the center line of row first_row + rows, where it crosses
+ * x = top_x + run * (2 * rows + 1) / denominator. With vertices anywhere in the
+ * int32 range the product takes up to 98 bits, so it is formed once in 128-bit
+ * arithmetic; the quotient is no larger than run.
+ */
+static void seek_edge(polygon_edge *edge, int64_t rows)
+{
+  wide_int offset = (wide_int)edge->run * (2 * rows + 1);
+  wide_int whole = offset / edge->denominator;
+  wide_int fraction = offset % edge->denominator;
+  if (fraction < 0)
+  {
+    fraction += edge->denominator;
+    whole--;
+  }
+
+  edge->x_whole = edge->top_x + (int64_t)whole;
+  edge->x_fraction = (int64_t)fraction;
+}
+
+static inline void advance_edge(polygon_edge *edge)
+{
+  edge->x_whole += edge->step_whole;
+  edge->x_fraction += edge->step_fraction;
+  if (edge->x_fraction >= edge->denominator)
+  {
+    edge->x_fraction -= edge->denominator;
+    edge->x_whole++;
+  }
+}
+
+/**
+ * First pixel column whose center lies at or after the edge's intersection x,
+ * i.e. ceil(x - 0.5).
+ */
+static inline int32_t first_covered_column(const polygon_edge *edge)
+{
+  return (int32_t)(edge->x_whole + (2 * edge->x_fraction > edge->denominator));
+}
+
+mat_fn_status fill_polygon(matrix *mat, uint16_t color, const matrix_point *points,
+                           size_t count)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(NULL_MAT, "fill_polygon: mat passed is NULL.");
+    return NULL_MAT;
+  }
+
+  if (points == NULL || count < 3)
+  {
+    mat_report_error(INVALID_PARAM, "fill_polygon: a polygon needs at least 3 points.");
+    return INVALID_PARAM;
+  }
+
+  INSTRUMENT_TIMER(start);
+
+  // One allocation holds both the edge table and the active edge list.
+  polygon_edge *edges = (polygon_edge *)malloc(
+      count * (sizeof(polygon_edge) + sizeof(polygon_edge *)));
+  if (edges == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "fill_polygon: unable to allocate edge table.");
+    return FAILED_MAT_ALLOCATION;
+  }
+  polygon_edge **active = (polygon_edge **)(edges + count);
+
+  // Build the edge table. Horizontal edges never cross a row center and are
+  // dropped. An edge covers the rows whose center lies in [top, bottom).
+  size_t edge_count = 0;
+  int32_t last_row = INT32_MIN;
+  for (size_t index = 0; index < count; index++)
+  {
+    matrix_point top = points[index];
+    matrix_point bottom = points[(index + 1) % count];
+    if (top.y == bottom.y)
+      continue;
+    if (top.y > bottom.y)
+    {
+      matrix_point swap = top;
+      top = bottom;
+      bottom = swap;
+    }
+
+    int64_t run = (int64_t)bottom.x - top.x;
+    int64_t rise = (int64_t)bottom.y - top.y;
+
+    // At row top.y + k the center line crosses the edge at
+    // x = top.x + run * (2k + 1) / (2 * rise), see seek_edge.
+    polygon_edge *edge = &edges[edge_count++];
+    edge->first_row = top.y;
+    edge->last_row = bottom.y - 1;
+    edge->top_x = top.x;
+    edge->run = run;
+    edge->denominator = 2 * rise;
+    edge->step_whole = floor_div(2 * run, edge->denominator);
+    edge->step_fraction = 2 * run - edge->step_whole * edge->denominator;
+
+    if (edge->last_row > last_row)
+      last_row = edge->last_row;
+  }
+
+  if (edge_count == 0)
+  {
+    free(edges);
+    return VALID_OP;
+  }
+
+  qsort(edges, edge_count, sizeof(polygon_edge), compare_edges_by_first_row);
+
+  int32_t row = edges[0].first_row;
+  if (row < 0)
+    row = 0;
+  if (last_row >= mat->vertical)
+    last_row = mat->vertical - 1;
+
+  size_t next_edge = 0;
+  size_t active_count = 0;
+
+  for (; row <= last_row; row++)
+  {
+    // Activate edges starting on or above this row. Edges that started above
+    // the first visible row are advanced to it.
+    while (next_edge < edge_count && edges[next_edge].first_row <= row)
+    {
+      polygon_edge *edge = &edges[next_edge++];
+      seek_edge(edge, (int64_t)row - edge->first_row);
+      active[active_count++] = edge;
+    }
+
+    // Retire finished edges and locate the remaining ones on this row.
+    size_t kept = 0;
+    for (size_t index = 0; index < active_count; index++)
+    {
+      if (active[index]->last_row >= row)
+      {
+        active[index]->column = first_covered_column(active[index]);
+        active[kept++] = active[index];
+      }
+    }
+    active_count = kept;
+
+    // Keep the active edges ordered by column. They are nearly sorted from the
+    // previous row, so insertion sort is close to linear.
+    for (size_t index = 1; index < active_count; index++)
+    {
+      polygon_edge *edge = active[index];
+      size_t position = index;
+      while (position > 0 && active[position - 1]->column > edge->column)
+      {
+        active[position] = active[position - 1];
+        position--;
+      }
+      active[position] = edge;
+    }
+
+    // Empty spans are skipped, which also keeps column - 1 from going below
+    // INT32_MIN.
+    for (size_t index = 0; index + 1 < active_count; index += 2)
+    {
+      if (active[index]->column < active[index + 1]->column)
+        fill_clipped_span(mat, color, row, active[index]->column,
+                          active[index + 1]->column - 1);
+    }
+
+    for (size_t index = 0; index < active_count; index++)
+      advance_edge(active[index]);
+  }
+
+  free(edges);
+  INSTRUMENT_LAP(INSTRUMENT_STAGE_DRAW, start);
+  return VALID_OP;
+}
@@ -0,0 +1,237 @@
+#include "stream.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bitmap.h"
+#include "errors.h"
+#include "instrument.h"
+
+#define STREAM_PATH_LENGTH 4096
+
+/**
+ * State shared between the reader thread and the encoding thread. Frame n
+ * always lives in slots[n % STREAM_RING_SIZE].
+ */
+typedef struct stream_ring
+{
+  matrix *slots[STREAM_RING_SIZE];
+
+  FILE *file_ptr;
+  raw_pixel_format format;
+
+  pthread_mutex_t lock;
+  pthread_cond_t slot_filled;
+  pthread_cond_t slot_released;
+
+  uint64_t produced;
+  uint64_t consumed;
+  bool reader_done;
+  bool aborted;
+  mat_fn_status reader_status;
+
+#ifdef MATRIX_INSTRUMENTATION
+  // When the read of the frame in each slot began, for end to end latency.
+  uint64_t started[STREAM_RING_SIZE];
+#endif
+} stream_ring;
+
+static void *stream_reader(void *arg)
+{
+  stream_ring *ring = (stream_ring *)arg;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&ring->lock);
+    while (ring->produced - ring->consumed == STREAM_RING_SIZE && !ring->aborted)
+      pthread_cond_wait(&ring->slot_released, &ring->lock);
+
+    if (ring->aborted)
+    {
+      pthread_mutex_unlock(&ring->lock);
+      break;
+    }
+
+    matrix *slot = ring->slots[ring->produced % STREAM_RING_SIZE];
+#ifdef MATRIX_INSTRUMENTATION
+    ring->started[ring->produced % STREAM_RING_SIZE] = instrument_now_ns();
+#endif
+    pthread_mutex_unlock(&ring->lock);
+
+    // The slot is owned by this thread until produced is bumped, so the read
+    // itself happens without holding the lock.
+    mat_fn_status status = read_binary_frame_format(slot, ring->file_ptr, ring->format);
+
+    pthread_mutex_lock(&ring->lock);
+    if (status != VALID_OP)
+    {
+      if (ferror(ring->file_ptr))
+      {
+        mat_report_error(FAILED_BINARY_FILE_READ,
+                         "stream_reader: failed to read frame %llu.",
+                         (unsigned long long)ring->produced);
+        ring->reader_status = FAILED_BINARY_FILE_READ;
+      }
+      ring->reader_done = true;
+      pthread_cond_signal(&ring->slot_filled);
+      pthread_mutex_unlock(&ring->lock);
+      break;
+    }
+
+    ring->produced++;
+    pthread_cond_signal(&ring->slot_filled);
+    pthread_mutex_unlock(&ring->lock);
+  }
+
+  return NULL;
+}
+
+mat_fn_status stream_convert_raw_file(const char *raw_path, const char *output_dir,
+                                      uint16_t horizontal, uint16_t vertical,
+                                      stream_stats *stats)
+{
+  return stream_convert_raw_file_format(raw_path, output_dir, horizontal, vertical,
+                                        RAW_FORMAT_RGB565, stats);
+}
+
+mat_fn_status stream_convert_raw_file_format(const char *raw_path, const char *output_dir,
+                                             uint16_t horizontal, uint16_t vertical,
+                                             raw_pixel_format format, stream_stats *stats)
+{
+  if (raw_path == NULL || output_dir == NULL)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "stream_convert_raw_file: raw_path or output_dir is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (horizontal == 0 || vertical == 0)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "stream_convert_raw_file: frame dimensions must be non-zero.");
+    return INVALID_PARAM;
+  }
+
+  stream_ring ring = {0};
+  ring.format = format;
+  ring.reader_status = VALID_OP;
+  mat_fn_status status = VALID_OP;
+  bmp_encoder *encoder = NULL;
+
+  for (uint8_t index = 0; index < STREAM_RING_SIZE; index++)
+  {
+    ring.slots[index] = allocate_matrix(horizontal, vertical);
+    if (ring.slots[index] == NULL)
+    {
+      mat_report_error(FAILED_MAT_ALLOCATION,
+                       "stream_convert_raw_file: unable to allocate frame ring.");
+      status = FAILED_MAT_ALLOCATION;
+      goto cleanup;
+    }
+  }
+
+  // Every frame shares one shape, so headers and the stripe buffer are
+  // prepared once for the whole stream.
+  encoder = create_bmp_encoder(horizontal, vertical, BMP_FORMAT_RGB565, NULL);
+  if (encoder == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "stream_convert_raw_file: unable to create BMP encoder.");
+    status = FAILED_MAT_ALLOCATION;
+    goto cleanup;
+  }
+
+  ring.file_ptr = fopen(raw_path, "rb");
+  if (ring.file_ptr == NULL)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "stream_convert_raw_file: unable to open %s for reading.", raw_path);
+    status = FAILED_BINARY_FILE_READ;
+    goto cleanup;
+  }
+
+  pthread_mutex_init(&ring.lock, NULL);
+  pthread_cond_init(&ring.slot_filled, NULL);
+  pthread_cond_init(&ring.slot_released, NULL);
+
+  double start = instrument_now_seconds();
+
+  pthread_t reader;
+  if (pthread_create(&reader, NULL, stream_reader, &ring) != 0)
+  {
+    mat_report_error(FAILED_BINARY_FILE_READ,
+                     "stream_convert_raw_file: unable to start reader thread.");
+    status = FAILED_BINARY_FILE_READ;
+    goto destroy_sync;
+  }
+
+  char bmp_path[STREAM_PATH_LENGTH];
+  for (;;)
+  {
+    pthread_mutex_lock(&ring.lock);
+    while (ring.consumed == ring.produced && !ring.reader_done)
+      pthread_cond_wait(&ring.slot_filled, &ring.lock);
+
+    if (ring.consumed == ring.produced)
+    {
+      pthread_mutex_unlock(&ring.lock);
+      break;
+    }
+
+    matrix *frame = ring.slots[ring.consumed % STREAM_RING_SIZE];
+    pthread_mutex_unlock(&ring.lock);
+
+    snprintf(bmp_path, sizeof(bmp_path), "%s/frame_%06llu.bmp", output_dir,
+             (unsigned long long)ring.consumed);
+    uint8_t write_status = bmp_encoder_write_file(encoder, bmp_path, frame);
+
+    pthread_mutex_lock(&ring.lock);
+    if (write_status != 0)
+    {
+      mat_report_error(FAILED_BMP_FILE_WRITE,
+                       "stream_convert_raw_file: failed to write %s.", bmp_path);
+      status = FAILED_BMP_FILE_WRITE;
+      ring.aborted = true;
+      pthread_cond_signal(&ring.slot_released);
+      pthread_mutex_unlock(&ring.lock);
+      break;
+    }
+
+    INSTRUMENT_LATENCY(INSTRUMENT_LATENCY_FRAME_TOTAL,
+                       ring.started[ring.consumed % STREAM_RING_SIZE]);
+    ring.consumed++;
+    pthread_cond_signal(&ring.slot_released);
+    pthread_mutex_unlock(&ring.lock);
+  }
+
+  pthread_join(reader, NULL);
+
+  if (status == VALID_OP)
+    status = ring.reader_status;
+
+  if (stats != NULL)
+  {
+    stats->frames = ring.consumed;
+    stats->seconds = instrument_now_seconds() - start;
+  }
+
+destroy_sync:
+  pthread_cond_destroy(&ring.slot_released);
+  pthread_cond_destroy(&ring.slot_filled);
+  pthread_mutex_destroy(&ring.lock);
+  fclose(ring.file_ptr);
+  INSTRUMENT_COUNT(INSTRUMENT_SYSCALLS, 2);
+
+cleanup:
+  destroy_bmp_encoder(encoder);
+  for (uint8_t index = 0; index < STREAM_RING_SIZE; index++)
+  {
+    if (ring.slots[index])
+      deallocate_matrix(ring.slots[index]);
+  }
+
+  return status;
+}
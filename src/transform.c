@@ -0,0 +1,392 @@
+#include "transform.h"
+#include "errors.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Side of the square tiles walked by the transposing transforms, in pixels. A
+ * 64x64 tile of the source plus the matching tile of the destination is 16 KiB,
+ * which stays in L1 while the tile is processed.
+ */
+#define TRANSFORM_TILE 64
+
+/**
+ * Side of the register blocks a tile is made of.
+ */
+#define TRANSFORM_BLOCK 8
+
+static inline uint16_t *row_pointer(matrix *mat, uint16_t row)
+{
+  return mat->mem + calculate_offset(mat, row, 0);
+}
+
+/*
+ * Row reversal, used by the horizontal flip and the 180 degree rotation.
+ */
+
+void reverse_rgb565_row(const uint16_t *src, uint16_t *dst, size_t count)
+{
+  size_t index = 0;
+
+#ifdef __SSE2__
+  for (; index + 8 <= count; index += 8)
+  {
+    __m128i pixels = _mm_loadu_si128((const __m128i *)(src + count - index - 8));
+    pixels = _mm_shufflelo_epi16(pixels, 0x1B);
+    pixels = _mm_shufflehi_epi16(pixels, 0x1B);
+    pixels = _mm_shuffle_epi32(pixels, 0x4E);
+    _mm_storeu_si128((__m128i *)(dst + index), pixels);
+  }
+#endif
+
+  for (; index < count; index++)
+    dst[index] = src[count - 1 - index];
+}
+
+/*
+ * Transposing transforms. The source is cut into 8x8 blocks; each block is
+ * loaded into eight registers, transposed, and stored as eight destination
+ * rows. Which source row feeds which register and which destination row each
+ * register lands in is what distinguishes the two rotations from the transpose.
+ */
+
+#ifdef __SSE2__
+static inline void transpose_block_sse2(const uint16_t *const *src_rows,
+                                        uint16_t *const *dst_rows)
+{
+  __m128i a0 = _mm_loadu_si128((const __m128i *)src_rows[0]);
+  __m128i a1 = _mm_loadu_si128((const __m128i *)src_rows[1]);
+  __m128i a2 = _mm_loadu_si128((const __m128i *)src_rows[2]);
+  __m128i a3 = _mm_loadu_si128((const __m128i *)src_rows[3]);
+  __m128i a4 = _mm_loadu_si128((const __m128i *)src_rows[4]);
+  __m128i a5 = _mm_loadu_si128((const __m128i *)src_rows[5]);
+  __m128i a6 = _mm_loadu_si128((const __m128i *)src_rows[6]);
+  __m128i a7 = _mm_loadu_si128((const __m128i *)src_rows[7]);
+
+  __m128i t0 = _mm_unpacklo_epi16(a0, a1);
+  __m128i t1 = _mm_unpackhi_epi16(a0, a1);
+  __m128i t2 = _mm_unpacklo_epi16(a2, a3);
+  __m128i t3 = _mm_unpackhi_epi16(a2, a3);
+  __m128i t4 = _mm_unpacklo_epi16(a4, a5);
+  __m128i t5 = _mm_unpackhi_epi16(a4, a5);
+  __m128i t6 = _mm_unpacklo_epi16(a6, a7);
+  __m128i t7 = _mm_unpackhi_epi16(a6, a7);
+
+  __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+  __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+  __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+  __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+  __m128i u4 = _mm_unpacklo_epi32(t4, t6);
+  __m128i u5 = _mm_unpackhi_epi32(t4, t6);
+  __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+  __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+  _mm_storeu_si128((__m128i *)dst_rows[0], _mm_unpacklo_epi64(u0, u4));
+  _mm_storeu_si128((__m128i *)dst_rows[1], _mm_unpackhi_epi64(u0, u4));
+  _mm_storeu_si128((__m128i *)dst_rows[2], _mm_unpacklo_epi64(u1, u5));
+  _mm_storeu_si128((__m128i *)dst_rows[3], _mm_unpackhi_epi64(u1, u5));
+  _mm_storeu_si128((__m128i *)dst_rows[4], _mm_unpacklo_epi64(u2, u6));
+  _mm_storeu_si128((__m128i *)dst_rows[5], _mm_unpackhi_epi64(u2, u6));
+  _mm_storeu_si128((__m128i *)dst_rows[6], _mm_unpacklo_epi64(u3, u7));
+  _mm_storeu_si128((__m128i *)dst_rows[7], _mm_unpackhi_epi64(u3, u7));
+}
+#else
+static inline void transpose_block_scalar(const uint16_t *const *src_rows,
+                                          uint16_t *const *dst_rows)
+{
+  for (uint32_t i = 0; i < TRANSFORM_BLOCK; i++)
+    for (uint32_t j = 0; j < TRANSFORM_BLOCK; j++)
+      dst_rows[i][j] = src_rows[j][i];
+}
+#endif
+
+/**
+ * Move the source pixel at (row, col) to its place in dst. Used for the blocks
+ * at the right and bottom edges that are narrower than a register block.
+ */
+static inline void scatter_pixel(matrix *src, matrix *dst, matrix_transform transform,
+                                 uint16_t row, uint16_t col)
+{
+  uint16_t pixel = src->mem[calculate_offset(src, row, col)];
+
+  switch (transform)
+  {
+  case TRANSFORM_ROTATE_90:
+    dst->mem[calculate_offset(dst, col, (uint16_t)(src->vertical - 1 - row))] = pixel;
+    break;
+  case TRANSFORM_ROTATE_270:
+    dst->mem[calculate_offset(dst, (uint16_t)(src->horizontal - 1 - col), row)] = pixel;
+    break;
+  default:
+    dst->mem[calculate_offset(dst, col, row)] = pixel;
+    break;
+  }
+}
+
+static void transform_block(matrix *src, matrix *dst, matrix_transform transform,
+                            uint16_t row, uint16_t col)
+{
+  const uint16_t *src_rows[TRANSFORM_BLOCK];
+  uint16_t *dst_rows[TRANSFORM_BLOCK];
+
+  for (uint32_t i = 0; i < TRANSFORM_BLOCK; i++)
+  {
+    switch (transform)
+    {
+    case TRANSFORM_ROTATE_90:
+      // Feeding the rows bottom first makes the transpose come out rotated.
+      src_rows[i] = src->mem + calculate_offset(src, (uint16_t)(row + 7 - i), col);
+      dst_rows[i] = dst->mem + calculate_offset(dst, (uint16_t)(col + i),
+                                                (uint16_t)(src->vertical - 8 - row));
+      break;
+    case TRANSFORM_ROTATE_270:
+      src_rows[i] = src->mem + calculate_offset(src, (uint16_t)(row + i), col);
+      dst_rows[i] = dst->mem +
+                    calculate_offset(dst, (uint16_t)(src->horizontal - 1 - col - i), row);
+      break;
+    default:
+      src_rows[i] = src->mem + calculate_offset(src, (uint16_t)(row + i), col);
+      dst_rows[i] = dst->mem + calculate_offset(dst, (uint16_t)(col + i), row);
+      break;
+    }
+  }
+
+#ifdef __SSE2__
+  transpose_block_sse2(src_rows, dst_rows);
+#else
+  transpose_block_scalar(src_rows, dst_rows);
+#endif
+}
+
+static void transpose_tiled(matrix *src, matrix *dst, matrix_transform transform)
+{
+  uint32_t height = src->vertical;
+  uint32_t width = src->horizontal;
+
+  for (uint32_t tile_row = 0; tile_row < height; tile_row += TRANSFORM_TILE)
+  {
+    uint32_t tile_bottom = tile_row + TRANSFORM_TILE < height ? tile_row + TRANSFORM_TILE
+                                                              : height;
+
+    for (uint32_t tile_col = 0; tile_col < width; tile_col += TRANSFORM_TILE)
+    {
+      uint32_t tile_right = tile_col + TRANSFORM_TILE < width ? tile_col + TRANSFORM_TILE
+                                                              : width;
+
+      for (uint32_t row = tile_row; row < tile_bottom; row += TRANSFORM_BLOCK)
+      {
+        for (uint32_t col = tile_col; col < tile_right; col += TRANSFORM_BLOCK)
+        {
+          if (row + TRANSFORM_BLOCK <= tile_bottom && col + TRANSFORM_BLOCK <= tile_right)
+          {
+            transform_block(src, dst, transform, (uint16_t)row, (uint16_t)col);
+            continue;
+          }
+
+          for (uint32_t y = row; y < row + TRANSFORM_BLOCK && y < tile_bottom; y++)
+            for (uint32_t x = col; x < col + TRANSFORM_BLOCK && x < tile_right; x++)
+              scatter_pixel(src, dst, transform, (uint16_t)y, (uint16_t)x);
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Public interface.
+ */
+
+bool transform_swaps_dimensions(matrix_transform transform)
+{
+  return transform == TRANSFORM_ROTATE_90 || transform == TRANSFORM_ROTATE_270 ||
+         transform == TRANSFORM_TRANSPOSE;
+}
+
+static bool valid_transform(matrix_transform transform)
+{
+  return transform >= TRANSFORM_NONE && transform <= TRANSFORM_TRANSPOSE;
+}
+
+mat_fn_status transform_matrix(matrix *src, matrix *dst, matrix_transform transform)
+{
+  if (src == NULL || dst == NULL || src == dst)
+  {
+    mat_report_error(INVALID_PARAM,
+                     "transform_matrix: src or dst passed is NULL or both are the same "
+                     "matrix.");
+    return INVALID_PARAM;
+  }
+
+  if (!valid_transform(transform))
+  {
+    mat_report_error(INVALID_PARAM, "transform_matrix: unknown transform %d.",
+                     (int)transform);
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(src) || !matrix_is_row_major(dst))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "transform_matrix: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  bool swaps = transform_swaps_dimensions(transform);
+  uint16_t horizontal = swaps ? src->vertical : src->horizontal;
+  uint16_t vertical = swaps ? src->horizontal : src->vertical;
+
+  if (dst->horizontal != horizontal || dst->vertical != vertical)
+  {
+    mat_report_error(INVALID_PARAM, "transform_matrix: dst must be %ux%u.", horizontal,
+                     vertical);
+    return INVALID_PARAM;
+  }
+
+  if (src->size == 0)
+    return VALID_OP;
+
+  size_t row_bytes = (size_t)src->horizontal * sizeof(uint16_t);
+
+  switch (transform)
+  {
+  case TRANSFORM_NONE:
+    memcpy(dst->mem, src->mem, (size_t)src->size * sizeof(uint16_t));
+    break;
+  case TRANSFORM_FLIP_VERTICAL:
+    for (uint32_t row = 0; row < src->vertical; row++)
+      memcpy(row_pointer(dst, (uint16_t)(src->vertical - 1 - row)),
+             row_pointer(src, (uint16_t)row), row_bytes);
+    break;
+  case TRANSFORM_FLIP_HORIZONTAL:
+    for (uint32_t row = 0; row < src->vertical; row++)
+      reverse_rgb565_row(row_pointer(src, (uint16_t)row), row_pointer(dst, (uint16_t)row),
+                         src->horizontal);
+    break;
+  case TRANSFORM_ROTATE_180:
+    for (uint32_t row = 0; row < src->vertical; row++)
+      reverse_rgb565_row(row_pointer(src, (uint16_t)row),
+                         row_pointer(dst, (uint16_t)(src->vertical - 1 - row)),
+                         src->horizontal);
+    break;
+  default:
+    transpose_tiled(src, dst, transform);
+    break;
+  }
+
+  mark_dirty_rows(dst, 0, dst->vertical - 1);
+  return VALID_OP;
+}
+
+mat_fn_status transform_matrix_in_place(matrix *mat, matrix_transform transform)
+{
+  if (mat == NULL)
+  {
+    mat_report_error(INVALID_PARAM, "transform_matrix_in_place: matrix passed is NULL.");
+    return INVALID_PARAM;
+  }
+
+  if (!valid_transform(transform) || transform_swaps_dimensions(transform))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "transform_matrix_in_place: transform %d cannot be applied in "
+                     "place.", (int)transform);
+    return INVALID_PARAM;
+  }
+
+  if (!matrix_is_row_major(mat))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "transform_matrix_in_place: tiled matrices are not supported.");
+    return INVALID_PARAM;
+  }
+
+  if (transform == TRANSFORM_NONE || mat->size == 0)
+    return VALID_OP;
+
+  size_t row_bytes = (size_t)mat->horizontal * sizeof(uint16_t);
+  uint16_t *scratch = (uint16_t *)malloc(row_bytes);
+  if (scratch == NULL)
+  {
+    mat_report_error(FAILED_MAT_ALLOCATION,
+                     "transform_matrix_in_place: Unable to allocate row buffer.");
+    return FAILED_MAT_ALLOCATION;
+  }
+
+  uint32_t last = mat->vertical - 1u;
+
+  if (transform == TRANSFORM_FLIP_HORIZONTAL)
+  {
+    for (uint32_t row = 0; row <= last; row++)
+    {
+      uint16_t *pixels = row_pointer(mat, (uint16_t)row);
+      memcpy(scratch, pixels, row_bytes);
+      reverse_rgb565_row(scratch, pixels, mat->horizontal);
+    }
+  }
+  else
+  {
+    // Swap rows pairwise from both ends; the 180 degree rotation also reverses them.
+    bool reverse = transform == TRANSFORM_ROTATE_180;
+
+    for (uint32_t row = 0; row < last - row; row++)
+    {
+      uint16_t *top = row_pointer(mat, (uint16_t)row);
+      uint16_t *bottom = row_pointer(mat, (uint16_t)(last - row));
+
+      if (reverse)
+      {
+        reverse_rgb565_row(top, scratch, mat->horizontal);
+        reverse_rgb565_row(bottom, top, mat->horizontal);
+      }
+      else
+      {
+        memcpy(scratch, top, row_bytes);
+        memcpy(top, bottom, row_bytes);
+      }
+      memcpy(bottom, scratch, row_bytes);
+    }
+
+    if (reverse && (mat->vertical & 1u))
+    {
+      uint16_t *middle = row_pointer(mat, (uint16_t)(last / 2));
+      memcpy(scratch, middle, row_bytes);
+      reverse_rgb565_row(scratch, middle, mat->horizontal);
+    }
+  }
+
+  free(scratch);
+  mark_dirty_rows(mat, 0, (uint16_t)last);
+  return VALID_OP;
+}
+
+matrix *create_transformed_matrix(matrix *src, matrix_transform transform)
+{
+  if (src == NULL || !valid_transform(transform))
+  {
+    mat_report_error(INVALID_PARAM,
+                     "create_transformed_matrix: src is NULL or transform is unknown.");
+    return NULL;
+  }
+
+  bool swaps = transform_swaps_dimensions(transform);
+  matrix *dst = allocate_matrix(swaps ? src->vertical : src->horizontal,
+                                swaps ? src->horizontal : src->vertical);
+  if (dst == NULL)
+    return NULL;
+
+  if (transform_matrix(src, dst, transform) != VALID_OP)
+  {
+    deallocate_matrix(dst);
+    return NULL;
+  }
+
+  return dst;
+}
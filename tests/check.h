@@ -0,0 +1,66 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Failed checks of the running test program.
+ */
+static unsigned check_failures = 0;
+
+/**
+ * @brief Print only the first failures, a broken kernel would otherwise report every
+ * pixel.
+ */
+#define CHECK_REPORT_LIMIT 20
+
+/**
+ * @brief Count a failure and print a printf style message when condition is false.
+ */
+#define CHECK(condition, ...)                                                            \
+  do                                                                                     \
+  {                                                                                      \
+    if (!(condition))                                                                    \
+    {                                                                                    \
+      if (check_failures++ < CHECK_REPORT_LIMIT)                                         \
+      {                                                                                  \
+        fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);                                  \
+        fprintf(stderr, __VA_ARGS__);                                                    \
+        fputc('\n', stderr);                                                             \
+      }                                                                                  \
+    }                                                                                    \
+  } while (0)
+
+/**
+ * @brief Exit status of a test program: 0 when every check passed.
+ */
+static inline int check_report(const char *name)
+{
+  if (check_failures)
+    fprintf(stderr, "%s: %u failed checks\n", name, check_failures);
+  else
+    printf("%s: ok\n", name);
+  return check_failures ? 1 : 0;
+}
+
+/**
+ * @brief xorshift32, so test inputs are the same on every run.
+ */
+static inline uint32_t check_random(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static inline void check_fill_random(uint8_t *bytes, size_t count, uint32_t *state)
+{
+  for (size_t index = 0; index < count; index++)
+    bytes[index] = (uint8_t)(check_random(state) >> 24);
+}
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "check.h"
+#include "matrix.h"
+
+/*
+ * A synthetic RAW sequence is archived with archive_raw_file and every frame read back
+ * with frame_archive_read_frame must match the source bit for bit. Frames are read
+ * forwards, backwards and in random order, so both the walk from the nearest keyframe
+ * and the continuation from the last rebuilt frame are exercised.
+ */
+
+#define FRAME_COUNT 41
+
+/**
+ * Fill frames with a sequence that has something for every payload kind: a moving
+ * block and scattered changes give short deltas, an unchanged frame an empty one, and
+ * scene cuts deltas as large as a keyframe.
+ */
+static void make_sequence(uint16_t *frames, size_t pixels, uint16_t horizontal,
+                          uint32_t *state)
+{
+  check_fill_random((uint8_t *)frames, pixels * sizeof(uint16_t), state);
+
+  for (size_t frame = 1; frame < FRAME_COUNT; frame++)
+  {
+    uint16_t *current = frames + frame * pixels;
+    if (frame % 9 == 0)
+    {
+      check_fill_random((uint8_t *)current, pixels * sizeof(uint16_t), state);
+      continue;
+    }
+
+    memcpy(current, current - pixels, pixels * sizeof(uint16_t));
+    if (frame == 5)
+      continue;
+
+    for (size_t row = 0; row < 4; row++)
+      for (size_t column = 0; column < 5; column++)
+        current[((frame + row) * horizontal + frame * 2 + column) % pixels] =
+            (uint16_t)(0x0841u * frame);
+
+    for (unsigned change = 0; change < 8; change++)
+      current[check_random(state) % pixels] = (uint16_t)check_random(state);
+  }
+}
+
+static void check_frame(frame_archive_reader *reader, matrix *mat, const uint16_t *frames,
+                        uint64_t index, const char *label)
+{
+  mat_fn_status status = frame_archive_read_frame(reader, index, mat);
+  CHECK(status == VALID_OP, "%s: reading frame %llu failed with %d", label,
+        (unsigned long long)index, status);
+  if (status != VALID_OP)
+    return;
+
+  const uint16_t *expected = frames + index * mat->size;
+  for (uint64_t pixel = 0; pixel < mat->size; pixel++)
+  {
+    if (mat->mem[pixel] != expected[pixel])
+    {
+      CHECK(0, "%s: frame %llu pixel %llu is 0x%04X, expected 0x%04X", label,
+            (unsigned long long)index, (unsigned long long)pixel, mat->mem[pixel],
+            expected[pixel]);
+      return;
+    }
+  }
+}
+
+static void check_archive(const char *raw_path, const char *archive_path,
+                          const uint16_t *frames, uint16_t horizontal, uint16_t vertical,
+                          uint32_t keyframe_interval, uint32_t *state)
+{
+  char label[64];
+  snprintf(label, sizeof(label), "%ux%u interval %u", horizontal, vertical,
+           keyframe_interval);
+
+  archive_stats stats;
+  mat_fn_status status = archive_raw_file(raw_path, archive_path, horizontal, vertical,
+                                          keyframe_interval, &stats);
+  CHECK(status == VALID_OP, "%s: archive_raw_file failed with %d", label, status);
+  if (status != VALID_OP)
+    return;
+
+  uint32_t interval = keyframe_interval ? keyframe_interval
+                                        : ARCHIVE_DEFAULT_KEYFRAME_INTERVAL;
+  CHECK(stats.frames == FRAME_COUNT, "%s: archived %llu frames", label,
+        (unsigned long long)stats.frames);
+  CHECK(stats.keyframes == (FRAME_COUNT + interval - 1) / interval,
+        "%s: archived %llu keyframes", label, (unsigned long long)stats.keyframes);
+
+  frame_archive_reader *reader = open_frame_archive(archive_path);
+  CHECK(reader != NULL, "%s: open_frame_archive failed", label);
+  if (reader == NULL)
+    return;
+
+  uint16_t read_horizontal = 0, read_vertical = 0;
+  frame_archive_dimensions(reader, &read_horizontal, &read_vertical);
+  CHECK(frame_archive_frame_count(reader) == FRAME_COUNT &&
+            read_horizontal == horizontal && read_vertical == vertical,
+        "%s: archive holds %llu frames of %ux%u", label,
+        (unsigned long long)frame_archive_frame_count(reader), read_horizontal,
+        read_vertical);
+
+  matrix *mat = allocate_matrix(horizontal, vertical);
+  CHECK(mat != NULL, "allocate_matrix failed");
+  if (mat != NULL)
+  {
+    for (uint64_t index = 0; index < FRAME_COUNT; index++)
+      check_frame(reader, mat, frames, index, label);
+
+    for (uint64_t index = FRAME_COUNT; index-- > 0;)
+      check_frame(reader, mat, frames, index, label);
+
+    // Random order, with the same frame now and then read twice in a row.
+    for (unsigned read = 0; read < 4 * FRAME_COUNT; read++)
+    {
+      uint64_t index = check_random(state) % FRAME_COUNT;
+      check_frame(reader, mat, frames, index, label);
+      if (read % 7 == 0)
+        check_frame(reader, mat, frames, index, label);
+    }
+
+    deallocate_matrix(mat);
+  }
+
+  close_frame_archive_reader(reader);
+}
+
+int main(void)
+{
+  static const struct
+  {
+    uint16_t horizontal;
+    uint16_t vertical;
+  } sizes[] = {{1, 1}, {37, 23}, {128, 64}};
+  static const uint32_t intervals[] = {1, 7, 0};
+
+  char raw_path[] = "/tmp/test_archive_raw.XXXXXX";
+  char archive_path[] = "/tmp/test_archive.XXXXXX";
+  int raw_fd = mkstemp(raw_path);
+  int archive_fd = mkstemp(archive_path);
+  if (raw_fd < 0 || archive_fd < 0)
+  {
+    fprintf(stderr, "test_archive: unable to create temporary files\n");
+    return 1;
+  }
+  close(raw_fd);
+  close(archive_fd);
+
+  uint32_t state = 0xBB67AE85u;
+  for (size_t size = 0; size < sizeof(sizes) / sizeof(sizes[0]); size++)
+  {
+    size_t pixels = (size_t)sizes[size].horizontal * sizes[size].vertical;
+    uint16_t *frames = (uint16_t *)malloc(FRAME_COUNT * pixels * sizeof(uint16_t));
+    CHECK(frames != NULL, "unable to allocate %d frames", FRAME_COUNT);
+    if (frames == NULL)
+      continue;
+    make_sequence(frames, pixels, sizes[size].horizontal, &state);
+
+    FILE *raw = fopen(raw_path, "wb");
+    CHECK(raw != NULL && fwrite(frames, pixels * sizeof(uint16_t), FRAME_COUNT, raw) ==
+                             FRAME_COUNT,
+          "unable to write %s", raw_path);
+    if (raw != NULL)
+      fclose(raw);
+
+    for (size_t interval = 0; interval < sizeof(intervals) / sizeof(intervals[0]);
+         interval++)
+      check_archive(raw_path, archive_path, frames, sizes[size].horizontal,
+                    sizes[size].vertical, intervals[interval], &state);
+
+    free(frames);
+  }
+
+  unlink(raw_path);
+  unlink(archive_path);
+  return check_report("test_archive");
+}
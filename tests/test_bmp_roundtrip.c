@@ -0,0 +1,169 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "check.h"
+#include "matrix.h"
+
+/*
+ * Files written by every BMP writer are read back with read_rgb565_bmpfile and compared
+ * with the source matrix pixel for pixel. Odd widths give the rows padding, 24 and
+ * 32-bit files go through the quantizing read path, and the stripe writer produces
+ * top-down files.
+ */
+
+static const bmp_pixel_format formats[] = {BMP_FORMAT_RGB565, BMP_FORMAT_BGR888,
+                                           BMP_FORMAT_BGRA8888};
+
+static void fill_frame(matrix *mat, uint32_t *state)
+{
+  for (uint32_t row = 0; row < mat->vertical; row++)
+    for (uint32_t column = 0; column < mat->horizontal; column++)
+      mat->mem[calculate_offset(mat, (uint16_t)row, (uint16_t)column)] =
+          (uint16_t)check_random(state);
+}
+
+/**
+ * Whether filepath stores its rows top row first, i.e. has a negative height.
+ */
+static bool is_top_down(const char *filepath)
+{
+  uint8_t header[26];
+  FILE *file = fopen(filepath, "rb");
+  bool top_down = file != NULL && fread(header, sizeof(header), 1, file) == 1 &&
+                  (header[25] & 0x80) != 0;
+  if (file != NULL)
+    fclose(file);
+  return top_down;
+}
+
+/**
+ * Read filepath back and compare it with mat, row flipped when flipped is set.
+ */
+static void check_file(const char *filepath, matrix *mat, bool flipped,
+                       const char *label)
+{
+  matrix *decoded = read_rgb565_bmpfile(filepath);
+  CHECK(decoded != NULL, "%s: read_rgb565_bmpfile failed", label);
+  if (decoded == NULL)
+    return;
+
+  CHECK(decoded->horizontal == mat->horizontal && decoded->vertical == mat->vertical,
+        "%s: read back as %ux%u", label, decoded->horizontal, decoded->vertical);
+  if (decoded->horizontal == mat->horizontal && decoded->vertical == mat->vertical)
+  {
+    for (uint32_t row = 0; row < mat->vertical; row++)
+    {
+      uint32_t source_row = flipped ? mat->vertical - 1 - row : row;
+      for (uint32_t column = 0; column < mat->horizontal; column++)
+      {
+        uint16_t expected =
+            mat->mem[calculate_offset(mat, (uint16_t)source_row, (uint16_t)column)];
+        uint16_t actual =
+            decoded->mem[calculate_offset(decoded, (uint16_t)row, (uint16_t)column)];
+        CHECK(actual == expected, "%s: pixel (%u, %u) is 0x%04X, expected 0x%04X", label,
+              row, column, actual, expected);
+      }
+    }
+  }
+
+  deallocate_matrix(decoded);
+}
+
+static void check_writers(const char *filepath, matrix *mat, const char *shape)
+{
+  char label[128];
+
+  snprintf(label, sizeof(label), "%s, write_rgb565_bmpfile", shape);
+  CHECK(write_rgb565_bmpfile(filepath, mat) == 0, "%s failed", label);
+  check_file(filepath, mat, false, label);
+
+  // A scratch buffer of 100 bytes holds a few rows at most, forcing many stripes.
+  uint8_t scratch[100];
+  snprintf(label, sizeof(label), "%s, write_rgb565_bmpfile_buffered", shape);
+  CHECK(write_rgb565_bmpfile_buffered(filepath, mat, scratch, sizeof(scratch)) == 0,
+        "%s failed", label);
+  check_file(filepath, mat, false, label);
+
+  for (size_t format = 0; format < sizeof(formats) / sizeof(formats[0]); format++)
+  {
+    unsigned bits = bmp_bits_per_pixel(formats[format]);
+
+    snprintf(label, sizeof(label), "%s, write_bmpfile %u-bit", shape, bits);
+    CHECK(write_bmpfile(filepath, mat, formats[format]) == 0, "%s failed", label);
+    check_file(filepath, mat, false, label);
+
+    snprintf(label, sizeof(label), "%s, stripe writer %u-bit", shape, bits);
+    bmp_stripe_writer *writer = create_bmp_stripe_writer(filepath, mat->horizontal,
+                                                         mat->vertical, formats[format]);
+    CHECK(writer != NULL, "%s: create_bmp_stripe_writer failed", label);
+    if (writer != NULL)
+    {
+      CHECK(bmp_stripe_writer_append(writer, mat) == 0, "%s: append failed", label);
+      CHECK(close_bmp_stripe_writer(writer) == 0, "%s: close failed", label);
+      CHECK(is_top_down(filepath), "%s: file is not top-down", label);
+      check_file(filepath, mat, false, label);
+    }
+
+    // flip_vertical stores the frame upside down in an ordinary bottom-up file.
+    snprintf(label, sizeof(label), "%s, flipped encoder %u-bit", shape, bits);
+    bmp_encoder_settings settings = {0};
+    settings.flip_vertical = true;
+    bmp_encoder *encoder =
+        create_bmp_encoder(mat->horizontal, mat->vertical, formats[format], &settings);
+    CHECK(encoder != NULL, "%s: create_bmp_encoder failed", label);
+    if (encoder != NULL)
+    {
+      CHECK(bmp_encoder_write_file(encoder, filepath, mat) == 0, "%s failed", label);
+      CHECK(!is_top_down(filepath), "%s: file is top-down", label);
+      check_file(filepath, mat, true, label);
+      destroy_bmp_encoder(encoder);
+    }
+  }
+}
+
+int main(void)
+{
+  static const struct
+  {
+    uint16_t horizontal;
+    uint16_t vertical;
+  } sizes[] = {{1, 1}, {2, 3}, {3, 5}, {4, 4}, {7, 9}, {317, 203}, {640, 4}, {1, 300}};
+  static const matrix_layout layouts[] = {MATRIX_LAYOUT_ROW_MAJOR,
+                                          MATRIX_LAYOUT_TILED_8X8};
+
+  char filepath[] = "/tmp/test_bmp_roundtrip.XXXXXX";
+  int fd = mkstemp(filepath);
+  if (fd < 0)
+  {
+    fprintf(stderr, "test_bmp_roundtrip: unable to create a temporary file\n");
+    return 1;
+  }
+  close(fd);
+
+  uint32_t state = 0x6A09E667u;
+  for (size_t layout = 0; layout < sizeof(layouts) / sizeof(layouts[0]); layout++)
+  {
+    for (size_t index = 0; index < sizeof(sizes) / sizeof(sizes[0]); index++)
+    {
+      matrix *mat = allocate_matrix_layout(sizes[index].horizontal,
+                                           sizes[index].vertical, layouts[layout]);
+      CHECK(mat != NULL, "allocate_matrix_layout failed");
+      if (mat == NULL)
+        continue;
+
+      char shape[64];
+      snprintf(shape, sizeof(shape), "%ux%u layout %zu", mat->horizontal, mat->vertical,
+               layout);
+      fill_frame(mat, &state);
+      check_writers(filepath, mat, shape);
+      deallocate_matrix(mat);
+    }
+  }
+
+  unlink(filepath);
+  return check_report("test_bmp_roundtrip");
+}
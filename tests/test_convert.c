@@ -0,0 +1,282 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "convert.h"
+
+/*
+ * Every SIMD kernel level the CPU supports is compared byte for byte against the
+ * scalar reference implementations, over all 65536 RGB565 values and over short rows
+ * at every alignment, so both the vector bodies and their scalar tails are covered.
+ */
+
+#define ALL_PIXELS 65536u
+#define MAX_OFFSET 16u
+#define MAX_SHORT_COUNT 80u
+#define GUARD_BYTES 64u
+#define BUFFER_PIXELS (ALL_PIXELS + MAX_OFFSET)
+
+static _Alignas(32) uint16_t pixels[BUFFER_PIXELS];
+static _Alignas(32) uint8_t bytes[4 * BUFFER_PIXELS];
+static _Alignas(32) uint8_t expected[4 * BUFFER_PIXELS + GUARD_BYTES];
+static _Alignas(32) uint8_t actual[4 * BUFFER_PIXELS + GUARD_BYTES];
+
+typedef void (*expand_fn)(const uint16_t *src, uint8_t *dst, size_t count);
+typedef void (*quantize_fn)(const uint8_t *src, uint16_t *dst, size_t count);
+
+/**
+ * Bytes of the output buffers a row of count pixels starting offset pixels in can
+ * touch, with a guard band behind it.
+ */
+static size_t output_extent(size_t offset, size_t count)
+{
+  return 4 * (offset + count) + GUARD_BYTES;
+}
+
+/**
+ * Clear both output buffers to the same pattern, so writes past the end of a row show
+ * up as a mismatch too.
+ */
+static void reset_outputs(size_t offset, size_t count)
+{
+  memset(expected, 0xA5, output_extent(offset, count));
+  memset(actual, 0xA5, output_extent(offset, count));
+}
+
+static void check_outputs(const char *what, const char *level, size_t offset,
+                          size_t count)
+{
+  size_t extent = output_extent(offset, count);
+  if (memcmp(expected, actual, extent) == 0)
+    return;
+
+  size_t index = 0;
+  while (expected[index] == actual[index])
+    index++;
+  CHECK(0, "%s (%s), offset %zu, count %zu: byte %zu is 0x%02X, expected 0x%02X", what,
+        level, offset, count, index, actual[index], expected[index]);
+}
+
+/**
+ * Run a kernel and its reference on count items starting offset items in, for the full
+ * range and for every short count.
+ */
+static void check_expand(const char *what, const char *level, expand_fn kernel,
+                         expand_fn reference)
+{
+  for (size_t offset = 0; offset < MAX_OFFSET; offset++)
+  {
+    for (size_t count = 0; count <= MAX_SHORT_COUNT + 1; count++)
+    {
+      size_t length = (count > MAX_SHORT_COUNT) ? ALL_PIXELS : count;
+      reset_outputs(offset, length);
+      reference(pixels + offset, expected + offset, length);
+      kernel(pixels + offset, actual + offset, length);
+      check_outputs(what, level, offset, length);
+    }
+  }
+}
+
+static void check_quantize(const char *what, const char *level, quantize_fn kernel,
+                           quantize_fn reference, size_t pixel_bytes)
+{
+  for (size_t offset = 0; offset < MAX_OFFSET; offset++)
+  {
+    for (size_t count = 0; count <= MAX_SHORT_COUNT + 1; count++)
+    {
+      size_t length = (count > MAX_SHORT_COUNT) ? ALL_PIXELS : count;
+      reset_outputs(offset, length);
+      reference(bytes + offset * pixel_bytes, (uint16_t *)expected + offset, length);
+      kernel(bytes + offset * pixel_bytes, (uint16_t *)actual + offset, length);
+      check_outputs(what, level, offset, length);
+    }
+  }
+}
+
+static void check_rgb888(const char *level)
+{
+  static const rgb565_dither dithers[] = {
+      RGB565_DITHER_NONE, RGB565_DITHER_ORDERED_4X4, RGB565_DITHER_ORDERED_8X8};
+
+  for (size_t mode = 0; mode < sizeof(dithers) / sizeof(dithers[0]); mode++)
+  {
+    // Row 8 wraps around to the first row of the 8x8 matrix.
+    for (uint32_t row = 0; row <= 8; row++)
+    {
+      for (size_t offset = 0; offset < MAX_OFFSET; offset++)
+      {
+        for (size_t count = 0; count <= MAX_SHORT_COUNT + 1; count++)
+        {
+          size_t length = (count > MAX_SHORT_COUNT) ? ALL_PIXELS : count;
+          reset_outputs(offset, length);
+          rgb888_to_rgb565_row_scalar(bytes + 3 * offset, (uint16_t *)expected + offset,
+                                      length, dithers[mode], row);
+          rgb888_to_rgb565_row(bytes + 3 * offset, (uint16_t *)actual + offset, length,
+                               dithers[mode], row);
+          check_outputs("rgb888_to_rgb565_row", level, offset, length);
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Channels at 0 and 255 are where the dithering bias is largest relative to the
+ * headroom, run them on their own as well as mixed into random data.
+ */
+static void check_rgb888_extremes(const char *level, uint32_t *state)
+{
+  check_fill_random(bytes, sizeof(bytes), state);
+  check_rgb888(level);
+
+  for (size_t index = 0; index < sizeof(bytes); index++)
+    bytes[index] = (check_random(state) & 1) ? 0xFF : 0x00;
+  check_rgb888(level);
+
+  memset(bytes, 0xFF, sizeof(bytes));
+  check_rgb888(level);
+}
+
+static void check_raw(const char *level, raw_pixel_format format)
+{
+  const char *name = raw_pixel_format_name(format);
+
+  for (size_t offset = 0; offset < MAX_OFFSET; offset++)
+  {
+    for (size_t count = 0; count <= MAX_SHORT_COUNT + 1; count++)
+    {
+      size_t length = (count > MAX_SHORT_COUNT) ? ALL_PIXELS : count;
+      reset_outputs(offset, length);
+      raw_to_rgb565_row_scalar(format, pixels + offset, (uint16_t *)expected + offset,
+                               length);
+      raw_to_rgb565_row(format, pixels + offset, (uint16_t *)actual + offset, length);
+      check_outputs(name, level, offset, length);
+
+      // In place, the way RAW frames are ingested.
+      memcpy(expected, pixels, sizeof(pixels));
+      memcpy(actual, pixels, sizeof(pixels));
+      memset(expected + sizeof(pixels), 0xA5, GUARD_BYTES);
+      memset(actual + sizeof(pixels), 0xA5, GUARD_BYTES);
+      raw_to_rgb565_row_scalar(format, (uint16_t *)expected + offset,
+                               (uint16_t *)expected + offset, length);
+      raw_to_rgb565_row(format, (uint16_t *)actual + offset, (uint16_t *)actual + offset,
+                        length);
+      check_outputs(name, level, offset, length);
+    }
+  }
+}
+
+/**
+ * Every Y, U and V combination: one row per (U, V) pair carrying all 256 luma values.
+ * The corners of the cube are where the conversion saturates.
+ */
+static void check_yuyv_exhaustive(const char *level)
+{
+  uint8_t row[2 * 256];
+  uint16_t reference[256], converted[256];
+
+  for (uint32_t u = 0; u < 256; u++)
+  {
+    for (uint32_t v = 0; v < 256; v++)
+    {
+      for (uint32_t pair = 0; pair < 128; pair++)
+      {
+        row[4 * pair] = (uint8_t)(2 * pair);
+        row[4 * pair + 1] = (uint8_t)u;
+        row[4 * pair + 2] = (uint8_t)(2 * pair + 1);
+        row[4 * pair + 3] = (uint8_t)v;
+      }
+
+      raw_to_rgb565_row_scalar(RAW_FORMAT_YUYV, row, reference, 256);
+      raw_to_rgb565_row(RAW_FORMAT_YUYV, row, converted, 256);
+      CHECK(memcmp(reference, converted, sizeof(reference)) == 0,
+            "yuyv (%s): mismatch for U %u, V %u", level, u, v);
+    }
+  }
+}
+
+/**
+ * Known answers for the clamping with neutral chroma: black at and below the bottom
+ * of the luma range, white at and above its top.
+ */
+static void check_yuyv_saturation(const char *level)
+{
+  static const uint8_t row[8] = {0, 128, 255, 128, 16, 128, 235, 128};
+  uint16_t converted[4];
+
+  raw_to_rgb565_row(RAW_FORMAT_YUYV, row, converted, 4);
+  CHECK(converted[0] == 0x0000, "yuyv (%s): Y 0 gives 0x%04X", level, converted[0]);
+  CHECK(converted[1] == 0xFFFF, "yuyv (%s): Y 255 gives 0x%04X", level, converted[1]);
+  CHECK(converted[2] == 0x0000, "yuyv (%s): Y 16 gives 0x%04X", level, converted[2]);
+  CHECK(converted[3] == 0xFFFF, "yuyv (%s): Y 235 gives 0x%04X", level, converted[3]);
+}
+
+/**
+ * bgr888_to_rgb565_row exactly undoes rgb565_to_bgr888_row, and the 32-bit pair alike.
+ */
+static void check_round_trip(const char *level)
+{
+  static uint16_t restored[ALL_PIXELS];
+
+  rgb565_to_bgr888_row(pixels, bytes, ALL_PIXELS);
+  bgr888_to_rgb565_row(bytes, restored, ALL_PIXELS);
+  CHECK(memcmp(pixels, restored, sizeof(restored)) == 0,
+        "bgr888 round trip (%s) is not exact", level);
+
+  rgb565_to_bgra8888_row(pixels, bytes, ALL_PIXELS);
+  bgra8888_to_rgb565_row(bytes, restored, ALL_PIXELS);
+  CHECK(memcmp(pixels, restored, sizeof(restored)) == 0,
+        "bgra8888 round trip (%s) is not exact", level);
+
+  for (uint32_t index = 0; index < ALL_PIXELS; index++)
+    CHECK(bytes[4 * index + 3] == 0xFF, "bgra8888 (%s): pixel %u is not opaque", level,
+          index);
+}
+
+static void fill_all_pixels(void)
+{
+  for (uint32_t index = 0; index < BUFFER_PIXELS; index++)
+    pixels[index] = (uint16_t)index;
+}
+
+int main(void)
+{
+  static const convert_kernel_level levels[] = {
+      CONVERT_KERNEL_SCALAR, CONVERT_KERNEL_SSE2, CONVERT_KERNEL_AVX2};
+  uint32_t state = 0x2545F491u;
+
+  for (size_t index = 0; index < sizeof(levels) / sizeof(levels[0]); index++)
+  {
+    const char *level = convert_kernel_name(levels[index]);
+    if (set_convert_kernel_level(levels[index]) != levels[index])
+    {
+      printf("test_convert: %s is not supported here, skipped\n", level);
+      continue;
+    }
+
+    // Sliding every offset over pixels[i] == i still covers all 65536 values.
+    fill_all_pixels();
+    check_expand("rgb565_to_bgr888_row", level, rgb565_to_bgr888_row,
+                 rgb565_to_bgr888_row_scalar);
+    check_expand("rgb565_to_bgra8888_row", level, rgb565_to_bgra8888_row,
+                 rgb565_to_bgra8888_row_scalar);
+    check_round_trip(level);
+
+    check_fill_random(bytes, sizeof(bytes), &state);
+    check_quantize("bgr888_to_rgb565_row", level, bgr888_to_rgb565_row,
+                   bgr888_to_rgb565_row_scalar, 3);
+    check_quantize("bgra8888_to_rgb565_row", level, bgra8888_to_rgb565_row,
+                   bgra8888_to_rgb565_row_scalar, 4);
+
+    check_rgb888_extremes(level, &state);
+
+    fill_all_pixels();
+    for (int format = RAW_FORMAT_RGB565; format <= RAW_FORMAT_YUYV; format++)
+      check_raw(level, (raw_pixel_format)format);
+    check_yuyv_exhaustive(level);
+    check_yuyv_saturation(level);
+  }
+
+  return check_report("test_convert");
+}
@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "check.h"
+#include "matrix.h"
+
+/*
+ * A bmp_encoder allocates its header block and stripe buffer once in
+ * create_bmp_encoder. This program replaces malloc, calloc, realloc and the aligned
+ * allocators with counting wrappers around glibc's own implementations, then checks
+ * that repeated encodes into every kind of sink allocate nothing.
+ */
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static unsigned long allocations = 0;
+
+void *malloc(size_t size)
+{
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+  *ptr = __libc_memalign(alignment, size);
+  return (*ptr != NULL) ? 0 : ENOMEM;
+}
+
+static unsigned long allocation_count(void)
+{
+  return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+#define ENCODES_PER_SINK 4
+
+static bool discard_bytes(void *context, const uint8_t *data, size_t length)
+{
+  (void)data;
+  *(size_t *)context += length;
+  return true;
+}
+
+static void fill_frame(matrix *mat, uint16_t seed)
+{
+  for (uint32_t row = 0; row < mat->vertical; row++)
+    for (uint32_t column = 0; column < mat->horizontal; column++)
+      mat->mem[calculate_offset(mat, (uint16_t)row, (uint16_t)column)] =
+          (uint16_t)(seed + row * 31 + column);
+}
+
+/**
+ * Encode a few frames through every sink and the file path of one encoder, counting
+ * allocations from the first encode on.
+ */
+static void check_encoder(const char *directory, matrix *mat, bmp_pixel_format format,
+                          const bmp_encoder_settings *settings, const char *label)
+{
+  unsigned long created = allocation_count();
+  bmp_encoder *encoder =
+      create_bmp_encoder(mat->horizontal, mat->vertical, format, settings);
+  CHECK(encoder != NULL, "%s: create_bmp_encoder failed", label);
+  if (encoder == NULL)
+    return;
+
+  // Proves the counting wrappers are the allocator the library actually calls.
+  CHECK(allocation_count() > created, "%s: create_bmp_encoder was not counted", label);
+
+  char file_path[256], mapped_path[256], fd_path[256];
+  snprintf(file_path, sizeof(file_path), "%s/file.bmp", directory);
+  snprintf(mapped_path, sizeof(mapped_path), "%s/mapped.bmp", directory);
+  snprintf(fd_path, sizeof(fd_path), "%s/fd.bmp", directory);
+
+  // Caller owned resources are set up before counting starts.
+  size_t encoded_size = bmp_encoder_encoded_size(encoder);
+  uint8_t *buffer = (uint8_t *)malloc(encoded_size);
+  int fd = open(fd_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  size_t streamed = 0;
+  bmp_sink sinks[] = {bmp_memory_sink(buffer, encoded_size), bmp_fd_sink(fd),
+                      bmp_mapped_file_sink(mapped_path),
+                      bmp_callback_sink(discard_bytes, &streamed)};
+  CHECK(buffer != NULL && fd >= 0, "%s: unable to set up the sinks", label);
+
+  unsigned long before = allocation_count();
+  for (uint16_t frame = 0; frame < ENCODES_PER_SINK; frame++)
+  {
+    fill_frame(mat, frame);
+    CHECK(bmp_encoder_write_file(encoder, file_path, mat) == 0,
+          "%s: bmp_encoder_write_file failed", label);
+
+    for (size_t index = 0; index < sizeof(sinks) / sizeof(sinks[0]); index++)
+    {
+      CHECK(bmp_encoder_encode(encoder, &sinks[index], mat) == 0,
+            "%s: bmp_encoder_encode into sink %zu failed", label, index);
+      CHECK(sinks[index].written == encoded_size,
+            "%s: sink %zu received %zu bytes, expected %zu", label, index,
+            sinks[index].written, encoded_size);
+    }
+  }
+  unsigned long during = allocation_count() - before;
+
+  CHECK(during == 0, "%s: %lu heap allocations across %d rounds of encodes", label,
+        during, ENCODES_PER_SINK);
+
+  close(fd);
+  free(buffer);
+  destroy_bmp_encoder(encoder);
+  unlink(file_path);
+  unlink(mapped_path);
+  unlink(fd_path);
+}
+
+int main(void)
+{
+  static const bmp_pixel_format formats[] = {BMP_FORMAT_RGB565, BMP_FORMAT_BGR888,
+                                             BMP_FORMAT_BGRA8888};
+  static const matrix_layout layouts[] = {MATRIX_LAYOUT_ROW_MAJOR,
+                                          MATRIX_LAYOUT_TILED_8X8};
+
+  char directory[] = "/tmp/test_encoder_alloc.XXXXXX";
+  if (mkdtemp(directory) == NULL)
+  {
+    fprintf(stderr, "test_encoder_alloc: unable to create a temporary directory\n");
+    return 1;
+  }
+
+  for (size_t layout = 0; layout < sizeof(layouts) / sizeof(layouts[0]); layout++)
+  {
+    // An odd width gives every row padding, a small stripe forces several stripes.
+    matrix *mat = allocate_matrix_layout(317, 203, layouts[layout]);
+    CHECK(mat != NULL, "allocate_matrix_layout failed");
+    if (mat == NULL)
+      continue;
+
+    for (size_t format = 0; format < sizeof(formats) / sizeof(formats[0]); format++)
+    {
+      for (int variant = 0; variant < 4; variant++)
+      {
+        bmp_encoder_settings settings = {0};
+        settings.stripe_size = 16 * 1024;
+        settings.flip_vertical = (variant & 1) != 0;
+        settings.mirror_horizontal = (variant & 2) != 0;
+
+        char label[96];
+        snprintf(label, sizeof(label), "layout %zu, format %zu, flip %d, mirror %d",
+                 layout, format, settings.flip_vertical, settings.mirror_horizontal);
+        check_encoder(directory, mat, formats[format], &settings, label);
+      }
+    }
+
+    deallocate_matrix(mat);
+  }
+
+  rmdir(directory);
+  return check_report("test_encoder_alloc");
+}
+
+#else
+
+int main(void)
+{
+  printf("test_encoder_alloc: needs glibc to count allocations, skipped\n");
+  return 0;
+}
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "errors.h"
+#include "matrix.h"
+#include "qoi.h"
+
+/*
+ * encode_qoi against byte streams worked out by hand from the QOI specification, and
+ * encode_qoi -> decode_qoi round trips that must restore the matrix exactly.
+ */
+
+/**
+ * A 4x2 frame reaching every 3-channel chunk type:
+ *   0x0000 0x0000  run of 2 from the initial (0, 0, 0, 255)     QOI_OP_RUN   0xC1
+ *   0xFFFF         (255, 255, 255), -1 on every channel         QOI_OP_DIFF  0x55
+ *   0xF800         (255, 0, 0), green and blue wrap to +1       QOI_OP_DIFF  0x6F
+ *   0xFFFF         seen before at hash 38                       QOI_OP_INDEX 0x26
+ *   0xF79D         (247, 243, 239), dg -12, dr-dg 4, db-dg -4   QOI_OP_LUMA  0x94 0xC4
+ *   0x1234 0x1234  (16, 69, 165), then a run of 1               QOI_OP_RGB, QOI_OP_RUN
+ */
+static const uint16_t spec_pixels[8] = {0x0000, 0x0000, 0xFFFF, 0xF800,
+                                        0xFFFF, 0xF79D, 0x1234, 0x1234};
+
+static const uint8_t spec_encoded[] = {
+    'q',  'o',  'i',  'f',  0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x02, 0x03, 0x00,
+    0xC1, 0x55, 0x6F, 0x26, 0x94, 0xC4, 0xFE, 0x10, 0x45, 0xA5, 0xC0,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+/**
+ * A 2x1 4-channel image: one QOI_OP_RGBA chunk with half transparent alpha, then a run.
+ */
+static const uint8_t spec_rgba[] = {
+    'q',  'o',  'i',  'f',  0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x01, 0x04, 0x00,
+    0xFF, 0xF8, 0xFC, 0x08, 0x80, 0xC0,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+static void check_known_answers(void)
+{
+  matrix *mat = allocate_matrix(4, 2);
+  CHECK(mat != NULL, "allocate_matrix failed");
+  if (mat == NULL)
+    return;
+  memcpy(mat->mem, spec_pixels, sizeof(spec_pixels));
+
+  uint8_t encoded[256];
+  CHECK(calculate_qoi_max_size(mat) <= sizeof(encoded), "4x2 bound is %zu bytes",
+        calculate_qoi_max_size(mat));
+  size_t length = encode_qoi(mat, encoded, sizeof(encoded));
+  CHECK(length == sizeof(spec_encoded), "spec frame encodes to %zu bytes, expected %zu",
+        length, sizeof(spec_encoded));
+  for (size_t index = 0; index < length && index < sizeof(spec_encoded); index++)
+    CHECK(encoded[index] == spec_encoded[index], "spec frame byte %zu is 0x%02X, "
+          "expected 0x%02X", index, encoded[index], spec_encoded[index]);
+
+  matrix *decoded = decode_qoi(spec_encoded, sizeof(spec_encoded));
+  CHECK(decoded != NULL && decoded->horizontal == 4 && decoded->vertical == 2 &&
+            memcmp(decoded->mem, spec_pixels, sizeof(spec_pixels)) == 0,
+        "spec frame does not decode to its pixels");
+  deallocate_matrix(decoded);
+  deallocate_matrix(mat);
+
+  decoded = decode_qoi(spec_rgba, sizeof(spec_rgba));
+  CHECK(decoded != NULL && decoded->horizontal == 2 && decoded->vertical == 1 &&
+            decoded->mem[0] == 0xFFE1 && decoded->mem[1] == 0xFFE1,
+        "4-channel spec image does not decode to 0xFFE1 twice");
+  deallocate_matrix(decoded);
+}
+
+/**
+ * Every proper prefix of the spec frame stops inside a chunk or before the end marker,
+ * among them the cuts inside the QOI_OP_LUMA and QOI_OP_RGB chunks, and must be
+ * rejected. So must the full frame with a damaged end marker.
+ */
+static void check_truncated_known_answers(void)
+{
+  uint8_t damaged[sizeof(spec_encoded)];
+
+  mat_set_error_output(MAT_ERRORS_QUIET);
+  for (size_t cut = 0; cut < sizeof(spec_encoded); cut++)
+  {
+    memcpy(damaged, spec_encoded, cut);
+    matrix *decoded = decode_qoi(damaged, cut);
+    CHECK(decoded == NULL, "spec frame cut to %zu bytes decodes", cut);
+    deallocate_matrix(decoded);
+  }
+
+  for (size_t index = sizeof(spec_encoded) - QOI_END_MARKER_SIZE;
+       index < sizeof(spec_encoded); index++)
+  {
+    memcpy(damaged, spec_encoded, sizeof(spec_encoded));
+    damaged[index] ^= 0x02;
+    matrix *decoded = decode_qoi(damaged, sizeof(damaged));
+    CHECK(decoded == NULL, "spec frame with end marker byte %zu damaged decodes", index);
+    deallocate_matrix(decoded);
+  }
+  mat_set_error_output(MAT_ERRORS_PRINT);
+}
+
+/**
+ * A stream cut to its first cut bytes must be rejected. The prefix is copied into a
+ * buffer of its own so reads past its end are caught by memory checkers.
+ */
+static void check_rejects_cut(const uint8_t *encoded, size_t cut, const char *label)
+{
+  uint8_t *truncated = (uint8_t *)malloc(cut ? cut : 1);
+  if (truncated == NULL)
+    return;
+  memcpy(truncated, encoded, cut);
+  matrix *decoded = decode_qoi(truncated, cut);
+  CHECK(decoded == NULL, "%s: stream cut to %zu bytes decodes", label, cut);
+  deallocate_matrix(decoded);
+  free(truncated);
+}
+
+/**
+ * Encode mat, decode it again and compare every pixel.
+ */
+static void check_round_trip(matrix *mat, const char *label)
+{
+  size_t capacity = calculate_qoi_max_size(mat);
+  uint8_t *encoded = (uint8_t *)malloc(capacity);
+  CHECK(encoded != NULL, "%s: unable to allocate %zu bytes", label, capacity);
+  if (encoded == NULL)
+    return;
+
+  size_t length = encode_qoi(mat, encoded, capacity);
+  CHECK(length > QOI_HEADER_SIZE + QOI_END_MARKER_SIZE && length <= capacity,
+        "%s: encoded length %zu out of range", label, length);
+
+  matrix *decoded = decode_qoi(encoded, length);
+  CHECK(decoded != NULL && decoded->horizontal == mat->horizontal &&
+            decoded->vertical == mat->vertical &&
+            memcmp(decoded->mem, mat->mem, mat->size * sizeof(uint16_t)) == 0,
+        "%s: round trip does not restore the frame", label);
+  deallocate_matrix(decoded);
+
+  // The cut one byte short of the end marker is always tried.
+  mat_set_error_output(MAT_ERRORS_QUIET);
+  for (size_t cut = 0; cut < length; cut += 1 + length / 64)
+    check_rejects_cut(encoded, cut, label);
+  check_rejects_cut(encoded, length - 1, label);
+  mat_set_error_output(MAT_ERRORS_PRINT);
+
+  free(encoded);
+}
+
+int main(void)
+{
+  check_known_answers();
+  check_truncated_known_answers();
+
+  static const struct
+  {
+    uint16_t horizontal;
+    uint16_t vertical;
+  } sizes[] = {{1, 1}, {7, 3}, {64, 1}, {333, 77}, {1, 200}};
+  uint32_t state = 0x9E3779B9u;
+
+  for (size_t index = 0; index < sizeof(sizes) / sizeof(sizes[0]); index++)
+  {
+    matrix *mat = allocate_matrix(sizes[index].horizontal, sizes[index].vertical);
+    CHECK(mat != NULL, "allocate_matrix failed");
+    if (mat == NULL)
+      continue;
+
+    char label[64];
+    snprintf(label, sizeof(label), "%ux%u random", mat->horizontal, mat->vertical);
+    check_fill_random((uint8_t *)mat->mem, mat->size * sizeof(uint16_t), &state);
+    check_round_trip(mat, label);
+
+    // Small steps between neighbours exercise DIFF and LUMA, repeats INDEX.
+    snprintf(label, sizeof(label), "%ux%u gradient", mat->horizontal, mat->vertical);
+    for (uint64_t pixel = 0; pixel < mat->size; pixel++)
+      mat->mem[pixel] = (uint16_t)((pixel / 3) * 0x0841u + (pixel % 5 == 0 ? 0xF800 : 0));
+    check_round_trip(mat, label);
+
+    // Runs longer than the 62 pixels one chunk can hold.
+    snprintf(label, sizeof(label), "%ux%u flat", mat->horizontal, mat->vertical);
+    for (uint64_t pixel = 0; pixel < mat->size; pixel++)
+      mat->mem[pixel] = (pixel < mat->size / 2) ? 0x0000 : 0xABCD;
+    check_round_trip(mat, label);
+
+    deallocate_matrix(mat);
+  }
+
+  return check_report("test_qoi");
+}
@@ -0,0 +1,158 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "errors.h"
+#include "matrix.h"
+#include "transform.h"
+
+/*
+ * transform_matrix and transform_matrix_in_place against a pixel by pixel reference.
+ * Sizes that are not multiples of the 8x8 block or the 64x64 tile send the edges
+ * through the scalar scatter path next to the block path.
+ */
+
+static const matrix_transform transforms[] = {
+    TRANSFORM_NONE,           TRANSFORM_ROTATE_90,       TRANSFORM_ROTATE_180,
+    TRANSFORM_ROTATE_270,     TRANSFORM_FLIP_HORIZONTAL, TRANSFORM_FLIP_VERTICAL,
+    TRANSFORM_TRANSPOSE};
+
+/**
+ * Position in the transformed image of the source pixel at (row, column) of a
+ * horizontal x vertical image.
+ */
+static void reference_position(matrix_transform transform, uint32_t horizontal,
+                               uint32_t vertical, uint32_t row, uint32_t column,
+                               uint32_t *dst_row, uint32_t *dst_column)
+{
+  switch (transform)
+  {
+  case TRANSFORM_ROTATE_90:
+    *dst_row = column;
+    *dst_column = vertical - 1 - row;
+    break;
+  case TRANSFORM_ROTATE_180:
+    *dst_row = vertical - 1 - row;
+    *dst_column = horizontal - 1 - column;
+    break;
+  case TRANSFORM_ROTATE_270:
+    *dst_row = horizontal - 1 - column;
+    *dst_column = row;
+    break;
+  case TRANSFORM_FLIP_HORIZONTAL:
+    *dst_row = row;
+    *dst_column = horizontal - 1 - column;
+    break;
+  case TRANSFORM_FLIP_VERTICAL:
+    *dst_row = vertical - 1 - row;
+    *dst_column = column;
+    break;
+  case TRANSFORM_TRANSPOSE:
+    *dst_row = column;
+    *dst_column = row;
+    break;
+  case TRANSFORM_NONE:
+  default:
+    *dst_row = row;
+    *dst_column = column;
+    break;
+  }
+}
+
+/**
+ * Compare result, the transformed image, with src moved pixel by pixel.
+ */
+static void check_against_reference(matrix *src, matrix *result,
+                                    matrix_transform transform, const char *label)
+{
+  for (uint32_t row = 0; row < src->vertical; row++)
+  {
+    for (uint32_t column = 0; column < src->horizontal; column++)
+    {
+      uint32_t dst_row, dst_column;
+      reference_position(transform, src->horizontal, src->vertical, row, column,
+                         &dst_row, &dst_column);
+      uint16_t expected =
+          src->mem[calculate_offset(src, (uint16_t)row, (uint16_t)column)];
+      uint16_t actual =
+          result->mem[calculate_offset(result, (uint16_t)dst_row, (uint16_t)dst_column)];
+      CHECK(actual == expected,
+            "%s: source pixel (%u, %u) became 0x%04X, expected 0x%04X", label, row,
+            column, actual, expected);
+    }
+  }
+}
+
+static void check_transforms(matrix *src, uint32_t *state)
+{
+  char label[64];
+
+  for (size_t index = 0; index < sizeof(transforms) / sizeof(transforms[0]); index++)
+  {
+    matrix_transform transform = transforms[index];
+    snprintf(label, sizeof(label), "%ux%u transform %d", src->horizontal, src->vertical,
+             (int)transform);
+
+    bool swaps = transform_swaps_dimensions(transform);
+    matrix *dst = swaps ? allocate_matrix(src->vertical, src->horizontal)
+                        : allocate_matrix(src->horizontal, src->vertical);
+    CHECK(dst != NULL, "%s: allocate_matrix failed", label);
+    if (dst == NULL)
+      continue;
+
+    // Stale destination contents must not survive anywhere in the result.
+    check_fill_random((uint8_t *)dst->mem, dst->size * sizeof(uint16_t), state);
+    mat_fn_status status = transform_matrix(src, dst, transform);
+    CHECK(status == VALID_OP, "%s: transform_matrix failed with %d", label, status);
+    if (status == VALID_OP)
+      check_against_reference(src, dst, transform, label);
+
+    if (!swaps)
+    {
+      snprintf(label, sizeof(label), "%ux%u transform %d in place", src->horizontal,
+               src->vertical, (int)transform);
+      memcpy(dst->mem, src->mem, src->size * sizeof(uint16_t));
+      status = transform_matrix_in_place(dst, transform);
+      CHECK(status == VALID_OP, "%s failed with %d", label, status);
+      if (status == VALID_OP)
+        check_against_reference(src, dst, transform, label);
+    }
+    else
+    {
+      status = transform_matrix_in_place(dst, transform);
+      CHECK(status == INVALID_PARAM, "%s: in place returned %d for a swapping transform",
+            label, status);
+    }
+
+    deallocate_matrix(dst);
+  }
+}
+
+int main(void)
+{
+  // Odd and even heights for the in place row swaps, with and without a middle row.
+  static const struct
+  {
+    uint16_t horizontal;
+    uint16_t vertical;
+  } sizes[] = {{1, 1},   {8, 8},  {16, 9}, {9, 16},  {67, 45},
+               {45, 67}, {1, 37}, {37, 1}, {64, 64}, {130, 71}};
+
+  mat_set_error_output(MAT_ERRORS_QUIET);
+  uint32_t state = 0x3C6EF372u;
+  for (size_t index = 0; index < sizeof(sizes) / sizeof(sizes[0]); index++)
+  {
+    matrix *src = allocate_matrix(sizes[index].horizontal, sizes[index].vertical);
+    CHECK(src != NULL, "allocate_matrix failed");
+    if (src == NULL)
+      continue;
+
+    check_fill_random((uint8_t *)src->mem, src->size * sizeof(uint16_t), &state);
+    check_transforms(src, &state);
+    deallocate_matrix(src);
+  }
+  mat_set_error_output(MAT_ERRORS_PRINT);
+
+  return check_report("test_transform");
+}